@@ -0,0 +1,2199 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include "qr_encodeem.h"
+#include "qr_penalty.h"
+#include "qr_rs.h"
+#include "qr_batch.h"
+#include "qr_stats.h"
+#include "qr_image.h"
+#include "qr_version.h"
+#include "qr_append.h"
+#include "qr_utf8.h"
+#include "qr_utils.h"
+#include "qr_scan.h"
+#include "qr_bits.h"
+#include "qr_cache.h"
+#include "qr_template.h"
+#include "qr_server.h"
+
+// Internal stages, not part of the public header.
+bool is_on_function_area(int width,int x,int y,int version);
+void FormatModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int m_nMaskingNo,int version,int level);
+void SetCodeWordPattern(uint8_t *image,int width,uint8_t *encoded_data,int encoded_data_size,int version);
+void ApplyMaskingPattern(uint8_t *image,int width,int m_nMaskingNo,int version,int level);
+void SetMaskingPattern(uint8_t *image,int width,int nPatternNo,int version);
+void SetMaskingPatternReference(uint8_t *image,int width,int nPatternNo,int version);
+void PlaceModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int version);
+int SetBitStream(uint8_t *codestream, int nIndex, uint16_t wData, int ncData);
+
+#define MAX_INPUTDATA   3096 // qr_encodeem.cpp
+#define MAX_QRCODESIZE  4096 // (177*177)/8
+#define MAX_ALLCODEWORD 3706 // 総コードワード数最大値(Ver.40)
+
+// bench_suite.cpp
+int bench_suite(int argc,char **argv);
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the optimiser from discarding benchmark loops.
+static volatile int bench_sink;
+
+// Function area scan as done by SetCodeWordPattern/SetMaskingPattern before
+// the templates: one predicate call chain per module.
+static double bench_predicate_scan(int version,int iterations) {
+  int width = version * 4 + 17;
+  int count = 0;
+
+  double start = now_ns();
+  for(int n=0;n<iterations;n++) {
+    for(int y=0;y<width;y++) {
+      for(int x=0;x<width;x++) {
+        if(is_on_function_area(width,x,y,version)) count++;
+      }
+    }
+  }
+  double end = now_ns();
+
+  bench_sink = count;
+  return (end - start) / iterations;
+}
+
+// The same scan using the packed function module template.
+static double bench_template_scan(int version,int iterations) {
+  int width = version * 4 + 17;
+  int count = 0;
+  const uint8_t *mask = qr_function_mask(version);
+
+  double start = now_ns();
+  for(int n=0;n<iterations;n++) {
+    for(int y=0;y<width;y++) {
+      for(int x=0;x<width;x++) {
+        int bitpos = (y*width)+x;
+        if(mask[bitpos/8] & (1<<(bitpos%8))) count++;
+      }
+    }
+  }
+  double end = now_ns();
+
+  bench_sink = count;
+  return (end - start) / iterations;
+}
+
+// Codeword scatter through the placement map for one symbol.
+static double bench_codeword_placement(int version,int iterations) {
+  int width = version * 4 + 17;
+  uint8_t codewords[3706];
+  uint8_t image[4096];
+
+  for(int n=0;n<(int)sizeof(codewords);n++) codewords[n] = (uint8_t)(n * 37 + 11);
+  memset(image,0,sizeof(image));
+
+  int ncAllCodeWord = QR_VersionInfo[version].ncAllCodeWord;
+
+  double start = now_ns();
+  for(int n=0;n<iterations;n++) {
+    codewords[0] = (uint8_t)n;
+    SetCodeWordPattern(image,width,codewords,ncAllCodeWord,version);
+  }
+  double end = now_ns();
+
+  bench_sink = image[0];
+  return (end - start) / iterations;
+}
+
+// Full module placement (function patterns, codewords, mask, format info) for one symbol.
+static double bench_format_module(int version,int iterations) {
+  int width = version * 4 + 17;
+  uint8_t codewords[3706];
+  uint8_t image[4096];
+
+  for(int n=0;n<(int)sizeof(codewords);n++) codewords[n] = (uint8_t)(n * 37 + 11);
+
+  int ncAllCodeWord = QR_VersionInfo[version].ncAllCodeWord;
+
+  double start = now_ns();
+  for(int n=0;n<iterations;n++) {
+    FormatModule(image,width,codewords,ncAllCodeWord,n % 8,version,QR_LEVEL_M);
+  }
+  double end = now_ns();
+
+  bench_sink = image[0];
+  return (end - start) / iterations;
+}
+
+// Full qr_encode_data() call with a payload that needs the given version.
+static double bench_encode(int version,int mask,int nThreads,int iterations) {
+  uint8_t payload[3000];
+  uint8_t image[4096];
+  int len = QR_VersionInfo[version].ncDataCodeWord[QR_LEVEL_M] - 3;
+  int outputdata_len;
+  int width;
+
+  for(int n=0;n<len;n++) payload[n] = (uint8_t)('a' + (n * 7) % 26);
+
+  double start = now_ns();
+  for(int n=0;n<iterations;n++) {
+    qr_encode_data_ex(QR_LEVEL_M,0,false,mask,payload,len,image,&outputdata_len,&width,NULL,nThreads);
+  }
+  double end = now_ns();
+
+  bench_sink = width;
+  return (end - start) / iterations;
+}
+
+// Checks CountPenalty() against CountPenaltyReference() on every version and
+// mask with a few payloads, and times both. Returns the number of mismatches.
+static int bench_penalty(int iterations) {
+  const char *kernels[] = {"scalar","avx2"};
+  int mismatches = 0;
+
+  printf("\n# penalty kernel: %s\n",qr_penalty_kernel());
+  printf("%-8s %14s %14s %14s %8s\n","version","reference_ns","scalar_ns","avx2_ns","speedup");
+
+  for(int v=1;v<=40;v++) {
+    double t_ref = 0, t_kernel[2] = {0,0};
+    int samples = 0;
+
+    for(int p=0;p<3;p++) {
+      uint8_t payload[3000];
+      uint8_t image[4096];
+      int len = QR_VersionInfo[v].ncDataCodeWord[p] - 3;
+      int outputdata_len, width;
+
+      for(int n=0;n<len;n++) payload[n] = (uint8_t)(p == 0 ? '0' + (n * 7) % 10 : (p == 1 ? 'A' + n % 26 : n * 131 + v));
+
+      for(int mask=0;mask<8;mask++) {
+        if(!qr_encode_data(p,v,false,mask,payload,len,image,&outputdata_len,&width)) continue;
+
+        int expected = CountPenaltyReference(image,width);
+
+        double start = now_ns();
+        for(int n=0;n<iterations / 10 + 1;n++) bench_sink = CountPenaltyReference(image,width);
+        t_ref += (now_ns() - start) / (iterations / 10 + 1);
+
+        for(int k=0;k<2;k++) {
+          if(!qr_penalty_select_kernel(kernels[k])) continue;
+
+          if(CountPenalty(image,width) != expected) {
+            printf("# MISMATCH version %d payload %d mask %d kernel %s: %d != %d\n",v,p,mask,kernels[k],CountPenalty(image,width),expected);
+            mismatches++;
+          }
+
+          start = now_ns();
+          for(int n=0;n<iterations;n++) bench_sink = CountPenalty(image,width);
+          t_kernel[k] += (now_ns() - start) / iterations;
+        }
+        samples++;
+      }
+    }
+
+    printf("%-8d %14.0f %14.0f %14.0f %7.1fx\n",v,t_ref/samples,t_kernel[0]/samples,t_kernel[1]/samples,
+           t_ref / (t_kernel[1] > 0 ? t_kernel[1] : t_kernel[0]));
+  }
+
+  // Back to the default kernel.
+  if(!qr_penalty_select_kernel("avx2")) qr_penalty_select_kernel("scalar");
+
+  printf("# penalty mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Checks qr_rs_encode() against GetRSCodeWord() for every generator degree
+// and kernel, and times one block of each degree. Returns the number of mismatches.
+static int bench_rs(int iterations) {
+  const char *kernels[] = {"scalar","ssse3","avx2"};
+  int mismatches = 0;
+
+  printf("\n# rs kernel: %s\n",qr_rs_kernel());
+  printf("%-8s %-8s %14s %14s %14s %14s %8s\n","degree","data","reference_ns","scalar_ns","ssse3_ns","avx2_ns","speedup");
+
+  for(int degree=7;degree<=68;degree++) {
+    if(byRSExp[degree] == NULL) continue;
+
+    // Longest block used with this degree, or 255 - degree if none.
+    int ncData = 0;
+    for(int v=1;v<=40;v++) {
+      for(int l=0;l<4;l++) {
+        const RS_BLOCKINFO *b[2] = {&QR_VersionInfo[v].RS_BlockInfo1[l],&QR_VersionInfo[v].RS_BlockInfo2[l]};
+        for(int n=0;n<2;n++) {
+          if(b[n]->ncRSBlock != 0 && b[n]->ncAllCodeWord - b[n]->ncDataCodeWord == degree && b[n]->ncDataCodeWord > ncData) ncData = b[n]->ncDataCodeWord;
+        }
+      }
+    }
+    if(ncData == 0) ncData = 255 - degree;
+
+    uint8_t data[256];
+    uint8_t work[512];
+    uint8_t ecc[68];
+    double t_ref, t_kernel[3] = {0,0,0};
+
+    for(int trial=0;trial<16;trial++) {
+      for(int n=0;n<ncData;n++) data[n] = (uint8_t)(trial == 0 ? 0 : (n * 89 + trial * 31) ^ (n >> 2));
+
+      memset(work,0,sizeof(work));
+      memcpy(work,data,ncData);
+      GetRSCodeWord(work,ncData,degree);
+
+      for(int k=0;k<3;k++) {
+        if(!qr_rs_select_kernel(kernels[k])) continue;
+        qr_rs_encode(data,ncData,ecc,degree);
+        if(memcmp(ecc,work,degree) != 0) {
+          printf("# MISMATCH degree %d trial %d kernel %s\n",degree,trial,kernels[k]);
+          mismatches++;
+        }
+      }
+    }
+
+    double start = now_ns();
+    for(int n=0;n<iterations;n++) {
+      memset(work,0,sizeof(work));
+      memcpy(work,data,ncData);
+      GetRSCodeWord(work,ncData,degree);
+    }
+    t_ref = (now_ns() - start) / iterations;
+
+    for(int k=0;k<3;k++) {
+      if(!qr_rs_select_kernel(kernels[k])) continue;
+      start = now_ns();
+      for(int n=0;n<iterations;n++) {
+        data[0] = (uint8_t)n;
+        qr_rs_encode(data,ncData,ecc,degree);
+      }
+      t_kernel[k] = (now_ns() - start) / iterations;
+    }
+
+    double best = t_kernel[2] > 0 ? t_kernel[2] : (t_kernel[1] > 0 ? t_kernel[1] : t_kernel[0]);
+    printf("%-8d %-8d %14.0f %14.0f %14.0f %14.0f %7.1fx\n",degree,ncData,t_ref,t_kernel[0],t_kernel[1],t_kernel[2],t_ref / best);
+  }
+
+  // Whole symbols: all blocks in lanes against block by block, for every
+  // version, level and kernel.
+  printf("\n%-8s %-6s %-7s %14s %14s %8s\n","version","level","blocks","per_block_ns","lanes_ns","speedup");
+  uint32_t seed = 3;
+  for(int v=1;v<=40;v++) {
+    for(int l=0;l<4;l++) {
+      const QR_VERSIONINFO &vi = QR_VersionInfo[v];
+      int ncBlock1 = vi.RS_BlockInfo1[l].ncRSBlock, ncBlock2 = vi.RS_BlockInfo2[l].ncRSBlock, ncBlockSum = ncBlock1 + ncBlock2;
+      int ncDataCw1 = vi.RS_BlockInfo1[l].ncDataCodeWord, ncData = vi.ncDataCodeWord[l];
+      int ncRSCw = vi.RS_BlockInfo1[l].ncAllCodeWord - ncDataCw1;
+      uint8_t data[MAX_ALLCODEWORD], ref[MAX_ALLCODEWORD], all[MAX_ALLCODEWORD + 1], ecc[68];
+
+      for(int n=0;n<ncData;n++) { seed = seed * 1103515245 + 12345; data[n] = (uint8_t)(seed >> 16); }
+
+      // 基準：ブロック毎に算出してインターリーブ配置
+      auto per_block = [&]() {
+        const uint8_t *p = data;
+        for(int b=0;b<ncBlockSum;b++) {
+          int ncDataCw = b < ncBlock1 ? ncDataCw1 : ncDataCw1 + 1;
+          for(int j=0;j<ncDataCw;j++) ref[j < ncDataCw1 ? ncBlockSum * j + b : ncBlockSum * j + (b - ncBlock1)] = p[j];
+          qr_rs_encode(p,ncDataCw,ecc,ncRSCw);
+          for(int j=0;j<ncRSCw;j++) ref[ncData + ncBlockSum * j + b] = ecc[j];
+          p += ncDataCw;
+        }
+      };
+      per_block();
+
+      for(int k=0;k<3;k++) {
+        if(!qr_rs_select_kernel(kernels[k])) continue;
+        memcpy(all,ref,ncData);
+        memset(all + ncData,0xa5,sizeof(all) - ncData);
+        qr_rs_encode_interleaved(all,ncBlock1,ncBlock2,ncDataCw1,ncRSCw);
+        if(memcmp(all,ref,vi.ncAllCodeWord) != 0 || all[vi.ncAllCodeWord] != 0xa5) {
+          printf("# MISMATCH interleaved rs v%d level %d kernel %s\n",v,l,kernels[k]);
+          mismatches++;
+        }
+      }
+      if(!qr_rs_select_kernel("avx2") && !qr_rs_select_kernel("ssse3")) qr_rs_select_kernel("scalar");
+
+      if(v % 10 != 0 && v != 5) continue;
+      int n = iterations / 10 + 1;
+      double start = now_ns();
+      for(int it=0;it<n;it++) per_block();
+      double mid = now_ns();
+      for(int it=0;it<n;it++) qr_rs_encode_interleaved(all,ncBlock1,ncBlock2,ncDataCw1,ncRSCw);
+      double end = now_ns();
+      printf("%-8d %-6d %-7d %14.0f %14.0f %7.1fx\n",v,l,ncBlockSum,(mid - start) / n,(end - mid) / n,(mid - start) / (end - mid));
+    }
+  }
+
+  // Back to the default kernel.
+  if(!qr_rs_select_kernel("avx2") && !qr_rs_select_kernel("ssse3")) qr_rs_select_kernel("scalar");
+
+  printf("# rs mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Reads a symbol back: unmasks it, gathers and de-interleaves the data
+// codewords and parses the segments. Returns the decoded length (-1 on a
+// malformed stream), ncBits receives the bit stream length without the
+// terminator. nAppend (may be NULL) receives the Structured Append
+// position, symbol count and parity, -1 each if there is no header.
+static int decode_symbol(const uint8_t *image,int width,int level,int mask,uint8_t *out,int *ncBits,int *nAppend = NULL,int *nECI = NULL,uint8_t *byKanji = NULL) {
+  static const char alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+  int version = (width - 17) / 4;
+  const QR_VERSIONINFO &vi = QR_VersionInfo[version];
+
+  uint8_t unmasked[4096];
+  uint8_t all[3706];
+  uint8_t data[3706];
+
+  memcpy(unmasked,image,qr_image_size(width));
+  ApplyMaskingPattern(unmasked,width,mask,version,level);
+  qr_gather_codewords(unmasked,version,all,vi.ncAllCodeWord);
+
+  int n1 = vi.RS_BlockInfo1[level].ncRSBlock,  d1 = vi.RS_BlockInfo1[level].ncDataCodeWord;
+  int n2 = vi.RS_BlockInfo2[level].ncRSBlock,  d2 = vi.RS_BlockInfo2[level].ncDataCodeWord;
+  int k = 0;
+  for(int b=0;b<n1+n2;b++) {
+    int d = b < n1 ? d1 : d2;
+    for(int j=0;j<d;j++) data[k++] = j < d1 ? all[j * (n1 + n2) + b] : all[d1 * (n1 + n2) + (b - n1)];
+  }
+
+  if(nAppend != NULL) nAppend[0] = nAppend[1] = nAppend[2] = -1;
+  if(nECI != NULL) *nECI = -1;
+
+  int ncData = vi.ncDataCodeWord[level] * 8;
+  int group  = version >= 27 ? 2 : (version >= 10 ? 1 : 0);
+  int pos = 0, len = 0;
+
+  #define READ_BITS(n) ({ int v_ = 0; for(int i_=0;i_<(n);i_++,pos++) v_ = (v_ << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1); v_; })
+
+  while(pos + 4 <= ncData) {
+    int mode = READ_BITS(4);
+    if(mode == 0) { pos -= 4; break; }
+
+    if(mode == 3) {
+      int index = READ_BITS(4), total = READ_BITS(4) + 1, parity = READ_BITS(8);
+      if(nAppend != NULL) { nAppend[0] = index; nAppend[1] = total; nAppend[2] = parity; }
+      continue;
+    }
+
+    if(mode == 7) {
+      int designator = READ_BITS(8);
+      if(designator & 0x80) return -1; // 8 ビット指定子のみ
+      if(nECI != NULL) *nECI = designator;
+      continue;
+    }
+
+    if(mode == 1) {
+      int count = READ_BITS(nIndicatorLenNumeral[group]);
+      for(;count >= 3;count -= 3) { int v = READ_BITS(10); out[len++] = '0' + v / 100; out[len++] = '0' + v / 10 % 10; out[len++] = '0' + v % 10; }
+      if(count == 2) { int v = READ_BITS(7); out[len++] = '0' + v / 10; out[len++] = '0' + v % 10; }
+      if(count == 1) out[len++] = '0' + READ_BITS(4);
+    } else if(mode == 2) {
+      int count = READ_BITS(nIndicatorLenAlphabet[group]);
+      for(;count >= 2;count -= 2) { int v = READ_BITS(11); out[len++] = alphabet[v / 45]; out[len++] = alphabet[v % 45]; }
+      if(count == 1) out[len++] = alphabet[READ_BITS(6)];
+    } else if(mode == 4) {
+      int count = READ_BITS(nIndicatorLen8Bit[group]);
+      for(int i=0;i<count;i++) out[len++] = (uint8_t)READ_BITS(8);
+    } else if(mode == 8) {
+      int count = READ_BITS(nIndicatorLenKanji[group]);
+      for(int i=0;i<count;i++) {
+        int v = READ_BITS(13);
+        int w = ((v / 0xc0) << 8) | (v % 0xc0);
+        w += (w + 0x8140 <= 0x9ffc) ? 0x8140 : 0xc140;
+        if(byKanji != NULL) byKanji[len] = byKanji[len + 1] = 1;
+        out[len++] = (uint8_t)(w >> 8);
+        out[len++] = (uint8_t)w;
+      }
+    } else {
+      return -1;
+    }
+  }
+
+  #undef READ_BITS
+
+  if(ncBits != NULL) *ncBits = pos;
+  return len;
+}
+
+// Mixed-mode input: runs of 1..nMaxRun digits, alphanumerics, lower case
+// and Shift-JIS Kanji pairs.
+static int mixed_payload(uint8_t *buf,int ncMax,int nMaxRun,uint32_t seed) {
+  int n = 0;
+  while(n < ncMax - 2) {
+    seed = seed * 1103515245 + 12345;
+    int mode = (seed >> 8) % 4, run = 1 + (seed >> 16) % nMaxRun;
+    for(int i=0;i<run && n < ncMax - 2;i++) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t r = seed >> 8;
+      switch(mode) {
+        case 0: buf[n++] = '0' + r % 10; break;
+        case 1: buf[n++] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:"[r % 35]; break;
+        case 2: buf[n++] = 'a' + r % 26; break;
+        default: buf[n++] = 0x88 + r % 0x18; buf[n++] = 0x40 + r % 0x3f; break;
+      }
+    }
+  }
+  return n;
+}
+
+// Checks the optimal segmentation round-trips and is never longer than the
+// greedy one, and times both on input that switches mode often.
+static int bench_segment(int iterations) {
+  QR_ENCODER_CTX *greedy  = qr_encoder_ctx_create();
+  QR_ENCODER_CTX *optimal = qr_encoder_ctx_create();
+  qr_encoder_ctx_set_segmentation(greedy,QR_SEGMENT_GREEDY);
+
+  int mismatches = 0, ncShorter = 0, ncSmaller = 0, ncCases = 0;
+  long ncBitsGreedy = 0, ncBitsOptimal = 0;
+
+  for(int trial=0;trial<400;trial++) {
+    uint8_t payload[2048], decoded[4096];
+    uint8_t image[2][4096];
+    int len = mixed_payload(payload,16 + trial * 5,1 + trial % 12,trial);
+    int level = trial % 4, width[2], bits[2];
+    QR_ENCODER_CTX *ctx[2] = {greedy,optimal};
+    bool ok[2];
+
+    for(int k=0;k<2;k++) {
+      ok[k] = qr_encode_data_ctx(ctx[k],level,0,false,0,payload,len,image[k],&width[k],NULL,1);
+      if(!ok[k]) continue;
+
+      int n = decode_symbol(image[k],width[k],level,0,decoded,&bits[k]);
+      if(n != len || memcmp(decoded,payload,len) != 0) {
+        printf("# MISMATCH segment trial %d %s: round trip failed\n",trial,k == 0 ? "greedy" : "optimal");
+        mismatches++;
+      }
+    }
+
+    if(ok[0] && !ok[1]) {
+      printf("# MISMATCH segment trial %d: optimal overflowed where greedy fit\n",trial);
+      mismatches++;
+    }
+    if(!ok[0] || !ok[1]) continue;
+
+    if(bits[1] > bits[0]) {
+      printf("# MISMATCH segment trial %d: optimal %d bits > greedy %d bits\n",trial,bits[1],bits[0]);
+      mismatches++;
+    }
+
+    ncCases++;
+    ncBitsGreedy  += bits[0];
+    ncBitsOptimal += bits[1];
+    if(bits[1] < bits[0]) ncShorter++;
+    if(width[1] < width[0]) ncSmaller++;
+  }
+
+  printf("\n# segmentation: %d cases, optimal shorter in %d, smaller version in %d, bits %.1f%% of greedy\n",
+         ncCases,ncShorter,ncSmaller,ncCases ? 100.0 * ncBitsOptimal / ncBitsGreedy : 0);
+
+  printf("%-8s %-8s %14s %14s\n","length","max_run","greedy_ns","optimal_ns");
+  for(int len=256;len<=2048;len*=2) {
+    for(int run=1;run<=8;run*=8) {
+      uint8_t payload[2048];
+      int ncSource = mixed_payload(payload,len,run,len + run);
+      double t[2];
+
+      for(int k=0;k<2;k++) {
+        qr_encoder_ctx_set_segmentation(qr_encoder_ctx_default(),k == 0 ? QR_SEGMENT_GREEDY : QR_SEGMENT_OPTIMAL);
+
+        double start = now_ns();
+        for(int n=0;n<iterations;n++) bench_sink = qr_encode_size(QR_LEVEL_L,0,false,payload,ncSource,NULL);
+        t[k] = (now_ns() - start) / iterations;
+      }
+
+      printf("%-8d %-8d %14.0f %14.0f\n",ncSource,run,t[0],t[1]);
+    }
+  }
+  qr_encoder_ctx_set_segmentation(qr_encoder_ctx_default(),QR_SEGMENT_OPTIMAL);
+
+  printf("# segment mismatches: %d\n",mismatches);
+
+  qr_encoder_ctx_destroy(greedy);
+  qr_encoder_ctx_destroy(optimal);
+  return mismatches;
+}
+
+// Bits of a single-mode payload (0 numeric, 1 alphanumeric, 2 8-bit) of
+// ncLength characters in version group g.
+static int single_mode_bits(int mode,int ncLength,int g) {
+  static const int ncIndicator[3][3] = {{10,12,14},{9,11,13},{8,16,16}};
+
+  if(mode == 0) return 4 + ncIndicator[0][g] + 10 * (ncLength / 3) + (ncLength % 3 == 0 ? 0 : ncLength % 3 == 1 ? 4 : 7);
+  if(mode == 1) return 4 + ncIndicator[1][g] + 11 * (ncLength / 2) + 6 * (ncLength % 2);
+  return 4 + ncIndicator[2][g] + 8 * ncLength;
+}
+
+// Version selection (binary search, all groups measured in one pass)
+// against a linear scan of QR_VersionInfo, for every level, with payloads
+// right at and one past the capacity of every version, so across the group
+// boundaries v9/10 and v26/27, with automatic and fixed versions and
+// bAutoExtent on and off.
+static int bench_select() {
+  static const int nVersions[] = {0,1,8,9,10,11,25,26,27,28,40};
+  uint8_t payload[MAX_INPUTDATA];
+  int mismatches = 0, ncChecks = 0;
+
+  for(int level=0;level<4;level++) {
+    for(int mode=0;mode<3;mode++) {
+      for(int v=1;v<=40;v++) {
+        int g = v >= 27 ? QR_VRESION_L : v >= 10 ? QR_VRESION_M : QR_VRESION_S;
+        int ncCapacity = 0;
+        while(single_mode_bits(mode,ncCapacity + 1,g) <= QR_VersionInfo[v].ncDataCodeWord[level] * 8) ncCapacity++;
+
+        for(int len=ncCapacity;len<=ncCapacity + 1 && len < MAX_INPUTDATA;len++) {
+          if(len == 0) continue;
+          for(int n=0;n<len;n++) payload[n] = mode == 0 ? '0' + n % 10 : mode == 1 ? 'A' + n % 26 : 'a' + n % 26;
+
+          // 基準：先頭から線形に探す
+          int nFirst = 0;
+          for(int u=1;u<=40 && nFirst == 0;u++) {
+            int gu = u >= 27 ? QR_VRESION_L : u >= 10 ? QR_VRESION_M : QR_VRESION_S;
+            if((single_mode_bits(mode,len,gu) + 7) / 8 <= QR_VersionInfo[u].ncDataCodeWord[level]) nFirst = u;
+          }
+
+          for(int i=0;i<(int)(sizeof(nVersions) / sizeof(nVersions[0]));i++) {
+            for(int e=0;e<2;e++) {
+              int nVersion = nVersions[i];
+              bool bAutoExtent = e != 0;
+              int nExpect = nFirst == 0 ? 0 : nVersion == 0 ? nFirst : nFirst <= nVersion ? nVersion : bAutoExtent ? nFirst : 0;
+              int width = 0;
+              int nGot = qr_encode_size(level,nVersion,bAutoExtent,payload,len,&width) != 0 ? (width - 17) / 4 : 0;
+
+              ncChecks++;
+              if(nGot != nExpect) {
+                printf("# MISMATCH select level %d mode %d length %d version %d extent %d: v%d, linear scan v%d\n",level,mode,len,nVersion,e,nGot,nExpect);
+                mismatches++;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  printf("\n# version selection: %d checks\n",ncChecks);
+  printf("# select mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Growing memory sink for qr_write_image().
+typedef struct tagIMAGEBUF
+{
+	uint8_t *data;
+	size_t   ncData;
+	size_t   ncAlloc;
+} IMAGEBUF;
+
+static bool imagebuf_write(void *arg,const uint8_t *data,size_t ncData) {
+  IMAGEBUF *buf = (IMAGEBUF *)arg;
+  if(buf->ncData + ncData > buf->ncAlloc) {
+    size_t ncAlloc = (buf->ncData + ncData) * 2;
+    uint8_t *p = new uint8_t[ncAlloc];
+    if(buf->ncData > 0) memcpy(p,buf->data,buf->ncData);
+    delete [] buf->data;
+    buf->data    = p;
+    buf->ncAlloc = ncAlloc;
+  }
+  memcpy(buf->data + buf->ncData,data,ncData);
+  buf->ncData += ncData;
+  return true;
+}
+
+static uint32_t be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Inflates a single fixed-Huffman deflate block, the only kind the PNG
+// writer produces. Returns the inflated length, -1 on anything else.
+static int inflate_fixed(const uint8_t *src,size_t ncSrc,uint8_t *dst,int ncDst) {
+  static const int nLenBase[29]   = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+  static const int nLenExtra[29]  = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+  static const int nDistBase[30]  = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+  static const int nDistExtra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+  size_t pos = 0;
+  int len = 0;
+
+  #define GET_BIT() (pos < ncSrc * 8 ? (src[pos / 8] >> (pos % 8)) & 1 : -1); pos++
+  #define GET_BITS(n) ({ int v_ = 0; for(int i_=0;i_<(n);i_++) { int b_ = GET_BIT(); v_ |= b_ << i_; } v_; })
+  #define GET_CODE(n) ({ int v_ = 0; for(int i_=0;i_<(n);i_++) { int b_ = GET_BIT(); v_ = (v_ << 1) | b_; } v_; })
+
+  if(GET_BITS(3) != 3) return -1;
+
+  for(;;) {
+    if(pos > ncSrc * 8) return -1;
+
+    int sym, code = GET_CODE(7);
+    if(code <= 0x17) sym = 256 + code;
+    else {
+      code = (code << 1) | GET_CODE(1);
+      if(code >= 0x30 && code <= 0xbf)      sym = code - 0x30;
+      else if(code >= 0xc0 && code <= 0xc7) sym = 280 + code - 0xc0;
+      else sym = 144 + ((code << 1) | GET_CODE(1)) - 0x190;
+    }
+
+    if(sym < 256) {
+      if(len >= ncDst) return -1;
+      dst[len++] = (uint8_t)sym;
+    } else if(sym == 256) {
+      break;
+    } else {
+      if(sym > 285) return -1;
+      int n = nLenBase[sym - 257] + GET_BITS(nLenExtra[sym - 257]);
+      int d = GET_CODE(5);
+      if(d > 29) return -1;
+      d = nDistBase[d] + GET_BITS(nDistExtra[d]);
+      if(d > len || len + n > ncDst) return -1;
+      for(int i=0;i<n;i++,len++) dst[len] = dst[len - d];
+    }
+  }
+
+  #undef GET_BIT
+  #undef GET_BITS
+  #undef GET_CODE
+
+  return len;
+}
+
+// Unpacks a PNG from the writer into 1 = dark pixels, row by row. Returns
+// the image side, -1 when it isn't what the writer should produce.
+static int read_png(const IMAGEBUF *buf,uint8_t *pixels,int ncPixels) {
+  static const uint8_t bySignature[8] = {0x89,'P','N','G','\r','\n',0x1a,'\n'};
+  if(buf->ncData < 8 || memcmp(buf->data,bySignature,8) != 0) return -1;
+
+  uint8_t *idat = new uint8_t[buf->ncData];
+  size_t ncIdat = 0, pos = 8;
+  int nSide = -1;
+  bool bEnd = false;
+
+  while(pos + 12 <= buf->ncData && !bEnd) {
+    uint32_t n = be32(buf->data + pos);
+    const uint8_t *type = buf->data + pos + 4;
+    if(pos + 12 + n > buf->ncData) break;
+
+    uint32_t crc = 0xffffffff;
+    for(uint32_t i=0;i<n+4;i++) {
+      crc ^= type[i];
+      for(int k=0;k<8;k++) crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+    }
+    if((crc ^ 0xffffffff) != be32(type + 4 + n)) break;
+
+    if(memcmp(type,"IHDR",4) == 0) {
+      if(be32(type + 4) == be32(type + 8) && type[12] == 1 && type[13] == 0) nSide = (int)be32(type + 4);
+    } else if(memcmp(type,"IDAT",4) == 0) {
+      memcpy(idat + ncIdat,type + 4,n);
+      ncIdat += n;
+    } else if(memcmp(type,"IEND",4) == 0) {
+      bEnd = true;
+    }
+    pos += 12 + n;
+  }
+
+  int ncRow = (nSide + 7) / 8, ncRaw = (ncRow + 1) * nSide;
+  uint8_t *raw = new uint8_t[ncRaw > 0 ? ncRaw : 1];
+  int nResult = -1;
+
+  if(bEnd && nSide > 0 && nSide * nSide <= ncPixels && ncIdat > 6 && idat[0] == 0x78 &&
+     inflate_fixed(idat + 2,ncIdat - 6,raw,ncRaw) == ncRaw) {
+    nResult = nSide;
+    for(int y=0;y<nSide && nResult > 0;y++) {
+      uint8_t *r = raw + y * (ncRow + 1);
+      if(r[0] == 2 && y > 0) for(int i=1;i<=ncRow;i++) r[i] += r[i - ncRow - 1];
+      else if(r[0] != 0) nResult = -1;
+      for(int x=0;x<nSide;x++) pixels[y * nSide + x] = !((r[1 + x / 8] >> (7 - x % 8)) & 1);
+    }
+  }
+
+  delete [] raw;
+  delete [] idat;
+  return nResult;
+}
+
+// PBM and PNG output checked pixel by pixel against the symbol, then timed.
+static int bench_image(int iterations) {
+  static const int nScale[4]     = {1,3,4,8};
+  static const int nQuietZone[3] = {0,1,QR_IMAGE_QUIETZONE};
+  IMAGEBUF buf = {NULL,0,0};
+  uint8_t *pixels = new uint8_t[(177 + 8) * 8 * (177 + 8) * 8];
+  int mismatches = 0;
+
+  for(int v=1;v<=40;v+=3) {
+    uint8_t payload[2048], image[4096];
+    int len = mixed_payload(payload,20 + v * 20,6,v), width;
+    if(!qr_encode_data_ctx(qr_encoder_ctx_default(),QR_LEVEL_L,v,true,-1,payload,len,image,&width,NULL,1)) continue;
+
+    for(int s=0;s<4;s++) {
+      for(int q=0;q<3;q++) {
+        int nSide = qr_image_pixels(width,nScale[s],nQuietZone[q]);
+        int ncRow = qr_image_row_bytes(width,nScale[s],nQuietZone[q]);
+
+        for(int f=0;f<2;f++) {
+          buf.ncData = 0;
+          bool ok = qr_write_image(image,width,f == 0 ? QR_IMAGE_PBM : QR_IMAGE_PNG,nScale[s],nQuietZone[q],imagebuf_write,&buf);
+
+          if(ok && f == 0) {
+            char szHeader[32];
+            int ncHeader = snprintf(szHeader,sizeof(szHeader),"P4\n%d %d\n",nSide,nSide);
+            ok = buf.ncData == (size_t)(ncHeader + ncRow * nSide) && memcmp(buf.data,szHeader,ncHeader) == 0;
+            for(int y=0;ok && y<nSide;y++)
+              for(int x=0;x<nSide;x++) pixels[y * nSide + x] = (buf.data[ncHeader + y * ncRow + x / 8] >> (7 - x % 8)) & 1;
+          }
+          if(ok && f == 1) ok = read_png(&buf,pixels,nSide * nSide) == nSide;
+
+          for(int y=0;ok && y<nSide;y++) {
+            for(int x=0;x<nSide;x++) {
+              int mx = x / nScale[s] - nQuietZone[q], my = y / nScale[s] - nQuietZone[q];
+              bool bDark = mx >= 0 && mx < width && my >= 0 && my < width && qr_getmodule(image,width,mx,my);
+              if(pixels[y * nSide + x] != bDark) { ok = false; break; }
+            }
+          }
+
+          if(!ok) {
+            printf("# MISMATCH image v%d scale %d quiet %d %s\n",v,nScale[s],nQuietZone[q],f == 0 ? "pbm" : "png");
+            mismatches++;
+          }
+        }
+      }
+    }
+  }
+
+  printf("\n%-8s %-6s %14s %14s %14s %14s\n","version","scale","pbm_ns","pbm_bytes","png_ns","png_bytes");
+  for(int v=1;v<=40;v+=13) {
+    for(int s=1;s<4;s+=2) {
+      uint8_t payload[2048], image[4096];
+      int len = mixed_payload(payload,20 + v * 20,6,v), width;
+      if(!qr_encode_data_ctx(qr_encoder_ctx_default(),QR_LEVEL_L,v,true,-1,payload,len,image,&width,NULL,1)) continue;
+
+      double t[2];
+      size_t ncBytes[2];
+      for(int f=0;f<2;f++) {
+        double start = now_ns();
+        for(int n=0;n<iterations;n++) {
+          buf.ncData = 0;
+          qr_write_image(image,width,f == 0 ? QR_IMAGE_PBM : QR_IMAGE_PNG,nScale[s],QR_IMAGE_QUIETZONE,imagebuf_write,&buf);
+        }
+        t[f] = (now_ns() - start) / iterations;
+        ncBytes[f] = buf.ncData;
+      }
+      printf("%-8d %-6d %14.0f %14zu %14.0f %14zu\n",width > 0 ? (width - 17) / 4 : v,nScale[s],t[0],ncBytes[0],t[1],ncBytes[1]);
+    }
+  }
+  printf("# image mismatches: %d\n",mismatches);
+
+  delete [] pixels;
+  delete [] buf.data;
+  return mismatches;
+}
+
+// Word-at-a-time masking against the module-at-a-time original, layout
+// conversions both ways, and encodes written straight into each layout.
+static int bench_layout(int iterations) {
+  static const int nAlign[4] = {QR_ALIGN_PACKED,QR_ALIGN_8,QR_ALIGN_32,QR_ALIGN_64};
+  int mismatches = 0;
+  uint32_t seed = 1;
+  double tMask = 0, tMaskRef = 0;
+
+  for(int v=1;v<=40;v++) {
+    int width = v * 4 + 17, ncBytes = qr_image_size(width);
+    uint8_t image[4096], fast[4096], slow[4096];
+
+    for(int n=0;n<ncBytes;n++) { seed = seed * 1103515245 + 12345; image[n] = (uint8_t)(seed >> 16); }
+
+    for(int m=0;m<8;m++) {
+      memcpy(fast,image,ncBytes);
+      memcpy(slow,image,ncBytes);
+
+      double start = now_ns();
+      SetMaskingPattern(fast,width,m,v);
+      double mid = now_ns();
+      SetMaskingPatternReference(slow,width,m,v);
+      tMask += mid - start;
+      tMaskRef += now_ns() - mid;
+
+      if(memcmp(fast,slow,ncBytes) != 0) {
+        printf("# MISMATCH masking v%d pattern %d\n",v,m);
+        mismatches++;
+      }
+    }
+
+    for(int a=0;a<4;a++) {
+      for(int b=0;b<2;b++) {
+        QR_LAYOUT layout = {nAlign[a],b == 0 ? QR_BITORDER_LSB : QR_BITORDER_MSB};
+        QR_LAYOUT other  = {nAlign[3 - a],1 - b};
+        int nStride = qr_layout_stride(&layout,width);
+        uint8_t conv[8192], back[4096], via[8192], direct[8192];
+
+        memset(conv,0xa5,sizeof(conv));
+        qr_layout_convert(image,&QR_LAYOUT_DEFAULT,conv,&layout,width);
+        qr_layout_convert(conv,&layout,back,&QR_LAYOUT_DEFAULT,width);
+        bool ok = memcmp(back,image,ncBytes - 1) == 0 &&
+             ((back[ncBytes - 1] ^ image[ncBytes - 1]) & ((1 << ((width * width - 1) % 8 + 1)) - 1)) == 0;
+
+        for(int y=0;ok && y<width;y++) {
+          for(int x=0;x<width;x++) {
+            if(qr_layout_getmodule(conv,&layout,width,x,y) != qr_getmodule(image,width,x,y)) { ok = false; break; }
+          }
+          // 行末の詰めビットは 0
+          for(int x=width;ok && nStride && x<nStride*8;x++) {
+            int nBit = y * nStride * 8 + (b == 0 ? x : x ^ 7);
+            if((conv[nBit / 8] >> (nBit % 8)) & 1) ok = false;
+          }
+        }
+
+        qr_layout_convert(conv,&layout,direct,&other,width);
+        qr_layout_convert(back,&QR_LAYOUT_DEFAULT,via,&other,width);
+        if(memcmp(direct,via,qr_layout_size(&other,width)) != 0) ok = false;
+
+        if(!ok) {
+          printf("# MISMATCH layout v%d align %d order %d\n",v,nAlign[a],b);
+          mismatches++;
+        }
+
+        // エンコーダの直接出力
+        if(v % 5 == 1) {
+          QR_ENCODER_CTX *ctx = qr_encoder_ctx_create();
+          uint8_t payload[2048], packed[4096], out[8192];
+          int len = mixed_payload(payload,10 + v * 15,5,v), w1, w2;
+
+          qr_encoder_ctx_set_layout(ctx,&layout);
+          bool ok1 = qr_encode_data_ctx(qr_encoder_ctx_default(),QR_LEVEL_M,v,true,-1,payload,len,packed,&w1,NULL,1);
+          bool ok2 = qr_encode_data_ctx(ctx,QR_LEVEL_M,v,true,-1,payload,len,out,&w2,NULL,1);
+          qr_layout_convert(packed,&QR_LAYOUT_DEFAULT,conv,&layout,w1);
+
+          if(ok1 != ok2 || w1 != w2 || (ok1 && memcmp(out,conv,qr_layout_size(&layout,w1)) != 0)) {
+            printf("# MISMATCH layout encode v%d align %d order %d\n",v,nAlign[a],b);
+            mismatches++;
+          }
+          qr_encoder_ctx_destroy(ctx);
+        }
+
+      }
+    }
+  }
+
+  printf("\n# masking: %.0f ns per pattern word-at-a-time, %.0f ns module-at-a-time (all versions)\n",tMask / (40 * 8),tMaskRef / (40 * 8));
+
+  printf("%-8s %-10s %14s %14s\n","version","layout","to_ns","from_ns");
+  for(int v=1;v<=40;v+=13) {
+    int width = v * 4 + 17;
+    uint8_t image[4096], conv[8192], back[4096];
+    memset(image,0x5a,sizeof(image));
+
+    for(int a=1;a<4;a++) {
+      QR_LAYOUT layout = {nAlign[a],QR_BITORDER_MSB};
+      double start = now_ns();
+      for(int n=0;n<iterations;n++) qr_layout_convert(image,&QR_LAYOUT_DEFAULT,conv,&layout,width);
+      double mid = now_ns();
+      for(int n=0;n<iterations;n++) qr_layout_convert(conv,&layout,back,&QR_LAYOUT_DEFAULT,width);
+      double end = now_ns();
+
+      char szLayout[16];
+      snprintf(szLayout,sizeof(szLayout),"msb/%d",nAlign[a] * 8);
+      printf("%-8d %-10s %14.0f %14.0f\n",v,szLayout,(mid - start) / iterations,(end - mid) / iterations);
+    }
+  }
+  printf("# layout mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Per-version codeword stages against interleave + RS + PlaceModule done
+// straight from QR_VersionInfo, for every version and level, and the time
+// per stage call.
+static int bench_version(int iterations) {
+  int mismatches = 0;
+  uint32_t seed = 7;
+
+  printf("\n%-8s %-6s %14s %14s\n","version","level","stage_ns","generic_ns");
+  for(int v=1;v<=40;v++) {
+    const QR_VERSIONINFO &vi = QR_VersionInfo[v];
+    int width = v * 4 + 17, ncBytes = qr_image_size(width);
+
+    for(int l=0;l<4;l++) {
+      uint8_t data[MAX_ALLCODEWORD], all[MAX_ALLCODEWORD], rs[MAX_ALLCODEWORD], work[MAX_ALLCODEWORD];
+      uint8_t fast[MAX_QRCODESIZE], slow[MAX_QRCODESIZE];
+      int ncData = vi.ncDataCodeWord[l], ncBlock1 = vi.RS_BlockInfo1[l].ncRSBlock, ncBlockSum = ncBlock1 + vi.RS_BlockInfo2[l].ncRSBlock;
+      int ncRSCw = vi.RS_BlockInfo1[l].ncAllCodeWord - vi.RS_BlockInfo1[l].ncDataCodeWord;
+
+      for(int n=0;n<ncData;n++) { seed = seed * 1103515245 + 12345; data[n] = (uint8_t)(seed >> 16); }
+
+      // 基準：ブロック毎にインターリーブ
+      double start = now_ns();
+      for(int it=0;it<iterations;it++) {
+        const uint8_t *p = data;
+        for(int b=0;b<ncBlockSum;b++) {
+          int ncDataCw = b < ncBlock1 ? vi.RS_BlockInfo1[l].ncDataCodeWord : vi.RS_BlockInfo2[l].ncDataCodeWord;
+          for(int j=0;j<ncDataCw;j++) {
+            int nPos = j < vi.RS_BlockInfo1[l].ncDataCodeWord ? ncBlockSum * j + b : ncBlockSum * j + (b - ncBlock1);
+            all[nPos] = p[j];
+          }
+          qr_rs_encode(p,ncDataCw,rs,ncRSCw);
+          for(int j=0;j<ncRSCw;j++) all[ncData + ncBlockSum * j + b] = rs[j];
+          p += ncDataCw;
+        }
+        PlaceModule(slow,width,all,vi.ncAllCodeWord,v);
+      }
+      double mid = now_ns();
+      for(int it=0;it<iterations;it++) qr_codeword_stage(v,l)(l,data,all,work,fast);
+      double end = now_ns();
+
+      if(memcmp(fast,slow,ncBytes) != 0) {
+        printf("# MISMATCH codeword stage v%d level %d\n",v,l);
+        mismatches++;
+      }
+      if(v <= 4 || v % 12 == 0) printf("%-8d %-6d %14.0f %14.0f\n",v,l,(end - mid) / iterations,(mid - start) / iterations);
+    }
+  }
+  printf("# version mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// qr_encode_datav_ctx() on payloads cut into fragments at random points
+// (inside Kanji pairs and numeric groups, with empty fragments) against the
+// contiguous call, for both segmentations, and a templated payload encoded
+// as prefix/id/suffix fragments against malloc + concatenate + encode.
+static int bench_gather(int iterations) {
+  QR_ENCODER_CTX *ctx = qr_encoder_ctx_create();
+  int mismatches = 0;
+  uint32_t seed = 11;
+
+  for(int s=0;s<2;s++) {
+    qr_encoder_ctx_set_segmentation(ctx,s == 0 ? QR_SEGMENT_OPTIMAL : QR_SEGMENT_GREEDY);
+
+    for(int trial=0;trial<400;trial++) {
+      uint8_t payload[2048], flat[4096], gathered[4096];
+      QR_IOVEC iov[32];
+      int len = mixed_payload(payload,3 + trial * 5 % 1500,1 + trial % 9,trial), ncIov = 0, pos = 0;
+      int level = trial % 4, mask = trial % 3 == 0 ? -1 : trial % 8, w1, w2;
+
+      while(pos < len && ncIov < 31) {
+        seed = seed * 1103515245 + 12345;
+        int n = (seed >> 16) % 7 == 0 ? 0 : 1 + (seed >> 8) % (len / 4 + 2);
+        if(n > len - pos) n = len - pos;
+        iov[ncIov].pData = payload + pos;
+        iov[ncIov++].ncData = n;
+        pos += n;
+      }
+      iov[ncIov].pData = payload + pos;
+      iov[ncIov++].ncData = len - pos;
+
+      bool ok1 = qr_encode_data_ctx(ctx,level,0,true,mask,payload,len,flat,&w1,NULL,1);
+      // qr_encode_sizev() segments with the default context, QR_SEGMENT_OPTIMAL
+      int  ncSize = s == 0 ? qr_encode_sizev(level,0,true,iov,ncIov,NULL) : qr_image_size(w1);
+      bool ok2 = qr_encode_datav_ctx(ctx,level,0,true,mask,iov,ncIov,gathered,&w2,NULL,1);
+
+      if(ok1 != ok2 || (ok1 && (w1 != w2 || ncSize != qr_image_size(w1) || memcmp(flat,gathered,qr_image_size(w1)) != 0))) {
+        printf("# MISMATCH gather segmentation %d trial %d (%d bytes, %d fragments)\n",s,trial,len,ncIov);
+        mismatches++;
+      }
+    }
+  }
+  qr_encoder_ctx_set_segmentation(ctx,QR_SEGMENT_OPTIMAL);
+
+  // No fragments, or only empty ones: no data.
+  QR_IOVEC empty = {(const uint8_t *)"",0};
+  uint8_t image[4096];
+  int width;
+  if(qr_encode_datav_ctx(ctx,QR_LEVEL_M,0,true,0,NULL,0,image,&width,NULL,1) ||
+     qr_encode_datav_ctx(ctx,QR_LEVEL_M,0,true,0,&empty,1,image,&width,NULL,1)) {
+    printf("# MISMATCH gather empty payload\n");
+    mismatches++;
+  }
+
+  const char *prefix = "HTTPS://EXAMPLE.COM/T/ACME-STORES/ORDER/";
+  const char *suffix = "?CH=QR&V=2";
+  double tConcat = 0, tGather = 0;
+
+  for(int n=0;n<iterations * 10;n++) {
+    char szID[16];
+    int ncID = snprintf(szID,sizeof(szID),"%010d",n * 7919);
+    QR_IOVEC iov[3] = {{(const uint8_t *)prefix,(int)strlen(prefix)},{(const uint8_t *)szID,ncID},{(const uint8_t *)suffix,(int)strlen(suffix)}};
+
+    double start = now_ns();
+    int ncAll = iov[0].ncData + iov[1].ncData + iov[2].ncData;
+    uint8_t *buf = new uint8_t[ncAll];
+    memcpy(buf,prefix,iov[0].ncData);
+    memcpy(buf + iov[0].ncData,szID,ncID);
+    memcpy(buf + iov[0].ncData + ncID,suffix,iov[2].ncData);
+    qr_encode_data_ctx(ctx,QR_LEVEL_M,0,true,0,buf,ncAll,image,&width,NULL,1);
+    delete [] buf;
+    double mid = now_ns();
+    qr_encode_datav_ctx(ctx,QR_LEVEL_M,0,true,0,iov,3,image,&width,NULL,1);
+    double end = now_ns();
+
+    tConcat += mid - start;
+    tGather += end - mid;
+  }
+
+  printf("\n# templated payload (prefix/id/suffix, mask 0): %.0f ns concatenated, %.0f ns gathered\n",tConcat / (iterations * 10),tGather / (iterations * 10));
+  printf("# gather mismatches: %d\n",mismatches);
+
+  qr_encoder_ctx_destroy(ctx);
+  return mismatches;
+}
+
+// Structured Append: payloads of 1..16 symbols' worth, every symbol decoded
+// back and checked for its header, its part and the common version, and
+// the serial against the pooled encode time.
+static int bench_append(int iterations) {
+  QR_THREADPOOL *pool = qr_pool_create(4);
+  uint8_t *arena = new uint8_t[QR_APPEND_MAXSYMBOLS * MAX_QRCODESIZE];
+  uint8_t *payload = new uint8_t[60000];
+  int mismatches = 0;
+
+  printf("\n%-8s %-6s %-8s %-8s %-8s %14s %14s\n","bytes","level","symbols","version","max_ver","serial_ns","pool_ns");
+  for(int trial=0;trial<48;trial++) {
+    int level = trial % 4, nMaxVersion = trial % 3 == 0 ? 0 : 10 + trial % 31;
+    int len = mixed_payload(payload,20 + trial * 613 % 20000,1 + trial % 12,trial);
+    QR_APPENDRESULT result, pooled;
+
+    bool ok = qr_encode_append(level,nMaxVersion,trial % 2 == 0 ? -1 : trial % 8,payload,len,arena,QR_APPEND_MAXSYMBOLS * MAX_QRCODESIZE,&result,NULL);
+    if(!ok) {
+      // 16 シンボルに収まらない場合のみ
+      QR_APPENDRESULT plan16;
+      if(result.nStatus != QR_APPEND_EENCODE || qr_append_plan(level,nMaxVersion,payload,len,&plan16)) mismatches++;
+      continue;
+    }
+
+    // 復号して連結
+    uint8_t decoded[60000], parity = 0;
+    int ncDecoded = 0;
+    for(int i=0;i<len;i++) parity ^= payload[i];
+
+    for(int n=0;n<result.ncSymbols;n++) {
+      const QR_APPENDSYMBOL &symbol = result.symbols[n];
+      int nAppend[3], bits;
+      int k = decode_symbol(arena + symbol.nOffset,result.nWidth,level,symbol.nMaskingNo,decoded + ncDecoded,&bits,nAppend);
+
+      if(k != symbol.ncSource || nAppend[0] != n || nAppend[1] != result.ncSymbols || nAppend[2] != parity || symbol.nOffset != (size_t)n * result.ncBytes) {
+        printf("# MISMATCH append trial %d symbol %d\n",trial,n);
+        mismatches++;
+        break;
+      }
+      ncDecoded += k;
+    }
+    if(ncDecoded != len || memcmp(decoded,payload,len) != 0 || result.ncSymbols > QR_APPEND_MAXSYMBOLS || result.byParity != parity ||
+       (nMaxVersion != 0 && result.nVersion > nMaxVersion)) {
+      printf("# MISMATCH append trial %d payload\n",trial);
+      mismatches++;
+    }
+
+    // ワーカープール経由でも同じ
+    uint8_t *copy = new uint8_t[result.ncArenaUsed];
+    memcpy(copy,arena,result.ncArenaUsed);
+    qr_encode_append(level,nMaxVersion,trial % 2 == 0 ? -1 : trial % 8,payload,len,arena,QR_APPEND_MAXSYMBOLS * MAX_QRCODESIZE,&pooled,pool);
+    if(pooled.ncSymbols != result.ncSymbols || memcmp(copy,arena,result.ncArenaUsed) != 0) {
+      printf("# MISMATCH append trial %d pooled\n",trial);
+      mismatches++;
+    }
+    delete [] copy;
+
+    if(trial % 5 != 0) continue;
+
+    int n = iterations / 20 + 1;
+    double start = now_ns();
+    for(int it=0;it<n;it++) qr_encode_append(level,nMaxVersion,-1,payload,len,arena,QR_APPEND_MAXSYMBOLS * MAX_QRCODESIZE,&result,NULL);
+    double mid = now_ns();
+    for(int it=0;it<n;it++) qr_encode_append(level,nMaxVersion,-1,payload,len,arena,QR_APPEND_MAXSYMBOLS * MAX_QRCODESIZE,&result,pool);
+    double end = now_ns();
+    printf("%-8d %-6d %-8d %-8d %-8d %14.0f %14.0f\n",len,level,result.ncSymbols,result.nVersion,nMaxVersion,(mid - start) / n,(end - mid) / n);
+  }
+
+  // Header fields out of range are refused and leave the context as it
+  // was: nIndex -1..15, ncTotal 1..16, nIndex below ncTotal.
+  {
+    static const int nBad[][2] = {{16,16},{-2,4},{0,0},{3,17},{5,5},{0,-1}};
+    QR_ENCODER_CTX *ctx = qr_encoder_ctx_create();
+    uint8_t image[MAX_QRCODESIZE], plain[MAX_QRCODESIZE], header[MAX_QRCODESIZE];
+    int width, plain_width, header_width;
+
+    qr_encode_data_ctx(ctx,QR_LEVEL_M,0,true,0,(const uint8_t *)"APPEND",6,plain,&plain_width,NULL,1);
+    for(int n=0;n<(int)(sizeof(nBad) / sizeof(nBad[0]));n++) {
+      if(qr_encoder_ctx_set_append(ctx,nBad[n][0],nBad[n][1],0x5a)) mismatches++;
+    }
+    if(!qr_encode_data_ctx(ctx,QR_LEVEL_M,0,true,0,(const uint8_t *)"APPEND",6,image,&width,NULL,1) ||
+       width != plain_width || memcmp(image,plain,qr_image_size(width)) != 0) mismatches++;
+
+    if(!qr_encoder_ctx_set_append(ctx,15,16,0x5a)) mismatches++;
+    qr_encode_data_ctx(ctx,QR_LEVEL_M,0,true,0,(const uint8_t *)"APPEND",6,header,&header_width,NULL,1);
+    if(qr_encoder_ctx_set_append(ctx,0,17,0x5a)) mismatches++;
+    if(!qr_encode_data_ctx(ctx,QR_LEVEL_M,0,true,0,(const uint8_t *)"APPEND",6,image,&width,NULL,1) ||
+       width != header_width || memcmp(image,header,qr_image_size(width)) != 0) mismatches++;
+    if(!qr_encoder_ctx_set_append(ctx,-1,0,0)) mismatches++;
+
+    qr_encoder_ctx_destroy(ctx);
+  }
+
+  printf("# append mismatches: %d\n",mismatches);
+
+  delete [] payload;
+  delete [] arena;
+  qr_pool_destroy(pool);
+  return mismatches;
+}
+
+static int utf8_put(uint8_t *buf,uint32_t c) {
+  if(c < 0x80)    { buf[0] = (uint8_t)c; return 1; }
+  if(c < 0x800)   { buf[0] = 0xc0 | (c >> 6); buf[1] = 0x80 | (c & 0x3f); return 2; }
+  if(c < 0x10000) { buf[0] = 0xe0 | (c >> 12); buf[1] = 0x80 | ((c >> 6) & 0x3f); buf[2] = 0x80 | (c & 0x3f); return 3; }
+  buf[0] = 0xf0 | (c >> 18); buf[1] = 0x80 | ((c >> 12) & 0x3f); buf[2] = 0x80 | ((c >> 6) & 0x3f); buf[3] = 0x80 | (c & 0x3f);
+  return 4;
+}
+
+// UTF-8 input: the conversion table against a few known codes and as a
+// one-to-one map onto Kanji mode pairs, then text mixing ASCII, Japanese,
+// other scripts, 4-byte characters and malformed bytes encoded, decoded
+// and turned back into UTF-8 through the inverted table. Japanese-only text
+// must give the same symbol as its Shift-JIS bytes.
+static int bench_utf8(int iterations) {
+  static uint32_t nCode[0x10000]; // Shift-JIS -> コードポイント
+  static uint32_t nKanji[8192];
+  int ncKanji = 0, mismatches = 0;
+
+  memset(nCode,0,sizeof(nCode));
+  for(uint32_t c=0;c<0x10000;c++) {
+    uint16_t w = qr_utf8_sjis(c);
+    if(w == 0) continue;
+    if(!IsKanjiData(w >> 8,w & 0xff) || nCode[w] != 0) mismatches++;
+    nCode[w] = c;
+    nKanji[ncKanji++] = c;
+  }
+
+  // 日 本 語 あ ア Ａ Ω Я 、 and characters the two mappings disagree on
+  static const uint32_t nKnown[][2] = {
+    {0x65e5,0x93fa},{0x672c,0x967b},{0x8a9e,0x8cea},{0x3042,0x82a0},{0x30a2,0x8341},{0xff21,0x8260},{0x03a9,0x83b6},{0x042f,0x8460},{0x3001,0x8141},
+    {0x301c,0},{0xff5e,0},{0x2212,0},{0xff0d,0},{0x00e9,0},{0x0041,0},{0xac00,0},{0x1f600,0}
+  };
+  for(size_t i=0;i<sizeof(nKnown) / sizeof(nKnown[0]);i++) {
+    if(qr_utf8_sjis(nKnown[i][0]) != nKnown[i][1]) {
+      printf("# MISMATCH utf8 table U+%04X\n",nKnown[i][0]);
+      mismatches++;
+    }
+  }
+
+  // Latin-1, wave dash, Hangul, minus sign; lone continuation and lead bytes
+  static const uint32_t nOther[4]      = {0xe0,0x301c,0xac00,0x2212};
+  static const uint8_t  byMalformed[5] = {0x80,0xff,0xc3,0xe3,0xed};
+
+  QR_ENCODER_CTX *ctx = qr_encoder_ctx_create();
+  uint32_t seed = 5;
+
+  for(int trial=0;trial<600;trial++) {
+    uint8_t payload[2048], sjis[2048], byClass[2048], decoded[4096], byKanji[4096], rebuilt[4096], image[MAX_QRCODESIZE], raw[MAX_QRCODESIZE];
+    int len = 0, ncMax = 8 + trial * 7 % 1200;
+    bool bJapanese = trial % 4 == 0;
+
+    while(len < ncMax - 4) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t r = seed >> 8;
+      int kind = bJapanese ? 1 : r % 6;
+      switch(kind) {
+        case 0:  payload[len++] = "0123456789ABCDEFabcdef:/. "[r % 26]; break;
+        case 1:
+        case 2:  len += utf8_put(payload + len,nKanji[(r >> 3) % ncKanji]); break;
+        case 3:  len += utf8_put(payload + len,nOther[r % 4] + (r >> 4) % 16); break;
+        case 4:  len += utf8_put(payload + len,0x1f600 + r % 64); break;
+        default: payload[len++] = byMalformed[r % 5]; break;
+      }
+    }
+
+    int level = trial % 4, mask = trial % 3 == 0 ? -1 : trial % 8, width, ncFallback;
+    int ncSjis = qr_utf8_convert(payload,len,sjis,byClass,&ncFallback);
+    QR_MASKRESULT mask_result;
+
+    if(!qr_encode_utf8_ctx(ctx,level,0,true,mask,payload,len,image,&width,&mask_result,1)) {
+      // 容量オーバーのみ
+      if(qr_encode_size_utf8(level,0,true,payload,len,NULL) != 0) mismatches++;
+      continue;
+    }
+
+    int nECI, bits;
+    memset(byKanji,0,sizeof(byKanji));
+    int k = decode_symbol(image,width,level,mask_result.nMaskingNo,decoded,&bits,NULL,&nECI,byKanji);
+    int n = 0;
+    for(int i=0;i<k;) {
+      if(byKanji[i] == 1) { n += utf8_put(rebuilt + n,nCode[(decoded[i] << 8) | decoded[i + 1]]); i += 2; }
+      else rebuilt[n++] = decoded[i++];
+    }
+
+    bool bKanjiMatch = k == ncSjis;
+    for(int i=0;i<k && bKanjiMatch;i++) bKanjiMatch = (byClass[i] != QR_UTF8_BYTE) == (byKanji[i] == 1);
+
+    if(n != len || memcmp(rebuilt,payload,len) != 0 || !bKanjiMatch || nECI != (ncFallback > 0 ? QR_ECI_UTF8 : -1) ||
+       qr_encode_size_utf8(level,0,true,payload,len,NULL) != qr_image_size(width)) {
+      printf("# MISMATCH utf8 trial %d (%d bytes)\n",trial,len);
+      mismatches++;
+      continue;
+    }
+
+    if(bJapanese) {
+      int w2;
+      if(!qr_encode_data_ctx(ctx,level,0,true,mask_result.nMaskingNo,sjis,ncSjis,raw,&w2,NULL,1) || w2 != width || memcmp(raw,image,qr_image_size(width)) != 0) {
+        printf("# MISMATCH utf8 trial %d against Shift-JIS\n",trial);
+        mismatches++;
+      }
+    }
+  }
+
+  // Conversion speed on mostly ASCII and on Japanese text, against memcpy
+  static uint8_t text[2][65536], out[65536], byClass[65536];
+  int ncText[2] = {0,0};
+  for(int i=0;ncText[0] < 65000;i++) ncText[0] += i % 40 == 39 ? utf8_put(text[0] + ncText[0],nKanji[i % ncKanji]) : utf8_put(text[0] + ncText[0],'a' + i % 26);
+  for(int i=0;ncText[1] < 65000;i++) ncText[1] += utf8_put(text[1] + ncText[1],i % 4 == 3 ? (uint32_t)'0' + i % 10 : nKanji[i * 31 % ncKanji]);
+
+  printf("\n%-10s %8s %12s %12s\n","text","bytes","memcpy_ns","convert_ns");
+  for(int t=0;t<2;t++) {
+    int n = iterations / 4 + 1;
+    double start = now_ns();
+    for(int it=0;it<n;it++) { memcpy(out,text[t],ncText[t]); bench_sink += out[it % ncText[t]]; }
+    double mid = now_ns();
+    for(int it=0;it<n;it++) bench_sink += qr_utf8_convert(text[t],ncText[t],out,byClass,NULL);
+    double end = now_ns();
+    printf("%-10s %8d %12.0f %12.0f\n",t == 0 ? "ascii" : "japanese",ncText[t],(mid - start) / n,(end - mid) / n);
+  }
+
+  printf("# utf8 mismatches: %d\n",mismatches);
+
+  qr_encoder_ctx_destroy(ctx);
+  return mismatches;
+}
+
+// The original byte at a time run split, as the reference for qr_scan_runs().
+static int scan_runs_reference(const uint8_t *src,int len,uint8_t *mode,int32_t *length) {
+  int n = 0;
+  for(int i=0;i<len;i++) {
+    uint8_t m = (i < len - 1 && IsKanjiData(src[i],src[i + 1])) ? QR_MODE_KANJI :
+                IsNumeralData(src[i]) ? QR_MODE_NUMERAL : IsAlphabetData(src[i]) ? QR_MODE_ALPHABET : QR_MODE_8BIT;
+    if(n == 0 || mode[n - 1] != m) { mode[n] = m; length[n++] = 0; }
+    length[n - 1] += m == QR_MODE_KANJI ? 2 : 1;
+    if(m == QR_MODE_KANJI) i++;
+  }
+  return n;
+}
+
+// Character class runs: every kernel against the reference on mixed text
+// and on bytes drawn around the Kanji lead and trail limits (long rows of
+// possible lead bytes, 9Fh/EBh with trails either side of their limits),
+// at lengths around the 64-byte block size, then the time per payload.
+static int bench_scan(int iterations) {
+  static const char *kernels[] = {"scalar","sse2","avx2"};
+  static const uint8_t byEdge[] = {0x81,0x9e,0x9f,0xe0,0xea,0xeb,0xec,0x40,0x3f,0x7f,0xbf,0xc0,0xfc,0xfd,0xff,'0','9','A','Z',' ',':','a'};
+  const char *saved = qr_scan_kernel();
+  int mismatches = 0;
+  uint32_t seed = 17;
+
+  for(int trial=0;trial<1500;trial++) {
+    uint8_t payload[4096], mode[2][4096];
+    int32_t length[2][4096];
+    int len = trial < 200 ? trial : 1 + trial * 37 % 3000;
+
+    if(trial % 3 == 0 && len >= 3) {
+      len = mixed_payload(payload,len,1 + trial % 9,trial);
+    } else {
+      for(int i=0;i<len;i++) {
+        seed = seed * 1103515245 + 12345;
+        payload[i] = trial % 3 == 1 ? byEdge[(seed >> 8) % sizeof(byEdge)] : (uint8_t)(seed >> 16);
+      }
+    }
+
+    int n0 = scan_runs_reference(payload,len,mode[0],length[0]);
+    for(int k=0;k<3;k++) {
+      if(!qr_scan_select_kernel(kernels[k])) continue;
+      int n1 = qr_scan_runs(payload,len,mode[1],length[1]);
+      if(n1 != n0 || memcmp(mode[0],mode[1],n0) != 0 || memcmp(length[0],length[1],n0 * sizeof(int32_t)) != 0) {
+        printf("# MISMATCH scan %s trial %d (%d bytes)\n",kernels[k],trial,len);
+        mismatches++;
+      }
+    }
+  }
+
+  printf("\n%-8s %-8s %14s %14s %14s %14s\n","bytes","max_run","reference_ns","scalar_ns","sse2_ns","avx2_ns");
+
+  for(int t=0;t<6;t++) {
+    uint8_t payload[4096], mode[4096];
+    int32_t length[4096];
+    int len = mixed_payload(payload,(t / 2 + 1) * 1024,t % 2 == 0 ? 4 : 64,t), n = iterations * 5;
+
+    double start = now_ns();
+    for(int it=0;it<n;it++) bench_sink += scan_runs_reference(payload,len,mode,length);
+    printf("%-8d %-8d %14.0f",len,t % 2 == 0 ? 4 : 64,(now_ns() - start) / n);
+
+    for(int k=0;k<3;k++) {
+      if(!qr_scan_select_kernel(kernels[k])) { printf(" %14s","-"); continue; }
+      start = now_ns();
+      for(int it=0;it<n;it++) bench_sink += qr_scan_runs(payload,len,mode,length);
+      printf(" %14.0f",(now_ns() - start) / n);
+    }
+    printf("\n");
+  }
+
+  qr_scan_select_kernel(saved);
+  printf("# scan mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// The original group at a time numeric and alphanumeric bit emission.
+static int pack_reference(const uint8_t *src,int len,bool bNumeral,uint8_t *out) {
+  int pos = 0;
+  if(bNumeral) {
+    for(int j=0;j<len;j+=3) {
+      if(j < len - 2)       pos = SetBitStream(out,pos,(src[j] - '0') * 100 + (src[j + 1] - '0') * 10 + (src[j + 2] - '0'),10);
+      else if(j == len - 2) pos = SetBitStream(out,pos,(src[j] - '0') * 10 + (src[j + 1] - '0'),7);
+      else                  pos = SetBitStream(out,pos,src[j] - '0',4);
+    }
+  } else {
+    for(int j=0;j<len;j+=2) {
+      if(j < len - 1) pos = SetBitStream(out,pos,AlphabetToBinary(src[j]) * 45 + AlphabetToBinary(src[j + 1]),11);
+      else            pos = SetBitStream(out,pos,AlphabetToBinary(src[j]),6);
+    }
+  }
+  return pos;
+}
+
+// Bit writer: random puts against SetBitStream (including running out of
+// buffer), the packers against the original emission, then the time to
+// emit numeric serials and alphanumeric text both ways.
+static int bench_bits(int iterations) {
+  static const char alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+  int mismatches = 0;
+  uint32_t seed = 23;
+
+  for(int trial=0;trial<300;trial++) {
+    uint8_t ref[MAX_INPUTDATA + 8], buf[MAX_INPUTDATA + 8];
+    QR_BITWRITER w;
+    int pos = 0, ncPuts = trial * 13 % 4000;
+
+    qr_bits_init(&w,buf,MAX_INPUTDATA);
+    for(int n=0;n<ncPuts;n++) {
+      seed = seed * 1103515245 + 12345;
+      int ncData = 1 + (seed >> 8) % 16;
+      uint16_t wData = (uint16_t)((seed >> 12) & ((1u << ncData) - 1));
+      pos = SetBitStream(ref,pos,wData,ncData);
+      qr_bits_put(&w,wData,ncData);
+    }
+
+    int ncBits = qr_bits_finish(&w);
+    if(ncBits != pos || (pos > 0 && memcmp(ref,buf,(pos + 7) / 8) != 0)) {
+      printf("# MISMATCH bits trial %d (%d puts)\n",trial,ncPuts);
+      mismatches++;
+    }
+
+    // 数字、英数字
+    uint8_t src[2048];
+    int len = trial * 7 % 2000;
+    bool bNumeral = trial % 2 == 0;
+    for(int i=0;i<len;i++) {
+      seed = seed * 1103515245 + 12345;
+      src[i] = bNumeral ? '0' + (seed >> 8) % 10 : alphabet[(seed >> 8) % 45];
+    }
+
+    pos = pack_reference(src,len,bNumeral,ref);
+    qr_bits_init(&w,buf,MAX_INPUTDATA);
+    if(bNumeral) qr_bits_numeral(&w,(const uint8_t *)src,0,len);
+    else         qr_bits_alphabet(&w,(const uint8_t *)src,0,len);
+    ncBits = qr_bits_finish(&w);
+
+    if(ncBits != pos || (pos > 0 && memcmp(ref,buf,(pos + 7) / 8) != 0)) {
+      printf("# MISMATCH bits pack trial %d (%d %s)\n",trial,len,bNumeral ? "digits" : "alphanumerics");
+      mismatches++;
+    }
+  }
+
+  printf("\n%-8s %-13s %14s %14s %8s\n","chars","mode","reference_ns","writer_ns","speedup");
+  for(int t=0;t<6;t++) {
+    static const int ncChars[3] = {20,200,2000};
+    uint8_t src[2048], out[MAX_INPUTDATA + 8];
+    bool bNumeral = t < 3;
+    int len = ncChars[t % 3], n = iterations * 20;
+
+    for(int i=0;i<len;i++) src[i] = bNumeral ? '0' + (i * 7 + 3) % 10 : alphabet[(i * 11 + 5) % 45];
+
+    double start = now_ns();
+    for(int it=0;it<n;it++) bench_sink += pack_reference(src,len,bNumeral,out);
+    double mid = now_ns();
+    for(int it=0;it<n;it++) {
+      QR_BITWRITER w;
+      qr_bits_init(&w,out,MAX_INPUTDATA);
+      if(bNumeral) qr_bits_numeral(&w,(const uint8_t *)src,0,len);
+      else         qr_bits_alphabet(&w,(const uint8_t *)src,0,len);
+      bench_sink += qr_bits_finish(&w);
+    }
+    double end = now_ns();
+
+    printf("%-8d %-13s %14.0f %14.0f %7.1fx\n",len,bNumeral ? "numeric" : "alphanumeric",(mid - start) / n,(end - mid) / n,(mid - start) / (end - mid));
+  }
+
+  printf("# bits mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// qr_encode_batch() throughput on ticket-like payloads for a few pool sizes.
+// Also checks every batch symbol against a plain qr_encode_data() call.
+static int bench_batch(int ncItems) {
+  char (*payloads)[32] = new char[ncItems][32];
+  QR_BATCHITEM *items = new QR_BATCHITEM[ncItems];
+  size_t ncArena = qr_batch_arena_size(ncItems);
+  uint8_t *arena = new uint8_t[ncArena];
+  int mismatches = 0;
+
+  for(int n=0;n<ncItems;n++) {
+    snprintf(payloads[n],sizeof(payloads[n]),"TICKET-%08d",n * 7919);
+
+    memset(&items[n],0,sizeof(QR_BATCHITEM));
+    items[n].lpsSource   = (const uint8_t *)payloads[n];
+    items[n].ncSource    = strlen(payloads[n]);
+    items[n].nLevel      = QR_LEVEL_M;
+    items[n].nVersion    = 0;
+    items[n].bAutoExtent = true;
+    items[n].nMaskingNo  = n % 2 == 0 ? 0 : -1;
+  }
+
+  printf("\n%-8s %-8s %14s %14s\n","threads","items","ns_per_item","symbols_per_s");
+  for(int nThreads=1;nThreads<=8;nThreads*=2) {
+    QR_THREADPOOL *pool = nThreads > 1 ? qr_pool_create(nThreads) : NULL;
+    size_t ncUsed;
+
+    double start = now_ns();
+    int ncEncoded = qr_encode_batch(items,ncItems,arena,ncArena,&ncUsed,pool);
+    double t = now_ns() - start;
+
+    qr_pool_destroy(pool);
+    printf("%-8d %-8d %14.0f %14.0f\n",nThreads,ncEncoded,t / ncItems,ncItems / (t / 1e9));
+  }
+
+  for(int n=0;n<ncItems;n++) {
+    uint8_t image[4096];
+    int outputdata_len, width;
+
+    qr_encode_data(items[n].nLevel,items[n].nVersion,items[n].bAutoExtent,items[n].nMaskingNo,items[n].lpsSource,items[n].ncSource,image,&outputdata_len,&width);
+    if(items[n].nStatus != QR_BATCH_OK || items[n].nWidth != width || memcmp(arena + items[n].nOffset,image,items[n].ncBytes) != 0) mismatches++;
+  }
+
+  // Tight arena: a symbol that does not fit fails alone, the small ones
+  // after it still get the space it did not take.
+  if(ncItems >= 8) {
+    static uint8_t large[2000];
+    QR_BATCHITEM tight[8];
+    size_t ncSmall = (21 * 21 + 7) / 8, ncUsed;
+
+    memset(large,'7',sizeof(large));
+    memcpy(tight,items,sizeof(tight));
+    tight[2].lpsSource = large;
+    tight[2].ncSource  = sizeof(large);
+
+    int ncEncoded = qr_encode_batch(tight,8,arena,7 * ncSmall,&ncUsed,NULL);
+    for(int n=0;n<8;n++) {
+      if((tight[n].nStatus == QR_BATCH_ENOSPC) != (n == 2)) mismatches++;
+    }
+    if(ncEncoded != 7 || ncUsed != 7 * ncSmall) mismatches++;
+  }
+  printf("# batch mismatches: %d\n",mismatches);
+
+  delete [] arena;
+  delete [] items;
+  delete [] payloads;
+  return mismatches;
+}
+
+// One context reused across random payloads of every size, level and
+// version (fixed ones too small included), against a fresh context per
+// payload: nothing left over from the previous encode may show, the symbol
+// takes exactly qr_encode_size() bytes and the guard bytes after it stay
+// untouched.
+static int bench_context(int iterations) {
+  static const char szAlnum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+  const int ncGuard = 64;
+  QR_ENCODER_CTX *ctx = qr_encoder_ctx_create();
+  uint8_t payload[3000];
+  uint8_t reused[MAX_QRCODESIZE + ncGuard], fresh[MAX_QRCODESIZE + ncGuard];
+  uint32_t seed = 11;
+  int mismatches = 0, ncEncoded = 0;
+
+  for(int trial=0;trial<iterations * 20;trial++) {
+    seed = seed * 1103515245 + 12345;
+    int level = (seed >> 8) & 3, kind = (seed >> 10) % 3, mask = (int)((seed >> 12) % 9) - 1;
+    bool bAutoExtent = ((seed >> 16) & 1) != 0;
+    seed = seed * 1103515245 + 12345;
+    int version = (seed >> 8) % 3 == 0 ? 0 : 1 + (int)((seed >> 12) % 40);
+    int len = 1 + (int)((seed >> 16) % (trial % 4 == 0 ? 2900 : 300));
+
+    for(int n=0;n<len;n++) {
+      seed = seed * 1103515245 + 12345;
+      payload[n] = kind == 0 ? '0' + (seed >> 16) % 10 : kind == 1 ? szAlnum[(seed >> 16) % 45] : (uint8_t)(seed >> 16);
+    }
+
+    int size_width = 0, width = 0, fresh_width = 0;
+    int ncSize = qr_encode_size(level,version,bAutoExtent,payload,len,&size_width);
+
+    memset(reused,0xa5,sizeof(reused));
+    memset(fresh,0x5a,sizeof(fresh));
+
+    QR_ENCODER_CTX *once = qr_encoder_ctx_create();
+    bool ok = qr_encode_data_ctx(ctx,level,version,bAutoExtent,mask,payload,len,reused,&width,NULL,1);
+    bool fresh_ok = qr_encode_data_ctx(once,level,version,bAutoExtent,mask,payload,len,fresh,&fresh_width,NULL,1);
+    qr_encoder_ctx_destroy(once);
+
+    if(ok != (ncSize != 0) || ok != fresh_ok) {
+      printf("# MISMATCH context trial %d: encoded %d, fresh %d, size %d\n",trial,ok,fresh_ok,ncSize);
+      mismatches++;
+      continue;
+    }
+    if(!ok) continue;
+    ncEncoded++;
+
+    if(width != size_width || width != fresh_width || ncSize != qr_image_size(width) || memcmp(reused,fresh,ncSize) != 0) {
+      printf("# MISMATCH context trial %d: v%d level %d length %d differs from a fresh context\n",trial,(width - 17) / 4,level,len);
+      mismatches++;
+    }
+    for(int n=ncSize;n<(int)sizeof(reused);n++) {
+      if(reused[n] != 0xa5) {
+        printf("# MISMATCH context trial %d: byte %d written past qr_encode_size() %d\n",trial,n,ncSize);
+        mismatches++;
+        break;
+      }
+    }
+  }
+
+  // Out of range levels and versions are refused, not read past the tables.
+  static const int nBad[][2] = {{-1,0},{4,0},{QR_LEVEL_M,-1},{QR_LEVEL_M,41}};
+  for(int n=0;n<4;n++) {
+    int width;
+    if(qr_encode_data_ctx(ctx,nBad[n][0],nBad[n][1],true,-1,(const uint8_t *)"HELLO",5,reused,&width,NULL,1) ||
+       qr_encode_size(nBad[n][0],nBad[n][1],true,(const uint8_t *)"HELLO",5,NULL) != 0) mismatches++;
+  }
+
+  printf("\n# context reuse: %d trials, %d encoded\n",iterations * 20,ncEncoded);
+  printf("# context mismatches: %d\n",mismatches);
+
+  qr_encoder_ctx_destroy(ctx);
+  return mismatches;
+}
+
+// qr_encode_data_cached() against qr_encode_data(): hit/miss/eviction
+// counts, the byte budget, and qr_encode_batch_cached() on a batch where
+// every payload appears four times, through a pool and a shared cache.
+// Times a re-encode against a hit, and the batch with and without the
+// duplicate pass.
+static int bench_cache(int iterations) {
+  const int ncPayloads = 64;
+  char payloads[ncPayloads][48];
+  uint8_t image[MAX_QRCODESIZE], cached[MAX_QRCODESIZE];
+  int mismatches = 0;
+
+  for(int n=0;n<ncPayloads;n++) snprintf(payloads[n],sizeof(payloads[n]),"https://example.com/t/%08d?s=%d",n * 7919,n % 5);
+
+  // Two passes: all misses, then all hits, byte for byte the plain encode.
+  QR_SYMBOLCACHE *cache = qr_cache_create(1 << 20,0);
+  QR_CACHESTATS stats;
+
+  for(int pass=0;pass<2;pass++) {
+    for(int n=0;n<ncPayloads;n++) {
+      QR_MASKRESULT expect_mask, mask_result;
+      int outputdata_len, width, cached_width;
+      int nMaskingNo = n % 3 == 0 ? 2 : -1;
+
+      qr_encode_data_ex(QR_LEVEL_M,0,true,nMaskingNo,(const uint8_t *)payloads[n],0,image,&outputdata_len,&width,&expect_mask,1);
+      if(!qr_encode_data_cached(cache,QR_LEVEL_M,0,true,nMaskingNo,(const uint8_t *)payloads[n],0,cached,&cached_width,&mask_result,1) ||
+         cached_width != width || mask_result.nMaskingNo != expect_mask.nMaskingNo || memcmp(cached,image,qr_image_size(width)) != 0) mismatches++;
+    }
+  }
+
+  // Same payload, other parameters: separate entries.
+  int width;
+  qr_encode_data_cached(cache,QR_LEVEL_H,0,true,-1,(const uint8_t *)payloads[0],0,cached,&width,NULL,1);
+  qr_encode_data_cached(cache,QR_LEVEL_M,10,true,-1,(const uint8_t *)payloads[0],0,cached,&width,NULL,1);
+
+  qr_cache_stats(cache,&stats);
+  if(stats.ncHits != ncPayloads || stats.ncMisses != ncPayloads + 2 || stats.ncInserts != ncPayloads + 2 || stats.ncEvictions != 0 || stats.ncEntries != ncPayloads + 2) mismatches++;
+
+  // One shard holding about eight entries: the oldest go, the newest stay.
+  QR_SYMBOLCACHE *small = qr_cache_create(8 * 400,1);
+
+  for(int n=0;n<ncPayloads;n++) qr_encode_data_cached(small,QR_LEVEL_M,0,true,-1,(const uint8_t *)payloads[n],0,cached,&width,NULL,1);
+  qr_cache_stats(small,&stats);
+  if(stats.ncBytes > stats.ncBudget || stats.ncEntries == 0 || stats.ncEvictions == 0 || stats.ncEvictions != stats.ncInserts - stats.ncEntries) mismatches++;
+
+  uint64_t ncHits = stats.ncHits;
+  qr_encode_data_cached(small,QR_LEVEL_M,0,true,-1,(const uint8_t *)payloads[ncPayloads - 1],0,cached,&width,NULL,1);
+  qr_encode_data_cached(small,QR_LEVEL_M,0,true,-1,(const uint8_t *)payloads[0],0,cached,&width,NULL,1);
+  qr_cache_stats(small,&stats);
+  if(stats.ncHits != ncHits + 1) mismatches++;
+
+  qr_cache_clear(small);
+  qr_cache_stats(small,&stats);
+  if(stats.ncEntries != 0 || stats.ncBytes != 0) mismatches++;
+  qr_cache_destroy(small);
+
+  // Batch: ncPayloads * 4 items, each payload four times, shuffled.
+  const int ncItems = ncPayloads * 4;
+  QR_BATCHITEM items[ncItems];
+  size_t ncArena = qr_batch_arena_size(ncItems);
+  uint8_t *arena = new uint8_t[ncArena];
+
+  for(int n=0;n<ncItems;n++) {
+    int p = (n * 37) % ncPayloads;
+
+    memset(&items[n],0,sizeof(QR_BATCHITEM));
+    items[n].lpsSource   = (const uint8_t *)payloads[p];
+    items[n].ncSource    = 0;
+    items[n].nLevel      = QR_LEVEL_M;
+    items[n].nVersion    = 0;
+    items[n].bAutoExtent = true;
+    items[n].nMaskingNo  = -1;
+  }
+
+  QR_SYMBOLCACHE *shared = qr_cache_create(1 << 20,0);
+  QR_THREADPOOL *pool = qr_pool_create(4);
+
+  for(int pass=0;pass<2;pass++) {
+    size_t ncUsed, ncUnique = 0;
+    int ncEncoded = qr_encode_batch_cached(items,ncItems,arena,ncArena,&ncUsed,pool,shared);
+
+    if(ncEncoded != ncItems) mismatches++;
+
+    for(int n=0;n<ncItems;n++) {
+      int outputdata_len;
+
+      qr_encode_data(items[n].nLevel,items[n].nVersion,items[n].bAutoExtent,items[n].nMaskingNo,items[n].lpsSource,0,image,&outputdata_len,&width);
+      if(items[n].nStatus != QR_BATCH_OK || items[n].nWidth != width || memcmp(arena + items[n].nOffset,image,items[n].ncBytes) != 0) mismatches++;
+
+      // 先行項目は同じ入力データ
+      int d = items[n].nDuplicateOf;
+      if(d == -1) ncUnique += items[n].ncBytes;
+      else if(d >= n || items[d].lpsSource != items[n].lpsSource || items[d].nDuplicateOf != -1) mismatches++;
+    }
+
+    if(ncUsed != ncUnique) mismatches++;
+  }
+
+  qr_cache_stats(shared,&stats);
+  if(stats.ncMisses != ncPayloads || stats.ncHits != ncPayloads || stats.ncEntries != ncPayloads) mismatches++;
+
+  // A thread whose default context has another layout and segmentation
+  // still stores and gets the default symbol.
+  {
+    QR_SYMBOLCACHE *isolated = qr_cache_create(1 << 20,1);
+    QR_LAYOUT aligned = {QR_ALIGN_32,QR_BITORDER_MSB};
+    uint8_t payload[512], plain[MAX_QRCODESIZE], missed[MAX_QRCODESIZE], hit[MAX_QRCODESIZE];
+    int len = mixed_payload(payload,300,3,17), plain_width, missed_width, hit_width, outputdata_len;
+
+    qr_encode_data(QR_LEVEL_M,0,true,-1,payload,len,plain,&outputdata_len,&plain_width);
+
+    qr_encoder_ctx_set_layout(qr_encoder_ctx_default(),&aligned);
+    qr_encoder_ctx_set_segmentation(qr_encoder_ctx_default(),QR_SEGMENT_GREEDY);
+    bool ok1 = qr_encode_data_cached(isolated,QR_LEVEL_M,0,true,-1,payload,len,missed,&missed_width,NULL,1);
+    bool ok2 = qr_encode_data_cached(isolated,QR_LEVEL_M,0,true,-1,payload,len,hit,&hit_width,NULL,1);
+    qr_encoder_ctx_set_layout(qr_encoder_ctx_default(),&QR_LAYOUT_DEFAULT);
+    qr_encoder_ctx_set_segmentation(qr_encoder_ctx_default(),QR_SEGMENT_OPTIMAL);
+
+    if(!ok1 || !ok2 || missed_width != plain_width || hit_width != plain_width ||
+       memcmp(missed,plain,qr_image_size(plain_width)) != 0 || memcmp(hit,plain,qr_image_size(plain_width)) != 0) mismatches++;
+
+    qr_cache_destroy(isolated);
+  }
+
+  // Timing: encode against hit, then the batch plain, deduplicated, and
+  // deduplicated with every symbol already cached.
+  printf("\n%-22s %14s\n","cache","ns_per_item");
+
+  int n = iterations * 10;
+  double start = now_ns();
+  for(int it=0;it<n;it++) {
+    int outputdata_len;
+    qr_encode_data(QR_LEVEL_M,0,true,-1,(const uint8_t *)payloads[it % ncPayloads],0,image,&outputdata_len,&width);
+    bench_sink += image[0];
+  }
+  double mid = now_ns();
+  for(int it=0;it<n;it++) {
+    qr_encode_data_cached(shared,QR_LEVEL_M,0,true,-1,(const uint8_t *)payloads[it % ncPayloads],0,image,&width,NULL,1);
+    bench_sink += image[0];
+  }
+  double end = now_ns();
+  printf("%-22s %14.0f\n","encode",(mid - start) / n);
+  printf("%-22s %14.0f\n","hit",(end - mid) / n);
+
+  QR_SYMBOLCACHE *cold = qr_cache_create(1 << 20,0);
+
+  start = now_ns();
+  qr_encode_batch(items,ncItems,arena,ncArena,NULL,pool);
+  mid = now_ns();
+  qr_encode_batch_cached(items,ncItems,arena,ncArena,NULL,pool,cold);
+  end = now_ns();
+  qr_encode_batch_cached(items,ncItems,arena,ncArena,NULL,pool,cold);
+  double warm = now_ns();
+
+  printf("%-22s %14.0f\n","batch",(mid - start) / ncItems);
+  printf("%-22s %14.0f\n","batch_dedup",(end - mid) / ncItems);
+  printf("%-22s %14.0f\n","batch_dedup_cached",(warm - end) / ncItems);
+
+  qr_cache_destroy(cold);
+  qr_pool_destroy(pool);
+  qr_cache_destroy(shared);
+  qr_cache_destroy(cache);
+  delete [] arena;
+
+  printf("# cache mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Random field character of the same class as c (see qr_template.h).
+static uint8_t template_char(uint8_t c,uint32_t r) {
+  static const char szAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+  if(c >= '0' && c <= '9') return (uint8_t)('0' + r % 10);
+  if(strchr(szAlphabet,c) != NULL) return (uint8_t)szAlphabet[r % 35];
+  return (uint8_t)('a' + r % 26);
+}
+
+// qr_template_encode() against qr_encode_data_ex() of the whole payload,
+// for random fields of the sample's classes, fixed and automatic masks;
+// a field of other classes must be refused. Times both per symbol.
+static int bench_template(int iterations) {
+  static uint8_t byLong[600];
+  for(int i=0;i<(int)sizeof(byLong);i++) byLong[i] = (uint8_t)("abcdefghij0123456789KLMN/.:-"[i % 28]);
+
+  struct {
+    const char *szPrefix, *szSample, *szSuffix;
+    int nLevel, nVersion, nMaskingNo;
+  } cases[] = {
+    {"https://x.example/t/","00000000","",QR_LEVEL_M,0,3},
+    {"https://x.example/t/","12345678","",QR_LEVEL_M,0,-1},
+    {"HTTPS://X.EXAMPLE/T/","0000000000","?S=1",QR_LEVEL_Q,0,5},
+    {"ID:","AB12CD34EF","/end",QR_LEVEL_H,0,0},
+    {"user=","ab-cd_01",";ok",QR_LEVEL_L,0,-1},
+    {NULL,"000000000000","",QR_LEVEL_M,0,2},      // 長い前置データ(byLong)
+    {NULL,"A1b2C3d4","",QR_LEVEL_H,25,-1},
+    {"","4711","",QR_LEVEL_L,0,7},
+  };
+  const int ncCases = sizeof(cases) / sizeof(cases[0]);
+  int mismatches = 0;
+
+  uint8_t image[MAX_QRCODESIZE], expect[MAX_QRCODESIZE];
+  uint8_t source[MAX_INPUTDATA];
+  uint32_t seed = 0x7e3a1c55;
+
+  printf("\n%-6s %-8s %-6s %-6s %14s %14s %8s\n","case","version","field","mask","encode_ns","template_ns","speedup");
+
+  for(int n=0;n<ncCases;n++) {
+    const uint8_t *pPrefix = cases[n].szPrefix != NULL ? (const uint8_t *)cases[n].szPrefix : byLong;
+    int ncPrefix = cases[n].szPrefix != NULL ? (int)strlen(cases[n].szPrefix) : (int)sizeof(byLong);
+    int ncField  = strlen(cases[n].szSample);
+    int ncSuffix = strlen(cases[n].szSuffix);
+    int ncSource = ncPrefix + ncField + ncSuffix;
+
+    QR_TEMPLATE *t = qr_template_create(cases[n].nLevel,cases[n].nVersion,true,cases[n].nMaskingNo,pPrefix,ncPrefix,
+                                        (const uint8_t *)cases[n].szSample,ncField,(const uint8_t *)cases[n].szSuffix,ncSuffix);
+    if(t == NULL) { mismatches++; continue; }
+
+    memcpy(source,pPrefix,ncPrefix);
+    memcpy(source + ncPrefix + ncField,cases[n].szSuffix,ncSuffix);
+    uint8_t *field = source + ncPrefix;
+
+    for(int it=0;it<iterations;it++) {
+      for(int i=0;i<ncField;i++) {
+        seed = seed * 1103515245 + 12345;
+        field[i] = template_char((uint8_t)cases[n].szSample[i],seed >> 8);
+      }
+
+      QR_MASKRESULT mask_result, expect_mask;
+      int outputdata_len, width, expect_width;
+
+      bool bOk = qr_template_encode(t,field,image,&width,&mask_result);
+      qr_encode_data_ex(cases[n].nLevel,cases[n].nVersion,true,cases[n].nMaskingNo,source,ncSource,expect,&outputdata_len,&expect_width,&expect_mask,1);
+
+      if(!bOk || width != expect_width || mask_result.nMaskingNo != expect_mask.nMaskingNo || memcmp(image,expect,qr_image_size(width)) != 0) mismatches++;
+    }
+
+    // 文字種別の異なる欄
+    memcpy(field,cases[n].szSample,ncField);
+    field[0] = field[0] >= '0' && field[0] <= '9' ? 'a' : '0';
+    int width;
+    if(qr_template_encode(t,field,image,&width,NULL)) mismatches++;
+    memcpy(field,cases[n].szSample,ncField);
+
+    int nRuns = iterations * 5;
+    double start = now_ns();
+    for(int it=0;it<nRuns;it++) {
+      int outputdata_len;
+      field[ncField - 1] = template_char((uint8_t)cases[n].szSample[ncField - 1],it);
+      qr_encode_data(cases[n].nLevel,cases[n].nVersion,true,cases[n].nMaskingNo,source,ncSource,image,&outputdata_len,&width);
+      bench_sink += image[0];
+    }
+    double mid = now_ns();
+    for(int it=0;it<nRuns;it++) {
+      field[ncField - 1] = template_char((uint8_t)cases[n].szSample[ncField - 1],it);
+      qr_template_encode(t,field,image,&width,NULL);
+      bench_sink += image[0];
+    }
+    double end = now_ns();
+
+    printf("%-6d %-8d %-6d %-6d %14.0f %14.0f %7.1fx\n",n,(width - 17) / 4,ncField,cases[n].nMaskingNo,(mid - start) / nRuns,(end - mid) / nRuns,(mid - start) / (end - mid));
+    qr_template_destroy(t);
+  }
+
+  printf("# template mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Callback side of bench_sequence(): compares each symbol with a fresh
+// encode of the formatted serial.
+struct SEQUENCE_CHECK
+{
+	const char *szPrefix, *szSuffix;
+	int nLevel, nDigits, nMaskingNo;
+	uint64_t nNext;
+	int64_t nStopAt; // この番号で打ち切る(-1=なし)
+	int mismatches;
+};
+
+static int sequence_source(const SEQUENCE_CHECK *c,uint64_t nSerial,uint8_t *source) {
+  return sprintf((char *)source,"%s%0*llu%s",c->szPrefix,c->nDigits,(unsigned long long)nSerial,c->szSuffix);
+}
+
+static bool sequence_check(void *arg,uint64_t nSerial,const uint8_t *image,int width,int nMaskingNo) {
+  SEQUENCE_CHECK *c = (SEQUENCE_CHECK *)arg;
+  uint8_t source[MAX_INPUTDATA], expect[MAX_QRCODESIZE];
+  QR_MASKRESULT expect_mask;
+  int outputdata_len, expect_width;
+
+  int ncSource = sequence_source(c,nSerial,source);
+  qr_encode_data_ex(c->nLevel,0,true,c->nMaskingNo,source,ncSource,expect,&outputdata_len,&expect_width,&expect_mask,1);
+
+  if(nSerial != c->nNext || width != expect_width || nMaskingNo != expect_mask.nMaskingNo || memcmp(image,expect,qr_image_size(width)) != 0) c->mismatches++;
+  c->nNext = nSerial + 1;
+
+  return (int64_t)nSerial != c->nStopAt;
+}
+
+// qr_sequence_encode() and qr_sequence_run() against qr_encode_data_ex() of
+// each formatted serial, over carries into the leading digits and after a
+// jump back; a range past the digit count and a stopping callback must be
+// refused. Times consecutive serials against full encodes.
+static int bench_sequence(int iterations) {
+  struct {
+    const char *szPrefix, *szSuffix;
+    int nLevel, nDigits, nMaskingNo;
+    uint64_t nFirst;
+  } cases[] = {
+    {"SN-","",QR_LEVEL_M,8,2,10000000},
+    {"","",QR_LEVEL_Q,12,-1,999999999000ull},
+    {"https://x.example/s/","?v=2",QR_LEVEL_L,10,5,1999999000},
+    {"LOT","-A",QR_LEVEL_H,6,0,99},
+    {"0042","",QR_LEVEL_M,19,7,9999999999999999000ull},
+  };
+  const int ncCases = sizeof(cases) / sizeof(cases[0]);
+  int mismatches = 0;
+
+  uint8_t *images = new uint8_t[(size_t)iterations * MAX_QRCODESIZE];
+  int *masks = new int[iterations];
+  uint8_t source[MAX_INPUTDATA], expect[MAX_QRCODESIZE];
+
+  printf("\n%-6s %-8s %-7s %-6s %14s %14s %8s %14s\n","case","version","digits","mask","encode_ns","sequence_ns","speedup","symbols_per_h");
+
+  for(int n=0;n<ncCases;n++) {
+    SEQUENCE_CHECK check = {cases[n].szPrefix,cases[n].szSuffix,cases[n].nLevel,cases[n].nDigits,cases[n].nMaskingNo,0,-1,0};
+
+    QR_SEQUENCE *s = qr_sequence_create(cases[n].nLevel,0,true,cases[n].nMaskingNo,(const uint8_t *)cases[n].szPrefix,strlen(cases[n].szPrefix),
+                                        cases[n].nDigits,(const uint8_t *)cases[n].szSuffix,strlen(cases[n].szSuffix));
+    if(s == NULL) { mismatches++; continue; }
+
+    int width = qr_sequence_width(s);
+    size_t ncBytes = qr_image_size(width);
+    uint64_t nFirst = cases[n].nFirst;
+
+    // 出力先へ
+    if(!qr_sequence_encode(s,nFirst,iterations,images,masks)) mismatches++;
+
+    for(int i=0;i<iterations;i++) {
+      QR_MASKRESULT expect_mask;
+      int outputdata_len, expect_width;
+      int ncSource = sequence_source(&check,nFirst + i,source);
+
+      qr_encode_data_ex(cases[n].nLevel,0,true,cases[n].nMaskingNo,source,ncSource,expect,&outputdata_len,&expect_width,&expect_mask,1);
+      if(expect_width != width || masks[i] != expect_mask.nMaskingNo || memcmp(images + i * ncBytes,expect,ncBytes) != 0) mismatches++;
+    }
+
+    // コールバックへ、前へ戻って
+    uint64_t nBack = nFirst / 3;
+    check.nNext = nBack;
+    if(!qr_sequence_run(s,nBack,nBack + iterations / 2,sequence_check,&check)) mismatches++;
+    if(check.nNext != nBack + iterations / 2 + 1) mismatches++;
+
+    // 途中で打ち切るコールバック
+    check.nNext   = nFirst;
+    check.nStopAt = (int64_t)(nFirst + 2);
+    if(qr_sequence_run(s,nFirst,nFirst + 10,sequence_check,&check) || check.nNext != nFirst + 3) mismatches++;
+    mismatches += check.mismatches;
+
+    // 桁数を超える範囲
+    uint64_t nLimit = 1;
+    for(int i=0;i<cases[n].nDigits;i++) nLimit *= 10;
+    if(qr_sequence_encode(s,nLimit - 1,2,images,NULL)) mismatches++;
+    if(cases[n].nDigits < 19 && qr_sequence_run(s,nLimit - 2,nLimit,sequence_check,&check)) mismatches++;
+
+    int nRuns = iterations * 5;
+    double start = now_ns();
+    for(int it=0;it<nRuns;it++) {
+      int outputdata_len, ncSource = sequence_source(&check,nBack + it,source);
+      qr_encode_data(cases[n].nLevel,0,true,cases[n].nMaskingNo,source,ncSource,expect,&outputdata_len,&width);
+      bench_sink += expect[0];
+    }
+    double mid = now_ns();
+    for(int it=0;it<nRuns;it+=iterations) {
+      int ncCount = nRuns - it < iterations ? nRuns - it : iterations;
+      qr_sequence_encode(s,nBack + it,ncCount,images,NULL);
+      bench_sink += images[0];
+    }
+    double end = now_ns();
+
+    double sequence_ns = (end - mid) / nRuns;
+    printf("%-6d %-8d %-7d %-6d %14.0f %14.0f %7.1fx %14.0f\n",n,(width - 17) / 4,cases[n].nDigits,cases[n].nMaskingNo,
+           (mid - start) / nRuns,sequence_ns,(mid - start) / (end - mid),3.6e12 / sequence_ns);
+    qr_sequence_destroy(s);
+  }
+
+  delete [] images;
+  delete [] masks;
+
+  printf("# sequence mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+// Expected response body for a request sent by bench_server().
+static bool server_expect(const QR_REQUEST *req,const uint8_t *payload,int ncPayload,IMAGEBUF *buf,int *width,int *nMaskingNo) {
+  uint8_t image[MAX_QRCODESIZE];
+  QR_MASKRESULT mask_result;
+  int outputdata_len;
+
+  buf->ncData = 0;
+  if(ncPayload == 0) return false; // 要求では長さ 0 は NUL 終端でなくデータなし
+  if(!qr_encode_data_ex(req->nLevel,req->nVersion,(req->nFlags & QR_REQFLAG_AUTOEXTENT) != 0,req->nMaskingNo,payload,ncPayload,image,&outputdata_len,width,&mask_result,1)) return false;
+
+  *nMaskingNo = mask_result.nMaskingNo;
+  if(req->nFormat == QR_OUTPUT_BITMAP) imagebuf_write(buf,image,qr_image_size(*width));
+  else qr_write_image(image,*width,req->nFormat == QR_OUTPUT_PBM ? QR_IMAGE_PBM : QR_IMAGE_PNG,req->nScale,req->nQuietZone,imagebuf_write,buf);
+
+  return true;
+}
+
+// A qr_server on a private socket, driven through qr_client: pipelined
+// bitmap, PBM and PNG requests on two interleaved connections must match
+// local encodes in order, with failed and malformed requests and a stats
+// request among them; a bad frame must close its connection after the
+// requests before it are answered. Times pipelined round trips.
+static int bench_server(int iterations) {
+  char szPath[64];
+  snprintf(szPath,sizeof(szPath),"/tmp/qrbench-%d.sock",(int)getpid());
+
+  QR_SERVEROPTIONS options = {2,16,0,1 << 20};
+  QR_SERVER *server = qr_server_create(szPath,&options);
+  if(server == NULL) {
+    printf("# server mismatches: 1 (cannot listen on %s)\n",szPath);
+    return 1;
+  }
+
+  std::thread running(qr_server_run,server);
+  int mismatches = 0;
+
+  QR_CLIENT *client[2] = {qr_client_connect(szPath),qr_client_connect(szPath)};
+  if(client[0] == NULL || client[1] == NULL) mismatches++;
+
+  const int ncRequests = 120; // 未応答上限(既定 256)未満
+  QR_REQUEST reqs[2][ncRequests];
+  uint8_t payloads[2][ncRequests][64];
+  int ncPayloads[2][ncRequests];
+  uint32_t seed = 0x51ed270b;
+
+  for(int round=0;round<iterations / 20 + 1 && mismatches == 0;round++) {
+    for(int c=0;c<2;c++) {
+      for(int n=0;n<ncRequests;n++) {
+        QR_REQUEST &req = reqs[c][n];
+        seed = seed * 1103515245 + 12345;
+
+        memset(&req,0,sizeof(req));
+        req.nId        = (uint32_t)(round * 1000 + n);
+        req.nLevel     = (seed >> 8) & 3;
+        req.nMaskingNo = (int)((seed >> 10) % 9) - 1;
+        req.nFormat    = (seed >> 14) % 3;
+        req.nScale     = 1 + (seed >> 16) % 4;
+        req.nQuietZone = (seed >> 18) % 5;
+        req.nFlags     = QR_REQFLAG_AUTOEXTENT | ((seed >> 20) & 1 ? QR_REQFLAG_NOCACHE : 0);
+
+        ncPayloads[c][n] = sprintf((char *)payloads[c][n],"https://x.example/%u/%d",(seed >> 4) % 50,n);
+
+        if(n % 40 == 7) ncPayloads[c][n] = 0;                  // データなし
+        if(n % 40 == 19) req.nLevel = 4;                        // 引数不正
+        if(n % 40 == 31) { req.nType = QR_REQUEST_STATS; req.nFormat = n % 80 < 40 ? QR_STATS_JSON : QR_STATS_TEXT; ncPayloads[c][n] = 0; }
+
+        if(!qr_client_send(client[c],&req,payloads[c][n],ncPayloads[c][n])) mismatches++;
+      }
+      if(!qr_client_flush(client[c])) mismatches++;
+    }
+
+    IMAGEBUF buf = {NULL,0,0};
+
+    for(int n=0;n<ncRequests;n++) {
+      for(int c=0;c<2;c++) {
+        const QR_REQUEST &req = reqs[c][n];
+        QR_RESPONSE resp;
+        const uint8_t *body;
+
+        if(!qr_client_recv(client[c],&resp,&body) || resp.nId != req.nId) {
+          mismatches++;
+          continue;
+        }
+
+        int width, nMaskingNo;
+
+        if(req.nType == QR_REQUEST_STATS) {
+          if(resp.nStatus != QR_STATUS_OK || resp.ncBody == 0) mismatches++;
+          if(req.nFormat == QR_STATS_JSON && (resp.ncBody < 10 || memcmp(body,"{\"server\":",10) != 0)) mismatches++;
+        } else if(req.nLevel > QR_LEVEL_H) {
+          if(resp.nStatus != QR_STATUS_BADREQUEST) mismatches++;
+        } else if(!server_expect(&req,payloads[c][n],ncPayloads[c][n],&buf,&width,&nMaskingNo)) {
+          if(resp.nStatus != QR_STATUS_FAILED) mismatches++;
+        } else if(resp.nStatus != QR_STATUS_OK || resp.width != width || resp.nVersion != (width - 17) / 4 || resp.nMaskingNo != nMaskingNo ||
+                  resp.ncBody != buf.ncData || memcmp(body,buf.data,buf.ncData) != 0) {
+          mismatches++;
+        }
+      }
+    }
+
+    delete [] buf.data;
+  }
+
+  // 不正な長さのフレーム: 先の要求には応答して切断(qr_client では送れないので直接)
+  QR_REQUEST req;
+  QR_RESPONSE resp;
+  const uint8_t *body;
+  uint8_t frames[2 * QR_SERVER_HEADERSIZE + 3];
+
+  memset(&req,0,sizeof(req));
+  req.nFormat = QR_OUTPUT_BITMAP;
+  qr_request_pack(&req,3,frames);
+  memcpy(frames + QR_SERVER_HEADERSIZE,"BAD",3);
+  qr_request_pack(&req,QR_SERVER_MAXPAYLOAD + 1,frames + QR_SERVER_HEADERSIZE + 3);
+
+  struct sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path,szPath);
+
+  int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if(connect(fd,(struct sockaddr *)&addr,sizeof(addr)) != 0 || write(fd,frames,sizeof(frames)) != (ssize_t)sizeof(frames)) mismatches++;
+
+  uint8_t reply[QR_SERVER_HEADERSIZE + MAX_QRCODESIZE];
+  size_t ncReply = 0;
+  ssize_t ncRead;
+  while((ncRead = read(fd,reply + ncReply,sizeof(reply) - ncReply)) > 0) ncReply += ncRead;
+  close(fd);
+
+  if(ncReply < QR_SERVER_HEADERSIZE || !qr_response_unpack(reply,&resp) || resp.nStatus != QR_STATUS_OK ||
+     ncReply != QR_SERVER_HEADERSIZE + resp.ncBody) mismatches++;
+
+  // 往復時間(窓 32 で連続送信)
+  int nRuns = iterations * 20, nSent = 0, nDone = 0;
+  uint8_t payload[64];
+  req.nLevel = QR_LEVEL_M;
+  req.nMaskingNo = 0;
+  req.nFlags = QR_REQFLAG_AUTOEXTENT | QR_REQFLAG_NOCACHE;
+
+  double start = now_ns();
+  while(nDone < nRuns) {
+    for(;nSent < nRuns && nSent - nDone < 32;nSent++) {
+      int ncPayload = sprintf((char *)payload,"https://x.example/rt/%d",nSent);
+      req.nId = nSent;
+      qr_client_send(client[0],&req,payload,ncPayload);
+    }
+    if(!qr_client_recv(client[0],&resp,&body) || resp.nId != (uint32_t)nDone) { mismatches++; break; }
+    nDone++;
+  }
+  double mid = now_ns();
+  for(int n=0;n<nRuns;n++) {
+    uint8_t image[MAX_QRCODESIZE];
+    int outputdata_len, width;
+    int ncPayload = sprintf((char *)payload,"https://x.example/rt/%d",n);
+    qr_encode_data(QR_LEVEL_M,0,true,0,payload,ncPayload,image,&outputdata_len,&width);
+    bench_sink += image[0];
+  }
+  double end = now_ns();
+
+  qr_client_close(client[0]);
+  qr_client_close(client[1]);
+
+  QR_SERVERSTATS stats;
+  qr_server_stats(server,&stats);
+  if(stats.ncBadFrames != 1 || stats.ncAccepted != 3) mismatches++;
+
+  qr_server_stop(server);
+  running.join();
+  qr_server_destroy(server);
+  if(access(szPath,F_OK) == 0) mismatches++;
+
+  printf("\n# server round trip (pipelined, fixed mask): %.0f ns per request, %.0f ns encode in process\n",(mid - start) / nRuns,(end - mid) / nRuns);
+  printf("# server mismatches: %d\n",mismatches);
+  return mismatches;
+}
+
+int main(int argc,char **argv) {
+  // qrbench --suite ...: machine readable per-stage results, see bench_suite.cpp.
+  if(argc > 1 && strcmp(argv[1],"--suite") == 0) return bench_suite(argc - 2,argv + 2);
+
+  int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+  // Build every template up front so the first version isn't charged for it.
+  double start = now_ns();
+  for(int v=1;v<=40;v++) qr_function_mask(v);
+  double end = now_ns();
+  printf("# template build (all versions): %.0f ns\n",end - start);
+
+  printf("%-8s %-6s %14s %14s %8s %14s %16s\n","version","width","predicate_ns","template_ns","speedup","placement_ns","format_module_ns");
+  for(int v=1;v<=40;v++) {
+    double p = bench_predicate_scan(v,iterations);
+    double t = bench_template_scan(v,iterations);
+    double c = bench_codeword_placement(v,iterations);
+    double f = bench_format_module(v,iterations);
+    printf("%-8d %-6d %14.0f %14.0f %7.1fx %14.0f %16.0f\n",v,v*4+17,p,t,p/t,c,f);
+  }
+
+  int mismatches = bench_penalty(iterations);
+  mismatches += bench_rs(iterations * 10);
+  mismatches += bench_batch(iterations * 50);
+  mismatches += bench_context(iterations);
+  mismatches += bench_segment(iterations);
+  mismatches += bench_select();
+  mismatches += bench_image(iterations);
+  mismatches += bench_layout(iterations);
+  mismatches += bench_version(iterations);
+  mismatches += bench_gather(iterations);
+  mismatches += bench_append(iterations);
+  mismatches += bench_utf8(iterations);
+  mismatches += bench_scan(iterations);
+  mismatches += bench_bits(iterations);
+  mismatches += bench_cache(iterations);
+  mismatches += bench_template(iterations);
+  mismatches += bench_sequence(iterations);
+  mismatches += bench_server(iterations);
+
+  printf("\n%-8s %14s %14s %14s %8s\n","version","fixed_mask_ns","auto_mask_ns","auto_4thr_ns","ratio");
+  for(int v=1;v<=40;v++) {
+    double f  = bench_encode(v,0,1,iterations);
+    double a  = bench_encode(v,-1,1,iterations);
+    double a4 = bench_encode(v,-1,4,iterations);
+    printf("%-8d %14.0f %14.0f %14.0f %7.1fx\n",v,f,a,a4,a/f);
+  }
+
+  // With make STATS=1, the encoder's own view of the runs above.
+  if(qr_stats_enabled()) {
+    QR_STATS stats;
+    char report[8192];
+
+    qr_stats_snapshot(&stats,false);
+    qr_stats_format(&stats,QR_STATS_TEXT,report,sizeof(report));
+    printf("\n# encoder stats\n%s",report);
+  }
+
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <new>
+#include "qr_encodeem.h"
+#include "qr_penalty.h"
+#include "qr_rs.h"
+
+// Stage-level benchmark suite.
+//
+// qrbench --suite runs every stage and the full encode for every version and
+// error correction level, with a fixed and an automatic mask, over five
+// payload corpora (URLs, numeric serials, alphanumeric codes, Shift-JIS
+// Kanji and random binary). Each payload is the longest prefix of its
+// corpus that still fits the version, so every case is a full symbol.
+//
+// Output is one tab separated line per case:
+//
+//   case  ns_per_op  symbols_per_s  bytes_alloc_per_op  peak_stack_bytes
+//
+// and can be saved with --out and compared against later with --baseline.
+
+// Internal stages, not part of the public header.
+void PlaceModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int version);
+void ApplyMaskingPattern(uint8_t *image,int width,int m_nMaskingNo,int version,int level);
+int SelectMaskingPattern(const uint8_t *placed,int width,int version,int level,int *penalties,int nThreads,uint8_t *work);
+
+#define MAX_CORPUS      8192 // 最長コーパス(Ver.40-L 数字 7089 文字)
+#define MAX_QRCODESIZE  4096 // (177*177)/8
+#define MAX_ALLCODEWORD 3706 // 総コードワード数最大値(Ver.40)
+#define STACK_PROBE   262144 // スタック使用量の計測範囲
+#define MAX_BASELINE    8192 // ベースライン最大ケース数
+
+static double suite_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+//
+// Every operator new in the process goes through here, so a case reports
+// the bytes the encoder allocated per operation. A warm encoder should
+// report 0.
+
+static std::atomic<uint64_t> ncAllocBytes(0);
+
+void *operator new(size_t size) {
+  ncAllocBytes.fetch_add(size,std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if(p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p,size_t) noexcept { free(p); }
+void operator delete[](void *p,size_t) noexcept { free(p); }
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Peak stack
+//
+// stack_paint() fills STACK_PROBE bytes below the caller's frame with a
+// pattern and stack_peak(), called from the same frame after the operation,
+// finds the deepest byte that was overwritten. Only the calling thread is
+// measured, so the suite runs the encoder single threaded.
+
+#define STACK_FILL 0xa5
+
+__attribute__((noinline))
+static void stack_paint() {
+  uint8_t probe[STACK_PROBE];
+  memset(probe,STACK_FILL,sizeof(probe));
+  __asm__ volatile("" : : "r"(probe) : "memory");
+}
+
+__attribute__((noinline))
+static size_t stack_peak() {
+  uint8_t probe[STACK_PROBE];
+  __asm__ volatile("" : : "r"(probe) : "memory");
+
+  // The stack grows down: probe[0] is the deepest byte.
+  size_t n = 0;
+  while(n < sizeof(probe) && probe[n] == STACK_FILL) n++;
+  return sizeof(probe) - n;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Corpora
+
+#define CORPUS_URL       0
+#define CORPUS_NUMERIC   1
+#define CORPUS_ALPHANUM  2
+#define CORPUS_KANJI     3
+#define CORPUS_BINARY    4
+#define CORPUS_COUNT     5
+
+static const char *CorpusName[CORPUS_COUNT] = {"url","numeric","alnum","kanji","binary"};
+
+// Bytes per character, payloads are only cut on a character boundary.
+static const int CorpusUnit[CORPUS_COUNT] = {1,1,1,2,1};
+
+static uint32_t corpus_rand(uint32_t *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+// Fills buf with MAX_CORPUS bytes of the corpus. Every corpus is the same on
+// every run so results can be compared against a baseline.
+static void build_corpus(int nCorpus,uint8_t *buf) {
+  uint32_t seed = 0x5eed0000 + nCorpus;
+  int n = 0;
+
+  switch(nCorpus) {
+  case CORPUS_URL:
+    // https://x.example/t/<tenant>/<id>?s=<n> records, back to back.
+    while(n < MAX_CORPUS) {
+      char rec[96];
+      int len = snprintf(rec,sizeof(rec),"https://x.example/t/%c%c%c%c/%08x?s=%u&",
+                         'a' + corpus_rand(&seed) % 26,'a' + corpus_rand(&seed) % 26,
+                         'a' + corpus_rand(&seed) % 26,'a' + corpus_rand(&seed) % 26,
+                         corpus_rand(&seed),corpus_rand(&seed) % 100000);
+      for(int i=0;i<len && n < MAX_CORPUS;i++) buf[n++] = (uint8_t)rec[i];
+    }
+    break;
+
+  case CORPUS_NUMERIC:
+    for(;n < MAX_CORPUS;n++) buf[n] = (uint8_t)('0' + corpus_rand(&seed) % 10);
+    break;
+
+  case CORPUS_ALPHANUM:
+    // Part codes such as "AB12-7Q9X-K3" from the 45 character set minus ' '.
+    for(;n < MAX_CORPUS;n++) {
+      static const char set[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ$%*+-./:";
+      buf[n] = (n % 5 == 4) ? '-' : (uint8_t)set[corpus_rand(&seed) % (sizeof(set) - 1)];
+    }
+    break;
+
+  case CORPUS_KANJI:
+    // Shift-JIS level 1/2 Kanji, lead 0x88-0x9f, trail 0x40-0xfc without 0x7f.
+    for(;n + 1 < MAX_CORPUS;n += 2) {
+      uint8_t c2;
+      do { c2 = (uint8_t)(0x40 + corpus_rand(&seed) % (0xfc - 0x40 + 1)); } while(c2 == 0x7f);
+      buf[n]     = (uint8_t)(0x88 + corpus_rand(&seed) % (0x9f - 0x88 + 1));
+      buf[n + 1] = c2;
+    }
+    if(n < MAX_CORPUS) buf[n] = 0x88;
+    break;
+
+  default: // CORPUS_BINARY
+    for(;n < MAX_CORPUS;n++) buf[n] = (uint8_t)corpus_rand(&seed);
+    break;
+  }
+}
+
+// Longest prefix of the corpus that encodes at exactly the given version,
+// or 0 if the corpus never lands on it.
+static int fit_corpus(int nCorpus,const uint8_t *buf,int version,int level) {
+  int unit = CorpusUnit[nCorpus];
+  int lo = 0, hi = MAX_CORPUS / unit;
+
+  // Largest character count with version <= target.
+  while(lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    int width;
+
+    if(qr_encode_size(level,0,false,buf,mid * unit,&width) != 0 && width <= version * 4 + 17) lo = mid;
+                                                                                         else hi = mid - 1;
+  }
+
+  int width;
+  if(lo == 0 || qr_encode_size(level,0,false,buf,lo * unit,&width) == 0 || width != version * 4 + 17) return 0;
+  return lo * unit;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Cases
+
+typedef void (*BENCHFUNC)(void *arg,int n);
+
+typedef struct tagBENCHCASE
+{
+	// 入力
+	int            nLevel;
+	int            nVersion;
+	int            nMaskingNo;
+	const uint8_t *lpsSource;
+	int            ncSource;
+
+	// 作業領域
+	QR_ENCODER_CTX *ctx;
+	uint8_t  byCodeWord[MAX_ALLCODEWORD];
+	int      ncAllCodeWord;
+	uint8_t  byPlaced[MAX_QRCODESIZE];
+	uint8_t  byImage[MAX_QRCODESIZE];
+	uint8_t  byWork[MAX_QRCODESIZE];
+	int      width;
+} BENCHCASE;
+
+static volatile int suite_sink;
+
+static void op_segment(void *arg,int n) {
+  BENCHCASE *c = (BENCHCASE *)arg;
+  int width;
+  suite_sink = qr_encode_size(c->nLevel,c->nVersion,false,c->lpsSource,c->ncSource,&width);
+}
+
+static void op_rs(void *arg,int n) {
+  BENCHCASE *c = (BENCHCASE *)arg;
+  const QR_VERSIONINFO &vi = QR_VersionInfo[c->nVersion];
+  const RS_BLOCKINFO *blocks[2] = {&vi.RS_BlockInfo1[c->nLevel],&vi.RS_BlockInfo2[c->nLevel]};
+  uint8_t ecc[68];
+  int nData = 0;
+
+  c->byCodeWord[0] = (uint8_t)n;
+  for(int b=0;b<2;b++) {
+    int ncRS = blocks[b]->ncAllCodeWord - blocks[b]->ncDataCodeWord;
+    for(int k=0;k<blocks[b]->ncRSBlock;k++) {
+      qr_rs_encode(c->byCodeWord + nData,blocks[b]->ncDataCodeWord,ecc,ncRS);
+      nData += blocks[b]->ncDataCodeWord;
+    }
+  }
+  suite_sink = ecc[0];
+}
+
+static void op_placement(void *arg,int n) {
+  BENCHCASE *c = (BENCHCASE *)arg;
+  c->byCodeWord[0] = (uint8_t)n;
+  PlaceModule(c->byImage,c->width,c->byCodeWord,c->ncAllCodeWord,c->nVersion);
+  suite_sink = c->byImage[0];
+}
+
+static void op_masking(void *arg,int n) {
+  BENCHCASE *c = (BENCHCASE *)arg;
+  int nMaskingNo = c->nMaskingNo;
+
+  if(nMaskingNo == -1)
+    nMaskingNo = SelectMaskingPattern(c->byPlaced,c->width,c->nVersion,c->nLevel,NULL,1,c->byWork);
+
+  memcpy(c->byImage,c->byPlaced,qr_image_size(c->width));
+  ApplyMaskingPattern(c->byImage,c->width,nMaskingNo,c->nVersion,c->nLevel);
+  suite_sink = c->byImage[0];
+}
+
+static void op_penalty(void *arg,int n) {
+  BENCHCASE *c = (BENCHCASE *)arg;
+  suite_sink = CountPenalty(c->byImage,c->width);
+}
+
+static void op_encode(void *arg,int n) {
+  BENCHCASE *c = (BENCHCASE *)arg;
+  int width;
+  qr_encode_data_ctx(c->ctx,c->nLevel,c->nVersion,false,c->nMaskingNo,c->lpsSource,c->ncSource,c->byImage,&width,NULL,1);
+  suite_sink = width;
+}
+
+typedef struct tagBENCHRESULT
+{
+	char     szName[64];
+	double   dNsPerOp;
+	double   dSymbolsPerSec;
+	double   dAllocPerOp;
+	size_t   ncPeakStack;
+} BENCHRESULT;
+
+typedef struct tagSUITEOPTIONS
+{
+	int         nIterations;  // 0 = nMinTimeNs まで繰り返す
+	double      dMinTimeNs;
+	const char *szFilter;     // ケース名の部分一致(NULL = 全て)
+	FILE       *fpOut;
+	BENCHRESULT *baseline;
+	int         ncBaseline;
+	double      dThreshold;   // 許容する低下率(%)
+	int         ncRegressed;
+	int         ncCompared;
+} SUITEOPTIONS;
+
+static const BENCHRESULT *find_baseline(const SUITEOPTIONS *opt,const char *szName) {
+  for(int n=0;n<opt->ncBaseline;n++) {
+    if(strcmp(opt->baseline[n].szName,szName) == 0) return &opt->baseline[n];
+  }
+  return NULL;
+}
+
+// Times one case and prints its line, with the change against the
+// baseline when there is one.
+static void run_case(SUITEOPTIONS *opt,const char *szName,BENCHFUNC fn,BENCHCASE *c) {
+  if(opt->szFilter != NULL && strstr(szName,opt->szFilter) == NULL) return;
+
+  BENCHRESULT r;
+  snprintf(r.szName,sizeof(r.szName),"%s",szName);
+
+  // Warm up the context, templates and tables, then measure the stack of
+  // one call from this frame.
+  fn(c,0);
+  stack_paint();
+  fn(c,0);
+  r.ncPeakStack = stack_peak();
+
+  int ncIterations = opt->nIterations;
+  uint64_t ncAlloc = ncAllocBytes.load();
+  double start = suite_now_ns(), elapsed;
+
+  if(ncIterations > 0) {
+    for(int n=0;n<ncIterations;n++) fn(c,n);
+    elapsed = suite_now_ns() - start;
+  } else {
+    // Double the batch until the minimum time is reached.
+    int batch = 1;
+    ncIterations = 0;
+    do {
+      for(int n=0;n<batch;n++) fn(c,ncIterations + n);
+      ncIterations += batch;
+      batch *= 2;
+      elapsed = suite_now_ns() - start;
+    } while(elapsed < opt->dMinTimeNs);
+  }
+
+  r.dNsPerOp       = elapsed / ncIterations;
+  r.dSymbolsPerSec = 1e9 / r.dNsPerOp;
+  r.dAllocPerOp    = (double)(ncAllocBytes.load() - ncAlloc) / ncIterations;
+
+  char line[256];
+  snprintf(line,sizeof(line),"%s\t%.1f\t%.0f\t%.1f\t%zu",r.szName,r.dNsPerOp,r.dSymbolsPerSec,r.dAllocPerOp,r.ncPeakStack);
+
+  const BENCHRESULT *base = find_baseline(opt,szName);
+  if(base != NULL) {
+    double change = (r.dNsPerOp / base->dNsPerOp - 1) * 100;
+    bool bRegressed = change > opt->dThreshold;
+
+    opt->ncCompared++;
+    if(bRegressed) opt->ncRegressed++;
+    printf("%s\t%+.1f%%%s\n",line,change,bRegressed ? "\tREGRESSED" : "");
+  } else {
+    printf("%s\n",line);
+  }
+
+  if(opt->fpOut != NULL) fprintf(opt->fpOut,"%s\n",line);
+}
+
+// Reads a file written by --out. Lines starting with '#' are skipped.
+static int load_baseline(const char *szFile,BENCHRESULT *baseline,int ncMax) {
+  FILE *fp = fopen(szFile,"r");
+  if(fp == NULL) return -1;
+
+  char line[256];
+  int n = 0;
+  while(n < ncMax && fgets(line,sizeof(line),fp) != NULL) {
+    if(line[0] == '#') continue;
+
+    BENCHRESULT &r = baseline[n];
+    if(sscanf(line,"%63s %lf %lf %lf %zu",r.szName,&r.dNsPerOp,&r.dSymbolsPerSec,&r.dAllocPerOp,&r.ncPeakStack) == 5 && r.dNsPerOp > 0) n++;
+  }
+
+  fclose(fp);
+  return n;
+}
+
+static const char LevelName[] = "LMQH";
+
+static void usage() {
+  fprintf(stderr,"usage: qrbench --suite [--iterations N] [--min-time MS] [--filter TEXT]\n"
+                 "                       [--out FILE] [--baseline FILE] [--threshold PCT]\n");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// bench_suite
+// 用  途：ステージ別ベンチマーク
+// 引  数：--suite 以降のコマンドライン
+// 戻り値：0 = 正常、1 = ベースラインより低下したケースあり、2 = 引数エラー
+
+int bench_suite(int argc,char **argv) {
+  SUITEOPTIONS opt;
+  memset(&opt,0,sizeof(opt));
+  opt.dMinTimeNs = 2e6;
+  opt.dThreshold = 10;
+
+  const char *szOut = NULL, *szBaseline = NULL;
+
+  for(int n=0;n<argc;n++) {
+    const char *arg = argv[n];
+    const char *val = n + 1 < argc ? argv[n + 1] : NULL;
+
+    if(strcmp(arg,"--iterations") == 0 && val)     { opt.nIterations = atoi(val); n++; }
+    else if(strcmp(arg,"--min-time") == 0 && val)  { opt.dMinTimeNs = atof(val) * 1e6; n++; }
+    else if(strcmp(arg,"--filter") == 0 && val)    { opt.szFilter = val; n++; }
+    else if(strcmp(arg,"--out") == 0 && val)       { szOut = val; n++; }
+    else if(strcmp(arg,"--baseline") == 0 && val)  { szBaseline = val; n++; }
+    else if(strcmp(arg,"--threshold") == 0 && val) { opt.dThreshold = atof(val); n++; }
+    else { usage(); return 2; }
+  }
+
+  if(szBaseline != NULL) {
+    opt.baseline   = new BENCHRESULT[MAX_BASELINE];
+    opt.ncBaseline = load_baseline(szBaseline,opt.baseline,MAX_BASELINE);
+    if(opt.ncBaseline < 0) {
+      fprintf(stderr,"qrbench: cannot read baseline %s\n",szBaseline);
+      delete [] opt.baseline;
+      return 2;
+    }
+  }
+
+  if(szOut != NULL && (opt.fpOut = fopen(szOut,"w")) == NULL) {
+    fprintf(stderr,"qrbench: cannot write %s\n",szOut);
+    delete [] opt.baseline;
+    return 2;
+  }
+
+  static uint8_t corpus[CORPUS_COUNT][MAX_CORPUS];
+  for(int k=0;k<CORPUS_COUNT;k++) build_corpus(k,corpus[k]);
+
+  printf("# qrbench suite, rs kernel %s, penalty kernel %s\n",qr_rs_kernel(),qr_penalty_kernel());
+  printf("# case\tns_per_op\tsymbols_per_s\tbytes_alloc_per_op\tpeak_stack_bytes%s\n",opt.ncBaseline > 0 ? "\tvs_baseline" : "");
+  if(opt.fpOut != NULL) fprintf(opt.fpOut,"# case\tns_per_op\tsymbols_per_s\tbytes_alloc_per_op\tpeak_stack_bytes\n");
+
+  BENCHCASE *c = new BENCHCASE;
+  c->ctx = qr_encoder_ctx_create();
+
+  for(int v=1;v<=40;v++) {
+    for(int l=0;l<4;l++) {
+      char szName[64];
+
+      c->nLevel    = l;
+      c->nVersion  = v;
+      c->width     = v * 4 + 17;
+
+      // Stages below segmentation only depend on the symbol shape: run them
+      // once per version and level on the URL corpus symbol.
+      int ncSource = fit_corpus(CORPUS_URL,corpus[CORPUS_URL],v,l);
+      if(ncSource > 0) {
+        c->lpsSource  = corpus[CORPUS_URL];
+        c->ncSource   = ncSource;
+        c->nMaskingNo = 0;
+
+        c->ncAllCodeWord = QR_VersionInfo[v].ncAllCodeWord;
+        for(int n=0;n<c->ncAllCodeWord;n++) c->byCodeWord[n] = c->lpsSource[n % ncSource];
+
+        snprintf(szName,sizeof(szName),"rs/v%d/%c",v,LevelName[l]);
+        run_case(&opt,szName,op_rs,c);
+
+        snprintf(szName,sizeof(szName),"placement/v%d/%c",v,LevelName[l]);
+        run_case(&opt,szName,op_placement,c);
+
+        PlaceModule(c->byPlaced,c->width,c->byCodeWord,c->ncAllCodeWord,v);
+        for(int m=0;m<2;m++) {
+          c->nMaskingNo = m == 0 ? 0 : -1;
+          snprintf(szName,sizeof(szName),"masking/v%d/%c/%s",v,LevelName[l],m == 0 ? "fixed" : "auto");
+          run_case(&opt,szName,op_masking,c);
+        }
+
+        snprintf(szName,sizeof(szName),"penalty/v%d/%c",v,LevelName[l]);
+        run_case(&opt,szName,op_penalty,c);
+      }
+
+      for(int k=0;k<CORPUS_COUNT;k++) {
+        ncSource = fit_corpus(k,corpus[k],v,l);
+        if(ncSource == 0) continue;
+
+        c->lpsSource = corpus[k];
+        c->ncSource  = ncSource;
+
+        snprintf(szName,sizeof(szName),"segment/%s/v%d/%c",CorpusName[k],v,LevelName[l]);
+        run_case(&opt,szName,op_segment,c);
+
+        for(int m=0;m<2;m++) {
+          c->nMaskingNo = m == 0 ? 0 : -1;
+          snprintf(szName,sizeof(szName),"encode/%s/v%d/%c/%s",CorpusName[k],v,LevelName[l],m == 0 ? "fixed" : "auto");
+          run_case(&opt,szName,op_encode,c);
+        }
+      }
+    }
+  }
+
+  qr_encoder_ctx_destroy(c->ctx);
+  delete c;
+
+  if(opt.fpOut != NULL) fclose(opt.fpOut);
+  delete [] opt.baseline;
+
+  if(opt.ncBaseline > 0)
+    printf("# %d cases compared, %d slower than baseline by more than %.1f%%\n",opt.ncCompared,opt.ncRegressed,opt.dThreshold);
+
+  return opt.ncRegressed == 0 ? 0 : 1;
+}
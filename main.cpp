@@ -1,22 +1,803 @@
-#include <stdio.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
-#include <algorithm>
-#include "qr_encodeem.h"
-#include <iostream>
-
-using namespace std;
-
-int main() {
-  char   *inputdata = "aaaaaaaaTESTaaaa";
-
-  int outputdata_len=16;
-  uint8_t outputdata[4096];
-
-  int width=25;
-  bool ok = qr_encode_data(0,0,0,-1,(uint8_t *) inputdata,16,outputdata,&outputdata_len,&width);
-
-  if(ok == false) printf("Encoding error\n");
-  qr_dumpimage(outputdata,width);
-}
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "qr_encodeem.h"
+#include "qr_image.h"
+
+// qrem: batch encoder.
+//
+// Reads payloads from a file or stdin, one per line, NUL delimited or as
+// CSV rows carrying their own options, and runs them through a pipeline:
+// a reader cuts the input into batches of records, a pool of encoder
+// threads turns each batch into finished images, and a writer puts them out
+// in input order (or as they finish, with -u) to stdout, one file, or one
+// file per record in a directory. A fixed number of batches circulate
+// between the three, so a slow writer holds the reader back instead of
+// letting the input pile up in memory.
+//
+// CSV rows are payload,level,version,mask,format,scale,quiet,name; empty
+// or missing fields take the command line values. A first row starting
+// with the column name "payload" is a header naming the columns instead,
+// in any order. Fields may be quoted as in RFC 4180.
+
+#define MAX_QRCODESIZE 4096 // (177*177)/8
+
+#define INPUT_LINES   0
+#define INPUT_NUL     1
+#define INPUT_CSV     2
+
+// 出力形式
+#define FORMAT_BITMAP 0 // qr_getmodule() のレイアウト
+#define FORMAT_PBM    1
+#define FORMAT_PNG    2
+#define FORMAT_TEXT   3 // ブロック文字
+
+// 処理結果
+#define RECORD_OK      0
+#define RECORD_EENCODE 1 // データなし、または容量オーバー
+#define RECORD_EOPTION 2 // CSV の値が不正
+
+#define BATCH_RECORDS  256        // バッチ当りの最大レコード数
+#define BATCH_BYTES    (1 << 16)  // バッチ当りの入力データ目安
+#define READ_BUFFER    (1 << 20)  // 1 レコードの上限でもある
+
+// CSV 列
+#define COLUMN_PAYLOAD 0
+#define COLUMN_LEVEL   1
+#define COLUMN_VERSION 2
+#define COLUMN_MASK    3
+#define COLUMN_FORMAT  4
+#define COLUMN_SCALE   5
+#define COLUMN_QUIET   6
+#define COLUMN_NAME    7
+#define COLUMN_COUNT   8
+
+static const char *ColumnName[COLUMN_COUNT] = {"payload","level","version","mask","format","scale","quiet","name"};
+static const char *FormatName[4] = {"bitmap","pbm","png","text"};
+static const char *FormatExt[4]  = {"bin","pbm","png","txt"};
+
+typedef struct tagENCODEOPTIONS
+{
+	int  nLevel;
+	int  nVersion;   // 0 = 自動
+	bool bAutoExtent;
+	int  nMaskingNo; // -1 = 自動
+	int  nFormat;    // FORMAT_*
+	int  nScale;
+	int  nQuietZone;
+} ENCODEOPTIONS;
+
+typedef struct tagRECORD
+{
+	uint64_t      nSeq;      // 入力内の番号(0 から)
+	size_t        nPayload;  // BATCH::byData 内位置
+	int           ncPayload;
+	size_t        nName;     // CSV の name 列
+	int           ncName;
+	ENCODEOPTIONS options;
+
+	int           nStatus;   // RECORD_*
+	size_t        nOut;      // BATCH::byOut 内位置
+	size_t        ncOut;
+} RECORD;
+
+typedef struct tagBATCH
+{
+	uint64_t             nSeq;   // バッチ番号
+	std::vector<RECORD>  records;
+	std::vector<uint8_t> byData; // 入力データと名前
+	std::vector<uint8_t> byOut;  // 出力画像
+} BATCH;
+
+// Blocking FIFO of batches. Its capacity is never reached: only as many
+// batches exist as the free queue starts with.
+typedef struct tagBATCHQUEUE
+{
+	std::mutex              mutex;
+	std::condition_variable cv;
+	std::deque<BATCH *>     batches;
+	bool                    bClosed;
+} BATCHQUEUE;
+
+static void queue_push(BATCHQUEUE *q,BATCH *batch) {
+  std::lock_guard<std::mutex> lock(q->mutex);
+  q->batches.push_back(batch);
+  q->cv.notify_one();
+}
+
+// NULL once the queue is closed and empty.
+static BATCH *queue_pop(BATCHQUEUE *q) {
+  std::unique_lock<std::mutex> lock(q->mutex);
+  q->cv.wait(lock,[&]{ return !q->batches.empty() || q->bClosed; });
+  if(q->batches.empty()) return NULL;
+
+  BATCH *batch = q->batches.front();
+  q->batches.pop_front();
+  return batch;
+}
+
+static void queue_close(BATCHQUEUE *q) {
+  std::lock_guard<std::mutex> lock(q->mutex);
+  q->bClosed = true;
+  q->cv.notify_all();
+}
+
+typedef struct tagPIPELINE
+{
+	// 設定
+	int           nInput;      // INPUT_*
+	int           fdInput;
+	ENCODEOPTIONS options;     // 既定値(CSV で行毎に変更可)
+	bool          bOrdered;
+	bool          bLengthPrefix;
+	const char   *szDirectory; // NULL = ストリーム出力
+	FILE         *fpOutput;
+
+	BATCHQUEUE freeBatches;    // 読込側へ
+	BATCHQUEUE inputBatches;   // エンコーダへ
+	BATCHQUEUE outputBatches;  // 書込側へ
+
+	// 集計
+	uint64_t ncRecords;
+	uint64_t ncEncoded;
+	uint64_t ncFailed;
+	uint64_t ncBytesIn;
+	uint64_t ncBytesOut;
+	uint64_t nReadNs;          // 各段の処理時間(待ちを除く)
+	uint64_t nWriteNs;
+	std::mutex encodeMutex;
+	uint64_t nEncodeNs;        // 全エンコーダ合計
+
+	bool bReadError;
+	bool bWriteError;
+} PIPELINE;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Options
+
+static bool parse_int(const char *s,int ncLength,int nMin,int nMax,int *value) {
+  char buf[16];
+  if(ncLength <= 0 || ncLength >= (int)sizeof(buf)) return false;
+
+  memcpy(buf,s,ncLength);
+  buf[ncLength] = 0;
+
+  char *end;
+  long n = strtol(buf,&end,10);
+  if(end != buf + ncLength || n < nMin || n > nMax) return false; // 空、NUL 入りも不可
+
+  *value = (int)n;
+  return true;
+}
+
+static bool parse_level(const char *s,int ncLength,int *nLevel) {
+  if(ncLength == 1) {
+    switch(s[0] & ~0x20) {
+      case 'L': *nLevel = QR_LEVEL_L; return true;
+      case 'M': *nLevel = QR_LEVEL_M; return true;
+      case 'Q': *nLevel = QR_LEVEL_Q; return true;
+      case 'H': *nLevel = QR_LEVEL_H; return true;
+    }
+  }
+  return parse_int(s,ncLength,QR_LEVEL_L,QR_LEVEL_H,nLevel);
+}
+
+static bool parse_mask(const char *s,int ncLength,int *nMaskingNo) {
+  if(ncLength == 4 && memcmp(s,"auto",4) == 0) {
+    *nMaskingNo = -1;
+    return true;
+  }
+  return parse_int(s,ncLength,-1,7,nMaskingNo);
+}
+
+static bool parse_format(const char *s,int ncLength,int *nFormat) {
+  for(int n=0;n<4;n++) {
+    if((int)strlen(FormatName[n]) == ncLength && memcmp(s,FormatName[n],ncLength) == 0) {
+      *nFormat = n;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Applies a non-empty CSV field to the record's options.
+static bool parse_column(int nColumn,const char *s,int ncLength,ENCODEOPTIONS *options) {
+  switch(nColumn) {
+    case COLUMN_LEVEL:   return parse_level(s,ncLength,&options->nLevel);
+    case COLUMN_VERSION: return parse_int(s,ncLength,0,40,&options->nVersion);
+    case COLUMN_MASK:    return parse_mask(s,ncLength,&options->nMaskingNo);
+    case COLUMN_FORMAT:  return parse_format(s,ncLength,&options->nFormat);
+    case COLUMN_SCALE:   return parse_int(s,ncLength,1,64,&options->nScale);
+    case COLUMN_QUIET:   return parse_int(s,ncLength,0,64,&options->nQuietZone);
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Reader
+
+typedef struct tagREADER
+{
+	PIPELINE *p;
+	uint8_t  *buf;
+	size_t    ncBuf;
+	size_t    nPos;
+	bool      bEof;
+	bool      bTooLong;  // 区切りが見つからないまま読込バッファが一杯
+	uint64_t  nSeq;
+
+	// CSV
+	int  nColumn[COLUMN_COUNT];    // 列 n に入る値(-1 = なし)
+	bool bFirstRow;
+	std::string field;             // 引用符を外した値
+	std::vector<size_t> fieldStart;
+} READER;
+
+// Makes room and reads more; false at end of input (or on error).
+static bool reader_fill(READER *r) {
+  if(r->bEof) return false;
+
+  if(r->nPos > 0) {
+    memmove(r->buf,r->buf + r->nPos,r->ncBuf - r->nPos);
+    r->ncBuf -= r->nPos;
+    r->nPos   = 0;
+  }
+  if(r->ncBuf == READ_BUFFER) {
+    fprintf(stderr,"qrem: record %llu longer than %d bytes\n",(unsigned long long)r->nSeq,READ_BUFFER);
+    r->p->bReadError = true;
+    r->bTooLong = true;
+    r->bEof     = true;
+    return false;
+  }
+
+  uint64_t nStart = now_ns();
+  ssize_t n;
+  do n = read(r->p->fdInput,r->buf + r->ncBuf,READ_BUFFER - r->ncBuf); while(n < 0 && errno == EINTR);
+  r->p->nReadNs += now_ns() - nStart;
+
+  if(n < 0) {
+    fprintf(stderr,"qrem: read error: %s\n",strerror(errno));
+    r->p->bReadError = true;
+  }
+  if(n <= 0) {
+    r->bEof = true;
+    return false;
+  }
+
+  r->ncBuf += n;
+  r->p->ncBytesIn += n;
+  return true;
+}
+
+static RECORD &add_record(READER *r,BATCH *batch,const uint8_t *lpsPayload,int ncPayload) {
+  batch->records.push_back(RECORD());
+  RECORD &rec = batch->records.back();
+
+  memset(&rec,0,sizeof(rec));
+  rec.nSeq      = r->nSeq++;
+  rec.nPayload  = batch->byData.size();
+  rec.ncPayload = ncPayload;
+  rec.options   = r->p->options;
+  batch->byData.insert(batch->byData.end(),lpsPayload,lpsPayload + ncPayload);
+
+  return rec;
+}
+
+// Next line or NUL delimited record into batch. False at end of input.
+static bool read_delimited(READER *r,BATCH *batch) {
+  uint8_t cDelimiter = r->p->nInput == INPUT_NUL ? 0 : '\n';
+
+  for(;;) {
+    uint8_t *p   = r->buf + r->nPos;
+    uint8_t *end = (uint8_t *)memchr(p,cDelimiter,r->ncBuf - r->nPos);
+    size_t ncRecord;
+
+    if(end != NULL) {
+      ncRecord = end - p;
+      r->nPos += ncRecord + 1;
+    } else if(!reader_fill(r)) {
+      // 区切りのない最後のレコード
+      if(r->bTooLong || r->nPos == r->ncBuf) return false;
+      p        = r->buf + r->nPos;
+      ncRecord = r->ncBuf - r->nPos;
+      r->nPos  = r->ncBuf;
+    } else {
+      continue;
+    }
+
+    if(cDelimiter == '\n' && ncRecord > 0 && p[ncRecord - 1] == '\r') ncRecord--;
+    if(ncRecord == 0) continue; // 空行
+
+    add_record(r,batch,p,(int)ncRecord);
+    return true;
+  }
+}
+
+// Splits one CSV row starting at nPos into fields; false if the row does
+// not end within the buffer yet.
+static bool csv_row(READER *r,size_t *nEnd) {
+  const uint8_t *buf = r->buf;
+  size_t n = r->nPos;
+
+  r->field.clear();
+  r->fieldStart.clear();
+  r->fieldStart.push_back(0);
+
+  for(;;) {
+    if(n < r->ncBuf && buf[n] == '"') {
+      // 引用符付き("" は ")
+      for(n++;;n++) {
+        if(n >= r->ncBuf) {
+          if(!r->bEof) return false;
+          break; // 閉じていない引用符は入力の終りまで
+        }
+        if(buf[n] != '"') {
+          r->field.push_back((char)buf[n]);
+          continue;
+        }
+        if(n + 1 >= r->ncBuf && !r->bEof) return false;
+        if(n + 1 < r->ncBuf && buf[n + 1] == '"') {
+          r->field.push_back('"');
+          n++;
+          continue;
+        }
+        n++;
+        break;
+      }
+    }
+
+    // 引用符なし部分(引用符の後に続く分も含める)
+    while(n < r->ncBuf && buf[n] != ',' && buf[n] != '\n') r->field.push_back((char)buf[n++]);
+
+    if(n >= r->ncBuf) {
+      if(!r->bEof) return false;
+      break;
+    }
+    if(buf[n] == '\n') break;
+
+    n++; // ','
+    r->fieldStart.push_back(r->field.size());
+  }
+
+  // 改行(CRLF の CR は値に含めない)
+  if(r->field.size() > r->fieldStart.back() && r->field.back() == '\r') r->field.pop_back();
+  *nEnd = n < r->ncBuf ? n + 1 : n;
+  return true;
+}
+
+static bool read_csv(READER *r,BATCH *batch) {
+  for(;;) {
+    size_t nEnd;
+
+    if(r->nPos == r->ncBuf && !reader_fill(r)) return false;
+    if(!csv_row(r,&nEnd)) {
+      // 入力の終りなら次の csv_row() は最後の行として読む
+      if(!reader_fill(r) && r->bTooLong) return false;
+      continue;
+    }
+    r->nPos = nEnd;
+
+    int ncFields = (int)r->fieldStart.size();
+    r->fieldStart.push_back(r->field.size());
+    const char *s = r->field.data();
+
+    if(ncFields == 1 && r->field.empty()) continue; // 空行
+
+    // 見出し行
+    if(r->bFirstRow) {
+      r->bFirstRow = false;
+
+      if(r->fieldStart[1] == 7 && memcmp(s,"payload",7) == 0) {
+        for(int c=0;c<COLUMN_COUNT;c++) r->nColumn[c] = -1;
+
+        for(int f=0;f<ncFields;f++) {
+          for(int c=0;c<COLUMN_COUNT;c++) {
+            size_t ncName = r->fieldStart[f + 1] - r->fieldStart[f];
+            if(ncName == strlen(ColumnName[c]) && memcmp(s + r->fieldStart[f],ColumnName[c],ncName) == 0) r->nColumn[c] = f;
+          }
+        }
+        continue;
+      }
+    }
+
+    int nPayload = r->nColumn[COLUMN_PAYLOAD];
+    int ncPayload = nPayload >= 0 && nPayload < ncFields ? (int)(r->fieldStart[nPayload + 1] - r->fieldStart[nPayload]) : 0;
+    RECORD &rec = add_record(r,batch,(const uint8_t *)s + (ncPayload ? r->fieldStart[nPayload] : 0),ncPayload);
+
+    for(int c=COLUMN_LEVEL;c<COLUMN_COUNT;c++) {
+      int f = r->nColumn[c];
+      if(f < 0 || f >= ncFields) continue;
+
+      const char *v = s + r->fieldStart[f];
+      int ncValue = (int)(r->fieldStart[f + 1] - r->fieldStart[f]);
+      if(ncValue == 0) continue;
+
+      if(c == COLUMN_NAME) {
+        rec.nName  = batch->byData.size();
+        rec.ncName = ncValue;
+        batch->byData.insert(batch->byData.end(),(const uint8_t *)v,(const uint8_t *)v + ncValue);
+      } else if(!parse_column(c,v,ncValue,&rec.options)) {
+        rec.nStatus = RECORD_EOPTION;
+      }
+    }
+
+    return true;
+  }
+}
+
+static void reader_thread(PIPELINE *p) {
+  READER r;
+
+  r.p         = p;
+  r.buf       = new uint8_t[READ_BUFFER];
+  r.ncBuf     = 0;
+  r.nPos      = 0;
+  r.bEof      = false;
+  r.bTooLong  = false;
+  r.nSeq      = 0;
+  r.bFirstRow = true;
+  for(int c=0;c<COLUMN_COUNT;c++) r.nColumn[c] = c;
+
+  for(uint64_t nBatch=0;;nBatch++) {
+    BATCH *batch = queue_pop(&p->freeBatches);
+    bool bMore = true;
+
+    batch->nSeq = nBatch;
+    batch->records.clear();
+    batch->byData.clear();
+
+    while(batch->records.size() < BATCH_RECORDS && batch->byData.size() < BATCH_BYTES) {
+      bMore = p->nInput == INPUT_CSV ? read_csv(&r,batch) : read_delimited(&r,batch);
+      if(!bMore) break;
+    }
+
+    if(!batch->records.empty()) queue_push(&p->inputBatches,batch);
+    else queue_push(&p->freeBatches,batch);
+    if(!bMore) break;
+  }
+
+  p->ncRecords = r.nSeq;
+  delete [] r.buf;
+  queue_close(&p->inputBatches);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Encoders
+
+static bool append_out(void *arg,const uint8_t *data,size_t ncData) {
+  std::vector<uint8_t> *out = (std::vector<uint8_t> *)arg;
+  out->insert(out->end(),data,data + ncData);
+  return true;
+}
+
+// Two characters per module, light modules as spaces, with the quiet zone.
+static void write_text(const uint8_t *image,int width,int nQuietZone,std::vector<uint8_t> *out) {
+  static const char szDark[] = "\xe2\x96\x88\xe2\x96\x88"; // ██
+  int nSize = width + 2 * nQuietZone;
+
+  for(int y=0;y<nSize;y++) {
+    for(int x=0;x<nSize;x++) {
+      int mx = x - nQuietZone, my = y - nQuietZone;
+      bool bDark = mx >= 0 && my >= 0 && mx < width && my < width && qr_getmodule((uint8_t *)image,width,mx,my) != 0;
+
+      if(bDark) out->insert(out->end(),szDark,szDark + 6);
+      else { out->push_back(' '); out->push_back(' '); }
+    }
+    out->push_back('\n');
+  }
+  out->push_back('\n');
+}
+
+static void encode_record(BATCH *batch,RECORD &rec) {
+  const ENCODEOPTIONS &o = rec.options;
+  uint8_t image[MAX_QRCODESIZE];
+  int outputdata_len, width;
+
+  rec.nOut  = batch->byOut.size();
+  rec.ncOut = 0;
+  if(rec.nStatus != RECORD_OK) return;
+
+  // 長さ 0 は NUL 終端の意味になるので、ここでデータなしとする
+  if(rec.ncPayload == 0 ||
+     !qr_encode_data(o.nLevel,o.nVersion,o.bAutoExtent,o.nMaskingNo,batch->byData.data() + rec.nPayload,rec.ncPayload,image,&outputdata_len,&width)) {
+    rec.nStatus = RECORD_EENCODE;
+    return;
+  }
+
+  std::vector<uint8_t> *out = &batch->byOut;
+
+  switch(o.nFormat) {
+    case FORMAT_BITMAP: out->insert(out->end(),image,image + qr_image_size(width)); break;
+    case FORMAT_PBM:    qr_write_image(image,width,QR_IMAGE_PBM,o.nScale,o.nQuietZone,append_out,out); break;
+    case FORMAT_PNG:    qr_write_image(image,width,QR_IMAGE_PNG,o.nScale,o.nQuietZone,append_out,out); break;
+    case FORMAT_TEXT:   write_text(image,width,o.nQuietZone,out); break;
+  }
+
+  rec.ncOut = out->size() - rec.nOut;
+}
+
+static void encoder_thread(PIPELINE *p) {
+  uint64_t nBusyNs = 0;
+  BATCH *batch;
+
+  while((batch = queue_pop(&p->inputBatches)) != NULL) {
+    uint64_t nStart = now_ns();
+
+    batch->byOut.clear();
+    for(size_t n=0;n<batch->records.size();n++) encode_record(batch,batch->records[n]);
+
+    nBusyNs += now_ns() - nStart;
+    queue_push(&p->outputBatches,batch);
+  }
+
+  std::lock_guard<std::mutex> lock(p->encodeMutex);
+  p->nEncodeNs += nBusyNs;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Writer
+
+static bool write_file(const char *szPath,const uint8_t *data,size_t ncData) {
+  int fd = open(szPath,O_WRONLY | O_CREAT | O_TRUNC,0644);
+  if(fd < 0) return false;
+
+  bool bOk = true;
+  while(ncData > 0 && bOk) {
+    ssize_t n = write(fd,data,ncData);
+    if(n < 0 && errno == EINTR) continue;
+    bOk = n > 0;
+    if(bOk) { data += n; ncData -= n; }
+  }
+
+  return close(fd) == 0 && bOk;
+}
+
+// File name of a record in the output directory: its CSV name, when that
+// is a plain file name, or its number.
+static void record_path(const PIPELINE *p,const BATCH *batch,const RECORD &rec,char *szPath,size_t ncPath) {
+  const char *szName = (const char *)batch->byData.data() + rec.nName;
+  bool bName = rec.ncName > 0 && rec.ncName < 256 && memchr(szName,'/',rec.ncName) == NULL && memchr(szName,0,rec.ncName) == NULL &&
+               !(rec.ncName == 1 && szName[0] == '.') && !(rec.ncName == 2 && szName[0] == '.' && szName[1] == '.');
+
+  if(bName) snprintf(szPath,ncPath,"%s/%.*s",p->szDirectory,rec.ncName,szName);
+  else snprintf(szPath,ncPath,"%s/%08llu.%s",p->szDirectory,(unsigned long long)rec.nSeq,FormatExt[rec.options.nFormat]);
+}
+
+static void write_batch(PIPELINE *p,const BATCH *batch) {
+  for(size_t n=0;n<batch->records.size();n++) {
+    const RECORD &rec = batch->records[n];
+    const uint8_t *data = batch->byOut.data() + rec.nOut;
+
+    if(rec.nStatus == RECORD_OK) p->ncEncoded++;
+    else {
+      p->ncFailed++;
+      fprintf(stderr,"qrem: record %llu: %s\n",(unsigned long long)rec.nSeq,rec.nStatus == RECORD_EOPTION ? "invalid option" : "cannot encode (empty or too long)");
+    }
+
+    if(p->bWriteError) continue;
+
+    if(p->szDirectory != NULL) {
+      if(rec.nStatus != RECORD_OK) continue;
+
+      char szPath[4096];
+      record_path(p,batch,rec,szPath,sizeof(szPath));
+      if(!write_file(szPath,data,rec.ncOut)) {
+        fprintf(stderr,"qrem: %s: %s\n",szPath,strerror(errno));
+        p->bWriteError = true;
+      }
+    } else {
+      // -L: 長さ(リトルエンディアン 32 ビット、失敗は 0)を前置
+      if(p->bLengthPrefix) {
+        uint8_t byLength[4] = {(uint8_t)rec.ncOut,(uint8_t)(rec.ncOut >> 8),(uint8_t)(rec.ncOut >> 16),(uint8_t)(rec.ncOut >> 24)};
+        if(fwrite(byLength,1,4,p->fpOutput) != 4) p->bWriteError = true;
+        p->ncBytesOut += 4;
+      }
+      if(rec.ncOut > 0 && fwrite(data,1,rec.ncOut,p->fpOutput) != rec.ncOut) p->bWriteError = true;
+    }
+
+    p->ncBytesOut += rec.ncOut;
+  }
+}
+
+static void writer_thread(PIPELINE *p) {
+  std::vector<BATCH *> waiting; // 順序待ち
+  uint64_t nNext = 0;
+  BATCH *batch;
+
+  while((batch = queue_pop(&p->outputBatches)) != NULL) {
+    if(!p->bOrdered) {
+      uint64_t nStart = now_ns();
+      write_batch(p,batch);
+      p->nWriteNs += now_ns() - nStart;
+      queue_push(&p->freeBatches,batch);
+      continue;
+    }
+
+    waiting.push_back(batch);
+
+    // 次の番号のバッチが揃う限り書き出す
+    for(bool bFound=true;bFound;) {
+      bFound = false;
+      for(size_t n=0;n<waiting.size();n++) {
+        if(waiting[n]->nSeq != nNext) continue;
+
+        uint64_t nStart = now_ns();
+        write_batch(p,waiting[n]);
+        p->nWriteNs += now_ns() - nStart;
+
+        queue_push(&p->freeBatches,waiting[n]);
+        waiting.erase(waiting.begin() + n);
+        nNext++;
+        bFound = true;
+        break;
+      }
+    }
+  }
+
+  if(p->fpOutput != NULL && fflush(p->fpOutput) != 0) p->bWriteError = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void usage() {
+  fprintf(stderr,
+    "usage: qrem [options] [input]\n"
+    "Encodes every payload of input (default stdin) to a QR Code image.\n"
+    "  -i lines|nul|csv  input records (default lines; empty ones are skipped)\n"
+    "  -f bitmap|pbm|png|text  output format (default pbm)\n"
+    "  -e L|M|Q|H        error correction level (default M)\n"
+    "  -v version        1-40, 0 = smallest that fits (default 0)\n"
+    "  -n                no larger version than -v asks for\n"
+    "  -m mask           0-7, -1 = best (default -1)\n"
+    "  -x scale          pixels per module for pbm/png (default 4)\n"
+    "  -z quiet          quiet zone in modules (default 4)\n"
+    "  -o file           write all images to one file (default stdout)\n"
+    "  -d directory      write one file per record, named by the CSV name\n"
+    "                    column or the record number\n"
+    "  -L                prefix each image in a stream with its length\n"
+    "                    (32 bit little endian, 0 for a failed record)\n"
+    "  -u                unordered: write images as they are finished\n"
+    "  -j threads        encoder threads (default: one per hardware thread)\n"
+    "  -b batches        batches in flight between the stages (default 4 per thread)\n"
+    "  -s                no summary on stderr\n");
+}
+
+int main(int argc,char **argv) {
+  PIPELINE p;
+
+  p.nInput      = INPUT_LINES;
+  p.fdInput     = 0;
+  p.bOrdered    = true;
+  p.bLengthPrefix = false;
+  p.szDirectory = NULL;
+  p.fpOutput    = stdout;
+  p.options.nLevel      = QR_LEVEL_M;
+  p.options.nVersion    = 0;
+  p.options.bAutoExtent = true;
+  p.options.nMaskingNo  = -1;
+  p.options.nFormat     = FORMAT_PBM;
+  p.options.nScale      = 4;
+  p.options.nQuietZone  = QR_IMAGE_QUIETZONE;
+  p.ncRecords = p.ncEncoded = p.ncFailed = p.ncBytesIn = p.ncBytesOut = 0;
+  p.nReadNs = p.nWriteNs = p.nEncodeNs = 0;
+  p.bReadError = p.bWriteError = false;
+
+  const char *szOutput = NULL;
+  int nThreads = 0, ncBatches = 0;
+  bool bSummary = true;
+  int c;
+
+  while((c = getopt(argc,argv,"i:f:e:v:nm:x:z:o:d:Luj:b:sh")) != -1) {
+    bool bOk = true;
+    int ncArg = optarg != NULL ? (int)strlen(optarg) : 0;
+
+    switch(c) {
+      case 'i':
+        if(strcmp(optarg,"lines") == 0)    p.nInput = INPUT_LINES;
+        else if(strcmp(optarg,"nul") == 0) p.nInput = INPUT_NUL;
+        else if(strcmp(optarg,"csv") == 0) p.nInput = INPUT_CSV;
+        else bOk = false;
+        break;
+      case 'f': bOk = parse_format(optarg,ncArg,&p.options.nFormat);        break;
+      case 'e': bOk = parse_level(optarg,ncArg,&p.options.nLevel);          break;
+      case 'v': bOk = parse_int(optarg,ncArg,0,40,&p.options.nVersion);     break;
+      case 'n': p.options.bAutoExtent = false;                              break;
+      case 'm': bOk = parse_mask(optarg,ncArg,&p.options.nMaskingNo);       break;
+      case 'x': bOk = parse_int(optarg,ncArg,1,64,&p.options.nScale);       break;
+      case 'z': bOk = parse_int(optarg,ncArg,0,64,&p.options.nQuietZone);   break;
+      case 'o': szOutput = optarg;                                          break;
+      case 'd': p.szDirectory = optarg;                                     break;
+      case 'L': p.bLengthPrefix = true;                                     break;
+      case 'u': p.bOrdered = false;                                         break;
+      case 'j': bOk = parse_int(optarg,ncArg,1,1024,&nThreads);             break;
+      case 'b': bOk = parse_int(optarg,ncArg,1,65536,&ncBatches);           break;
+      case 's': bSummary = false;                                           break;
+      default:  bOk = false;                                                break;
+    }
+
+    if(!bOk) {
+      usage();
+      return 2;
+    }
+  }
+
+  if(optind + 1 < argc || (szOutput != NULL && p.szDirectory != NULL)) {
+    usage();
+    return 2;
+  }
+
+  const char *szInput = optind < argc ? argv[optind] : "-";
+  if(strcmp(szInput,"-") != 0 && (p.fdInput = open(szInput,O_RDONLY)) < 0) {
+    fprintf(stderr,"qrem: %s: %s\n",szInput,strerror(errno));
+    return 2;
+  }
+
+  if(p.szDirectory != NULL) {
+    p.fpOutput = NULL;
+    struct stat st;
+    if(stat(p.szDirectory,&st) != 0 && mkdir(p.szDirectory,0755) != 0) {
+      fprintf(stderr,"qrem: %s: %s\n",p.szDirectory,strerror(errno));
+      return 2;
+    }
+  } else if(szOutput != NULL && strcmp(szOutput,"-") != 0 && (p.fpOutput = fopen(szOutput,"wb")) == NULL) {
+    fprintf(stderr,"qrem: %s: %s\n",szOutput,strerror(errno));
+    return 2;
+  }
+  if(p.fpOutput != NULL) setvbuf(p.fpOutput,NULL,_IOFBF,1 << 20);
+
+  if(nThreads == 0) nThreads = (int)std::thread::hardware_concurrency();
+  if(nThreads < 1) nThreads = 1;
+  if(ncBatches == 0) ncBatches = 4 * nThreads;
+  if(ncBatches < 2) ncBatches = 2;
+
+  p.freeBatches.bClosed = p.inputBatches.bClosed = p.outputBatches.bClosed = false;
+
+  std::vector<BATCH> batches(ncBatches);
+  for(int n=0;n<ncBatches;n++) p.freeBatches.batches.push_back(&batches[n]);
+
+  uint64_t nStart = now_ns();
+
+  std::thread reader(reader_thread,&p);
+  std::thread writer(writer_thread,&p);
+  std::vector<std::thread> encoders;
+  for(int n=0;n<nThreads;n++) encoders.push_back(std::thread(encoder_thread,&p));
+
+  reader.join();
+  for(int n=0;n<nThreads;n++) encoders[n].join();
+  queue_close(&p.outputBatches);
+  writer.join();
+
+  double seconds = (now_ns() - nStart) / 1e9;
+
+  if(p.fpOutput != NULL && p.fpOutput != stdout && fclose(p.fpOutput) != 0) p.bWriteError = true;
+  if(p.bWriteError && p.szDirectory == NULL) fprintf(stderr,"qrem: %s: write error\n",szOutput != NULL ? szOutput : "stdout");
+
+  if(bSummary) {
+    fprintf(stderr,"qrem: %llu records, %llu encoded, %llu failed in %.3f s: %.0f records/s\n",
+            (unsigned long long)p.ncRecords,(unsigned long long)p.ncEncoded,(unsigned long long)p.ncFailed,seconds,p.ncEncoded / seconds);
+    fprintf(stderr,"qrem: in %.1f MiB, out %.1f MiB (%.1f MiB/s), %d encoders %.0f%% busy, read %.3f s, write %.3f s, %s\n",
+            p.ncBytesIn / 1048576.0,p.ncBytesOut / 1048576.0,p.ncBytesOut / 1048576.0 / seconds,nThreads,
+            100.0 * p.nEncodeNs / 1e9 / (seconds * nThreads),p.nReadNs / 1e9,p.nWriteNs / 1e9,p.bOrdered ? "ordered" : "unordered");
+  }
+
+  if(p.bReadError || p.bWriteError) return 2;
+  return p.ncFailed > 0 ? 1 : 0;
+}
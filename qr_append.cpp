@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "qr_encodeem.h"
+#include "qr_utils.h"
+#include "qr_segment.h"
+#include "qr_version.h"
+#include "qr_append.h"
+
+#define MAX_PARTS (QR_APPEND_MAXSYMBOLS + 1) // これ以上は分割数超過
+
+// バージョン(型番)グループ
+static int version_group(int nVersion) {
+  return nVersion >= 27 ? QR_VRESION_L : (nVersion >= 10 ? QR_VRESION_M : QR_VRESION_S);
+}
+
+// Data bits of a version left after the header.
+static int part_capacity(int nVersion,int nLevel) {
+  return QR_VersionMeta.ncDataCodeWord[nVersion][nLevel] * 8 - QR_APPEND_HEADERBITS;
+}
+
+// Cuts the payload into parts of at most ncMaxBits each, every part as
+// long as it can be, and returns their number, or MAX_PARTS once there
+// are more than nLimit. nPartStart (may be NULL) receives where each
+// part begins.
+static int pack_parts(const uint8_t *lpsSource,int ncLength,const uint8_t *byCut,int nVerGroup,int ncMaxBits,int nLimit,int *nPartStart) {
+  int ncParts = 0;
+
+  for(int s=0;s<ncLength;) {
+    if(ncParts == nLimit) return MAX_PARTS;
+
+    int ncFit = qr_segment_fit(lpsSource + s,ncLength - s,nVerGroup,ncMaxBits,byCut + s,NULL);
+    if(ncFit == 0) return MAX_PARTS;
+
+    if(nPartStart != NULL) nPartStart[ncParts] = s;
+    ncParts++;
+    s += ncFit;
+  }
+
+  return ncParts;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_append_plan
+// 用  途：連結モードの分割
+// 引  数：誤り訂正レベル、最大型番(0=40)、入力データ、入力データ長、分割結果格納先
+// 戻り値：分割成功時=true
+
+bool qr_append_plan(int nLevel,int nMaxVersion,const uint8_t *lpsSource,int ncSource,QR_APPENDRESULT *result) {
+  int ncLength = ncSource > 0 ? ncSource : (int)strlen((const char *)lpsSource);
+
+  memset(result,0,sizeof(QR_APPENDRESULT));
+  result->nStatus = QR_APPEND_EENCODE;
+
+  if(ncLength == 0) return false;
+  if(nMaxVersion <= 0 || nMaxVersion > 40) nMaxVersion = 40;
+
+  // 分割可能位置(漢字の 2 バイトの間は除く)
+  uint8_t *byCut = new uint8_t[ncLength + 1];
+  memset(byCut,0,ncLength + 1);
+
+  for(int i=0;i<ncLength;) {
+    i += (i + 1 < ncLength && IsKanjiData(lpsSource[i],lpsSource[i + 1])) ? 2 : 1;
+    byCut[i] = 1;
+  }
+
+  // Fewest symbols at the largest version, then the smallest version
+  // holding the payload in that many, then the smallest part limit (to a
+  // byte) that still does: the greedy cut at that limit is the most even
+  // one. Both searches are binary, the number of parts only goes down as
+  // the version or the limit goes up. The parts together take at least the
+  // bits of the whole payload, so no limit below 1/ncParts of it works.
+  int ncParts = pack_parts(lpsSource,ncLength,byCut,version_group(nMaxVersion),part_capacity(nMaxVersion,nLevel),QR_APPEND_MAXSYMBOLS,NULL);
+
+  if(ncParts > QR_APPEND_MAXSYMBOLS) {
+    delete [] byCut;
+    return false;
+  }
+
+  int nFirst = 1, nVersion = nMaxVersion;
+
+  while(nFirst < nVersion) {
+    int nMid = (nFirst + nVersion) / 2;
+
+    if(pack_parts(lpsSource,ncLength,byCut,version_group(nMid),part_capacity(nMid,nLevel),ncParts,NULL) <= ncParts)
+      nVersion = nMid;
+    else
+      nFirst = nMid + 1;
+  }
+
+  int nVerGroup = version_group(nVersion);
+  int ncLow, ncHigh = part_capacity(nVersion,nLevel);
+
+  qr_segment_fit(lpsSource,ncLength,nVerGroup,0x3fffffff,NULL,&ncLow);
+  ncLow = (ncLow + ncParts - 1) / ncParts;
+
+  while(ncHigh - ncLow >= 8) {
+    int ncMid = (ncLow + ncHigh) / 2;
+
+    if(pack_parts(lpsSource,ncLength,byCut,nVerGroup,ncMid,ncParts,NULL) <= ncParts)
+      ncHigh = ncMid;
+    else
+      ncLow = ncMid + 1;
+  }
+
+  int nPartStart[QR_APPEND_MAXSYMBOLS];
+  ncParts = pack_parts(lpsSource,ncLength,byCut,nVerGroup,ncHigh,ncParts,nPartStart);
+
+  delete [] byCut;
+
+  // パリティ
+  uint8_t byParity = 0;
+  for(int i=0;i<ncLength;i++) byParity ^= lpsSource[i];
+
+  result->nStatus     = QR_APPEND_OK;
+  result->ncSymbols   = ncParts;
+  result->nVersion    = nVersion;
+  result->nWidth      = nVersion * 4 + 17;
+  result->ncBytes     = qr_image_size(result->nWidth);
+  result->byParity    = byParity;
+  result->ncArenaUsed = (size_t)ncParts * result->ncBytes;
+
+  for(int n=0;n<ncParts;n++) {
+    QR_APPENDSYMBOL &symbol = result->symbols[n];
+
+    symbol.nSourceOffset = nPartStart[n];
+    symbol.ncSource      = (n + 1 < ncParts ? nPartStart[n + 1] : ncLength) - nPartStart[n];
+    symbol.nOffset       = (size_t)n * result->ncBytes;
+    symbol.nMaskingNo    = -1;
+  }
+
+  return true;
+}
+
+typedef struct tagQR_APPENDJOB
+{
+	const uint8_t    *lpsSource;
+	int               nLevel;
+	int               nMaskingNo;
+	uint8_t          *arena;
+	QR_APPENDRESULT  *result;
+	QR_ENCODER_CTX  **ctx;       // ワーカー毎
+	std::atomic<int>  ncFailed;
+} QR_APPENDJOB;
+
+static void encode_append_symbol(void *arg,int nItem,int nWorker) {
+  QR_APPENDJOB    *job    = (QR_APPENDJOB *)arg;
+  QR_APPENDRESULT *result = job->result;
+  QR_APPENDSYMBOL &symbol = result->symbols[nItem];
+  QR_ENCODER_CTX  *ctx    = job->ctx[nWorker];
+  QR_MASKRESULT    mask_result;
+  int width;
+
+  if(!qr_encoder_ctx_set_append(ctx,nItem,result->ncSymbols,result->byParity) ||
+     !qr_encode_data_ctx(ctx,job->nLevel,result->nVersion,false,job->nMaskingNo,job->lpsSource + symbol.nSourceOffset,symbol.ncSource,
+                         job->arena + symbol.nOffset,&width,&mask_result,1)) {
+    job->ncFailed++;
+    return;
+  }
+
+  symbol.nMaskingNo = mask_result.nMaskingNo;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_encode_append
+// 用  途：連結モードエンコード
+// 引  数：誤り訂正レベル、最大型番(0=40)、マスキング番号(-1=自動)、入力データ、入力データ長、
+//         出力アリーナ、アリーナ長、結果格納先、ワーカープール
+// 戻り値：エンコード成功時=true
+
+bool qr_encode_append(int nLevel,int nMaxVersion,int nMaskingNo,const uint8_t *lpsSource,int ncSource,uint8_t *arena,size_t ncArena,QR_APPENDRESULT *result,QR_THREADPOOL *pool) {
+  if(!qr_append_plan(nLevel,nMaxVersion,lpsSource,ncSource,result)) return false;
+
+  if(result->ncArenaUsed > ncArena) {
+    result->nStatus = QR_APPEND_ENOSPC;
+    return false;
+  }
+
+  int ncWorkers = qr_pool_size(pool);
+  QR_ENCODER_CTX **ctx = new QR_ENCODER_CTX *[ncWorkers];
+  for(int n=0;n<ncWorkers;n++) ctx[n] = qr_encoder_ctx_create();
+
+  QR_APPENDJOB job;
+
+  job.lpsSource  = lpsSource;
+  job.nLevel     = nLevel;
+  job.nMaskingNo = nMaskingNo;
+  job.arena      = arena;
+  job.result     = result;
+  job.ctx        = ctx;
+  job.ncFailed   = 0;
+
+  qr_pool_run(pool,result->ncSymbols,encode_append_symbol,&job);
+
+  for(int n=0;n<ncWorkers;n++) qr_encoder_ctx_destroy(ctx[n]);
+  delete [] ctx;
+
+  // 分割時に容量は確認済み
+  if(job.ncFailed != 0) {
+    result->nStatus = QR_APPEND_EENCODE;
+    return false;
+  }
+
+  return true;
+}
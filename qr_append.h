@@ -0,0 +1,59 @@
+#ifndef QR_APPEND_H
+#define QR_APPEND_H
+#include <stddef.h>
+#include <stdint.h>
+#include "qr_pool.h"
+
+// Structured Append.
+//
+// qr_encode_append() spreads a payload over up to 16 symbols, each starting
+// with the Structured Append header (its position, the number of symbols
+// and the XOR parity of the whole payload), so a reader can put the payload
+// back together. It takes as few symbols as the largest allowed version
+// needs, then the smallest version that still holds the payload in that
+// many, and cuts the payload so the largest part is as small as possible.
+// Every symbol has that one version. Cuts never split a Shift-JIS Kanji
+// pair. The parts are encoded in parallel and written in order, back to
+// back, into the caller's arena.
+
+#define QR_APPEND_MAXSYMBOLS 16
+
+// 処理結果
+#define QR_APPEND_OK       0 // エンコード成功
+#define QR_APPEND_EENCODE  1 // データなし、または 16 シンボルに収まらない
+#define QR_APPEND_ENOSPC   2 // アリーナ容量不足
+
+typedef struct tagQR_APPENDSYMBOL
+{
+	int    nSourceOffset; // 入力データ内位置
+	int    ncSource;      // 入力データ長
+	size_t nOffset;       // アリーナ内位置
+	int    nMaskingNo;    // 使用したマスキングパターン番号
+
+} QR_APPENDSYMBOL;
+
+typedef struct tagQR_APPENDRESULT
+{
+	int     nStatus;     // QR_APPEND_*
+	int     ncSymbols;   // シンボル数
+	int     nVersion;    // 型番(全シンボル共通)
+	int     nWidth;      // 一辺モジュール数
+	int     ncBytes;     // シンボル 1 個のバイト数
+	uint8_t byParity;    // 全データの排他的論理和
+	size_t  ncArenaUsed; // ncSymbols * ncBytes
+
+	QR_APPENDSYMBOL symbols[QR_APPEND_MAXSYMBOLS];
+
+} QR_APPENDRESULT;
+
+// Splits the payload without encoding it: fills in everything but the
+// arena offsets and masks, so ncArenaUsed is the arena size
+// qr_encode_append() needs. nMaxVersion 0 allows up to version 40.
+// ncSource 0 means NUL terminated. Returns false (nStatus
+// QR_APPEND_EENCODE) if the payload is empty or needs more than 16 symbols.
+bool qr_append_plan(int nLevel,int nMaxVersion,const uint8_t *lpsSource,int ncSource,QR_APPENDRESULT *result);
+
+// Plans and encodes. Symbol n is at arena + symbols[n].nOffset, in the
+// qr_getmodule() layout. pool may be NULL to encode serially.
+bool qr_encode_append(int nLevel,int nMaxVersion,int nMaskingNo,const uint8_t *lpsSource,int ncSource,uint8_t *arena,size_t ncArena,QR_APPENDRESULT *result,QR_THREADPOOL *pool);
+#endif
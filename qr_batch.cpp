@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "qr_encodeem.h"
+#include "qr_batch.h"
+
+#define MAX_QRCODESIZE 4096 // (177*177)/8
+#define MAX_SYMBOLSIZE 3917 // (177*177+7)/8
+
+typedef struct tagQR_BATCHJOB
+{
+	QR_BATCHITEM        *items;
+	const int           *nUnique;  // 対象項目(NULL=全項目)
+	QR_SYMBOLCACHE      *cache;
+	uint8_t             *arena;
+	size_t               ncArena;
+	std::atomic<size_t>  ncUsed;
+	std::atomic<int>     ncEncoded;
+} QR_BATCHJOB;
+
+static void encode_batch_item(void *arg,int nItem,int) {
+  QR_BATCHJOB  *job  = (QR_BATCHJOB *)arg;
+  QR_BATCHITEM &item = job->items[job->nUnique != NULL ? job->nUnique[nItem] : nItem];
+
+  uint8_t image[MAX_QRCODESIZE];
+  int outputdata_len;
+  int width = 0;
+  bool bEncoded;
+
+  item.nOffset      = 0;
+  item.nWidth       = 0;
+  item.ncBytes      = 0;
+  item.nDuplicateOf = -1;
+
+  if(job->cache != NULL)
+    bEncoded = qr_encode_data_cached(job->cache,item.nLevel,item.nVersion,item.bAutoExtent,item.nMaskingNo,item.lpsSource,item.ncSource,image,&width,NULL,1);
+  else
+    bEncoded = qr_encode_data(item.nLevel,item.nVersion,item.bAutoExtent,item.nMaskingNo,item.lpsSource,item.ncSource,image,&outputdata_len,&width);
+
+  if(!bEncoded) {
+    item.nStatus = QR_BATCH_EENCODE;
+    return;
+  }
+
+  int ncBytes = qr_image_size(width);
+
+  // Reserve space at the end of the arena, only if the symbol fits there.
+  size_t nOffset = job->ncUsed.load();
+  do {
+    if(nOffset + ncBytes > job->ncArena) {
+      item.nStatus = QR_BATCH_ENOSPC;
+      return;
+    }
+  } while(!job->ncUsed.compare_exchange_weak(nOffset,nOffset + ncBytes));
+
+  memcpy(job->arena + nOffset,image,ncBytes);
+
+  item.nStatus = QR_BATCH_OK;
+  item.nOffset = nOffset;
+  item.nWidth  = width;
+  item.ncBytes = ncBytes;
+
+  job->ncEncoded++;
+}
+
+// End of the last symbol written.
+static size_t arena_used(const QR_BATCHITEM *items,int ncItems) {
+  size_t ncUsed = 0;
+
+  for(int n=0;n<ncItems;n++) {
+    if(items[n].nStatus == QR_BATCH_OK && items[n].nOffset + items[n].ncBytes > ncUsed) ncUsed = items[n].nOffset + items[n].ncBytes;
+  }
+
+  return ncUsed;
+}
+
+size_t qr_batch_arena_size(int ncItems) {
+  return (size_t)ncItems * MAX_SYMBOLSIZE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_encode_batch
+// 用  途：一括エンコード
+// 引  数：エンコード項目、項目数、出力アリーナ、アリーナ長、使用長格納先、ワーカープール
+// 戻り値：エンコード成功項目数
+
+int qr_encode_batch(QR_BATCHITEM *items,int ncItems,uint8_t *arena,size_t ncArena,size_t *ncArenaUsed,QR_THREADPOOL *pool) {
+  QR_BATCHJOB job;
+
+  job.items     = items;
+  job.nUnique   = NULL;
+  job.cache     = NULL;
+  job.arena     = arena;
+  job.ncArena   = ncArena;
+  job.ncUsed    = 0;
+  job.ncEncoded = 0;
+
+  qr_pool_run(pool,ncItems,encode_batch_item,&job);
+
+  if(ncArenaUsed != NULL) *ncArenaUsed = arena_used(items,ncItems);
+
+  return job.ncEncoded;
+}
+
+static int item_length(const QR_BATCHITEM &item) {
+  return item.ncSource > 0 ? item.ncSource : (int)strlen((const char *)item.lpsSource);
+}
+
+static bool same_symbol(const QR_BATCHITEM &a,int ncA,const QR_BATCHITEM &b,int ncB) {
+  return ncA == ncB && a.nLevel == b.nLevel && a.nVersion == b.nVersion && a.bAutoExtent == b.bAutoExtent &&
+         a.nMaskingNo == b.nMaskingNo && memcmp(a.lpsSource,b.lpsSource,ncA) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_encode_batch_cached
+// 用  途：重複除去付き一括エンコード
+// 引  数：エンコード項目、項目数、出力アリーナ、アリーナ長、使用長格納先、ワーカープール、
+//         シンボルキャッシュ(NULL=使用しない)
+// 戻り値：エンコード成功項目数(重複項目を含む)
+
+int qr_encode_batch_cached(QR_BATCHITEM *items,int ncItems,uint8_t *arena,size_t ncArena,size_t *ncArenaUsed,QR_THREADPOOL *pool,QR_SYMBOLCACHE *cache) {
+  // Open addressing over the key hashes, at most half full. The first
+  // item with a key leads, the later ones point at it.
+  int ncTable = 16;
+  while(ncTable < ncItems * 2) ncTable *= 2;
+
+  int      *nSlot   = new int[ncTable];
+  uint64_t *nHash   = new uint64_t[ncItems];
+  int      *ncItem  = new int[ncItems];
+  int      *nUnique = new int[ncItems];
+  int       ncUnique = 0;
+
+  for(int n=0;n<ncTable;n++) nSlot[n] = -1;
+
+  for(int n=0;n<ncItems;n++) {
+    QR_BATCHITEM &item = items[n];
+
+    ncItem[n] = item_length(item);
+    nHash[n]  = qr_cache_hash(item.lpsSource,ncItem[n],item.nLevel,item.nVersion,item.bAutoExtent,item.nMaskingNo);
+    item.nDuplicateOf = -1;
+
+    int s = (int)(nHash[n] & (ncTable - 1));
+
+    for(;nSlot[s] != -1;s = (s + 1) & (ncTable - 1)) {
+      int m = nSlot[s];
+      if(nHash[m] == nHash[n] && same_symbol(items[m],ncItem[m],item,ncItem[n])) {
+        item.nDuplicateOf = m;
+        break;
+      }
+    }
+
+    if(item.nDuplicateOf == -1) {
+      nSlot[s] = n;
+      nUnique[ncUnique++] = n;
+    }
+  }
+
+  delete [] nSlot;
+  delete [] nHash;
+  delete [] ncItem;
+
+  QR_BATCHJOB job;
+
+  job.items     = items;
+  job.nUnique   = nUnique;
+  job.cache     = cache;
+  job.arena     = arena;
+  job.ncArena   = ncArena;
+  job.ncUsed    = 0;
+  job.ncEncoded = 0;
+
+  qr_pool_run(pool,ncUnique,encode_batch_item,&job);
+
+  delete [] nUnique;
+
+  int ncEncoded = job.ncEncoded;
+
+  for(int n=0;n<ncItems;n++) {
+    QR_BATCHITEM &item = items[n];
+    if(item.nDuplicateOf == -1) continue;
+
+    const QR_BATCHITEM &lead = items[item.nDuplicateOf];
+
+    item.nStatus = lead.nStatus;
+    item.nOffset = lead.nOffset;
+    item.nWidth  = lead.nWidth;
+    item.ncBytes = lead.ncBytes;
+    if(item.nStatus == QR_BATCH_OK) ncEncoded++;
+  }
+
+  if(ncArenaUsed != NULL) *ncArenaUsed = arena_used(items,ncItems);
+
+  return ncEncoded;
+}
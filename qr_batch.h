@@ -0,0 +1,54 @@
+#ifndef QR_BATCH_H
+#define QR_BATCH_H
+#include <stddef.h>
+#include <stdint.h>
+#include "qr_pool.h"
+#include "qr_cache.h"
+
+// Batch encoding.
+//
+// qr_encode_batch() encodes every item across a worker pool and packs the
+// symbols back to back into one caller supplied arena. Each symbol takes
+// (width*width+7)/8 bytes in the qr_getmodule() layout. Symbols are placed
+// in completion order, use nOffset to find them.
+//
+// qr_encode_batch_cached() first looks for items asking for the same symbol
+// (same payload and parameters): each is encoded once, through the cache
+// if one is given, and the duplicates share its arena bytes.
+
+// 処理結果
+#define QR_BATCH_OK       0 // エンコード成功
+#define QR_BATCH_EENCODE  1 // データなし、または容量オーバー
+#define QR_BATCH_ENOSPC   2 // アリーナ容量不足
+
+typedef struct tagQR_BATCHITEM
+{
+	// 入力
+	const uint8_t *lpsSource;   // エンコードデータ
+	int            ncSource;    // エンコードデータ長(0 = NUL 終端)
+	int            nLevel;      // 誤り訂正レベル
+	int            nVersion;    // 型番(0=自動)
+	bool           bAutoExtent; // 型番自動拡張フラグ
+	int            nMaskingNo;  // マスキング番号(-1=自動)
+
+	// 出力
+	int    nStatus;  // QR_BATCH_*
+	size_t nOffset;  // アリーナ内位置
+	int    nWidth;   // 一辺モジュール数
+	int    ncBytes;  // シンボルのバイト数
+	int    nDuplicateOf; // 同一シンボルの先行項目(-1=なし)
+
+} QR_BATCHITEM;
+
+// Worst case arena size for ncItems symbols.
+size_t qr_batch_arena_size(int ncItems);
+
+// Returns the number of items encoded. ncArenaUsed (may be NULL) receives
+// the number of arena bytes written. pool may be NULL to encode serially.
+int qr_encode_batch(QR_BATCHITEM *items,int ncItems,uint8_t *arena,size_t ncArena,size_t *ncArenaUsed,QR_THREADPOOL *pool);
+
+// As qr_encode_batch with the duplicate pass; cache may be NULL. A
+// duplicate gets the status, offset and size of the item it repeats and
+// counts as encoded when that one was.
+int qr_encode_batch_cached(QR_BATCHITEM *items,int ncItems,uint8_t *arena,size_t ncArena,size_t *ncArenaUsed,QR_THREADPOOL *pool,QR_SYMBOLCACHE *cache);
+#endif
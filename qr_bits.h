@@ -0,0 +1,185 @@
+#ifndef QR_BITS_H
+#define QR_BITS_H
+#include <stdint.h>
+#include "qr_utils.h"
+
+// Data bit stream writer.
+//
+// The bit stream is MSB first, as SetBitStream() writes it, but goes
+// through a 64-bit accumulator: qr_bits_put() shifts up to 32 bits in and
+// stores a whole big endian 32-bit word whenever one is complete, so there
+// is no per-bit loop, divide or bounds check. Running out of buffer is
+// only noticed, the words past the end are dropped and qr_bits_finish()
+// reports it, as SetBitStream() would have on the write that crossed it.
+//
+// The packers turn a block of input into its groups with lookup tables
+// (digit values pre-scaled by 100/10/1, alphanumeric values pre-scaled by
+// 45/1) and hand the accumulator several groups at once: three numeric
+// groups (30 bits), two alphanumeric pairs (22 bits), four bytes or two
+// Kanji characters (26 bits) per put. They index the input through
+// operator[], so they work on every source of qr_source.h.
+
+typedef struct tagQR_BITWRITER
+{
+	uint8_t *pBuffer;  // 出力先
+	int      ncBuffer; // 出力先バイト数
+	int      nByte;    // 次に書き込むバイト位置(4 の倍数)
+	int      ncAcc;    // 未書込ビット数(0〜31)
+	uint64_t wAcc;     // 未書込ビット(下位 ncAcc ビット)
+
+} QR_BITWRITER;
+
+inline void qr_bits_init(QR_BITWRITER *w,uint8_t *pBuffer,int ncBuffer) {
+  w->pBuffer  = pBuffer;
+  w->ncBuffer = ncBuffer;
+  w->nByte    = 0;
+  w->ncAcc    = 0;
+  w->wAcc     = 0;
+}
+
+// Appends the low ncData (1..32) bits of wData, which has no bits above.
+inline void qr_bits_put(QR_BITWRITER *w,uint32_t wData,int ncData) {
+  w->wAcc   = (w->wAcc << ncData) | wData;
+  w->ncAcc += ncData;
+
+  if(w->ncAcc >= 32) {
+    w->ncAcc -= 32;
+
+    uint32_t wWord = (uint32_t)(w->wAcc >> w->ncAcc);
+
+    if(w->nByte + 4 <= w->ncBuffer) {
+      w->pBuffer[w->nByte]     = (uint8_t)(wWord >> 24);
+      w->pBuffer[w->nByte + 1] = (uint8_t)(wWord >> 16);
+      w->pBuffer[w->nByte + 2] = (uint8_t)(wWord >> 8);
+      w->pBuffer[w->nByte + 3] = (uint8_t)wWord;
+    }
+    w->nByte += 4;
+  }
+}
+
+// Bits written so far.
+inline int qr_bits_length(const QR_BITWRITER *w) {
+  return w->nByte * 8 + w->ncAcc;
+}
+
+// Writes out the last partial word, its unused low bits cleared, and
+// returns the bit length, -1 if it is longer than the buffer.
+inline int qr_bits_finish(QR_BITWRITER *w) {
+  int ncBits = qr_bits_length(w);
+
+  if(ncBits > w->ncBuffer * 8) return -1;
+
+  uint32_t wWord = w->ncAcc > 0 ? (uint32_t)(w->wAcc << (32 - w->ncAcc)) : 0;
+
+  for(int i=0;i<(w->ncAcc + 7) / 8;i++) w->pBuffer[w->nByte + i] = (uint8_t)(wWord >> (24 - 8 * i));
+
+  return ncBits;
+}
+
+// 数字、英数字の値(範囲外の文字は 0)
+struct QR_PACKTABLE
+{
+	uint16_t wNumeral[3][256];  // 百の位、十の位、一の位
+	uint16_t wAlphabet[2][256]; // 45 倍、1 倍
+};
+
+constexpr QR_PACKTABLE qr_build_pack_table() {
+  QR_PACKTABLE t = {};
+  const char szAlphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+  for(int c='0';c<='9';c++) {
+    t.wNumeral[0][c] = (uint16_t)((c - '0') * 100);
+    t.wNumeral[1][c] = (uint16_t)((c - '0') * 10);
+    t.wNumeral[2][c] = (uint16_t)(c - '0');
+  }
+
+  for(int n=0;n<45;n++) {
+    t.wAlphabet[0][(uint8_t)szAlphabet[n]] = (uint16_t)(n * 45);
+    t.wAlphabet[1][(uint8_t)szAlphabet[n]] = (uint16_t)n;
+  }
+
+  return t;
+}
+
+inline constexpr QR_PACKTABLE QR_PackTable = qr_build_pack_table();
+
+// ncData digits from nStart, as 10-bit groups and a 4 or 7-bit tail.
+template<class SOURCE>
+inline void qr_bits_numeral(QR_BITWRITER *w,const SOURCE &lpsSource,int nStart,int ncData) {
+  const uint16_t (*t)[256] = QR_PackTable.wNumeral;
+  int j = 0;
+
+  for(;j + 9 <= ncData;j += 9) {
+    int p = nStart + j;
+    uint32_t g0 = t[0][lpsSource[p]]     + t[1][lpsSource[p + 1]] + t[2][lpsSource[p + 2]];
+    uint32_t g1 = t[0][lpsSource[p + 3]] + t[1][lpsSource[p + 4]] + t[2][lpsSource[p + 5]];
+    uint32_t g2 = t[0][lpsSource[p + 6]] + t[1][lpsSource[p + 7]] + t[2][lpsSource[p + 8]];
+
+    qr_bits_put(w,(g0 << 20) | (g1 << 10) | g2,30);
+  }
+
+  for(;j + 3 <= ncData;j += 3) {
+    int p = nStart + j;
+    qr_bits_put(w,t[0][lpsSource[p]] + t[1][lpsSource[p + 1]] + t[2][lpsSource[p + 2]],10);
+  }
+
+  // 端数
+  if(ncData - j == 2)
+    qr_bits_put(w,t[1][lpsSource[nStart + j]] + t[2][lpsSource[nStart + j + 1]],7);
+  else if(ncData - j == 1)
+    qr_bits_put(w,t[2][lpsSource[nStart + j]],4);
+}
+
+// ncData alphanumeric characters from nStart, as 11-bit pairs and a 6-bit tail.
+template<class SOURCE>
+inline void qr_bits_alphabet(QR_BITWRITER *w,const SOURCE &lpsSource,int nStart,int ncData) {
+  const uint16_t (*t)[256] = QR_PackTable.wAlphabet;
+  int j = 0;
+
+  for(;j + 4 <= ncData;j += 4) {
+    int p = nStart + j;
+    uint32_t g0 = t[0][lpsSource[p]]     + t[1][lpsSource[p + 1]];
+    uint32_t g1 = t[0][lpsSource[p + 2]] + t[1][lpsSource[p + 3]];
+
+    qr_bits_put(w,(g0 << 11) | g1,22);
+  }
+
+  for(;j + 2 <= ncData;j += 2)
+    qr_bits_put(w,t[0][lpsSource[nStart + j]] + t[1][lpsSource[nStart + j + 1]],11);
+
+  // 端数
+  if(j < ncData)
+    qr_bits_put(w,t[1][lpsSource[nStart + j]],6);
+}
+
+// ncData bytes from nStart.
+template<class SOURCE>
+inline void qr_bits_8bit(QR_BITWRITER *w,const SOURCE &lpsSource,int nStart,int ncData) {
+  int j = 0;
+
+  for(;j + 4 <= ncData;j += 4) {
+    int p = nStart + j;
+    qr_bits_put(w,((uint32_t)lpsSource[p] << 24) | ((uint32_t)lpsSource[p + 1] << 16) | ((uint32_t)lpsSource[p + 2] << 8) | lpsSource[p + 3],32);
+  }
+
+  for(;j < ncData;j++)
+    qr_bits_put(w,lpsSource[nStart + j],8);
+}
+
+// ncData bytes (ncData / 2 Shift-JIS characters) from nStart, 13 bits each.
+template<class SOURCE>
+inline void qr_bits_kanji(QR_BITWRITER *w,const SOURCE &lpsSource,int nStart,int ncData) {
+  int j = 0;
+
+  for(;j + 4 <= ncData;j += 4) {
+    int p = nStart + j;
+    uint32_t k0 = KanjiToBinary((uint16_t)((lpsSource[p] << 8) | lpsSource[p + 1]));
+    uint32_t k1 = KanjiToBinary((uint16_t)((lpsSource[p + 2] << 8) | lpsSource[p + 3]));
+
+    qr_bits_put(w,(k0 << 13) | k1,26);
+  }
+
+  for(;j + 2 <= ncData;j += 2)
+    qr_bits_put(w,KanjiToBinary((uint16_t)((lpsSource[nStart + j] << 8) | lpsSource[nStart + j + 1])),13);
+}
+#endif
@@ -0,0 +1,337 @@
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include "qr_encodeem.h"
+#include "qr_cache.h"
+
+#define CACHE_SHARDS_DEFAULT  16
+#define CACHE_BUCKETS_MIN     64
+
+typedef struct tagCACHE_ENTRY CACHE_ENTRY;
+
+// データ領域に入力データ、シンボルの順に格納
+struct tagCACHE_ENTRY
+{
+	CACHE_ENTRY *pChain;   // 同一バケット
+	CACHE_ENTRY *pNewer;   // LRU リスト
+	CACHE_ENTRY *pOlder;
+
+	uint64_t nHash;
+	int      nLevel;
+	int      nVersion;
+	bool     bAutoExtent;
+	int      nMaskingNo;   // 指定されたマスキング番号
+	int      ncSource;
+
+	int      nWidth;
+	int      nMaskUsed;    // 使用したマスキングパターン番号
+	int      ncImage;
+	size_t   ncEntry;      // 確保バイト数
+
+	uint8_t *source() { return (uint8_t *)(this + 1); }
+	uint8_t *image()  { return source() + ncSource; }
+};
+
+typedef struct alignas(64) tagCACHE_SHARD
+{
+	std::mutex    mutex;
+
+	CACHE_ENTRY **pBucket;
+	size_t        ncBuckets;   // 2 の累乗
+	CACHE_ENTRY   lru;         // 番兵(pNewer = 最古、pOlder = 最新)
+
+	size_t        ncEntries;
+	size_t        ncBytes;
+	size_t        ncBudget;
+
+	uint64_t      ncHits;
+	uint64_t      ncMisses;
+	uint64_t      ncInserts;
+	uint64_t      ncEvictions;
+} CACHE_SHARD;
+
+struct tagQR_SYMBOLCACHE
+{
+	int          ncShards;
+	CACHE_SHARD *shards;
+	size_t       ncBudget;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_cache_hash
+// 用  途：キーのハッシュ値算出
+// 備  考：8 バイト単位の乗算ハッシュ、最後に全ビットを撹拌
+
+static inline uint64_t hash_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t qr_cache_hash(const uint8_t *lpsSource,int ncSource,int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo) {
+  const uint64_t k = 0x9e3779b97f4a7c15ULL;
+  uint64_t h = ((uint64_t)ncSource << 32) ^ ((uint64_t)(nMaskingNo + 1) << 16) ^ ((uint64_t)nVersion << 8) ^ ((uint64_t)nLevel << 1) ^ (bAutoExtent ? 1 : 0);
+  int i = 0;
+
+  h *= k;
+
+  for(;i + 8 <= ncSource;i += 8) {
+    uint64_t w;
+    memcpy(&w,lpsSource + i,8);
+    h = (h ^ w) * k;
+    h ^= h >> 29;
+  }
+
+  if(i < ncSource) {
+    uint64_t w = 0;
+    memcpy(&w,lpsSource + i,ncSource - i);
+    h = (h ^ w) * k;
+  }
+
+  return hash_mix(h);
+}
+
+QR_SYMBOLCACHE *qr_cache_create(size_t ncBudget,int ncShards) {
+  if(ncShards <= 0) ncShards = CACHE_SHARDS_DEFAULT;
+
+  QR_SYMBOLCACHE *cache = new QR_SYMBOLCACHE;
+
+  cache->ncShards       = ncShards;
+  cache->shards         = new CACHE_SHARD[ncShards];
+  cache->ncBudget       = ncBudget;
+
+  for(int n=0;n<ncShards;n++) {
+    CACHE_SHARD &shard = cache->shards[n];
+
+    shard.ncBuckets  = CACHE_BUCKETS_MIN;
+    shard.pBucket    = new CACHE_ENTRY *[shard.ncBuckets]();
+    shard.lru.pNewer = shard.lru.pOlder = &shard.lru;
+    shard.ncEntries  = 0;
+    shard.ncBytes    = 0;
+    shard.ncBudget   = ncBudget / ncShards;
+    shard.ncHits     = shard.ncMisses = shard.ncInserts = shard.ncEvictions = 0;
+  }
+
+  return cache;
+}
+
+static void free_entry(CACHE_ENTRY *entry) {
+  delete [] (uint8_t *)entry;
+}
+
+static void clear_shard(CACHE_SHARD &shard) {
+  for(CACHE_ENTRY *entry = shard.lru.pNewer, *next; entry != &shard.lru; entry = next) {
+    next = entry->pNewer;
+    free_entry(entry);
+  }
+
+  memset(shard.pBucket,0,shard.ncBuckets * sizeof(CACHE_ENTRY *));
+  shard.lru.pNewer = shard.lru.pOlder = &shard.lru;
+  shard.ncEntries  = 0;
+  shard.ncBytes    = 0;
+}
+
+void qr_cache_destroy(QR_SYMBOLCACHE *cache) {
+  if(cache == NULL) return;
+
+  for(int n=0;n<cache->ncShards;n++) {
+    clear_shard(cache->shards[n]);
+    delete [] cache->shards[n].pBucket;
+  }
+
+  delete [] cache->shards;
+  delete cache;
+}
+
+void qr_cache_clear(QR_SYMBOLCACHE *cache) {
+  for(int n=0;n<cache->ncShards;n++) {
+    std::lock_guard<std::mutex> lock(cache->shards[n].mutex);
+    clear_shard(cache->shards[n]);
+  }
+}
+
+void qr_cache_stats(QR_SYMBOLCACHE *cache,QR_CACHESTATS *stats) {
+  memset(stats,0,sizeof(QR_CACHESTATS));
+
+  for(int n=0;n<cache->ncShards;n++) {
+    CACHE_SHARD &shard = cache->shards[n];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    stats->ncHits      += shard.ncHits;
+    stats->ncMisses    += shard.ncMisses;
+    stats->ncInserts   += shard.ncInserts;
+    stats->ncEvictions += shard.ncEvictions;
+    stats->ncEntries   += shard.ncEntries;
+    stats->ncBytes     += shard.ncBytes;
+  }
+
+  stats->ncBudget       = cache->ncBudget;
+}
+
+// The low hash bits pick the bucket, the high bits the shard.
+static CACHE_SHARD &shard_of(QR_SYMBOLCACHE *cache,uint64_t nHash) {
+  return cache->shards[(nHash >> 32) % (uint64_t)cache->ncShards];
+}
+
+static CACHE_ENTRY *find_entry(CACHE_SHARD &shard,uint64_t nHash,const uint8_t *lpsSource,int ncSource,int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo) {
+  for(CACHE_ENTRY *entry = shard.pBucket[nHash & (shard.ncBuckets - 1)]; entry != NULL; entry = entry->pChain) {
+    if(entry->nHash == nHash && entry->ncSource == ncSource && entry->nLevel == nLevel && entry->nVersion == nVersion &&
+       entry->bAutoExtent == bAutoExtent && entry->nMaskingNo == nMaskingNo && memcmp(entry->source(),lpsSource,ncSource) == 0)
+      return entry;
+  }
+
+  return NULL;
+}
+
+static void lru_unlink(CACHE_ENTRY *entry) {
+  entry->pNewer->pOlder = entry->pOlder;
+  entry->pOlder->pNewer = entry->pNewer;
+}
+
+static void lru_push_newest(CACHE_SHARD &shard,CACHE_ENTRY *entry) {
+  entry->pOlder = shard.lru.pOlder;
+  entry->pNewer = &shard.lru;
+  shard.lru.pOlder->pNewer = entry;
+  shard.lru.pOlder = entry;
+}
+
+static void unlink_bucket(CACHE_SHARD &shard,CACHE_ENTRY *entry) {
+  CACHE_ENTRY **p = &shard.pBucket[entry->nHash & (shard.ncBuckets - 1)];
+
+  while(*p != entry) p = &(*p)->pChain;
+  *p = entry->pChain;
+}
+
+// Doubles the buckets once there are more entries than buckets.
+static void grow_buckets(CACHE_SHARD &shard) {
+  size_t ncBuckets = shard.ncBuckets * 2;
+  CACHE_ENTRY **pBucket = new CACHE_ENTRY *[ncBuckets]();
+
+  for(size_t b=0;b<shard.ncBuckets;b++) {
+    for(CACHE_ENTRY *entry = shard.pBucket[b], *next; entry != NULL; entry = next) {
+      next = entry->pChain;
+      entry->pChain = pBucket[entry->nHash & (ncBuckets - 1)];
+      pBucket[entry->nHash & (ncBuckets - 1)] = entry;
+    }
+  }
+
+  delete [] shard.pBucket;
+  shard.pBucket   = pBucket;
+  shard.ncBuckets = ncBuckets;
+}
+
+static void insert_entry(CACHE_SHARD &shard,CACHE_ENTRY *entry) {
+  // 古いものから追い出す
+  while(shard.ncBytes + entry->ncEntry > shard.ncBudget && shard.lru.pNewer != &shard.lru) {
+    CACHE_ENTRY *oldest = shard.lru.pNewer;
+
+    lru_unlink(oldest);
+    unlink_bucket(shard,oldest);
+    shard.ncBytes -= oldest->ncEntry;
+    shard.ncEntries--;
+    shard.ncEvictions++;
+    free_entry(oldest);
+  }
+
+  if(shard.ncEntries + 1 > shard.ncBuckets) grow_buckets(shard);
+
+  CACHE_ENTRY **pHead = &shard.pBucket[entry->nHash & (shard.ncBuckets - 1)];
+  entry->pChain = *pHead;
+  *pHead = entry;
+
+  lru_push_newest(shard,entry);
+  shard.ncBytes += entry->ncEntry;
+  shard.ncEntries++;
+  shard.ncInserts++;
+}
+
+// Misses are encoded on a context of the cache's own, one per thread, that
+// keeps the default segmentation and layout: whatever the caller set on its
+// thread's default context must not reach the symbols other callers get.
+static QR_ENCODER_CTX *cache_ctx() {
+  struct owner {
+    QR_ENCODER_CTX *ctx;
+    owner() : ctx(qr_encoder_ctx_create()) {}
+    ~owner() { qr_encoder_ctx_destroy(ctx); }
+  };
+  static thread_local owner ctx;
+  return ctx.ctx;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_encode_data_cached
+// 用  途：キャッシュ経由のエンコード
+// 引  数：キャッシュ、以降 qr_encode_data_ex と同じ
+// 戻り値：エンコード成功時=true
+
+bool qr_encode_data_cached(QR_SYMBOLCACHE *cache,int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo,const uint8_t *lpsSource,int ncSource,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads) {
+  // データ長が指定されていない場合は lstrlen によって取得
+  int ncLength = ncSource > 0 ? ncSource : (int)strlen((const char *)lpsSource);
+
+  uint64_t nHash = qr_cache_hash(lpsSource,ncLength,nLevel,nVersion,bAutoExtent,nMaskingNo);
+  CACHE_SHARD &shard = shard_of(cache,nHash);
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    CACHE_ENTRY *entry = find_entry(shard,nHash,lpsSource,ncLength,nLevel,nVersion,bAutoExtent,nMaskingNo);
+
+    if(entry != NULL) {
+      lru_unlink(entry);
+      lru_push_newest(shard,entry);
+      shard.ncHits++;
+
+      memcpy(outputdata,entry->image(),entry->ncImage);
+      *width = entry->nWidth;
+
+      if(mask_result != NULL) {
+        mask_result->nMaskingNo = entry->nMaskUsed;
+        for(int n=0;n<8;n++) mask_result->nPenalty[n] = -1;
+      }
+
+      return true;
+    }
+
+    shard.ncMisses++;
+  }
+
+  // Encoded outside the lock, so two threads missing on the same key both
+  // encode it and the second insert just finds the first.
+  QR_MASKRESULT result;
+
+  if(!qr_encode_data_ctx(cache_ctx(),nLevel,nVersion,bAutoExtent,nMaskingNo,lpsSource,ncLength,outputdata,width,&result,nThreads))
+    return false;
+
+  if(mask_result != NULL) *mask_result = result;
+
+  int    ncImage = qr_image_size(*width);
+  size_t ncEntry = sizeof(CACHE_ENTRY) + ncLength + ncImage;
+
+  if(ncEntry > shard.ncBudget) return true; // 格納しない
+
+  CACHE_ENTRY *entry = (CACHE_ENTRY *)new uint8_t[ncEntry];
+
+  entry->nHash       = nHash;
+  entry->nLevel      = nLevel;
+  entry->nVersion    = nVersion;
+  entry->bAutoExtent = bAutoExtent;
+  entry->nMaskingNo  = nMaskingNo;
+  entry->ncSource    = ncLength;
+  entry->nWidth      = *width;
+  entry->nMaskUsed   = result.nMaskingNo;
+  entry->ncImage     = ncImage;
+  entry->ncEntry     = ncEntry;
+  memcpy(entry->source(),lpsSource,ncLength);
+  memcpy(entry->image(),outputdata,ncImage);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  if(find_entry(shard,nHash,lpsSource,ncLength,nLevel,nVersion,bAutoExtent,nMaskingNo) != NULL)
+    free_entry(entry);
+  else
+    insert_entry(shard,entry);
+
+  return true;
+}
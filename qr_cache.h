@@ -0,0 +1,52 @@
+#ifndef QR_CACHE_H
+#define QR_CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "qr_encodeem.h"
+
+// Symbol cache.
+//
+// A least recently used cache of finished symbols, keyed by the payload and
+// the encode parameters (level, version, mask, auto-extent). Lookups hash
+// the key once and compare the stored payload, so a hash collision is only
+// a miss. The cache is split into shards, each with its own lock, LRU list
+// and share of the byte budget, so threads encoding different payloads
+// rarely meet. An entry costs its payload, its packed symbol (at most
+// 3917 bytes) and a small header; the least recently used entries of a
+// shard are evicted to keep it within budget.
+//
+// Symbols are cached in the qr_getmodule() layout as qr_encode_data() makes
+// them with default settings; the encodes behind a miss use a context of
+// the cache's own, so a layout or segmentation set on the calling thread's
+// default context neither gets into the cache nor changes what it returns.
+
+typedef struct tagQR_SYMBOLCACHE QR_SYMBOLCACHE;
+
+typedef struct tagQR_CACHESTATS
+{
+	uint64_t ncHits;
+	uint64_t ncMisses;
+	uint64_t ncInserts;
+	uint64_t ncEvictions;
+	size_t   ncEntries;      // 格納シンボル数
+	size_t   ncBytes;        // 使用量
+	size_t   ncBudget;       // 上限
+
+} QR_CACHESTATS;
+
+// ncShards 0 picks a default; the budget is shared out evenly.
+QR_SYMBOLCACHE *qr_cache_create(size_t ncBudget,int ncShards);
+void qr_cache_destroy(QR_SYMBOLCACHE *cache);
+
+// Drops every entry, the counters are kept.
+void qr_cache_clear(QR_SYMBOLCACHE *cache);
+void qr_cache_stats(QR_SYMBOLCACHE *cache,QR_CACHESTATS *stats);
+
+// Hash of a key; ncSource must be the actual length.
+uint64_t qr_cache_hash(const uint8_t *lpsSource,int ncSource,int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo);
+
+// As qr_encode_data_ex, served from the cache when the same payload was
+// encoded with the same parameters before. On a hit mask_result only
+// reports the mask, the penalties are -1.
+bool qr_encode_data_cached(QR_SYMBOLCACHE *cache,int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo,const uint8_t *lpsSource,int ncSource,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads);
+#endif
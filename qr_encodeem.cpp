@@ -5,22 +5,38 @@
 #include <algorithm>
 #include "qr_encodeem.h"
 #include "qr_utils.h"
+#include "qr_bits.h"
+#include "qr_penalty.h"
+#include "qr_pool.h"
+#include "qr_rs.h"
+#include "qr_scan.h"
+#include "qr_segment.h"
+#include "qr_source.h"
+#include "qr_stats.h"
+#include "qr_utf8.h"
+#include "qr_version.h"
 #include <iostream>
+#include <mutex>
 
 using namespace std;
 
 #define MAX_INPUTDATA  3096 // maximum input data size
 #define MAX_QRCODESIZE 4096 // (177*177)/8
+#define MAX_ALLCODEWORD 3706 // 総コードワード数最大値(Ver.40)
 
 #define MAX_CODEBLOCK   153 // ブロックデータコードワード数最大値(ＲＳコードワードを含む)
 #define MAX_MODULESIZE    177 // 一辺モジュール数最大値
 
-bool qr_encode_source_data(const uint8_t* lpsSource,uint8_t *m_byDataCodeWord,int *outputdata_len,int ncLength, int nVerGroup);
-int qr_encode_with_version(int nVersion,int level,const uint8_t* lpsSource, int ncLength,uint8_t *outputdata,int *outputdata_len);
+// 入力データは const uint8_t *、QR_GATHERSOURCE または QR_SJISSOURCE(qr_source.h)
+template<class SOURCE> bool qr_encode_source_data(QR_ENCODER_CTX *ctx,const SOURCE &lpsSource,int nVerGroup,int ncDataBlock);
+template<class SOURCE> int qr_encode_with_version(QR_ENCODER_CTX *ctx,int nVersion,int level,const SOURCE &lpsSource, int ncLength,bool bWrite);
+template<class SOURCE> static int segment_greedy(QR_ENCODER_CTX *ctx,const SOURCE &lpsSource,int ncLength, int nVerGroup);
 int SetBitStream(uint8_t *codestream, int nIndex, uint16_t wData, int ncData);
-void GetRSCodeWord(uint8_t *lpbyRSWork, int ncDataCodeWord, int ncRSCodeWord);
 void SetFinderPattern(uint8_t *image,int width,int x, int y);
 void FormatModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int m_nMaskingNo,int version,int level);
+void PlaceModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int version);
+void ApplyMaskingPattern(uint8_t *image,int width,int m_nMaskingNo,int version,int level);
+int SelectMaskingPattern(const uint8_t *placed,int width,int version,int level,int *penalties,int nThreads,uint8_t *work);
 void SetFunctionModule(uint8_t *image,int width,int version);
 void SetCodeWordPattern(uint8_t *image,int width,uint8_t *encoded_data,int encoded_data_size,int version);
 void SetMaskingPattern(uint8_t *image,int width,int nPatternNo,int version);
@@ -28,10 +44,10 @@ void SetFormatInfoPattern(uint8_t *image,int width,int nPatternNo,int level);
 void SetVersionPattern(uint8_t *image,int width);
 void SetAlignmentPattern(uint8_t *image,int width, int x, int y);
 void SetVersionPattern(uint8_t *image,int width,int version);
-int CountPenalty(uint8_t *image,int width);
 bool is_on_finder_pattern(int width,int x,int y);
 bool is_on_deadarea(int width,int x,int y);
 bool is_on_timing(int width,int x,int y);
+bool is_on_function_area(int width,int x,int y,int version);
 
 void qr_setmodule(uint8_t *image,int width,int x,int y,int value) {
   int bitpos = ((y*width)+x);
@@ -92,71 +108,253 @@ void qr_dumpimage(uint8_t *image,int width) {
 // lpsSource : Source data
 // ncSource  : Source data length, if 0 then assume NULL terminated.
 bool qr_encode_data(int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *outputdata_len,int *width) {
+  return qr_encode_data_ex(nLevel,nVersion,bAutoExtent,nMaskingNo,lpsSource,ncSource,outputdata,outputdata_len,width,NULL,1);
+}
 
-  // If negative masking number, we need to find the mask with the best penalty
-  if(nMaskingNo == -1) {
-    int min_penalty = 100000000;
-		for(int n=0;n<=7;n++) {
-			uint8_t outputdata[4096];
-			int width;
-			bool ok = qr_encode_data(nLevel,nVersion,bAutoExtent,n,lpsSource,ncSource,outputdata,outputdata_len,&width);
-			
-      int penalty = CountPenalty(outputdata,width);
-      cout << " mask: " << n << " penalty: " << penalty << endl;
-      if(penalty < min_penalty) { min_penalty = penalty; nMaskingNo = n;}
-		}
-    cout << "Selected mask: " << nMaskingNo << endl;
-  }
+// qr_encode_data_ex
+// As qr_encode_data, but reports the mask selection.
+// mask_result: If not NULL receives the mask used and, when nMaskingNo is -1,
+//              the penalty of every candidate (-1 for masks not evaluated).
+// nThreads   : Number of threads used to evaluate the mask candidates.
+bool qr_encode_data_ex(int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *outputdata_len,int *width,QR_MASKRESULT *mask_result,int nThreads) {
+  return qr_encode_data_ctx(qr_encoder_ctx_default(),nLevel,nVersion,bAutoExtent,nMaskingNo,lpsSource,ncSource,outputdata,width,mask_result,nThreads);
+}
 
 
-	int i, j;
-  
-  uint8_t m_byDataCodeWord[MAX_INPUTDATA];
-  int     m_ncDataCodeWordBit;
+/////////////////////////////////////////////////////////////////////////////
+// Encoder context
+//
+// Holds the scratch space of the encode pipeline so it lives on the heap,
+// is allocated once and is reused from call to call. Nothing in it needs
+// clearing between calls: every stage writes what it later reads.
+
+struct tagQR_ENCODER_CTX
+{
+	// 入力データエンコードエリア
+	uint8_t byDataCodeWord[MAX_INPUTDATA];
+	int     ncDataCodeWordBit; // データコードワードビット長
+
+	// 総コードワード算出エリア
+	uint8_t byAllCodeWord[MAX_ALLCODEWORD];
+	uint8_t byRSWork[MAX_CODEBLOCK]; // ＲＳコードワード算出ワーク
+
+	// モードブロック(入力長に合わせて拡張)
+	int      ncBlockAlloc;
+	int32_t *nBlockLength;
+	uint8_t *byBlockMode;
+	uint8_t *bySegmentWork; // qr_segment_optimal 作業領域
+
+	int      nSegmentation; // QR_SEGMENT_*
+	int      ncDataBlock;   // ビット列化したモードブロック数
+
+	// マスキングパターン評価用イメージ(スレッド毎)
+	int      ncMaskWorkAlloc;
+	uint8_t *byMaskWork;
+
+	// 出力レイアウト(既定以外はここで組み立てて変換)
+	QR_LAYOUT layout;
+	uint8_t   byImage[MAX_QRCODESIZE];
+
+	// 連結モードヘッダ(nAppendIndex < 0 = なし)
+	int     nAppendIndex;
+	int     ncAppendTotal;
+	uint8_t byAppendParity;
+
+	// ECI 指定子(nECI < 0 = なし、UTF-8 入力時のみ)
+	int     nECI;
+
+	// UTF-8 入力の変換結果(入力長に合わせて拡張)
+	int      ncUtf8Alloc;
+	uint8_t *byUtf8Data;
+	uint8_t *byUtf8Kanji;
+};
+
+QR_ENCODER_CTX *qr_encoder_ctx_create() {
+  QR_ENCODER_CTX *ctx = new QR_ENCODER_CTX;
+
+  ctx->ncDataCodeWordBit = 0;
+  ctx->ncBlockAlloc      = 0;
+  ctx->nBlockLength      = NULL;
+  ctx->byBlockMode       = NULL;
+  ctx->bySegmentWork     = NULL;
+  ctx->nSegmentation     = QR_SEGMENT_OPTIMAL;
+  ctx->ncDataBlock       = 0;
+  ctx->ncMaskWorkAlloc   = 0;
+  ctx->byMaskWork        = NULL;
+  ctx->layout            = QR_LAYOUT_DEFAULT;
+  ctx->nAppendIndex      = -1;
+  ctx->ncAppendTotal     = 0;
+  ctx->byAppendParity    = 0;
+  ctx->nECI              = -1;
+  ctx->ncUtf8Alloc       = 0;
+  ctx->byUtf8Data        = NULL;
+  ctx->byUtf8Kanji       = NULL;
+
+  return ctx;
+}
+
+void qr_encoder_ctx_destroy(QR_ENCODER_CTX *ctx) {
+  if(ctx == NULL) return;
+
+  delete [] ctx->nBlockLength;
+  delete [] ctx->byBlockMode;
+  delete [] ctx->bySegmentWork;
+  delete [] ctx->byMaskWork;
+  delete [] ctx->byUtf8Data;
+  delete [] ctx->byUtf8Kanji;
+  delete ctx;
+}
+
+// One context per thread for the calls that don't take one.
+QR_ENCODER_CTX *qr_encoder_ctx_default() {
+  struct owner {
+    QR_ENCODER_CTX *ctx;
+    owner() : ctx(qr_encoder_ctx_create()) {}
+    ~owner() { qr_encoder_ctx_destroy(ctx); }
+  };
+  static thread_local owner default_ctx;
+  return default_ctx.ctx;
+}
+
+// There is at most one mode block per input character.
+static void reserve_blocks(QR_ENCODER_CTX *ctx,int ncLength) {
+  if(ncLength + 1 <= ctx->ncBlockAlloc) return;
+
+  delete [] ctx->nBlockLength;
+  delete [] ctx->byBlockMode;
+  delete [] ctx->bySegmentWork;
+
+  ctx->ncBlockAlloc  = ncLength + 1;
+  ctx->nBlockLength  = new int32_t[ctx->ncBlockAlloc];
+  ctx->byBlockMode   = new uint8_t[ctx->ncBlockAlloc];
+  ctx->bySegmentWork = new uint8_t[qr_segment_work_size(ncLength)];
+}
+
+// qr_encoder_ctx_set_segmentation
+// Chooses how the context splits input into mode blocks, QR_SEGMENT_OPTIMAL
+// (default) or QR_SEGMENT_GREEDY, the original block merging.
+void qr_encoder_ctx_set_segmentation(QR_ENCODER_CTX *ctx,int nSegmentation) {
+  ctx->nSegmentation = nSegmentation;
+}
+
+// qr_encoder_ctx_set_layout
+// Layout of the symbols qr_encode_data_ctx() writes, see qr_layout.h.
+// outputdata then needs qr_layout_size(layout,*width) bytes.
+void qr_encoder_ctx_set_layout(QR_ENCODER_CTX *ctx,const QR_LAYOUT *layout) {
+  ctx->layout = *layout;
+}
+
+// qr_encoder_ctx_set_append
+// Starts every symbol the context encodes with a Structured Append header:
+// symbol nIndex (0..15) of ncTotal (1..16), with the parity of the whole
+// payload. nIndex -1 turns it off again. Anything else would not fit the
+// header's 4-bit fields and is refused, leaving the context as it was.
+bool qr_encoder_ctx_set_append(QR_ENCODER_CTX *ctx,int nIndex,int ncTotal,uint8_t byParity) {
+  if(nIndex == -1) {
+    ctx->nAppendIndex = -1;
+    return true;
+  }
+  if(nIndex < 0 || nIndex >= ncTotal || ncTotal > 16) return false;
 
-	int m_nMaskingNo = nMaskingNo;
+  ctx->nAppendIndex   = nIndex;
+  ctx->ncAppendTotal  = ncTotal;
+  ctx->byAppendParity = byParity;
+  return true;
+}
 
-	// データ長が指定されていない場合は lstrlen によって取得
-	int ncLength = ncSource > 0 ? ncSource : strlen((char *) lpsSource);
+// Bits written ahead of the first mode block.
+static int header_bits(const QR_ENCODER_CTX *ctx) {
+  return (ctx->nAppendIndex >= 0 ? QR_APPEND_HEADERBITS : 0) + (ctx->nECI >= 0 ? QR_ECI_HEADERBITS : 0);
+}
 
-	if (ncLength == 0) {
-    cout << "Data length 0" << endl;
-		return false; // データなし
+static uint8_t *reserve_mask_work(QR_ENCODER_CTX *ctx,int ncBytes) {
+  if(ncBytes > ctx->ncMaskWorkAlloc) {
+    delete [] ctx->byMaskWork;
+    ctx->ncMaskWorkAlloc = ncBytes;
+    ctx->byMaskWork = new uint8_t[ncBytes];
   }
+  return ctx->byMaskWork;
+}
+
+// qr_image_size
+// Bytes needed to hold a symbol of the given width.
+int qr_image_size(int width) {
+  return (width * width + 7) / 8;
+}
+
+// Segments the data and picks the version, leaving the data bit stream in
+// the context when bWrite is set. Returns the version, 0 when there is no
+// data, it does not fit, or the level or version is out of range.
+template<class SOURCE>
+static int encode_version(QR_ENCODER_CTX *ctx,int nLevel,int nVersion,bool bAutoExtent,const SOURCE &lpsSource,int ncLength,bool bWrite) {
+
+	if (ncLength <= 0)
+		return 0; // データなし
+
+	if (nLevel < QR_LEVEL_L || nLevel > QR_LEVEL_H || nVersion < 0 || nVersion > 40)
+		return 0; // 引数不正
+
+  reserve_blocks(ctx,ncLength);
 
   // Version Check
 	// バージョン(型番)チェック
-	//int nEncodeVersion = GetEncodeVersion(nVersion, lpsSource, ncLength);
-  int nEncodeVersion = qr_encode_with_version(nVersion,nLevel,lpsSource,ncLength,m_byDataCodeWord,&m_ncDataCodeWordBit);
+  QR_STAT_BEGIN(version);
+  int nEncodeVersion = qr_encode_with_version(ctx,nVersion,nLevel,lpsSource,ncLength,bWrite);
+  QR_STAT_END(version,QR_STAT_VERSION);
+
+	if (nEncodeVersion == 0)
+		return 0; // 容量オーバー
 
-	if (nEncodeVersion == 0) {
-    cout << "encoding failure" << endl;
-		return false; // 容量オーバー
-  }
-  int m_nVersion;
 	if (nVersion == 0)
-	{
-		// 型番自動
-		m_nVersion = nEncodeVersion;
-	}
-	else
-	{
-		if (nEncodeVersion <= nVersion)
-		{
-			m_nVersion = nVersion;
-		}
-		else
-		{
-			if (bAutoExtent)
-				m_nVersion = nEncodeVersion; // バージョン(型番)自動拡張
-			else
-				return false; // 容量オーバー
-		}
-	}
+		return nEncodeVersion; // 型番自動
+
+	if (nEncodeVersion <= nVersion)
+		return nVersion;
+
+	if (bAutoExtent)
+		return nEncodeVersion; // バージョン(型番)自動拡張
+
+	return 0; // 容量オーバー
+}
+
+// qr_encode_size
+// 用  途：シンボルサイズ取得
+// 引  数：qr_encode_data と同じ
+// 戻り値：シンボルのバイト数(qr_image_size)、データなし、または容量オーバー時=0
+// Runs segmentation and the version search only, without writing the bit
+// stream, so callers can allocate the exact output size before encoding.
+int qr_encode_size(int nLevel, int nVersion,bool bAutoExtent, const uint8_t * lpsSource, int ncSource,int *width) {
+  // データ長が指定されていない場合は lstrlen によって取得
+  int ncLength = ncSource > 0 ? ncSource : strlen((char *) lpsSource);
+  int m_nVersion = encode_version(qr_encoder_ctx_default(),nLevel,nVersion,bAutoExtent,lpsSource,ncLength,false);
+
+  if(m_nVersion == 0) return 0;
+
+  if(width != NULL) *width = m_nVersion * 4 + 17;
+  return qr_image_size(m_nVersion * 4 + 17);
+}
+
+// qr_encode_sizev
+// qr_encode_size for a payload given as fragments.
+int qr_encode_sizev(int nLevel, int nVersion,bool bAutoExtent, const QR_IOVEC *iov, int ncIov,int *width) {
+  int ncLength = qr_iovec_length(iov,ncIov);
+  int m_nVersion = encode_version(qr_encoder_ctx_default(),nLevel,nVersion,bAutoExtent,QR_GATHERSOURCE(iov,ncIov),ncLength,false);
+
+  if(m_nVersion == 0) return 0;
+
+  if(width != NULL) *width = m_nVersion * 4 + 17;
+  return qr_image_size(m_nVersion * 4 + 17);
+}
+
+// Terminator and padding codewords up to the version's data capacity.
+static void pad_codewords(QR_ENCODER_CTX *ctx,int nVersion,int nLevel) {
+  uint8_t *m_byDataCodeWord    = ctx->byDataCodeWord;
+  int     &m_ncDataCodeWordBit = ctx->ncDataCodeWordBit;
+	int i;
 
   // Terminator Code "0000"
 	// ターミネータコード"0000"付加
-	int ncDataCodeWord = QR_VersionInfo[m_nVersion].ncDataCodeWord[nLevel];
+	int ncDataCodeWord = QR_VersionMeta.ncDataCodeWord[nVersion][nLevel];
 
 	int ncTerminater = std::min(4, (ncDataCodeWord * 8) - m_ncDataCodeWordBit);
 
@@ -172,161 +370,253 @@ bool qr_encode_data(int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, c
 
 		byPaddingCode = (uint8_t)(byPaddingCode == 0xec ? 0x11 : 0xec);
 	}
+}
 
-	// 総コードワード算出エリアクリア
-  int m_ncAllCodeWord; // 総コードワード数(ＲＳ誤り訂正データを含む)
-  uint8_t m_byAllCodeWord[MAX_INPUTDATA]; // 総コードワード算出エリア
+template<class SOURCE>
+static bool encode_data(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const SOURCE &lpsSource, int ncLength,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads) {
 
-	m_ncAllCodeWord = QR_VersionInfo[m_nVersion].ncAllCodeWord;
-  memset(m_byAllCodeWord,0,m_ncAllCodeWord);
+  QR_STAT_CALL();
+  QR_STAT_BEGIN(encode);
 
-	int nDataCwIndex = 0; // データコードワード処理位置
+  if(mask_result != NULL) {
+    mask_result->nMaskingNo = -1;
+    for(int n=0;n<8;n++) mask_result->nPenalty[n] = -1;
+  }
 
-	// データブロック分割数
-	int ncBlock1 = QR_VersionInfo[m_nVersion].RS_BlockInfo1[nLevel].ncRSBlock;
-	int ncBlock2 = QR_VersionInfo[m_nVersion].RS_BlockInfo2[nLevel].ncRSBlock;
-	int ncBlockSum = ncBlock1 + ncBlock2;
+  int m_nVersion = encode_version(ctx,nLevel,nVersion,bAutoExtent,lpsSource,ncLength,true);
 
-	int nBlockNo = 0; // 処理中ブロック番号
+  if (m_nVersion == 0)
+  {
+		QR_STAT_RESULT(ncLength <= 0 ? QR_RESULT_NODATA : QR_RESULT_OVERFLOW,ncLength,0);
+		return false;
+  }
 
-	// ブロック別データコードワード数
-	int ncDataCw1 = QR_VersionInfo[m_nVersion].RS_BlockInfo1[nLevel].ncDataCodeWord;
-	int ncDataCw2 = QR_VersionInfo[m_nVersion].RS_BlockInfo2[nLevel].ncDataCodeWord;
+	pad_codewords(ctx,m_nVersion,nLevel);
 
-	// データコードワードインターリーブ配置
-	for (i = 0; i < ncBlock1; ++i)
-	{
-		for (j = 0; j < ncDataCw1; ++j)
-		{
-			m_byAllCodeWord[(ncBlockSum * j) + nBlockNo] = m_byDataCodeWord[nDataCwIndex++];
-		}
+	*width = m_nVersion * 4 + 17;
 
-		++nBlockNo;
-	}
+	// The stages below work in the default layout, other layouts are
+	// written out row by row once the mask is applied.
+	bool bDefaultLayout = ctx->layout.nAlign == QR_ALIGN_PACKED && ctx->layout.nBitOrder == QR_BITORDER_LSB;
+	uint8_t *image = bDefaultLayout ? outputdata : ctx->byImage;
 
-	for (i = 0; i < ncBlock2; ++i)
+	// インターリーブ、ＲＳコードワード算出、モジュール配置(型番別、qr_version.h)
+	// 総コードワード算出エリアはデータとＲＳコードワードで全て埋まるためクリア不要
+	qr_codeword_stage(m_nVersion,nLevel)(nLevel,ctx->byDataCodeWord,ctx->byAllCodeWord,ctx->byRSWork,image);
+
+	QR_STAT_BEGIN(masking);
+
+  // If negative masking number, we need to find the mask with the best penalty.
+  // The data is only placed once, each candidate is tried on a copy.
+	if (nMaskingNo == -1)
 	{
-		for (j = 0; j < ncDataCw2; ++j)
-		{
-			if (j < ncDataCw1)
-			{
-				m_byAllCodeWord[(ncBlockSum * j) + nBlockNo] = m_byDataCodeWord[nDataCwIndex++];
-			}
-			else
-			{
-				// ２種目ブロック端数分配置
-				m_byAllCodeWord[(ncBlockSum * ncDataCw1) + i]  = m_byDataCodeWord[nDataCwIndex++];
-			}	
-		}
+		if (nThreads < 1) nThreads = 1;
+		if (nThreads > 8) nThreads = 8;
 
-		++nBlockNo;
+		uint8_t *work = reserve_mask_work(ctx,nThreads * qr_image_size(*width));
+		nMaskingNo = SelectMaskingPattern(image,*width,m_nVersion,nLevel,mask_result != NULL ? mask_result->nPenalty : NULL,nThreads,work);
 	}
 
-	// ブロック別ＲＳコードワード数(※現状では同数)
-	int ncRSCw1 = QR_VersionInfo[m_nVersion].RS_BlockInfo1[nLevel].ncAllCodeWord - ncDataCw1;
-	int ncRSCw2 = QR_VersionInfo[m_nVersion].RS_BlockInfo2[nLevel].ncAllCodeWord - ncDataCw2;
+	ApplyMaskingPattern(image,*width,nMaskingNo,m_nVersion,nLevel);
+	QR_STAT_END(masking,QR_STAT_MASKING);
 
-	/////////////////////////////////////////////////////////////////////////
-	// ＲＳコードワード算出
+	if (!bDefaultLayout)
+		qr_layout_convert(image,&QR_LAYOUT_DEFAULT,outputdata,&ctx->layout,*width);
 
-	nDataCwIndex = 0;
-	nBlockNo = 0;
+	if (mask_result != NULL)
+		mask_result->nMaskingNo = nMaskingNo;
 
-  uint8_t m_byRSWork[MAX_CODEBLOCK]; // ＲＳコードワード算出ワーク
-	for (i = 0; i < ncBlock1; ++i)
-	{
+	QR_STAT_END(encode,QR_STAT_ENCODE);
+	QR_STAT_RESULT(QR_RESULT_OK,ncLength,m_nVersion);
 
-		memset(m_byRSWork,0,sizeof(m_byRSWork));
+	return true;
+}
 
-		memmove(m_byRSWork, m_byDataCodeWord + nDataCwIndex, ncDataCw1);
+// qr_encode_data_ctx
+// As qr_encode_data_ex, using the given context for all scratch space.
+// outputdata only needs qr_image_size(*width) bytes, see qr_encode_size,
+// or qr_layout_size() of the context's layout.
+bool qr_encode_data_ctx(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads) {
+  // データ長が指定されていない場合は lstrlen によって取得
+  int ncLength = ncSource > 0 ? ncSource : strlen((char *) lpsSource);
 
-		GetRSCodeWord(m_byRSWork, ncDataCw1, ncRSCw1);
+  return encode_data(ctx,nLevel,nVersion,bAutoExtent,nMaskingNo,lpsSource,ncLength,outputdata,width,mask_result,nThreads);
+}
 
-		// ＲＳコードワード配置
-		for (j = 0; j < ncRSCw1; ++j)
-		{
-			m_byAllCodeWord[ncDataCodeWord + (ncBlockSum * j) + nBlockNo] = m_byRSWork[j];
-		}
+// qr_encode_datav_ctx
+// qr_encode_data_ctx for a payload given as fragments, read in place.
+bool qr_encode_datav_ctx(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const QR_IOVEC *iov, int ncIov,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads) {
+  int ncLength = qr_iovec_length(iov,ncIov);
 
-		nDataCwIndex += ncDataCw1;
-		++nBlockNo;
-	}
+  return encode_data(ctx,nLevel,nVersion,bAutoExtent,nMaskingNo,QR_GATHERSOURCE(iov,ncIov),ncLength,outputdata,width,mask_result,nThreads);
+}
 
-	for (i = 0; i < ncBlock2; ++i)
-	{
-		memset(m_byRSWork,0,sizeof(m_byRSWork));
+// qr_encode_codewords
+// 用  途：データコードワード作成
+// 引  数：コンテキスト、誤り訂正レベル、型番(0=自動)、型番自動拡張フラグ、エンコードデータ、エンコードデータ長、
+//         データコードワード格納先、モードブロック格納先(NULL可)、モードブロック数格納先
+// 戻り値：型番(データなし、または容量オーバー時=0)
+int qr_encode_codewords(QR_ENCODER_CTX *ctx,int nLevel,int nVersion,bool bAutoExtent,const uint8_t *lpsSource,int ncSource,uint8_t *byDataCodeWord,uint8_t *byBlockMode,int32_t *nBlockLength,int *ncBlocks) {
+  // データ長が指定されていない場合は lstrlen によって取得
+  int ncLength = ncSource > 0 ? ncSource : strlen((char *) lpsSource);
+  int m_nVersion = encode_version(ctx,nLevel,nVersion,bAutoExtent,lpsSource,ncLength,true);
 
-		memmove(m_byRSWork, m_byDataCodeWord + nDataCwIndex, ncDataCw2);
+  if(m_nVersion == 0) return 0;
 
-		GetRSCodeWord(m_byRSWork, ncDataCw2, ncRSCw2);
+  pad_codewords(ctx,m_nVersion,nLevel);
+  memcpy(byDataCodeWord,ctx->byDataCodeWord,QR_VersionMeta.ncDataCodeWord[m_nVersion][nLevel]);
 
-		// ＲＳコードワード配置
-		for (j = 0; j < ncRSCw2; ++j)
-		{
-			m_byAllCodeWord[ncDataCodeWord + (ncBlockSum * j) + nBlockNo] = m_byRSWork[j];
-		}
+  if(byBlockMode != NULL) {
+    memcpy(byBlockMode,ctx->byBlockMode,ctx->ncDataBlock);
+    memcpy(nBlockLength,ctx->nBlockLength,ctx->ncDataBlock * sizeof(int32_t));
+  }
+  if(ncBlocks != NULL) *ncBlocks = ctx->ncDataBlock;
 
-		nDataCwIndex += ncDataCw2;
-		++nBlockNo;
-	}
+  return m_nVersion;
+}
 
-	*width = m_nVersion * 4 + 17;
+// Converts UTF-8 input into the context (qr_utf8.h) and sets the ECI header
+// for it. The converted pairs must stay in Kanji mode, which only the
+// optimal segmentation keeps to (the greedy one merges short Kanji blocks
+// into 8-bit ones), so the caller encodes with that.
+static QR_SJISSOURCE convert_utf8(QR_ENCODER_CTX *ctx,const uint8_t *lpsSource,int ncSource,int *ncLength) {
+  if(ncSource > ctx->ncUtf8Alloc) {
+    delete [] ctx->byUtf8Data;
+    delete [] ctx->byUtf8Kanji;
+
+    ctx->ncUtf8Alloc = ncSource;
+    ctx->byUtf8Data  = new uint8_t[ncSource];
+    ctx->byUtf8Kanji = new uint8_t[ncSource];
+  }
+
+  int ncFallback;
+  *ncLength = ncSource > 0 ? qr_utf8_convert(lpsSource,ncSource,ctx->byUtf8Data,ctx->byUtf8Kanji,&ncFallback) : 0;
 
+  // 変換できなかった UTF-8 は 8 ビットバイトモードで ECI 26 として読ませる
+  ctx->nECI = (*ncLength > 0 && ncFallback > 0) ? QR_ECI_UTF8 : -1;
 
-  // Up until here we've just been reorganising the input data. We now start drawing the QRCode image.
+  QR_SJISSOURCE source = { ctx->byUtf8Data,ctx->byUtf8Kanji };
+  return source;
+}
 
-	// モジュール配置
-	FormatModule(outputdata,*width,m_byAllCodeWord,m_ncAllCodeWord,nMaskingNo,m_nVersion,nLevel);
+// qr_encode_utf8_ctx
+// qr_encode_data_ctx for UTF-8 text, see qr_utf8.h. Always segments
+// optimally, whatever the context is set to.
+bool qr_encode_utf8_ctx(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads) {
+  // データ長が指定されていない場合は lstrlen によって取得
+  int ncLength = ncSource > 0 ? ncSource : strlen((char *) lpsSource);
+  QR_SJISSOURCE source = convert_utf8(ctx,lpsSource,ncLength,&ncLength);
 
-	return true;
+  int nSegmentation = ctx->nSegmentation;
+  ctx->nSegmentation = QR_SEGMENT_OPTIMAL;
+
+  bool bResult = encode_data(ctx,nLevel,nVersion,bAutoExtent,nMaskingNo,source,ncLength,outputdata,width,mask_result,nThreads);
+
+  ctx->nSegmentation = nSegmentation;
+  ctx->nECI = -1;
+
+  return bResult;
 }
 
+// qr_encode_size_utf8
+// qr_encode_size for UTF-8 text.
+int qr_encode_size_utf8(int nLevel, int nVersion,bool bAutoExtent, const uint8_t * lpsSource, int ncSource,int *width) {
+  QR_ENCODER_CTX *ctx = qr_encoder_ctx_default();
+
+  int ncLength = ncSource > 0 ? ncSource : strlen((char *) lpsSource);
+  QR_SJISSOURCE source = convert_utf8(ctx,lpsSource,ncLength,&ncLength);
+
+  int nSegmentation = ctx->nSegmentation;
+  ctx->nSegmentation = QR_SEGMENT_OPTIMAL;
+
+  int m_nVersion = encode_version(ctx,nLevel,nVersion,bAutoExtent,source,ncLength,false);
+
+  ctx->nSegmentation = nSegmentation;
+  ctx->nECI = -1;
+
+  if(m_nVersion == 0) return 0;
+
+  if(width != NULL) *width = m_nVersion * 4 + 17;
+  return qr_image_size(m_nVersion * 4 + 17);
+}
+
+// バージョン(型番)グループ別の型番範囲
+static const int nVerGroupFirst[] = { 1, 10, 27};
+static const int nVerGroupLast[]  = { 9, 26, 40};
+
+// First version of nFirst..nLast whose data capacity holds ncBits, found by
+// binary search (capacity grows with the version), or 0 if none does.
+static int find_version(int nFirst,int nLast,int level,int ncBits) {
+	int ncBytes = (ncBits + 7) / 8;
+
+	if (QR_VersionMeta.ncDataCodeWord[nLast][level] < ncBytes)
+		return 0;
+
+	while (nFirst < nLast)
+	{
+		int nMid = (nFirst + nLast) / 2;
+
+		if (QR_VersionMeta.ncDataCodeWord[nMid][level] >= ncBytes)
+			nLast = nMid;
+		else
+			nFirst = nMid + 1;
+	}
+
+	return nFirst;
+}
 
 // GetEncodeVersion
 // qr_encode_with_version, this does the basic encoding, with a specified version (if possible)
 // 用  途：エンコード時バージョン(型番)取得
-// 引  数：調査開始バージョン、エンコードデータ、エンコードデータ長
+// 引  数：調査開始バージョン、エンコードデータ、エンコードデータ長、ビット列作成フラグ
 // 戻り値：バージョン番号（容量オーバー時=0）
-int qr_encode_with_version(int nVersion,int level,const uint8_t* lpsSource, int ncLength,uint8_t *outputdata,int *outputdata_len) {
-
-  int &m_ncDataCodeWordBit = *outputdata_len;
-  int m_nLevel = level;
+// 備  考：最適分割では全グループのビット長を 1 パスで求め、選んだグループのみビット列化
+template<class SOURCE>
+int qr_encode_with_version(QR_ENCODER_CTX *ctx,int nVersion,int level,const SOURCE &lpsSource, int ncLength,bool bWrite) {
 
 	int nVerGroup = nVersion >= 27 ? QR_VRESION_L : (nVersion >= 10 ? QR_VRESION_M : QR_VRESION_S);
+	int ncBits[3];
 	int i, j;
 
-  // try different versions in order?
+	QR_STAT_BEGIN(segment);
+
+	if (ctx->nSegmentation != QR_SEGMENT_GREEDY)
+		qr_segment_measure(lpsSource,ncLength,ctx->bySegmentWork,ncBits);
+
 	for (i = nVerGroup; i <= QR_VRESION_L; ++i)
 	{
-		if (qr_encode_source_data(lpsSource,outputdata,outputdata_len, ncLength, i))
+		int ncDataBlock = 0;
+
+		if (ctx->nSegmentation == QR_SEGMENT_GREEDY)
 		{
-			if (i == QR_VRESION_S)
-			{
-				for (j = 1; j <= 9; ++j)
-				{
-					if ((m_ncDataCodeWordBit + 7) / 8 <= QR_VersionInfo[j].ncDataCodeWord[m_nLevel])
-						return j;
-				}
-			}
-			else if (i == QR_VRESION_M)
-			{
-				for (j = 10; j <= 26; ++j)
-				{
-					if ((m_ncDataCodeWordBit + 7) / 8 <= QR_VersionInfo[j].ncDataCodeWord[m_nLevel])
-						return j;
-				}
-			}
-			else if (i == QR_VRESION_L)
-			{
-				for (j = 27; j <= 40; ++j)
-				{
-					if ((m_ncDataCodeWordBit + 7) / 8 <= QR_VersionInfo[j].ncDataCodeWord[m_nLevel])
-						return j;
-				}
-			}
+			// 逐次結合はグループ毎に分割し直す
+			ncDataBlock = segment_greedy(ctx,lpsSource,ncLength,i);
+
+			for (ncBits[i] = j = 0; j < ncDataBlock; ++j)
+				ncBits[i] += GetBitLength(ctx->byBlockMode[j],ctx->nBlockLength[j],i);
+		}
+
+		int nEncodeVersion = find_version(nVerGroupFirst[i],nVerGroupLast[i],level,ncBits[i] + header_bits(ctx));
+
+		if (nEncodeVersion == 0)
+			continue;
+
+		if (bWrite)
+		{
+			if (ctx->nSegmentation != QR_SEGMENT_GREEDY)
+				ncDataBlock = qr_segment_blocks(ncLength,i,ctx->bySegmentWork,ctx->byBlockMode,ctx->nBlockLength);
+
+			if (!qr_encode_source_data(ctx,lpsSource,i,ncDataBlock))
+				nEncodeVersion = 0;
+
+			ctx->ncDataBlock = ncDataBlock;
 		}
+
+		QR_STAT_END(segment,QR_STAT_SEGMENT);
+		return nEncodeVersion;
 	}
 
+	QR_STAT_END(segment,QR_STAT_SEGMENT);
 	return 0;
 }
 
@@ -336,7 +626,7 @@ int qr_encode_with_version(int nVersion,int level,const uint8_t* lpsSource, int
 // 用  途：ビットセット
 // 引  数：挿入位置、ビット配列データ、データビット長(最大16)
 // 戻り値：次回挿入位置(バッファオーバー時=-1)
-// 備  考：m_byDataCodeWord に結果をセット(要ゼロ初期化)
+// 備  考：m_byDataCodeWord に結果をセット(バイト先頭ビット書込時にそのバイトをクリア)
 
 int SetBitStream(uint8_t *codestream, int nIndex, uint16_t wData, int ncData) {
 	int i;
@@ -346,6 +636,9 @@ int SetBitStream(uint8_t *codestream, int nIndex, uint16_t wData, int ncData) {
 
 	for (i = 0; i < ncData; ++i)
 	{
+		if ((nIndex + i) % 8 == 0)
+			codestream[(nIndex + i) / 8] = 0;
+
 		if (wData & (1 << (ncData - i - 1)))
 		{
 			codestream[(nIndex + i) / 8] |= 1 << (7 - ((nIndex + i) % 8));
@@ -358,31 +651,24 @@ int SetBitStream(uint8_t *codestream, int nIndex, uint16_t wData, int ncData) {
 
 
 /////////////////////////////////////////////////////////////////////////////
-// CQR_Encode::EncodeSourceData
-// 用  途：入力データエンコード
-// 引  数：入力データ、入力データ長、バージョン(型番)グループ
-// 戻り値：エンコード成功時=true
-
-// This actually does the main data encoding.
-bool qr_encode_source_data(const uint8_t* lpsSource,uint8_t *m_byDataCodeWord,int *outputdata_len,int ncLength, int nVerGroup) {
-  int &m_ncDataCodeWordBit = *outputdata_len; // データコードワードビット長 (data code bit)
-
-  int32_t m_nBlockLength[MAX_INPUTDATA];
-  uint8_t m_byBlockMode [MAX_INPUTDATA];
-//	uint8_t m_byDataCodeWord[MAX_INPUTDATA]; // 入力データエンコードエリア data encode area
+// source_runs
+// 用  途：どのモードが何文字(バイト)継続しているかを調査
+// 戻り値：ブロック数
+// 備  考：連続した入力は qr_scan_runs、断片や変換済みの入力は 1 バイトずつ
 
+template<class SOURCE>
+static int source_runs(const SOURCE &lpsSource,int ncLength,uint8_t *m_byBlockMode,int32_t *m_nBlockLength) {
 	int m_ncDataBlock;
 
-	memset(m_nBlockLength,0,sizeof(m_nBlockLength));
-	memset(m_byBlockMode  ,5,sizeof(m_byBlockMode));
+	// Blocks are initialised as they are opened, see below.
+	m_nBlockLength[0] = 0;
 
-	int i, j;
+	int i;
 
-	// どのモードが何文字(バイト)継続しているかを調査
 	for (m_ncDataBlock = i = 0; i < ncLength; ++i) {
 		uint8_t byMode;
 
-		if (i < ncLength - 1 && IsKanjiData(lpsSource[i], lpsSource[i + 1]))
+		if (qr_source_kanji(lpsSource,i,ncLength))
 			byMode = QR_MODE_KANJI;
 		else if (IsNumeralData(lpsSource[i]))
 			byMode = QR_MODE_NUMERAL;
@@ -394,7 +680,10 @@ bool qr_encode_source_data(const uint8_t* lpsSource,uint8_t *m_byDataCodeWord,in
 		if (i == 0) { m_byBlockMode[0] = byMode; }
  
 		if (m_byBlockMode[m_ncDataBlock] != byMode)
+		{
 			m_byBlockMode[++m_ncDataBlock] = byMode;
+			m_nBlockLength[m_ncDataBlock] = 0;
+		}
  
 		++m_nBlockLength[m_ncDataBlock];
 
@@ -406,7 +695,27 @@ bool qr_encode_source_data(const uint8_t* lpsSource,uint8_t *m_byDataCodeWord,in
 		}
 	}
 
-	++m_ncDataBlock;
+	return m_ncDataBlock + 1;
+}
+
+static int source_runs(const uint8_t *lpsSource,int ncLength,uint8_t *m_byBlockMode,int32_t *m_nBlockLength) {
+	return qr_scan_runs(lpsSource,ncLength,m_byBlockMode,m_nBlockLength);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// segment_greedy
+// 用  途：モードブロック分割(逐次結合)
+// 戻り値：ブロック数
+// 備  考：QR_SEGMENT_GREEDY、元の EncodeSourceData の分割部分
+
+template<class SOURCE>
+static int segment_greedy(QR_ENCODER_CTX *ctx,const SOURCE &lpsSource,int ncLength, int nVerGroup) {
+  int32_t *m_nBlockLength  = ctx->nBlockLength;   // ncLength + 1 entries
+  uint8_t *m_byBlockMode   = ctx->byBlockMode;
+
+	int m_ncDataBlock = source_runs(lpsSource,ncLength,m_byBlockMode,m_nBlockLength);
+
+	int i;
 
 	/////////////////////////////////////////////////////////////////////////
 	// 隣接する英数字モードブロックと数字モードブロックの並びをを条件により結合
@@ -625,187 +934,87 @@ bool qr_encode_source_data(const uint8_t* lpsSource,uint8_t *m_byDataCodeWord,in
 		++nBlock; // 次ブロックを調査
 	}
 
+	return m_ncDataBlock;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CQR_Encode::EncodeSourceData
+// 用  途：入力データエンコード
+// 引  数：入力データ、バージョン(型番)グループ、モードブロック数(ブロックは ctx に格納済み)
+// 戻り値：エンコード成功時=true
+
+// This actually does the main data encoding.
+// The blocks go through the accumulating bit writer and the table driven
+// packers of qr_bits.h rather than SetBitStream() a group at a time.
+template<class SOURCE>
+bool qr_encode_source_data(QR_ENCODER_CTX *ctx,const SOURCE &lpsSource,int nVerGroup,int ncDataBlock) {
+  int32_t *m_nBlockLength  = ctx->nBlockLength;
+  uint8_t *m_byBlockMode   = ctx->byBlockMode;
+
+	int m_ncDataBlock = ncDataBlock;
+	int i;
 
   // actual bit encoding happens here.
 	// ビット配列化
 	int ncComplete = 0; // 処理済データカウンタ
-	uint16_t wBinCode;
 
-	m_ncDataCodeWordBit = 0; // ビット単位処理カウンタ
+	QR_BITWRITER w;
+	qr_bits_init(&w,ctx->byDataCodeWord,MAX_INPUTDATA); // 入力データエンコードエリア data encode area
 
-  for(int n=0;n<MAX_INPUTDATA;n++) m_byDataCodeWord[n]=0;
-  
-	for (i = 0; i < m_ncDataBlock && m_ncDataCodeWordBit != -1; ++i)
+	if (ctx->nAppendIndex >= 0)
+	{
+		// 連結モード(0011b)、シンボル位置、シンボル数 - 1、パリティ
+		qr_bits_put(&w,(3u << 16) | ((uint32_t)ctx->nAppendIndex << 12) | ((uint32_t)(ctx->ncAppendTotal - 1) << 8) | ctx->byAppendParity,QR_APPEND_HEADERBITS);
+	}
+
+	if (ctx->nECI >= 0)
+	{
+		// ECI(0111b)、指定子(0〜127 は 8 ビット)
+		qr_bits_put(&w,(7u << 8) | (uint32_t)ctx->nECI,QR_ECI_HEADERBITS);
+	}
+
+	for (i = 0; i < m_ncDataBlock; ++i)
 	{
 		if (m_byBlockMode[i] == QR_MODE_NUMERAL)
 		{
-			/////////////////////////////////////////////////////////////////
 			// 数字モード
-
-			// インジケータ(0001b)
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, 1, 4); 
-
-			// 文字数セット
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit,
-                                         (uint16_t)m_nBlockLength[i],
-                                         nIndicatorLenNumeral[nVerGroup]);
-
-			// ビット列保存
-			for (j = 0; j < m_nBlockLength[i]; j += 3)
-			{
-				if (j < m_nBlockLength[i] - 2)
-				{
-					wBinCode = (uint16_t)(((lpsSource[ncComplete + j]	  - '0') * 100) +
-									  ((lpsSource[ncComplete + j + 1] - '0') * 10) +
-									   (lpsSource[ncComplete + j + 2] - '0'));
-
-					m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, wBinCode, 10);
-				}
-				else if (j == m_nBlockLength[i] - 2)
-				{
-					// 端数２バイト
-					wBinCode = (uint16_t)(((lpsSource[ncComplete + j] - '0') * 10) +
-									   (lpsSource[ncComplete + j + 1] - '0'));
-
-					m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, wBinCode, 7);
-				}
-				else if (j == m_nBlockLength[i] - 1)
-				{
-					// 端数１バイト
-					wBinCode = (uint16_t)(lpsSource[ncComplete + j] - '0');
-
-					m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, wBinCode, 4);
-				}
-			}
-
-			ncComplete += m_nBlockLength[i];
+			// インジケータ(0001b)、文字数、ビット列
+			qr_bits_put(&w,(1u << nIndicatorLenNumeral[nVerGroup]) | (uint32_t)m_nBlockLength[i],4 + nIndicatorLenNumeral[nVerGroup]);
+			qr_bits_numeral(&w,lpsSource,ncComplete,m_nBlockLength[i]);
 		}
-
 		else if (m_byBlockMode[i] == QR_MODE_ALPHABET)
 		{
-			/////////////////////////////////////////////////////////////////
 			// 英数字モード
-
-			// モードインジケータ(0010b)
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, 2, 4);
-
-			// 文字数セット
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, (uint16_t)m_nBlockLength[i], nIndicatorLenAlphabet[nVerGroup]);
-
-			// ビット列保存
-			for (j = 0; j < m_nBlockLength[i]; j += 2)
-			{
-				if (j < m_nBlockLength[i] - 1)
-				{
-					wBinCode = (uint16_t)((AlphabetToBinary(lpsSource[ncComplete + j]) * 45) +
-									   AlphabetToBinary(lpsSource[ncComplete + j + 1]));
-
-					m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, wBinCode, 11);
-				}
-				else
-				{
-					// 端数１バイト
-					wBinCode = (uint16_t)AlphabetToBinary(lpsSource[ncComplete + j]);
-
-					m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, wBinCode, 6);
-				}
-			}
-
-			ncComplete += m_nBlockLength[i];
+			// モードインジケータ(0010b)、文字数、ビット列
+			qr_bits_put(&w,(2u << nIndicatorLenAlphabet[nVerGroup]) | (uint32_t)m_nBlockLength[i],4 + nIndicatorLenAlphabet[nVerGroup]);
+			qr_bits_alphabet(&w,lpsSource,ncComplete,m_nBlockLength[i]);
 		}
-
 		else if (m_byBlockMode[i] == QR_MODE_8BIT)
 		{
-			/////////////////////////////////////////////////////////////////
 			// ８ビットバイトモード
-
-			// モードインジケータ(0100b)
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, 4, 4);
-
-			// 文字数セット
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, (uint16_t)m_nBlockLength[i], nIndicatorLen8Bit[nVerGroup]);
-
-			// ビット列保存
-			for (j = 0; j < m_nBlockLength[i]; ++j)
-			{
-				m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, (uint16_t)lpsSource[ncComplete + j], 8);
-			}
-
-			ncComplete += m_nBlockLength[i];
+			// モードインジケータ(0100b)、文字数、ビット列
+			qr_bits_put(&w,(4u << nIndicatorLen8Bit[nVerGroup]) | (uint32_t)m_nBlockLength[i],4 + nIndicatorLen8Bit[nVerGroup]);
+			qr_bits_8bit(&w,lpsSource,ncComplete,m_nBlockLength[i]);
 		}
 		else // m_byBlockMode[i] == QR_MODE_KANJI
 		{
-			/////////////////////////////////////////////////////////////////
 			// 漢字モード
-
-			// モードインジケータ(1000b)
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, 8, 4);
-
-			// 文字数セット
-			m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, (uint16_t)(m_nBlockLength[i] / 2), nIndicatorLenKanji[nVerGroup]);
-
-			// 漢字モードでビット列保存
-			for (j = 0; j < m_nBlockLength[i] / 2; ++j)
-			{
-				uint16_t wBinCode = KanjiToBinary((uint16_t)(((uint8_t)lpsSource[ncComplete + (j * 2)] << 8) + (uint8_t)lpsSource[ncComplete + (j * 2) + 1]));
-
-				m_ncDataCodeWordBit = SetBitStream(m_byDataCodeWord,m_ncDataCodeWordBit, wBinCode, 13);
-			}
-
-			ncComplete += m_nBlockLength[i];
+			// モードインジケータ(1000b)、文字数(バイト数 / 2)、ビット列
+			qr_bits_put(&w,(8u << nIndicatorLenKanji[nVerGroup]) | (uint32_t)(m_nBlockLength[i] / 2),4 + nIndicatorLenKanji[nVerGroup]);
+			qr_bits_kanji(&w,lpsSource,ncComplete,m_nBlockLength[i]);
 		}
-	}
-
-	return (m_ncDataCodeWordBit != -1);
-}
-
-
 
+		ncComplete += m_nBlockLength[i];
+	}
 
-/////////////////////////////////////////////////////////////////////////////
-// CQR_Encode::GetRSCodeWord
-// 用  途：ＲＳ誤り訂正コードワード取得
-// 引  数：データコードワードアドレス、データコードワード長、ＲＳコードワード長
-// 備  考：総コードワード分のエリアを確保してから呼び出し
-
-void GetRSCodeWord(uint8_t *lpbyRSWork, int ncDataCodeWord, int ncRSCodeWord)
-{
-	int i, j;
-
-	for (i = 0; i < ncDataCodeWord ; ++i)
-	{
-		if (lpbyRSWork[0] != 0)
-		{
-			uint8_t nExpFirst = byIntToExp[lpbyRSWork[0]]; // 初項係数より乗数算出
-
-			for (j = 0; j < ncRSCodeWord; ++j)
-			{
-				// 各項乗数に初項乗数を加算（% 255 → α^255 = 1）
-				uint8_t nExpElement = (uint8_t)(((int)(byRSExp[ncRSCodeWord][j] + nExpFirst)) % 255);
-
-				// 排他論理和による剰余算出
-				lpbyRSWork[j] = (uint8_t)(lpbyRSWork[j + 1] ^ byExpToInt[nExpElement]);
-			}
+	ctx->ncDataCodeWordBit = qr_bits_finish(&w);
 
-			// 残り桁をシフト
-			for (j = ncRSCodeWord; j < ncDataCodeWord + ncRSCodeWord - 1; ++j)
-				lpbyRSWork[j] = lpbyRSWork[j + 1];
-		}
-		else
-		{
-			// 残り桁をシフト
-			for (j = 0; j < ncDataCodeWord + ncRSCodeWord - 1; ++j)
-				lpbyRSWork[j] = lpbyRSWork[j + 1];
-		}
-	}
+	return (ctx->ncDataCodeWordBit != -1);
 }
 
 
-void clear_qrimage(uint8_t *data) {
-  for(int n=0;n<MAX_QRCODESIZE;n++) {
-    data[n] = 0;
-  }
-}
+
 
 /////////////////////////////////////////////////////////////////////////////
 // CQR_Encode::FormatModule
@@ -813,15 +1022,28 @@ void clear_qrimage(uint8_t *data) {
 // 戻り値：一辺のモジュール数
 
 void FormatModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int m_nMaskingNo,int version,int level) {
-	int i, j;
 
-  clear_qrimage(image);
+	PlaceModule(image,width,input_data,input_data_len,version);
+
+	ApplyMaskingPattern(image,width,m_nMaskingNo,version,level);
+}
+
+// PlaceModule
+// First half of FormatModule: function patterns and unmasked codewords.
+void PlaceModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int version) {
 
 	// 機能モジュール配置
-	SetFunctionModule(image,width,version);
+	// On a clear image this is just the template, and it also clears the
+	// data modules, so only the symbol's own bytes are written.
+	memcpy(image,qr_function_image(version),qr_image_size(width));
 
 	// データパターン配置
 	SetCodeWordPattern(image,width,input_data,input_data_len,version);
+}
+
+// ApplyMaskingPattern
+// Second half of FormatModule: masks a placed image and adds the format information.
+void ApplyMaskingPattern(uint8_t *image,int width,int m_nMaskingNo,int version,int level) {
 
 	SetMaskingPattern(image,width,m_nMaskingNo,version); // マスキング
   // added masking pattern
@@ -830,7 +1052,79 @@ void FormatModule(uint8_t *image,int width,uint8_t *input_data,int input_data_le
 	SetFunctionModule(image,width,version);
 
 	SetFormatInfoPattern(image,width,m_nMaskingNo,level); // フォーマット情報パターン配置
+}
+
+// Scores masks nFirst, nFirst+nStep, ... on copies of the placed image.
+static void count_mask_penalties(const uint8_t *placed,int width,int version,int level,int nFirst,int nStep,int *penalties,uint8_t *image) {
+	int ncBytes = qr_image_size(width);
+
+	for (int n = nFirst; n < 8; n += nStep)
+	{
+		memcpy(image,placed,ncBytes);
+		ApplyMaskingPattern(image,width,n,version,level);
+
+		QR_STAT_BEGIN(penalty);
+		penalties[n] = CountPenalty(image,width);
+		QR_STAT_END(penalty,QR_STAT_PENALTY);
+	}
+}
+
+// One mask per pool item, scored on the worker's own copy.
+typedef struct tagMASKJOB
+{
+	const uint8_t *placed;
+	int            width;
+	int            version;
+	int            level;
+	int           *penalties;
+	uint8_t       *work;      // ワーカー毎に qr_image_size(width) バイト
+} MASKJOB;
+
+static void count_mask_job(void *arg,int nItem,int nWorker) {
+	MASKJOB *job = (MASKJOB *)arg;
+
+	count_mask_penalties(job->placed,job->width,job->version,job->level,nItem,8,job->penalties,job->work + nWorker * qr_image_size(job->width));
+}
+
+// Pools for 2..8 threads, started on first use and kept for the life of the
+// process, so an encode no longer pays for creating and joining threads.
+// Encodes asking for the same count take turns on its pool.
+static QR_THREADPOOL *mask_pool(int nThreads) {
+	static QR_THREADPOOL *pools[9];
+	static std::mutex mutex;
 
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pools[nThreads] == NULL) pools[nThreads] = qr_pool_create(nThreads);
+	return pools[nThreads];
+}
+
+// SelectMaskingPattern
+// 用  途：マスキングパターン選択
+// 引  数：配置済み(マスク前)イメージ、各パターンのペナルティ格納先(NULL可)、スレッド数(1〜8)、
+//         作業領域(スレッド数 * qr_image_size(width) バイト)
+// 戻り値：ペナルティ最小のマスキングパターン番号
+int SelectMaskingPattern(const uint8_t *placed,int width,int version,int level,int *penalties,int nThreads,uint8_t *work) {
+	int nPenalty[8];
+
+	if (nThreads > 1)
+	{
+		MASKJOB job = {placed,width,version,level,nPenalty,work};
+
+		qr_pool_run(mask_pool(nThreads),8,count_mask_job,&job);
+	}
+	else
+	{
+		count_mask_penalties(placed,width,version,level,0,1,nPenalty,work);
+	}
+
+	int nMaskingNo = 0;
+	for (int n = 0; n < 8; ++n)
+	{
+		if (penalties != NULL) penalties[n] = nPenalty[n];
+		if (nPenalty[n] < nPenalty[nMaskingNo]) nMaskingNo = n;
+	}
+
+	return nMaskingNo;
 }
 
 bool is_within(int start_x,int start_y,int end_x,int end_y,int x,int y) {
@@ -928,6 +1222,183 @@ bool is_on_function_area(int width,int x,int y,int version) {
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+// Function pattern templates
+//
+// The function area only depends on the version, so rather than running the
+// is_on_* predicates for every module of every symbol we draw each version
+// once, on first use, into a packed bitmask (1 = function module) and a
+// packed image holding the finder/timing/alignment/version pixels. Both use
+// the same bit layout as qr_setmodule().
+//
+// The template also holds the codeword placement map: the bit index
+// (y*width+x) of every data module in the order the zig-zag walk visits
+// them, so codeword bit n always lands on module wPlacement[n], and the
+// eight masking patterns restricted to the data modules.
+
+typedef struct tagQR_FUNCTIONTEMPLATE
+{
+	int     width;
+	int     ncBytes;
+	uint8_t byMask[MAX_QRCODESIZE];
+	uint8_t byImage[MAX_QRCODESIZE];
+
+	int       ncPlacement; // データモジュール数(剰余ビットを含む)
+	uint16_t *wPlacement;
+
+	uint8_t  *byMaskPattern; // マスキングパターン別のデータモジュール反転ビット(8 * ncBytes)
+} QR_FUNCTIONTEMPLATE;
+
+static QR_FUNCTIONTEMPLATE QR_FunctionTemplate[41];
+static std::once_flag      QR_FunctionTemplateOnce[41];
+
+void DrawFunctionModule(uint8_t *image,int width,int version);
+static bool is_masked(int nPatternNo,int i,int j);
+
+static inline bool is_function_module(const uint8_t *mask,int width,int x,int y) {
+  int bitpos = ((y*width)+x);
+  return (mask[bitpos/8] >> (bitpos%8)) & 1;
+}
+
+static void build_function_template(int version) {
+  QR_FUNCTIONTEMPLATE &t = QR_FunctionTemplate[version];
+
+  t.width   = version * 4 + 17;
+  t.ncBytes = (t.width * t.width + 7) / 8;
+
+  memset(t.byMask ,0,sizeof(t.byMask));
+  memset(t.byImage,0,sizeof(t.byImage));
+
+  for(int y=0;y<t.width;y++) {
+    for(int x=0;x<t.width;x++) {
+      if(is_on_function_area(t.width,x,y,version)) qr_setmodule(t.byMask,t.width,x,y,1);
+    }
+  }
+
+  DrawFunctionModule(t.byImage,t.width,version);
+
+  t.byMaskPattern = new uint8_t[8 * t.ncBytes];
+  memset(t.byMaskPattern,0,8 * t.ncBytes);
+
+  for(int m=0;m<8;m++) {
+    for(int y=0;y<t.width;y++) {
+      for(int x=0;x<t.width;x++) {
+        if(!is_function_module(t.byMask,t.width,x,y) && is_masked(m,y,x)) qr_setmodule(t.byMaskPattern + m * t.ncBytes,t.width,x,y,1);
+      }
+    }
+  }
+
+  // Walk the data area once, in placement order.
+  t.ncPlacement = 0;
+  for(int n=0;n<t.width*t.width;n++) {
+    if(!is_function_module(t.byMask,t.width,n%t.width,n/t.width)) t.ncPlacement++;
+  }
+
+  t.wPlacement = new uint16_t[t.ncPlacement];
+
+	int x = t.width;
+	int y = t.width - 1;
+
+	int nCoef_x = 1; // ｘ軸配置向き
+	int nCoef_y = 1; // ｙ軸配置向き
+
+	for (int i = 0; i < t.ncPlacement; ++i)
+	{
+		do
+		{
+			x += nCoef_x;
+			nCoef_x *= -1;
+
+			if (nCoef_x < 0)
+			{
+				y += nCoef_y;
+
+				if (y < 0 || y == t.width)
+				{
+					y = (y < 0) ? 0 : t.width - 1;
+					nCoef_y *= -1;
+
+					x -= 2;
+
+					if (x == 6) // タイミングパターン
+						--x;
+				}
+			}
+		}
+		while (is_function_module(t.byMask,t.width,x,y)); // 機能モジュールを除外
+
+		t.wPlacement[i] = (uint16_t)((y * t.width) + x);
+	}
+}
+
+static const QR_FUNCTIONTEMPLATE *get_function_template(int version) {
+  std::call_once(QR_FunctionTemplateOnce[version],build_function_template,version);
+  return &QR_FunctionTemplate[version];
+}
+
+// Packed function module mask for a version (1..40), (width*width+7)/8 bytes.
+const uint8_t *qr_function_mask(int version) {
+  return get_function_template(version)->byMask;
+}
+
+// Packed function pattern pixels for a version (1..40), (width*width+7)/8 bytes.
+const uint8_t *qr_function_image(int version) {
+  return get_function_template(version)->byImage;
+}
+
+// Codeword placement map for a version (1..40). Entry n is the bit index
+// (y*width+x) of the module that carries codeword bit n (MSB first), the
+// map covers every data module including the remainder bits.
+const uint16_t *qr_placement_map(int version,int *count) {
+  const QR_FUNCTIONTEMPLATE *t = get_function_template(version);
+  if(count != NULL) *count = t->ncPlacement;
+  return t->wPlacement;
+}
+
+// Reads codewords back out of an (unmasked) image through the placement map.
+void qr_gather_codewords(const uint8_t *image,int version,uint8_t *codewords,int ncCodeWords) {
+  const QR_FUNCTIONTEMPLATE *t = get_function_template(version);
+
+  for (int i = 0; i < ncCodeWords; ++i)
+  {
+    const uint16_t *p = t->wPlacement + (i * 8);
+    uint8_t c = 0;
+
+    for (int j = 0; j < 8; ++j)
+      c = (uint8_t)((c << 1) | ((image[p[j] / 8] >> (p[j] % 8)) & 1));
+
+    codewords[i] = c;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// SetFunctionModule
+// Copies the version's function pattern template over the image, leaving
+// the data modules untouched. Works a word at a time.
+
+void SetFunctionModule(uint8_t *image,int width,int version) {
+  const QR_FUNCTIONTEMPLATE *t = get_function_template(version);
+
+  int ncWords = t->ncBytes / 8;
+  int i;
+
+  for (i = 0; i < ncWords; ++i)
+  {
+    uint64_t img, mask, pat;
+    memcpy(&img ,image      + i * 8,8);
+    memcpy(&mask,t->byMask  + i * 8,8);
+    memcpy(&pat ,t->byImage + i * 8,8);
+
+    img = (img & ~mask) | pat;
+    memcpy(image + i * 8,&img,8);
+  }
+
+  for (i = ncWords * 8; i < t->ncBytes; ++i)
+    image[i] = (uint8_t)((image[i] & ~t->byMask[i]) | t->byImage[i]);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 // CQR_Encode::SetFunctionModule
 // 用  途：機能モジュール配置
@@ -935,7 +1406,8 @@ bool is_on_function_area(int width,int x,int y,int version) {
 
 // My understanding is that this function places the various formating and alignment data on the image.
 // It does not add the coded data to the image.
-void SetFunctionModule(uint8_t *image,int width,int version) {
+// Only used to build the function pattern templates, see SetFunctionModule().
+void DrawFunctionModule(uint8_t *image,int width,int version) {
 	int i, j;
 
 	// 位置検出パターン
@@ -1101,51 +1573,23 @@ void SetVersionPattern(uint8_t *image,int width,int version)
 /////////////////////////////////////////////////////////////////////////////
 // CQR_Encode::SetCodeWordPattern
 // 用  途：データパターン配置
+// 備  考：配置順はバージョン別の配置マップ(qr_placement_map)による
 
 void SetCodeWordPattern(uint8_t *image,int width,uint8_t *encoded_data,int encoded_data_size,int version)
 {
-	int x = width;
-	int y = width - 1;
-
-	int nCoef_x = 1; // ｘ軸配置向き
-	int nCoef_y = 1; // ｙ軸配置向き
+	const uint16_t *placement = qr_placement_map(version,NULL);
 
 	int i, j;
 	for (i = 0; i < encoded_data_size; ++i)
 	{
+		const uint16_t *p = placement + (i * 8);
+
 		for (j = 0; j < 8; ++j)
 		{
-			do
-			{
-				x += nCoef_x;
-				nCoef_x *= -1;
-
-				if (nCoef_x < 0)
-				{
-					y += nCoef_y;
-
-					if (y < 0 || y == width)
-					{
-						y = (y < 0) ? 0 : width - 1;
-						nCoef_y *= -1;
-
-						x -= 2;
+			int nBit = p[j] % 8;
+			int nValue = (encoded_data[i] >> (7 - j)) & 1;
 
-						if (x == 6) // タイミングパターン
-							--x;
-					}
-				}
-			}
-			while (is_on_function_area(width,x,y,version));
-
-//m_byModuleData[x][y] & 0x20); // 機能モジュールを除外
-  
-      int set=0;
-      if(encoded_data[i] & (1 << (7-j))) set=1;else set=0;
- 
-      qr_setmodule(image,width,x,y,set);
-
-			//m_byModuleData[x][y] = (m_byAllCodeWord[i] & (1 << (7 - j))) ? '\x02' : '\x00';
+			image[p[j] / 8] = (uint8_t)((image[p[j] / 8] & ~(1 << nBit)) | (nValue << nBit));
 		}
 	}
 }
@@ -1155,65 +1599,75 @@ void SetCodeWordPattern(uint8_t *image,int width,uint8_t *encoded_data,int encod
 // CQR_Encode::SetMaskingPattern
 // 用  途：マスキングパターン配置
 // 引  数：マスキングパターン番号
+// The pattern bits of the data modules are part of the version's template,
+// so masking is a word-at-a-time XOR.
 
-void SetMaskingPattern(uint8_t *image,int width,int nPatternNo,int version)
+static bool is_masked(int nPatternNo,int i,int j)
 {
-	int i, j;
+	switch (nPatternNo)
+	{
+	case 0:
+		return ((i + j) % 2 == 0);
 
-  int m_nSymbolSize = width;
+	case 1:
+		return (i % 2 == 0);
 
-	for (i = 0; i < m_nSymbolSize; ++i)
-	{
-		for (j = 0; j < m_nSymbolSize; ++j)
-		{
-			if(!is_on_function_area(width,j,i,version)) 
-			//if (!(qr_getmodule(image,width,j,i))) // 機能モジュールを除外
-			//if (! (m_byModuleData[j][i] & 0x20)) // 機能モジュールを除外
-			{
-				bool bMask;
+	case 2:
+		return (j % 3 == 0);
 
-				switch (nPatternNo)
-				{
-				case 0:
-					bMask = ((i + j) % 2 == 0);
-					break;
+	case 3:
+		return ((i + j) % 3 == 0);
 
-				case 1:
-					bMask = (i % 2 == 0);
-					break;
+	case 4:
+		return (((i / 2) + (j / 3)) % 2 == 0);
 
-				case 2:
-					bMask = (j % 3 == 0);
-					break;
+	case 5:
+		return (((i * j) % 2) + ((i * j) % 3) == 0);
 
-				case 3:
-					bMask = ((i + j) % 3 == 0);
-					break;
+	case 6:
+		return ((((i * j) % 2) + ((i * j) % 3)) % 2 == 0);
 
-				case 4:
-					bMask = (((i / 2) + (j / 3)) % 2 == 0);
-					break;
+	default: // case 7:
+		return ((((i * j) % 3) + ((i + j) % 2)) % 2 == 0);
+	}
+}
 
-				case 5:
-					bMask = (((i * j) % 2) + ((i * j) % 3) == 0);
-					break;
+void SetMaskingPattern(uint8_t *image,int width,int nPatternNo,int version)
+{
+	const QR_FUNCTIONTEMPLATE *t = get_function_template(version);
+	const uint8_t *pattern = t->byMaskPattern + nPatternNo * t->ncBytes;
 
-				case 6:
-					bMask = ((((i * j) % 2) + ((i * j) % 3)) % 2 == 0);
-					break;
+	int ncWords = t->ncBytes / 8;
+	int i;
 
-				default: // case 7:
-					bMask = ((((i * j) % 3) + ((i + j) % 2)) % 2 == 0);
-					break;
-				}
+	for (i = 0; i < ncWords; ++i)
+	{
+		uint64_t img, pat;
+		memcpy(&img,image   + i * 8,8);
+		memcpy(&pat,pattern + i * 8,8);
 
-			 // if(is_on_function_area(width,j,i,version)) {
-          int d = qr_getmodule(image,width,j,i) ^ bMask;
-          qr_setmodule(image,width,j,i,d);
-      //  } else {
-      //  }
-//				m_byModuleData[j][i] = (uint8_t)((m_byModuleData[j][i] & 0xfe) | (((m_byModuleData[j][i] & 0x02) > 1) ^ bMask));
-			}
+		img ^= pat;
+		memcpy(image + i * 8,&img,8);
+	}
+
+	for (i = ncWords * 8; i < t->ncBytes; ++i)
+		image[i] ^= pattern[i];
+}
+
+// SetMaskingPatternReference
+// The original module-at-a-time masking, kept to check the templates against.
+void SetMaskingPatternReference(uint8_t *image,int width,int nPatternNo,int version)
+{
+	int i, j;
+
+	const uint8_t *function_mask = qr_function_mask(version);
+
+	for (i = 0; i < width; ++i)
+	{
+		for (j = 0; j < width; ++j)
+		{
+			if (!is_function_module(function_mask,width,j,i) && is_masked(nPatternNo,i,j))
+				qr_setmodule(image,width,j,i,!qr_getmodule(image,width,j,i));
 		}
 	}
 }
@@ -1295,8 +1749,9 @@ void SetFormatInfoPattern(uint8_t *image,int width,int nPatternNo,int level)
 /////////////////////////////////////////////////////////////////////////////
 // CQR_Encode::CountPenalty
 // 用  途：マスク後ペナルティスコア算出
+// 備  考：モジュール単位の参照実装、通常は qr_penalty.cpp の CountPenalty() を使用
 
-int CountPenalty(uint8_t *image,int width) {
+int CountPenaltyReference(uint8_t *image,int width) {
 	int nPenalty = 0;
 	int i, j, k;
 
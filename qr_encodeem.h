@@ -2,7 +2,10 @@
 #define QRENCODEEM_H
 
 #include <stdint.h>
+#include "qr_layout.h"
+#ifndef NULL
 #define NULL 0
+#endif
 
 // QR Code Version Information
 // QRコードバージョン(型番)情報
@@ -24,10 +27,85 @@
 #define QR_VRESION_M	1 // 10 〜 26
 #define QR_VRESION_L	2 // 27 〜 40
 
+// マスキングパターン選択結果
+typedef struct tagQR_MASKRESULT
+{
+	int nMaskingNo;  // 使用したマスキングパターン番号
+	int nPenalty[8]; // パターン別ペナルティ(未評価=-1)
+
+} QR_MASKRESULT;
+
 bool qr_encode_data(int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *outputdata_len,int *width);
+bool qr_encode_data_ex(int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *outputdata_len,int *width,QR_MASKRESULT *mask_result,int nThreads);
+
+// Reusable encoder scratch space. A context may only be used by one thread
+// at a time; the calls without one use a per-thread default context.
+typedef struct tagQR_ENCODER_CTX QR_ENCODER_CTX;
+
+QR_ENCODER_CTX *qr_encoder_ctx_create();
+void qr_encoder_ctx_destroy(QR_ENCODER_CTX *ctx);
+QR_ENCODER_CTX *qr_encoder_ctx_default();
+
+// モードブロック分割方式
+#define QR_SEGMENT_OPTIMAL 0 // 最短ビット長(qr_segment.h)
+#define QR_SEGMENT_GREEDY  1 // 隣接ブロックの逐次結合
+
+void qr_encoder_ctx_set_segmentation(QR_ENCODER_CTX *ctx,int nSegmentation);
+
+// 出力レイアウト(既定は QR_LAYOUT_DEFAULT)
+void qr_encoder_ctx_set_layout(QR_ENCODER_CTX *ctx,const QR_LAYOUT *layout);
 
+// 連結モードヘッダ(qr_append.h、nIndex = -1 で解除、範囲外は false)
+#define QR_APPEND_HEADERBITS 20 // モード 4 + 位置 4 + シンボル数 4 + パリティ 8
+bool qr_encoder_ctx_set_append(QR_ENCODER_CTX *ctx,int nIndex,int ncTotal,uint8_t byParity);
+
+bool qr_encode_data_ctx(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads);
+
+// The encode up to the padded data codewords, before Reed-Solomon (see
+// qr_template.h). byDataCodeWord receives the codewords block after block,
+// byBlockMode and nBlockLength (may be NULL, else ncSource + 1 entries)
+// the mode blocks the context's segmentation chose. Returns the version,
+// 0 if there is no data or it does not fit.
+int qr_encode_codewords(QR_ENCODER_CTX *ctx,int nLevel,int nVersion,bool bAutoExtent,const uint8_t *lpsSource,int ncSource,uint8_t *byDataCodeWord,uint8_t *byBlockMode,int32_t *nBlockLength,int *ncBlocks);
+
+// 入力データ断片(scatter-gather 入力)
+typedef struct tagQR_IOVEC
+{
+	const uint8_t *pData;
+	int            ncData;
+} QR_IOVEC;
+
+// As qr_encode_data_ctx and qr_encode_size, with the payload given as
+// ncIov fragments read in order, without concatenating them. The symbol is
+// the same as for the concatenated payload; empty fragments are allowed and
+// there is no NUL terminated form.
+bool qr_encode_datav_ctx(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const QR_IOVEC *iov, int ncIov,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads);
+int qr_encode_sizev(int nLevel, int nVersion,bool bAutoExtent, const QR_IOVEC *iov, int ncIov,int *width);
+
+// As qr_encode_data_ctx and qr_encode_size, for UTF-8 text: characters
+// with a Shift-JIS code are encoded in Kanji mode, the rest as UTF-8 bytes
+// behind an ECI 26 header (qr_utf8.h).
+#define QR_ECI_HEADERBITS 12 // モード 4 + 指定子 8
+bool qr_encode_utf8_ctx(QR_ENCODER_CTX *ctx,int nLevel, int nVersion,bool bAutoExtent, int nMaskingNo, const uint8_t * lpsSource, int ncSource,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result,int nThreads);
+int qr_encode_size_utf8(int nLevel, int nVersion,bool bAutoExtent, const uint8_t * lpsSource, int ncSource,int *width);
+
+// Output size: qr_encode_size() returns the bytes qr_encode_data() will
+// write for this input (0 if it cannot be encoded), qr_image_size() the
+// bytes for a given width, ceil(width*width/8).
+int qr_encode_size(int nLevel, int nVersion,bool bAutoExtent, const uint8_t * lpsSource, int ncSource,int *width);
+int qr_image_size(int width);
+
+void qr_setmodule(uint8_t *image,int width,int x,int y,int value);
+int qr_getmodule(uint8_t *outputdata,int width,int x,int y);
+int qr_getmoduleC(uint8_t *outputdata,int width,int x,int y);
 void qr_dumpimage(uint8_t *image,int width);
 
+// Per-version tables, built on first use and shared by all encodes.
+const uint8_t  *qr_function_mask(int version);
+const uint8_t  *qr_function_image(int version);
+const uint16_t *qr_placement_map(int version,int *count);
+void qr_gather_codewords(const uint8_t *image,int version,uint8_t *codewords,int ncCodeWords);
+
 /////////////////////////////////////////////////////////////////////////////
 typedef struct tagRS_BLOCKINFO
 {
@@ -53,7 +131,8 @@ typedef struct tagQR_VERSIONINFO
 
 } QR_VERSIONINFO, *LPQR_VERSIONINFO;
 
-static QR_VERSIONINFO QR_VersionInfo[] = {{0}, // (ダミー:Ver.0)
+// Tables below are defined once for the whole program (C++17 inline variables).
+inline constexpr QR_VERSIONINFO QR_VersionInfo[] = {{0}, // (ダミー:Ver.0)
 										 { 1, // Ver.1
 										    26,   19,   16,   13,    9,
 										   0,   0,   0,   0,   0,   0,   0,
@@ -499,7 +578,7 @@ static QR_VERSIONINFO QR_VersionInfo[] = {{0}, // (ダミー:Ver.0)
 
 /////////////////////////////////////////////////////////////////////////////
 // GF(2^8)α指数→整数変換テーブル
-static uint8_t byExpToInt[] = {  1,   2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,
+inline constexpr uint8_t byExpToInt[] = {  1,   2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,
 							 76, 152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192,
 							157,  39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,
 							 70, 140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,
@@ -519,7 +598,7 @@ static uint8_t byExpToInt[] = {  1,   2,   4,   8,  16,  32,  64, 128,  29,  58,
 
 /////////////////////////////////////////////////////////////////////////////
 // GF(2^8)α整数→指数変換テーブル
-static uint8_t byIntToExp[] = {  0,   0,   1,  25,   2,  50,  26, 198,   3, 223,  51, 238,  27, 104, 199,  75,
+inline constexpr uint8_t byIntToExp[] = {  0,   0,   1,  25,   2,  50,  26, 198,   3, 223,  51, 238,  27, 104, 199,  75,
 							  4, 100, 224,  14,  52, 141, 239, 129,  28, 193, 105, 248, 200,   8,  76, 113,
 							  5, 138, 101,  47, 225,  36,  15,  33,  53, 147, 142, 218, 240,  18, 130,  69,
 							 29, 181, 194, 125, 106,  39, 249, 185, 201, 154,   9, 120,  77, 228, 114, 166,
@@ -539,82 +618,82 @@ static uint8_t byIntToExp[] = {  0,   0,   1,  25,   2,  50,  26, 198,   3, 223,
 
 /////////////////////////////////////////////////////////////////////////////
 // 誤り訂正生成多項式α係数
-static uint8_t byRSExp7[]  = {87, 229, 146, 149, 238, 102,  21};
-static uint8_t byRSExp10[] = {251,  67,  46,  61, 118,  70,  64,  94,  32,  45};
-static uint8_t byRSExp13[] = { 74, 152, 176, 100,  86, 100, 106, 104, 130, 218, 206, 140,  78};
-static uint8_t byRSExp15[] = {  8, 183,  61,  91, 202,  37,  51,  58,  58, 237, 140, 124,   5,  99, 105};
-static uint8_t byRSExp16[] = {120, 104, 107, 109, 102, 161,  76,   3,  91, 191, 147, 169, 182, 194, 225, 120};
-static uint8_t byRSExp17[] = { 43, 139, 206,  78,  43, 239, 123, 206, 214, 147,  24,  99, 150,  39, 243, 163, 136};
-static uint8_t byRSExp18[] = {215, 234, 158,  94, 184,  97, 118, 170,  79, 187, 152, 148, 252, 179,   5,  98,  96, 153};
-static uint8_t byRSExp20[] = { 17,  60,  79,  50,  61, 163,  26, 187, 202, 180, 221, 225,  83, 239, 156, 164, 212, 212, 188, 190};
-static uint8_t byRSExp22[] = {210, 171, 247, 242,  93, 230,  14, 109, 221,  53, 200,  74,   8, 172,  98,  80, 219, 134, 160, 105,
+inline constexpr uint8_t byRSExp7[]  = {87, 229, 146, 149, 238, 102,  21};
+inline constexpr uint8_t byRSExp10[] = {251,  67,  46,  61, 118,  70,  64,  94,  32,  45};
+inline constexpr uint8_t byRSExp13[] = { 74, 152, 176, 100,  86, 100, 106, 104, 130, 218, 206, 140,  78};
+inline constexpr uint8_t byRSExp15[] = {  8, 183,  61,  91, 202,  37,  51,  58,  58, 237, 140, 124,   5,  99, 105};
+inline constexpr uint8_t byRSExp16[] = {120, 104, 107, 109, 102, 161,  76,   3,  91, 191, 147, 169, 182, 194, 225, 120};
+inline constexpr uint8_t byRSExp17[] = { 43, 139, 206,  78,  43, 239, 123, 206, 214, 147,  24,  99, 150,  39, 243, 163, 136};
+inline constexpr uint8_t byRSExp18[] = {215, 234, 158,  94, 184,  97, 118, 170,  79, 187, 152, 148, 252, 179,   5,  98,  96, 153};
+inline constexpr uint8_t byRSExp20[] = { 17,  60,  79,  50,  61, 163,  26, 187, 202, 180, 221, 225,  83, 239, 156, 164, 212, 212, 188, 190};
+inline constexpr uint8_t byRSExp22[] = {210, 171, 247, 242,  93, 230,  14, 109, 221,  53, 200,  74,   8, 172,  98,  80, 219, 134, 160, 105,
 						   165, 231};
-static uint8_t byRSExp24[] = {229, 121, 135,  48, 211, 117, 251, 126, 159, 180, 169, 152, 192, 226, 228, 218, 111,   0, 117, 232,
+inline constexpr uint8_t byRSExp24[] = {229, 121, 135,  48, 211, 117, 251, 126, 159, 180, 169, 152, 192, 226, 228, 218, 111,   0, 117, 232,
 						    87,  96, 227,  21};
-static uint8_t byRSExp26[] = {173, 125, 158,   2, 103, 182, 118,  17, 145, 201, 111,  28, 165,  53, 161,  21, 245, 142,  13, 102,
+inline constexpr uint8_t byRSExp26[] = {173, 125, 158,   2, 103, 182, 118,  17, 145, 201, 111,  28, 165,  53, 161,  21, 245, 142,  13, 102,
 						    48, 227, 153, 145, 218,  70};
-static uint8_t byRSExp28[] = {168, 223, 200, 104, 224, 234, 108, 180, 110, 190, 195, 147, 205,  27, 232, 201,  21,  43, 245,  87,
+inline constexpr uint8_t byRSExp28[] = {168, 223, 200, 104, 224, 234, 108, 180, 110, 190, 195, 147, 205,  27, 232, 201,  21,  43, 245,  87,
 						    42, 195, 212, 119, 242,  37,   9, 123};
-static uint8_t byRSExp30[] = { 41, 173, 145, 152, 216,  31, 179, 182,  50,  48, 110,  86, 239,  96, 222, 125,  42, 173, 226, 193,
+inline constexpr uint8_t byRSExp30[] = { 41, 173, 145, 152, 216,  31, 179, 182,  50,  48, 110,  86, 239,  96, 222, 125,  42, 173, 226, 193,
 						   224, 130, 156,  37, 251, 216, 238,  40, 192, 180};
-static uint8_t byRSExp32[] = { 10,   6, 106, 190, 249, 167,   4,  67, 209, 138, 138,  32, 242, 123,  89,  27, 120, 185,  80, 156,
+inline constexpr uint8_t byRSExp32[] = { 10,   6, 106, 190, 249, 167,   4,  67, 209, 138, 138,  32, 242, 123,  89,  27, 120, 185,  80, 156,
 						    38,  69, 171,  60,  28, 222,  80,  52, 254, 185, 220, 241};
-static uint8_t byRSExp34[] = {111,  77, 146,  94,  26,  21, 108,  19, 105,  94, 113, 193,  86, 140, 163, 125,  58, 158, 229, 239,
+inline constexpr uint8_t byRSExp34[] = {111,  77, 146,  94,  26,  21, 108,  19, 105,  94, 113, 193,  86, 140, 163, 125,  58, 158, 229, 239,
 						   218, 103,  56,  70, 114,  61, 183, 129, 167,  13,  98,  62, 129,  51};
-static uint8_t byRSExp36[] = {200, 183,  98,  16, 172,  31, 246, 234,  60, 152, 115,   0, 167, 152, 113, 248, 238, 107,  18,  63,
+inline constexpr uint8_t byRSExp36[] = {200, 183,  98,  16, 172,  31, 246, 234,  60, 152, 115,   0, 167, 152, 113, 248, 238, 107,  18,  63,
 						   218,  37,  87, 210, 105, 177, 120,  74, 121, 196, 117, 251, 113, 233,  30, 120};
-static uint8_t byRSExp38[] = {159,  34,  38, 228, 230,  59, 243,  95,  49, 218, 176, 164,  20,  65,  45, 111,  39,  81,  49, 118,
+inline constexpr uint8_t byRSExp38[] = {159,  34,  38, 228, 230,  59, 243,  95,  49, 218, 176, 164,  20,  65,  45, 111,  39,  81,  49, 118,
 						   113, 222, 193, 250, 242, 168, 217,  41, 164, 247, 177,  30, 238,  18, 120, 153,  60, 193};
-static uint8_t byRSExp40[] = { 59, 116,  79, 161, 252,  98, 128, 205, 128, 161, 247,  57, 163,  56, 235, 106,  53,  26, 187, 174,
+inline constexpr uint8_t byRSExp40[] = { 59, 116,  79, 161, 252,  98, 128, 205, 128, 161, 247,  57, 163,  56, 235, 106,  53,  26, 187, 174,
 						   226, 104, 170,   7, 175,  35, 181, 114,  88,  41,  47, 163, 125, 134,  72,  20, 232,  53,  35,  15};
-static uint8_t byRSExp42[] = {250, 103, 221, 230,  25,  18, 137, 231,   0,   3,  58, 242, 221, 191, 110,  84, 230,   8, 188, 106,
+inline constexpr uint8_t byRSExp42[] = {250, 103, 221, 230,  25,  18, 137, 231,   0,   3,  58, 242, 221, 191, 110,  84, 230,   8, 188, 106,
 						    96, 147,  15, 131, 139,  34, 101, 223,  39, 101, 213, 199, 237, 254, 201, 123, 171, 162, 194, 117,
 						    50,  96};
-static uint8_t byRSExp44[] = {190,   7,  61, 121,  71, 246,  69,  55, 168, 188,  89, 243, 191,  25,  72, 123,   9, 145,  14, 247,
+inline constexpr uint8_t byRSExp44[] = {190,   7,  61, 121,  71, 246,  69,  55, 168, 188,  89, 243, 191,  25,  72, 123,   9, 145,  14, 247,
 						     1, 238,  44,  78, 143,  62, 224, 126, 118, 114,  68, 163,  52, 194, 217, 147, 204, 169,  37, 130,
 						   113, 102,  73, 181};
-static uint8_t byRSExp46[] = {112,  94,  88, 112, 253, 224, 202, 115, 187,  99,  89,   5,  54, 113, 129,  44,  58,  16, 135, 216,
+inline constexpr uint8_t byRSExp46[] = {112,  94,  88, 112, 253, 224, 202, 115, 187,  99,  89,   5,  54, 113, 129,  44,  58,  16, 135, 216,
 						   169, 211,  36,   1,   4,  96,  60, 241,  73, 104, 234,   8, 249, 245, 119, 174,  52,  25, 157, 224,
 						    43, 202, 223,  19,  82,  15};
-static uint8_t byRSExp48[] = {228,  25, 196, 130, 211, 146,  60,  24, 251,  90,  39, 102, 240,  61, 178,  63,  46, 123, 115,  18,
+inline constexpr uint8_t byRSExp48[] = {228,  25, 196, 130, 211, 146,  60,  24, 251,  90,  39, 102, 240,  61, 178,  63,  46, 123, 115,  18,
 						   221, 111, 135, 160, 182, 205, 107, 206,  95, 150, 120, 184,  91,  21, 247, 156, 140, 238, 191,  11,
 						    94, 227,  84,  50, 163,  39,  34, 108};
-static uint8_t byRSExp50[] = {232, 125, 157, 161, 164,   9, 118,  46, 209,  99, 203, 193,  35,   3, 209, 111, 195, 242, 203, 225,
+inline constexpr uint8_t byRSExp50[] = {232, 125, 157, 161, 164,   9, 118,  46, 209,  99, 203, 193,  35,   3, 209, 111, 195, 242, 203, 225,
 						    46,  13,  32, 160, 126, 209, 130, 160, 242, 215, 242,  75,  77,  42, 189,  32, 113,  65, 124,  69,
 						   228, 114, 235, 175, 124, 170, 215, 232, 133, 205};
-static uint8_t byRSExp52[] = {116,  50,  86, 186,  50, 220, 251,  89, 192,  46,  86, 127, 124,  19, 184, 233, 151, 215,  22,  14,
+inline constexpr uint8_t byRSExp52[] = {116,  50,  86, 186,  50, 220, 251,  89, 192,  46,  86, 127, 124,  19, 184, 233, 151, 215,  22,  14,
 						    59, 145,  37, 242, 203, 134, 254,  89, 190,  94,  59,  65, 124, 113, 100, 233, 235, 121,  22,  76,
 						    86,  97,  39, 242, 200, 220, 101,  33, 239, 254, 116,  51};
-static uint8_t byRSExp54[] = {183,  26, 201,  87, 210, 221, 113,  21,  46,  65,  45,  50, 238, 184, 249, 225, 102,  58, 209, 218,
+inline constexpr uint8_t byRSExp54[] = {183,  26, 201,  87, 210, 221, 113,  21,  46,  65,  45,  50, 238, 184, 249, 225, 102,  58, 209, 218,
 						   109, 165,  26,  95, 184, 192,  52, 245,  35, 254, 238, 175, 172,  79, 123,  25, 122,  43, 120, 108,
 						   215,  80, 128, 201, 235,   8, 153,  59, 101,  31, 198,  76,  31, 156};
-static uint8_t byRSExp56[] = {106, 120, 107, 157, 164, 216, 112, 116,   2,  91, 248, 163,  36, 201, 202, 229,   6, 144, 254, 155,
+inline constexpr uint8_t byRSExp56[] = {106, 120, 107, 157, 164, 216, 112, 116,   2,  91, 248, 163,  36, 201, 202, 229,   6, 144, 254, 155,
 						   135, 208, 170, 209,  12, 139, 127, 142, 182, 249, 177, 174, 190,  28,  10,  85, 239, 184, 101, 124,
 						   152, 206,  96,  23, 163,  61,  27, 196, 247, 151, 154, 202, 207,  20,  61,  10};
-static uint8_t byRSExp58[] = { 82, 116,  26, 247,  66,  27,  62, 107, 252, 182, 200, 185, 235,  55, 251, 242, 210, 144, 154, 237,
+inline constexpr uint8_t byRSExp58[] = { 82, 116,  26, 247,  66,  27,  62, 107, 252, 182, 200, 185, 235,  55, 251, 242, 210, 144, 154, 237,
 						   176, 141, 192, 248, 152, 249, 206,  85, 253, 142,  65, 165, 125,  23,  24,  30, 122, 240, 214,   6,
 						   129, 218,  29, 145, 127, 134, 206, 245, 117,  29,  41,  63, 159, 142, 233, 125, 148, 123};
-static uint8_t byRSExp60[] = {107, 140,  26,  12,   9, 141, 243, 197, 226, 197, 219,  45, 211, 101, 219, 120,  28, 181, 127,   6,
+inline constexpr uint8_t byRSExp60[] = {107, 140,  26,  12,   9, 141, 243, 197, 226, 197, 219,  45, 211, 101, 219, 120,  28, 181, 127,   6,
 						   100, 247,   2, 205, 198,  57, 115, 219, 101, 109, 160,  82,  37,  38, 238,  49, 160, 209, 121,  86,
 						    11, 124,  30, 181,  84,  25, 194,  87,  65, 102, 190, 220,  70,  27, 209,  16,  89,   7,  33, 240};
-static uint8_t byRSExp62[] = { 65, 202, 113,  98,  71, 223, 248, 118, 214,  94,   0, 122,  37,  23,   2, 228,  58, 121,   7, 105,
+inline constexpr uint8_t byRSExp62[] = { 65, 202, 113,  98,  71, 223, 248, 118, 214,  94,   0, 122,  37,  23,   2, 228,  58, 121,   7, 105,
 						   135,  78, 243, 118,  70,  76, 223,  89,  72,  50,  70, 111, 194,  17, 212, 126, 181,  35, 221, 117,
 						   235,  11, 229, 149, 147, 123, 213,  40, 115,   6, 200, 100,  26, 246, 182, 218, 127, 215,  36, 186,
 						   110, 106};
-static uint8_t byRSExp64[] = { 45,  51, 175,   9,   7, 158, 159,  49,  68, 119,  92, 123, 177, 204, 187, 254, 200,  78, 141, 149,
+inline constexpr uint8_t byRSExp64[] = { 45,  51, 175,   9,   7, 158, 159,  49,  68, 119,  92, 123, 177, 204, 187, 254, 200,  78, 141, 149,
 						   119,  26, 127,  53, 160,  93, 199, 212,  29,  24, 145, 156, 208, 150, 218, 209,   4, 216,  91,  47,
 						   184, 146,  47, 140, 195, 195, 125, 242, 238,  63,  99, 108, 140, 230, 242,  31, 204,  11, 178, 243,
 						   217, 156, 213, 231};
-static uint8_t byRSExp66[] = {  5, 118, 222, 180, 136, 136, 162,  51,  46, 117,  13, 215,  81,  17, 139, 247, 197, 171,  95, 173,
+inline constexpr uint8_t byRSExp66[] = {  5, 118, 222, 180, 136, 136, 162,  51,  46, 117,  13, 215,  81,  17, 139, 247, 197, 171,  95, 173,
 						    65, 137, 178,  68, 111,  95, 101,  41,  72, 214, 169, 197,  95,   7,  44, 154,  77, 111, 236,  40,
 						   121, 143,  63,  87,  80, 253, 240, 126, 217,  77,  34, 232, 106,  50, 168,  82,  76, 146,  67, 106,
 						   171,  25, 132,  93,  45, 105};
-static uint8_t byRSExp68[] = {247, 159, 223,  33, 224,  93,  77,  70,  90, 160,  32, 254,  43, 150,  84, 101, 190, 205, 133,  52,
+inline constexpr uint8_t byRSExp68[] = {247, 159, 223,  33, 224,  93,  77,  70,  90, 160,  32, 254,  43, 150,  84, 101, 190, 205, 133,  52,
 						    60, 202, 165, 220, 203, 151,  93,  84,  15,  84, 253, 173, 160,  89, 227,  52, 199,  97,  95, 231,
 						    52, 177,  41, 125, 137, 241, 166, 225, 118,   2,  54,  32,  82, 215, 175, 198,  43, 238, 235,  27,
 						   101, 184, 127,   3,   5,   8, 163, 238};
 
-static uint8_t* 
+inline constexpr const uint8_t *
 							byRSExp[] = {NULL,      NULL,      NULL,      NULL,      NULL,      NULL,      NULL,      byRSExp7,  NULL,      NULL,
 							byRSExp10, NULL,      NULL,      byRSExp13, NULL,      byRSExp15, byRSExp16, byRSExp17, byRSExp18, NULL,
 							byRSExp20, NULL,      byRSExp22, NULL,      byRSExp24, NULL,      byRSExp26, NULL,      byRSExp28, NULL,
@@ -624,9 +703,9 @@ static uint8_t*
 							byRSExp60, NULL,      byRSExp62, NULL,      byRSExp64, NULL,      byRSExp66, NULL,      byRSExp68};
 
 // 文字数インジケータビット長(バージョングループ別, {S, M, L})
-static int nIndicatorLenNumeral[]  = {10, 12, 14};
-static int nIndicatorLenAlphabet[] = { 9, 11, 13};
-static int nIndicatorLen8Bit[]	   = { 8, 16, 16};
-static int nIndicatorLenKanji[]	   = { 8, 10, 12};
+inline constexpr int nIndicatorLenNumeral[]  = {10, 12, 14};
+inline constexpr int nIndicatorLenAlphabet[] = { 9, 11, 13};
+inline constexpr int nIndicatorLen8Bit[]	   = { 8, 16, 16};
+inline constexpr int nIndicatorLenKanji[]	   = { 8, 10, 12};
 
 #endif
@@ -0,0 +1,401 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <mutex>
+#include "qr_encodeem.h"
+#include "qr_image.h"
+
+// 画像一辺の上限(ピクセル)
+#define QR_IMAGE_MAXPIXELS  65536
+
+// IDAT チャンク 1 個のデータ長
+#define QR_PNG_CHUNK        16384
+
+int qr_image_pixels(int width,int nScale,int nQuietZone) {
+  if(width <= 0 || nScale <= 0 || nQuietZone < 0) return 0;
+
+  int64_t nPixels = (int64_t)(width + 2 * (int64_t)nQuietZone) * nScale;
+  return nPixels <= QR_IMAGE_MAXPIXELS ? (int)nPixels : 0;
+}
+
+int qr_image_row_bytes(int width,int nScale,int nQuietZone) {
+  return (qr_image_pixels(width,nScale,nQuietZone) + 7) / 8;
+}
+
+// Sets n pixels from x on, MSB first.
+static inline void set_run(uint8_t *row,int x,int n) {
+  int nEnd = x + n - 1;
+  int b0 = x >> 3, b1 = nEnd >> 3;
+  uint8_t m0 = (uint8_t)(0xff >> (x & 7));
+  uint8_t m1 = (uint8_t)(0xff << (7 - (nEnd & 7)));
+
+  if(b0 == b1) {
+    row[b0] |= m0 & m1;
+  } else {
+    row[b0] |= m0;
+    memset(row + b0 + 1,0xff,b1 - b0 - 1);
+    row[b1] |= m1;
+  }
+}
+
+// Scanline of module row my (-nQuietZone .. width + nQuietZone - 1).
+static void module_row(const uint8_t *image,int width,int nScale,int nQuietZone,int my,uint8_t *row,int ncRow) {
+  memset(row,0,ncRow);
+  if(my < 0 || my >= width) return;
+
+  // 連続する暗モジュールをまとめて描画(qr_getmodule の配置を直接読む)
+  int nBit = my * width;
+  int mx = 0;
+  while(mx < width) {
+    if(!((image[(nBit + mx) >> 3] >> ((nBit + mx) & 7)) & 1)) { mx++; continue; }
+
+    int nStart = mx;
+    while(mx < width && ((image[(nBit + mx) >> 3] >> ((nBit + mx) & 7)) & 1)) mx++;
+    set_run(row,(nQuietZone + nStart) * nScale,(mx - nStart) * nScale);
+  }
+}
+
+void qr_image_row(const uint8_t *image,int width,int nScale,int nQuietZone,int y,uint8_t *row) {
+  int ncRow = qr_image_row_bytes(width,nScale,nQuietZone);
+  if(ncRow == 0) return;
+
+  module_row(image,width,nScale,nQuietZone,y / nScale - nQuietZone,row,ncRow);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PNG
+
+// 固定ハフマン符号(ビット反転済み)
+static uint16_t PngLitCode[257];
+static uint8_t  PngLitBits[257];
+
+// 一致長 3-258 の長さ符号 + 拡張ビット + 距離 1 (符号 0、5 ビット)
+static uint32_t PngMatchCode[259];
+static uint8_t  PngMatchBits[259];
+
+static uint32_t PngCrcTable[256];
+static std::once_flag PngTablesOnce;
+
+static uint32_t reverse_bits(uint32_t nCode,int ncBits) {
+  uint32_t nResult = 0;
+  for(int n=0;n<ncBits;n++) nResult |= ((nCode >> n) & 1) << (ncBits - 1 - n);
+  return nResult;
+}
+
+static void fixed_code(int nSymbol,uint32_t *nCode,int *ncBits) {
+  if(nSymbol < 144)      { *nCode = 0x30 + nSymbol;           *ncBits = 8; }
+  else if(nSymbol < 256) { *nCode = 0x190 + (nSymbol - 144);  *ncBits = 9; }
+  else if(nSymbol < 280) { *nCode = nSymbol - 256;            *ncBits = 7; }
+  else                   { *nCode = 0xc0 + (nSymbol - 280);   *ncBits = 8; }
+  *nCode = reverse_bits(*nCode,*ncBits);
+}
+
+static void build_png_tables() {
+  static const int nLenBase[29]  = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+  static const int nLenExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+
+  for(int n=0;n<=256;n++) {
+    uint32_t nCode;
+    int      ncBits;
+    fixed_code(n,&nCode,&ncBits);
+    PngLitCode[n] = (uint16_t)nCode;
+    PngLitBits[n] = (uint8_t)ncBits;
+  }
+
+  for(int nLen=3;nLen<=258;nLen++) {
+    int i = 28;
+    while(nLenBase[i] > nLen) i--;
+
+    uint32_t nCode;
+    int      ncBits;
+    fixed_code(257 + i,&nCode,&ncBits);
+    PngMatchCode[nLen] = nCode | (uint32_t)(nLen - nLenBase[i]) << ncBits;
+    PngMatchBits[nLen] = (uint8_t)(ncBits + nLenExtra[i] + 5);
+  }
+
+  for(uint32_t n=0;n<256;n++) {
+    uint32_t c = n;
+    for(int k=0;k<8;k++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    PngCrcTable[n] = c;
+  }
+}
+
+static uint32_t crc32_update(uint32_t nCrc,const uint8_t *data,size_t ncData) {
+  for(size_t n=0;n<ncData;n++) nCrc = PngCrcTable[(nCrc ^ data[n]) & 0xff] ^ (nCrc >> 8);
+  return nCrc;
+}
+
+static inline void put_be32(uint8_t *p,uint32_t n) {
+  p[0] = (uint8_t)(n >> 24); p[1] = (uint8_t)(n >> 16); p[2] = (uint8_t)(n >> 8); p[3] = (uint8_t)n;
+}
+
+typedef struct tagPNG_WRITER
+{
+	QR_WRITEFUNC fnWrite;
+	void        *arg;
+	bool         bError;
+
+	// チャンク長(4) + 種別(4) + データ + CRC(4)、末尾の書き出し分の余裕あり
+	uint8_t  byChunk[8 + QR_PNG_CHUNK + 16];
+	int      ncChunk;
+
+	uint64_t nBits;  // 未出力ビット(LSB から)
+	int      ncBits;
+	int      nPrev;  // 直前の非圧縮バイト(-1 = なし)
+	uint32_t nAdlerA, nAdlerB;
+} PNG_WRITER;
+
+// byChunk holds ncData bytes at offset 8, the header and CRC go around them.
+static void emit_chunk(PNG_WRITER *w,uint8_t *byChunk,const char *szType,int ncData) {
+  if(w->bError) return;
+
+  put_be32(byChunk,(uint32_t)ncData);
+  memcpy(byChunk + 4,szType,4);
+  put_be32(byChunk + 8 + ncData,crc32_update(0xffffffff,byChunk + 4,ncData + 4) ^ 0xffffffff);
+  if(!w->fnWrite(w->arg,byChunk,ncData + 12)) w->bError = true;
+}
+
+static void flush_idat(PNG_WRITER *w) {
+  if(w->ncChunk == 0) return;
+  emit_chunk(w,w->byChunk,"IDAT",w->ncChunk);
+  w->ncChunk = 0;
+}
+
+static inline void put_byte(PNG_WRITER *w,uint8_t by) {
+  w->byChunk[8 + w->ncChunk++] = by;
+}
+
+static inline void put_bits(PNG_WRITER *w,uint32_t nCode,int ncBits) {
+  w->nBits  |= (uint64_t)nCode << w->ncBits;
+  w->ncBits += ncBits;
+
+  if(w->ncBits >= 32) {
+    uint8_t *p = w->byChunk + 8 + w->ncChunk;
+    p[0] = (uint8_t)w->nBits; p[1] = (uint8_t)(w->nBits >> 8); p[2] = (uint8_t)(w->nBits >> 16); p[3] = (uint8_t)(w->nBits >> 24);
+    w->ncChunk += 4;
+    w->nBits  >>= 32;
+    w->ncBits  -= 32;
+    if(w->ncChunk >= QR_PNG_CHUNK) flush_idat(w);
+  }
+}
+
+static void adler_update(PNG_WRITER *w,const uint8_t *data,int ncData) {
+  uint32_t a = w->nAdlerA, b = w->nAdlerB;
+  while(ncData > 0) {
+    int n = ncData < 5552 ? ncData : 5552;
+    ncData -= n;
+    while(n--) { a += *data++; b += a; }
+    a %= 65521;
+    b %= 65521;
+  }
+  w->nAdlerA = a;
+  w->nAdlerB = b;
+}
+
+// Adler-32 of ncData copies of by, in closed form.
+static void adler_repeat(PNG_WRITER *w,uint8_t by,int ncData) {
+  uint64_t n = (uint64_t)ncData;
+  uint64_t b = w->nAdlerB + (n % 65521) * w->nAdlerA + by * ((n * (n + 1) / 2) % 65521);
+  w->nAdlerA = (uint32_t)((w->nAdlerA + by * (n % 65521)) % 65521);
+  w->nAdlerB = (uint32_t)(b % 65521);
+}
+
+// ncData copies of by: a literal unless it continues the previous byte,
+// then distance 1 matches.
+static void deflate_repeat(PNG_WRITER *w,uint8_t by,int ncData) {
+  if(w->nPrev != by) {
+    put_bits(w,PngLitCode[by],PngLitBits[by]);
+    w->nPrev = by;
+    ncData--;
+  }
+
+  while(ncData >= 3) {
+    int n = ncData < 258 ? ncData : 258;
+    put_bits(w,PngMatchCode[n],PngMatchBits[n]);
+    ncData -= n;
+  }
+
+  while(ncData-- > 0) put_bits(w,PngLitCode[by],PngLitBits[by]);
+}
+
+static void deflate_bytes(PNG_WRITER *w,const uint8_t *data,int ncData) {
+  int n = 0;
+  while(n < ncData) {
+    int nRun = 1;
+    while(n + nRun < ncData && data[n + nRun] == data[n]) nRun++;
+
+    if(nRun >= 3 || data[n] == w->nPrev) {
+      deflate_repeat(w,data[n],nRun);
+    } else {
+      for(int k=0;k<nRun;k++) put_bits(w,PngLitCode[data[n]],PngLitBits[data[n]]);
+      w->nPrev = data[n];
+    }
+    n += nRun;
+  }
+}
+
+static bool write_png(const uint8_t *image,int width,int nScale,int nQuietZone,uint8_t *row,QR_WRITEFUNC fnWrite,void *arg) {
+  std::call_once(PngTablesOnce,build_png_tables);
+
+  int nPixels = qr_image_pixels(width,nScale,nQuietZone);
+  int ncRow   = (nPixels + 7) / 8;
+
+  PNG_WRITER *w = new PNG_WRITER;
+  w->fnWrite = fnWrite;
+  w->arg     = arg;
+  w->bError  = false;
+  w->ncChunk = 0;
+  w->nBits   = 0;
+  w->ncBits  = 0;
+  w->nPrev   = -1;
+  w->nAdlerA = 1;
+  w->nAdlerB = 0;
+
+  static const uint8_t bySignature[8] = {0x89,'P','N','G','\r','\n',0x1a,'\n'};
+  if(!fnWrite(arg,bySignature,8)) w->bError = true;
+
+  uint8_t byHeader[8 + 13 + 4];
+  put_be32(byHeader + 8,nPixels);
+  put_be32(byHeader + 12,nPixels);
+  byHeader[16] = 1; // ビット深度
+  byHeader[17] = 0; // グレースケール
+  byHeader[18] = 0; // deflate
+  byHeader[19] = 0; // フィルタ方式
+  byHeader[20] = 0; // インターレースなし
+  emit_chunk(w,byHeader,"IHDR",13);
+
+  // zlib ヘッダ(最速圧縮)、最終ブロック、固定ハフマン
+  put_byte(w,0x78);
+  put_byte(w,0x01);
+  put_bits(w,3,3);
+
+  static const uint8_t byFilterNone = 0, byFilterUp = 2;
+
+  for(int my=-nQuietZone;my<width+nQuietZone && !w->bError;my++) {
+    // Quiet zone rows after the first repeat the one above as well.
+    bool bRepeat = my > -nQuietZone && (my < 0 || my > width);
+
+    if(!bRepeat) {
+      module_row(image,width,nScale,nQuietZone,my,row,ncRow);
+      for(int n=0;n<ncRow;n++) row[n] = (uint8_t)~row[n]; // 0 = 黒
+
+      adler_update(w,&byFilterNone,1);
+      adler_update(w,row,ncRow);
+      deflate_repeat(w,byFilterNone,1);
+      deflate_bytes(w,row,ncRow);
+    }
+
+    for(int s=bRepeat?0:1;s<nScale;s++) {
+      adler_update(w,&byFilterUp,1);
+      adler_repeat(w,0,ncRow);
+      deflate_repeat(w,byFilterUp,1);
+      deflate_repeat(w,0,ncRow);
+    }
+  }
+
+  // ブロック終端、バイト境界まで詰めて Adler-32
+  put_bits(w,PngLitCode[256],PngLitBits[256]);
+  put_bits(w,0,(8 - (w->ncBits & 7)) & 7);
+  while(w->ncBits > 0) {
+    put_byte(w,(uint8_t)w->nBits);
+    w->nBits >>= 8;
+    w->ncBits -= 8;
+  }
+  put_be32(w->byChunk + 8 + w->ncChunk,(w->nAdlerB << 16) | w->nAdlerA);
+  w->ncChunk += 4;
+  flush_idat(w);
+
+  uint8_t byEnd[12];
+  emit_chunk(w,byEnd,"IEND",0);
+
+  bool bResult = !w->bError;
+  delete w;
+  return bResult;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PBM
+
+static bool write_pbm(const uint8_t *image,int width,int nScale,int nQuietZone,uint8_t *row,QR_WRITEFUNC fnWrite,void *arg) {
+  int nPixels = qr_image_pixels(width,nScale,nQuietZone);
+  int ncRow   = (nPixels + 7) / 8;
+
+  char szHeader[32];
+  int  ncHeader = snprintf(szHeader,sizeof(szHeader),"P4\n%d %d\n",nPixels,nPixels);
+  if(!fnWrite(arg,(const uint8_t *)szHeader,ncHeader)) return false;
+
+  for(int my=-nQuietZone;my<width+nQuietZone;my++) {
+    // 静穏領域は 2 行目以降も同じ空行
+    bool bRepeat = my > -nQuietZone && (my < 0 || my > width);
+    if(!bRepeat) module_row(image,width,nScale,nQuietZone,my,row,ncRow);
+
+    for(int s=0;s<nScale;s++) {
+      if(!fnWrite(arg,row,ncRow)) return false;
+    }
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_write_image
+// 用  途：画像出力
+// 引  数：シンボル、一辺モジュール数、画像形式、拡大率、静穏領域(モジュール数)、出力関数、出力関数引数
+// 戻り値：成功時=true、引数不正または出力関数が false を返した時=false
+
+bool qr_write_image(const uint8_t *image,int width,int nFormat,int nScale,int nQuietZone,QR_WRITEFUNC fnWrite,void *arg) {
+  int ncRow = qr_image_row_bytes(width,nScale,nQuietZone);
+  if(image == NULL || fnWrite == NULL || ncRow == 0) return false;
+  if(nFormat != QR_IMAGE_PBM && nFormat != QR_IMAGE_PNG) return false;
+
+  uint8_t *row = new uint8_t[ncRow];
+  bool bResult = nFormat == QR_IMAGE_PNG ? write_png(image,width,nScale,nQuietZone,row,fnWrite,arg)
+                                         : write_pbm(image,width,nScale,nQuietZone,row,fnWrite,arg);
+  delete [] row;
+  return bResult;
+}
+
+// 出力をまとめて write(2) の回数を抑える
+typedef struct tagFD_WRITER
+{
+	int     fd;
+	size_t  ncBuf;
+	uint8_t byBuf[8192];
+} FD_WRITER;
+
+static bool write_all(int fd,const uint8_t *data,size_t ncData) {
+  while(ncData > 0) {
+    ssize_t n = write(fd,data,ncData);
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      return false;
+    }
+    data   += n;
+    ncData -= (size_t)n;
+  }
+  return true;
+}
+
+static bool fd_write(void *arg,const uint8_t *data,size_t ncData) {
+  FD_WRITER *w = (FD_WRITER *)arg;
+
+  if(w->ncBuf + ncData > sizeof(w->byBuf)) {
+    if(!write_all(w->fd,w->byBuf,w->ncBuf)) return false;
+    w->ncBuf = 0;
+    if(ncData > sizeof(w->byBuf)) return write_all(w->fd,data,ncData);
+  }
+
+  memcpy(w->byBuf + w->ncBuf,data,ncData);
+  w->ncBuf += ncData;
+  return true;
+}
+
+bool qr_write_image_fd(const uint8_t *image,int width,int nFormat,int nScale,int nQuietZone,int fd) {
+  FD_WRITER w;
+  w.fd    = fd;
+  w.ncBuf = 0;
+
+  if(!qr_write_image(image,width,nFormat,nScale,nQuietZone,fd_write,&w)) return false;
+  return write_all(fd,w.byBuf,w.ncBuf);
+}
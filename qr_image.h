@@ -0,0 +1,45 @@
+#ifndef QR_IMAGE_H
+#define QR_IMAGE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Image output.
+//
+// Rasterizes a symbol in the qr_getmodule() layout to PBM (P4) or PNG with
+// each module drawn as nScale x nScale pixels and nQuietZone light modules
+// around it. Output is produced one scanline at a time and handed to a
+// write callback, so only a scanline (plus a small compression buffer for
+// PNG) is ever held in memory, whatever the scale.
+//
+// PNG is written as 1-bit grayscale. A scanline that repeats the one above
+// uses the Up filter and becomes all zeros, the others are left unfiltered,
+// and the zlib stream is a single fixed-Huffman block with run-length
+// matches only (zlib's Z_RLE with Z_FIXED), which is what 1-bit scaled
+// images compress best with for the time spent. No zlib is needed.
+
+// 画像形式
+#define QR_IMAGE_PBM  0 // Netpbm P4
+#define QR_IMAGE_PNG  1 // グレースケール 1 ビット
+
+// 4 モジュール(規格上の最小値)
+#define QR_IMAGE_QUIETZONE  4
+
+// Called with consecutive pieces of the file. Returning false aborts the
+// write, qr_write_image() then returns false.
+typedef bool (*QR_WRITEFUNC)(void *arg,const uint8_t *data,size_t ncData);
+
+// Pixels per side of the image, 0 when nScale or nQuietZone is out of range.
+int qr_image_pixels(int width,int nScale,int nQuietZone);
+
+// Bytes per packed scanline, (pixels + 7) / 8.
+int qr_image_row_bytes(int width,int nScale,int nQuietZone);
+
+// Scanline y of the image, MSB first, 1 = dark (the PBM convention) and
+// unused bits in the last byte cleared. For callers with their own sink.
+void qr_image_row(const uint8_t *image,int width,int nScale,int nQuietZone,int y,uint8_t *row);
+
+bool qr_write_image(const uint8_t *image,int width,int nFormat,int nScale,int nQuietZone,QR_WRITEFUNC fnWrite,void *arg);
+
+// Same, to a file descriptor (retries short writes and EINTR).
+bool qr_write_image_fd(const uint8_t *image,int width,int nFormat,int nScale,int nQuietZone,int fd);
+#endif
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <string.h>
+#include "qr_layout.h"
+
+#define MAX_MODULESIZE  177 // 一辺モジュール数最大値
+#define ROW_WORDS         3 // 177 ビット
+
+const QR_LAYOUT QR_LAYOUT_DEFAULT = {QR_ALIGN_PACKED,QR_BITORDER_LSB};
+
+// バイト内ビット反転
+static const uint8_t ReverseBits[256] = {
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
+  R6(0), R6(2), R6(1), R6(3)
+#undef R2
+#undef R4
+#undef R6
+};
+
+int qr_layout_stride(const QR_LAYOUT *layout,int width) {
+  if(layout->nAlign == QR_ALIGN_PACKED) return 0;
+  return (width + layout->nAlign * 8 - 1) / (layout->nAlign * 8) * layout->nAlign;
+}
+
+int qr_layout_size(const QR_LAYOUT *layout,int width) {
+  if(layout->nAlign == QR_ALIGN_PACKED) return (width * width + 7) / 8;
+  return qr_layout_stride(layout,width) * width;
+}
+
+// Bit position of a module, counted LSB first.
+static inline int module_bit(const QR_LAYOUT *layout,int width,int x,int y) {
+  int nRowBits = layout->nAlign == QR_ALIGN_PACKED ? width : qr_layout_stride(layout,width) * 8;
+  int nBit = y * nRowBits + x;
+  return layout->nBitOrder == QR_BITORDER_MSB ? nBit ^ 7 : nBit;
+}
+
+int qr_layout_getmodule(const uint8_t *image,const QR_LAYOUT *layout,int width,int x,int y) {
+  int nBit = module_bit(layout,width,x,y);
+  return (image[nBit >> 3] >> (nBit & 7)) & 1;
+}
+
+void qr_layout_setmodule(uint8_t *image,const QR_LAYOUT *layout,int width,int x,int y,int value) {
+  int nBit = module_bit(layout,width,x,y);
+
+  if(value != 0) image[nBit >> 3] |= (uint8_t)(1 << (nBit & 7));
+            else image[nBit >> 3] &= (uint8_t)~(1 << (nBit & 7));
+}
+
+static inline uint64_t load_le64(const uint8_t *p) {
+  uint64_t n = 0;
+  for(int k=7;k>=0;k--) n = (n << 8) | p[k];
+  return n;
+}
+
+static inline void store_le64(uint8_t *p,uint64_t n) {
+  for(int k=0;k<8;k++,n>>=8) p[k] = (uint8_t)n;
+}
+
+// Row y as LSB first words, bits past the width cleared.
+static void read_row(const uint8_t *image,const QR_LAYOUT *layout,int width,int y,uint64_t *row) {
+  // Bytes of the row, plus slack so every word load below is in bounds.
+  uint8_t byRow[ROW_WORDS * 8 + 16];
+  int nBit, ncBytes = (width + 7) / 8;
+
+  if(layout->nAlign == QR_ALIGN_PACKED) {
+    nBit    = y * width;
+    ncBytes = ((nBit & 7) + width + 7) / 8;
+    memcpy(byRow,image + (nBit >> 3),ncBytes);
+    nBit &= 7;
+  } else {
+    memcpy(byRow,image + y * qr_layout_stride(layout,width),ncBytes);
+    nBit = 0;
+  }
+  memset(byRow + ncBytes,0,sizeof(byRow) - ncBytes);
+
+  if(layout->nBitOrder == QR_BITORDER_MSB)
+    for(int n=0;n<ncBytes;n++) byRow[n] = ReverseBits[byRow[n]];
+
+  for(int w=0;w<ROW_WORDS;w++) {
+    uint64_t n = load_le64(byRow + w * 8) >> nBit;
+    if(nBit) n |= load_le64(byRow + w * 8 + 8) << (64 - nBit);
+    row[w] = n;
+  }
+
+  // 行末以降のビットを消去
+  for(int w=0;w<ROW_WORDS;w++) {
+    int nBits = width - w * 64;
+    if(nBits <= 0) row[w] = 0;
+    else if(nBits < 64) row[w] &= ((uint64_t)1 << nBits) - 1;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_layout_convert
+// 用  途：レイアウト変換
+// 引  数：変換元シンボル、変換元レイアウト、変換先、変換先レイアウト、一辺モジュール数
+
+void qr_layout_convert(const uint8_t *src,const QR_LAYOUT *srcLayout,uint8_t *dst,const QR_LAYOUT *dstLayout,int width) {
+  if(width <= 0 || width > MAX_MODULESIZE) return;
+
+  bool bMSB = dstLayout->nBitOrder == QR_BITORDER_MSB;
+
+  if(dstLayout->nAlign != QR_ALIGN_PACKED) {
+    int nStride = qr_layout_stride(dstLayout,width);
+
+    for(int y=0;y<width;y++) {
+      uint64_t row[ROW_WORDS];
+      uint8_t  byRow[ROW_WORDS * 8];
+      read_row(src,srcLayout,width,y,row);
+
+      for(int w=0;w<ROW_WORDS;w++) store_le64(byRow + w * 8,row[w]);
+      if(bMSB) for(int n=0;n<nStride;n++) byRow[n] = ReverseBits[byRow[n]];
+      memcpy(dst + y * nStride,byRow,nStride);
+    }
+    return;
+  }
+
+  // 連続ビット列へは 64 ビット単位で追記
+  uint64_t nAcc = 0;
+  int      ncAcc = 0;
+  uint8_t *p = dst;
+
+  for(int y=0;y<width;y++) {
+    uint64_t row[ROW_WORDS];
+    read_row(src,srcLayout,width,y,row);
+
+    for(int w=0;w*64<width;w++) {
+      int nBits = width - w * 64 < 64 ? width - w * 64 : 64;
+
+      nAcc |= row[w] << ncAcc;
+      if(ncAcc + nBits >= 64) {
+        store_le64(p,nAcc);
+        p += 8;
+        nAcc = ncAcc ? row[w] >> (64 - ncAcc) : 0;
+      }
+      ncAcc = (ncAcc + nBits) & 63;
+    }
+  }
+
+  for(int n=0;n<ncAcc;n+=8,nAcc>>=8) *p++ = (uint8_t)nAcc;
+
+  if(bMSB) {
+    int ncBytes = (width * width + 7) / 8;
+    for(int n=0;n<ncBytes;n++) dst[n] = ReverseBits[dst[n]];
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef QR_LAYOUT_H
+#define QR_LAYOUT_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Symbol bitmap layouts.
+//
+// The encoder's own layout is one continuous bit stream: module (x,y) is
+// bit y*width+x, LSB first within each byte (qr_getmodule()), so rows start
+// at arbitrary bit offsets. The aligned layouts start every row on a byte,
+// 32-bit or 64-bit boundary instead, with the padding bits at the end of
+// each row cleared, so rows can be copied and processed a word at a time.
+// Either can be LSB first (x = 0 in bit 0, little endian word loads see
+// module x at bit x) or MSB first (x = 0 in bit 7, as PBM and most 1-bit
+// framebuffers and printers expect).
+//
+// qr_encoder_ctx_set_layout() makes qr_encode_data_ctx() write its symbols
+// in a given layout.
+
+// 行揃え
+#define QR_ALIGN_PACKED  0 // 行間の詰めなし
+#define QR_ALIGN_8       1 // バイト境界
+#define QR_ALIGN_32      4
+#define QR_ALIGN_64      8
+
+// バイト内のビット順
+#define QR_BITORDER_LSB  0 // x = 0 が最下位ビット
+#define QR_BITORDER_MSB  1 // x = 0 が最上位ビット
+
+typedef struct tagQR_LAYOUT
+{
+	int nAlign;    // QR_ALIGN_*
+	int nBitOrder; // QR_BITORDER_*
+} QR_LAYOUT;
+
+// qr_getmodule() のレイアウト
+extern const QR_LAYOUT QR_LAYOUT_DEFAULT;
+
+// Bytes from one row to the next, 0 for QR_ALIGN_PACKED.
+int qr_layout_stride(const QR_LAYOUT *layout,int width);
+
+// Bytes for a whole symbol, qr_image_size() for the default layout.
+int qr_layout_size(const QR_LAYOUT *layout,int width);
+
+int  qr_layout_getmodule(const uint8_t *image,const QR_LAYOUT *layout,int width,int x,int y);
+void qr_layout_setmodule(uint8_t *image,const QR_LAYOUT *layout,int width,int x,int y,int value);
+
+// Rewrites a symbol from one layout into another. dst must not overlap src
+// and needs qr_layout_size(dstLayout,width) bytes.
+void qr_layout_convert(const uint8_t *src,const QR_LAYOUT *srcLayout,uint8_t *dst,const QR_LAYOUT *dstLayout,int width);
+#endif
@@ -0,0 +1,364 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <immintrin.h>
+#include "qr_encodeem.h"
+#include "qr_penalty.h"
+
+#define MAX_MODULESIZE 177 // 一辺モジュール数最大値
+#define LINE_WORDS       4 // 177 bits rounded up to one 256-bit vector
+
+// One row or column of the symbol, bit n = module n. Bits past the symbol
+// edge are always zero, which is what lets the "or outside the symbol"
+// clauses of the rules fall out of plain shifts.
+typedef uint64_t LINE[LINE_WORDS];
+
+/////////////////////////////////////////////////////////////////////////////
+// Per-width constants
+//
+// The run length and dark ratio rules of CountPenaltyReference() read the
+// modules through qr_getmoduleC(), which only looks at the timing, separator,
+// format and finder areas and not at the image. Their contribution only
+// depends on the width, as does the +40 the column finder rule scores on
+// the first module of every column. All of it is worked out once per
+// version, together with the column copy of the qr_getmoduleC() area that
+// the column finder rule looks at.
+
+typedef struct tagQR_PENALTYCONST
+{
+	int  nPenalty;                    // 画像に依存しない加算分
+	LINE lineAreaCol[MAX_MODULESIZE]; // qr_getmoduleC() 該当モジュール(列)
+	LINE lineRange2x2;                // 0 .. width-2
+	LINE lineRangeRow;                // 0 .. width-7
+	LINE lineRangeCol;                // 1 .. width-7
+} QR_PENALTYCONST;
+
+static QR_PENALTYCONST QR_PenaltyConst[41];
+static std::once_flag  QR_PenaltyConstOnce[41];
+
+static void set_range(LINE line,int first,int last) {
+  memset(line,0,sizeof(LINE));
+  for(int n=first;n<=last;n++) line[n/64] |= (uint64_t)1 << (n%64);
+}
+
+static void build_penalty_const(int version) {
+  QR_PENALTYCONST &c = QR_PenaltyConst[version];
+  int width = version * 4 + 17;
+  int nPenalty = 0;
+  int i, j, k;
+
+  // Same loops as CountPenaltyReference(), the image is never read.
+
+	// 同色の列の隣接モジュール
+	for (i = 0; i < width; ++i)
+	{
+		for (j = 0; j < width - 4; ++j)
+		{
+			int nCount = 1;
+
+			for (k = j + 1; k < width; k++)
+			{
+				if ((qr_getmoduleC(NULL,width,i,j) == 0) == (qr_getmoduleC(NULL,width,i,k) == 0))
+					++nCount;
+				else
+					break;
+			}
+
+			if (nCount >= 5)
+				nPenalty += 3 + (nCount - 5);
+
+			j = k - 1;
+		}
+	}
+
+	// 同色の行の隣接モジュール
+	for (i = 0; i < width; ++i)
+	{
+		for (j = 0; j < width - 4; ++j)
+		{
+			int nCount = 1;
+
+			for (k = j + 1; k < width; k++)
+			{
+				if ((qr_getmoduleC(NULL,width,j,i) == 0) == (qr_getmoduleC(NULL,width,k,i) == 0))
+					++nCount;
+				else
+					break;
+			}
+
+			if (nCount >= 5)
+				nPenalty += 3 + (nCount - 5);
+
+			j = k - 1;
+		}
+	}
+
+  // 同一列における 1:1:3:1:1 比率, j == 0 always scores
+  nPenalty += 40 * width;
+
+	// 全体に対する暗モジュールの占める割合
+	int nCount = 0;
+
+	for (i = 0; i < width; ++i)
+		for (j = 0; j < width; ++j)
+			if (! (qr_getmoduleC(NULL,width,i,j)))
+				++nCount;
+
+	nPenalty += (abs(50 - ((nCount * 100) / (width * width))) / 5) * 10;
+
+  c.nPenalty = nPenalty;
+
+  for(i=0;i<MAX_MODULESIZE;i++) {
+    memset(c.lineAreaCol[i],0,sizeof(LINE));
+    if(i >= width) continue;
+    for(j=0;j<width;j++) {
+      if(qr_getmoduleC(NULL,width,i,j)) c.lineAreaCol[i][j/64] |= (uint64_t)1 << (j%64);
+    }
+  }
+
+  set_range(c.lineRange2x2,0,width - 2);
+  set_range(c.lineRangeRow,0,width - 7);
+  set_range(c.lineRangeCol,1,width - 7);
+}
+
+static const QR_PENALTYCONST *get_penalty_const(int width) {
+  int version = (width - 17) / 4;
+  std::call_once(QR_PenaltyConstOnce[version],build_penalty_const,version);
+  return &QR_PenaltyConst[version];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Bitboard construction
+
+// Reads nBits (<= 64) bits starting at bitpos from the packed image,
+// without touching bytes past ncBytes.
+static inline uint64_t load_bits(const uint8_t *image,int ncBytes,int bitpos,int nBits) {
+  int byte  = bitpos / 8;
+  int shift = bitpos % 8;
+  uint64_t v = 0;
+
+  if(byte + 8 <= ncBytes) {
+    memcpy(&v,image + byte,8);
+  } else {
+    for(int n=0;byte+n<ncBytes;n++) v |= (uint64_t)image[byte+n] << (8*n);
+  }
+
+  v >>= shift;
+  if(shift + nBits > 64 && byte + 8 < ncBytes) v |= (uint64_t)image[byte+8] << (64-shift);
+
+  if(nBits < 64) v &= ((uint64_t)1 << nBits) - 1;
+  return v;
+}
+
+// 64x64 bit matrix transpose, a[r] bit c <-> a[c] bit r.
+static void transpose64(uint64_t a[64]) {
+  uint64_t m = 0x00000000FFFFFFFFULL;
+
+  for(int j=32;j!=0;j>>=1, m ^= m << j) {
+    for(int k=0;k<64;k=((k|j)+1) & ~j) {
+      uint64_t t = ((a[k] >> j) ^ a[k|j]) & m;
+      a[k]   ^= t << j;
+      a[k|j] ^= t;
+    }
+  }
+}
+
+static void load_lines(const uint8_t *image,int width,LINE *rows,LINE *cols) {
+  int ncBytes = (width * width + 7) / 8;
+  int ncWords = (width + 63) / 64;
+
+  for(int y=0;y<width;y++) {
+    for(int w=0;w<LINE_WORDS;w++) {
+      int nBits = width - w * 64;
+      rows[y][w] = nBits > 0 ? load_bits(image,ncBytes,y*width + w*64,nBits > 64 ? 64 : nBits) : 0;
+    }
+  }
+
+  for(int x=0;x<width;x++) memset(cols[x],0,sizeof(LINE));
+
+  uint64_t block[64];
+  for(int by=0;by<ncWords;by++) {
+    for(int bx=0;bx<ncWords;bx++) {
+      for(int r=0;r<64;r++) block[r] = (by*64 + r < width) ? rows[by*64 + r][bx] : 0;
+      transpose64(block);
+      for(int r=0;r<64 && bx*64 + r < width;r++) cols[bx*64 + r][by] = block[r];
+    }
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Scalar kernel
+
+// bit n <- bit n+k
+static inline void line_shr(const LINE x,int k,LINE out) {
+  for(int w=0;w<LINE_WORDS;w++) out[w] = (x[w] >> k) | (w+1 < LINE_WORDS ? x[w+1] << (64-k) : 0);
+}
+
+// bit n <- bit n-k
+static inline void line_shl(const LINE x,int k,LINE out) {
+  for(int w=0;w<LINE_WORDS;w++) out[w] = (x[w] << k) | (w > 0 ? x[w-1] >> (64-k) : 0);
+}
+
+// 1:1:3:1:1 pattern starts on a line. The module after the pattern is read
+// from 'after' (the image for rows, the qr_getmoduleC() area for columns).
+static int count_finder_line(const LINE m,const LINE after,const LINE range) {
+  LINE l1, l2, l3, l4, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10;
+  int nCount = 0;
+
+  line_shl(m,1,l1); line_shl(m,2,l2); line_shl(m,3,l3); line_shl(m,4,l4);
+  line_shr(m,1,r1); line_shr(m,2,r2); line_shr(m,3,r3); line_shr(m,4,r4);
+  line_shr(m,5,r5); line_shr(m,6,r6); line_shr(after,7,r7);
+  line_shr(m,8,r8); line_shr(m,9,r9); line_shr(m,10,r10);
+
+  for(int w=0;w<LINE_WORDS;w++) {
+    uint64_t pat = ~l1[w] & m[w] & ~r1[w] & r2[w] & r3[w] & r4[w] & ~r5[w] & r6[w] & ~r7[w];
+    uint64_t lr  = (~l2[w] & ~l3[w] & ~l4[w]) | (~r8[w] & ~r9[w] & ~r10[w]);
+    nCount += __builtin_popcountll(pat & lr & range[w]);
+  }
+
+  return nCount;
+}
+
+// 2x2 same colour blocks with their top left corner on row a.
+static int count_block_line(const LINE a,const LINE b,const LINE range) {
+  LINE a1, b1;
+  int nCount = 0;
+
+  line_shr(a,1,a1);
+  line_shr(b,1,b1);
+
+  for(int w=0;w<LINE_WORDS;w++) {
+    uint64_t same = ~(a[w] ^ a1[w]) & ~(a[w] ^ b[w]) & ~(a[w] ^ b1[w]);
+    nCount += __builtin_popcountll(same & range[w]);
+  }
+
+  return nCount;
+}
+
+static int count_penalty_scalar(const QR_PENALTYCONST *c,const LINE *rows,const LINE *cols,int width) {
+  int nBlock  = 0;
+  int nFinder = 0;
+
+  for(int y=0;y<width-1;y++) nBlock += count_block_line(rows[y],rows[y+1],c->lineRange2x2);
+
+  for(int i=0;i<width;i++) {
+    nFinder += count_finder_line(rows[i],rows[i],c->lineRangeRow);
+    nFinder += count_finder_line(cols[i],c->lineAreaCol[i],c->lineRangeCol);
+  }
+
+  return c->nPenalty + (nBlock * 3) + (nFinder * 40);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// AVX2 kernel, one line per 256-bit vector
+
+__attribute__((target("avx2")))
+static inline __m256i v_shr(__m256i x,int k) {
+  __m256i hi = _mm256_permute4x64_epi64(x,_MM_SHUFFLE(0,3,2,1));
+  hi = _mm256_blend_epi32(hi,_mm256_setzero_si256(),0xc0);
+  return _mm256_or_si256(_mm256_srl_epi64(x,_mm_cvtsi32_si128(k)),_mm256_sll_epi64(hi,_mm_cvtsi32_si128(64-k)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i v_shl(__m256i x,int k) {
+  __m256i lo = _mm256_permute4x64_epi64(x,_MM_SHUFFLE(2,1,0,3));
+  lo = _mm256_blend_epi32(lo,_mm256_setzero_si256(),0x03);
+  return _mm256_or_si256(_mm256_sll_epi64(x,_mm_cvtsi32_si128(k)),_mm256_srl_epi64(lo,_mm_cvtsi32_si128(64-k)));
+}
+
+__attribute__((target("avx2,popcnt")))
+static inline int v_popcount(__m256i x) {
+  return (int)(_mm_popcnt_u64(_mm256_extract_epi64(x,0)) + _mm_popcnt_u64(_mm256_extract_epi64(x,1)) +
+               _mm_popcnt_u64(_mm256_extract_epi64(x,2)) + _mm_popcnt_u64(_mm256_extract_epi64(x,3)));
+}
+
+__attribute__((target("avx2,popcnt")))
+static int count_penalty_avx2(const QR_PENALTYCONST *c,const LINE *rows,const LINE *cols,int width) {
+  __m256i range2x2 = _mm256_loadu_si256((const __m256i *)c->lineRange2x2);
+  __m256i rangeRow = _mm256_loadu_si256((const __m256i *)c->lineRangeRow);
+  __m256i rangeCol = _mm256_loadu_si256((const __m256i *)c->lineRangeCol);
+  __m256i ones     = _mm256_set1_epi64x(-1);
+
+  int nBlock  = 0;
+  int nFinder = 0;
+
+  __m256i a = _mm256_loadu_si256((const __m256i *)rows[0]);
+  for(int y=0;y<width-1;y++) {
+    __m256i b = _mm256_loadu_si256((const __m256i *)rows[y+1]);
+    __m256i same = _mm256_andnot_si256(_mm256_xor_si256(a,v_shr(a,1)),ones);
+    same = _mm256_andnot_si256(_mm256_xor_si256(a,b),same);
+    same = _mm256_andnot_si256(_mm256_xor_si256(a,v_shr(b,1)),same);
+    nBlock += v_popcount(_mm256_and_si256(same,range2x2));
+    a = b;
+  }
+
+  for(int i=0;i<2*width;i++) {
+    __m256i m, after, range;
+
+    if(i < width) {
+      m = after = _mm256_loadu_si256((const __m256i *)rows[i]);
+      range = rangeRow;
+    } else {
+      m     = _mm256_loadu_si256((const __m256i *)cols[i-width]);
+      after = _mm256_loadu_si256((const __m256i *)c->lineAreaCol[i-width]);
+      range = rangeCol;
+    }
+
+    // 暗:明:暗暗暗:明:暗, 明 before and after
+    __m256i dark  = _mm256_and_si256(m,_mm256_and_si256(v_shr(m,2),v_shr(m,3)));
+    dark  = _mm256_and_si256(dark,_mm256_and_si256(v_shr(m,4),v_shr(m,6)));
+    __m256i light = _mm256_or_si256(_mm256_or_si256(v_shl(m,1),v_shr(m,1)),
+                                    _mm256_or_si256(v_shr(m,5),v_shr(after,7)));
+    __m256i pat   = _mm256_andnot_si256(light,dark);
+
+    // 前または後に4以上の明パターン
+    __m256i before = _mm256_or_si256(v_shl(m,2),_mm256_or_si256(v_shl(m,3),v_shl(m,4)));
+    __m256i behind = _mm256_or_si256(v_shr(m,8),_mm256_or_si256(v_shr(m,9),v_shr(m,10)));
+    __m256i lr     = _mm256_or_si256(_mm256_andnot_si256(before,ones),_mm256_andnot_si256(behind,ones));
+
+    nFinder += v_popcount(_mm256_and_si256(_mm256_and_si256(pat,lr),range));
+  }
+
+  return c->nPenalty + (nBlock * 3) + (nFinder * 40);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CQR_Encode::CountPenalty
+// 用  途：マスク後ペナルティスコア算出
+// 備  考：CountPenaltyReference() と同一の結果を返す
+
+typedef int (*PENALTYKERNEL)(const QR_PENALTYCONST *,const LINE *,const LINE *,int);
+
+static bool cpu_has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+static PENALTYKERNEL PenaltyKernel = cpu_has_avx2() ? count_penalty_avx2 : count_penalty_scalar;
+
+const char *qr_penalty_kernel() {
+  return PenaltyKernel == count_penalty_avx2 ? "avx2" : "scalar";
+}
+
+bool qr_penalty_select_kernel(const char *name) {
+  if(strcmp(name,"scalar") == 0) { PenaltyKernel = count_penalty_scalar; return true; }
+  if(strcmp(name,"avx2") == 0 && cpu_has_avx2()) { PenaltyKernel = count_penalty_avx2; return true; }
+  return false;
+}
+
+int CountPenalty(uint8_t *image,int width) {
+  if(width == 0) return 0;
+
+  const QR_PENALTYCONST *c = get_penalty_const(width);
+
+  LINE rows[MAX_MODULESIZE];
+  LINE cols[MAX_MODULESIZE];
+  load_lines(image,width,rows,cols);
+
+  return PenaltyKernel(c,rows,cols,width);
+}
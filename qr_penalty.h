@@ -0,0 +1,19 @@
+#ifndef QR_PENALTY_H
+#define QR_PENALTY_H
+#include <stdint.h>
+
+// Mask penalty scoring.
+//
+// CountPenalty() keeps the symbol as 64-bit row words plus a transposed copy
+// of the columns and evaluates the rules with shifts, ANDs and popcount. An
+// AVX2 kernel is used when the CPU has one. CountPenaltyReference() is the
+// original module-at-a-time scorer, kept to check the two agree.
+
+int CountPenalty(uint8_t *image,int width);
+int CountPenaltyReference(uint8_t *image,int width);
+
+// Name of the kernel CountPenalty() dispatches to ("avx2" or "scalar"), and
+// a way to force one for testing. Not thread safe against running encodes.
+const char *qr_penalty_kernel();
+bool qr_penalty_select_kernel(const char *name);
+#endif
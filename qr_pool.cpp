@@ -0,0 +1,107 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "qr_pool.h"
+
+struct tagQR_THREADPOOL
+{
+	std::vector<std::thread> threads;
+
+	std::mutex              run;   // one run at a time
+	std::mutex              mutex;
+	std::condition_variable cvWork;
+	std::condition_variable cvDone;
+
+	// Current run
+	QR_POOLFUNC      fn;
+	void            *arg;
+	int              ncItems;
+	std::atomic<int> nNext;
+	int              ncActive;
+	unsigned         nGeneration;
+	bool             bStop;
+};
+
+static void pool_work(QR_THREADPOOL *pool,int nWorker) {
+  int n;
+  while((n = pool->nNext.fetch_add(1)) < pool->ncItems) pool->fn(pool->arg,n,nWorker);
+}
+
+static void pool_thread(QR_THREADPOOL *pool,int nWorker) {
+  unsigned nSeen = 0;
+
+  for(;;) {
+    {
+      std::unique_lock<std::mutex> lock(pool->mutex);
+      pool->cvWork.wait(lock,[&]{ return pool->bStop || pool->nGeneration != nSeen; });
+      if(pool->bStop) return;
+      nSeen = pool->nGeneration;
+    }
+
+    pool_work(pool,nWorker);
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    if(--pool->ncActive == 0) pool->cvDone.notify_one();
+  }
+}
+
+QR_THREADPOOL *qr_pool_create(int nThreads) {
+  QR_THREADPOOL *pool = new QR_THREADPOOL;
+
+  pool->fn          = NULL;
+  pool->arg         = NULL;
+  pool->ncItems     = 0;
+  pool->nNext       = 0;
+  pool->ncActive    = 0;
+  pool->nGeneration = 0;
+  pool->bStop       = false;
+
+  // The caller works too, so nThreads - 1 extra threads.
+  for(int n=1;n<nThreads;n++) pool->threads.push_back(std::thread(pool_thread,pool,n));
+
+  return pool;
+}
+
+void qr_pool_destroy(QR_THREADPOOL *pool) {
+  if(pool == NULL) return;
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->bStop = true;
+  }
+  pool->cvWork.notify_all();
+
+  for(size_t n=0;n<pool->threads.size();n++) pool->threads[n].join();
+  delete pool;
+}
+
+int qr_pool_size(QR_THREADPOOL *pool) {
+  return pool == NULL ? 1 : (int)pool->threads.size() + 1;
+}
+
+void qr_pool_run(QR_THREADPOOL *pool,int ncItems,QR_POOLFUNC fn,void *arg) {
+  if(pool == NULL || pool->threads.empty() || ncItems <= 1) {
+    for(int n=0;n<ncItems;n++) fn(arg,n,0);
+    return;
+  }
+
+  std::lock_guard<std::mutex> run(pool->run);
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->fn       = fn;
+    pool->arg      = arg;
+    pool->ncItems  = ncItems;
+    pool->nNext    = 0;
+    pool->ncActive = (int)pool->threads.size();
+    pool->nGeneration++;
+  }
+  pool->cvWork.notify_all();
+
+  pool_work(pool,0);
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->cvDone.wait(lock,[&]{ return pool->ncActive == 0; });
+}
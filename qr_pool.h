@@ -0,0 +1,24 @@
+#ifndef QR_POOL_H
+#define QR_POOL_H
+
+// Fixed size worker pool.
+//
+// qr_pool_run() hands items 0..ncItems-1 out to the workers and the calling
+// thread one at a time and returns once all of them are done. fn receives
+// the item number and the index (0..qr_pool_size()-1) of the thread running
+// it, so callers can keep per-thread scratch space. Runs on the same pool
+// are serialised.
+
+typedef struct tagQR_THREADPOOL QR_THREADPOOL;
+
+typedef void (*QR_POOLFUNC)(void *arg,int nItem,int nWorker);
+
+QR_THREADPOOL *qr_pool_create(int nThreads);
+void qr_pool_destroy(QR_THREADPOOL *pool);
+
+// Number of threads taking part in a run, including the caller.
+int qr_pool_size(QR_THREADPOOL *pool);
+
+// pool may be NULL, in which case the items run on the calling thread.
+void qr_pool_run(QR_THREADPOOL *pool,int ncItems,QR_POOLFUNC fn,void *arg);
+#endif
@@ -0,0 +1,349 @@
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include <immintrin.h>
+#include "qr_encodeem.h"
+#include "qr_rs.h"
+
+#define MAX_RSDEGREE  68 // ＲＳコードワード数最大値
+#define MAX_CODEBLOCK 153 // ブロックデータコードワード数最大値(ＲＳコードワードを含む)
+#define RS_REGSIZE    96 // LFSR register, MAX_RSDEGREE rounded up to 32 bytes
+#define RS_LANES      32 // ブロック並列数(AVX2 1 レジスタ分)
+#define RS_LANES_MIN   8 // これ未満のブロック数はブロック毎に算出
+
+/////////////////////////////////////////////////////////////////////////////
+// GF(256) tables
+
+// byMulLo[f][n] = f * n, byMulHi[f][n] = f * (n << 4), the split-nibble
+// halves of a multiply by f.
+alignas(16) static uint8_t byMulLo[256][16];
+alignas(16) static uint8_t byMulHi[256][16];
+static std::once_flag      MulTableOnce;
+
+static uint8_t gf_mul(uint8_t a,uint8_t b) {
+  if(a == 0 || b == 0) return 0;
+  return byExpToInt[(byIntToExp[a] + byIntToExp[b]) % 255];
+}
+
+static void build_mul_table() {
+  for(int f=0;f<256;f++) {
+    for(int n=0;n<16;n++) {
+      byMulLo[f][n] = gf_mul((uint8_t)f,(uint8_t)n);
+      byMulHi[f][n] = gf_mul((uint8_t)f,(uint8_t)(n << 4));
+    }
+  }
+}
+
+// Generator polynomial of one degree. byProduct[f] is the generator scaled
+// by f, byGenLo/byGenHi are its coefficients split into nibbles for PSHUFB.
+// Lanes past the degree are zero.
+typedef struct tagQR_RSGENERATOR
+{
+	uint8_t byProduct[256][MAX_RSDEGREE];
+	uint8_t byCoef[MAX_RSDEGREE];
+	alignas(32) uint8_t byGenLo[RS_REGSIZE];
+	alignas(32) uint8_t byGenHi[RS_REGSIZE];
+} QR_RSGENERATOR;
+
+static QR_RSGENERATOR *RSGenerator[MAX_RSDEGREE + 1];
+static std::once_flag  RSGeneratorOnce[MAX_RSDEGREE + 1];
+
+static void build_generator(int ncRSCodeWord) {
+  QR_RSGENERATOR *g = new QR_RSGENERATOR;
+  memset(g,0,sizeof(QR_RSGENERATOR));
+
+  for(int j=0;j<ncRSCodeWord;j++) {
+    uint8_t c = byExpToInt[byRSExp[ncRSCodeWord][j]];
+
+    for(int f=0;f<256;f++) g->byProduct[f][j] = gf_mul((uint8_t)f,c);
+
+    g->byCoef[j]  = c;
+    g->byGenLo[j] = (uint8_t)(c & 0x0f);
+    g->byGenHi[j] = (uint8_t)(c >> 4);
+  }
+
+  RSGenerator[ncRSCodeWord] = g;
+}
+
+static const QR_RSGENERATOR *get_generator(int ncRSCodeWord) {
+  std::call_once(MulTableOnce,build_mul_table);
+  std::call_once(RSGeneratorOnce[ncRSCodeWord],build_generator,ncRSCodeWord);
+  return RSGenerator[ncRSCodeWord];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Kernels
+//
+// reg holds the running remainder, reg[0] being the highest order term. For
+// each data codeword the feedback term f = data ^ reg[0] is multiplied into
+// the generator and added to the register moved down one place. The
+// register buffer is RS_REGSIZE + 32 bytes and zero past the degree, so the
+// vector kernels can move it down with an unaligned load at reg + 1.
+
+static void rs_encode_scalar(const QR_RSGENERATOR *g,const uint8_t *data,int ncDataCodeWord,uint8_t *reg,int ncRSCodeWord) {
+  for(int i=0;i<ncDataCodeWord;i++) {
+    const uint8_t *p = g->byProduct[data[i] ^ reg[0]];
+    int j;
+
+    for(j=0;j<ncRSCodeWord-1;j++) reg[j] = (uint8_t)(reg[j+1] ^ p[j]);
+    reg[j] = p[j];
+  }
+}
+
+__attribute__((target("ssse3")))
+static void rs_encode_ssse3(const QR_RSGENERATOR *g,const uint8_t *data,int ncDataCodeWord,uint8_t *reg,int ncRSCodeWord) {
+  int ncVec = (ncRSCodeWord + 15) / 16;
+
+  for(int i=0;i<ncDataCodeWord;i++) {
+    int f = data[i] ^ reg[0];
+    __m128i lo = _mm_load_si128((const __m128i *)byMulLo[f]);
+    __m128i hi = _mm_load_si128((const __m128i *)byMulHi[f]);
+
+    for(int v=0;v<ncVec;v++) {
+      __m128i glo = _mm_load_si128((const __m128i *)(g->byGenLo + v*16));
+      __m128i ghi = _mm_load_si128((const __m128i *)(g->byGenHi + v*16));
+      __m128i p   = _mm_xor_si128(_mm_shuffle_epi8(lo,glo),_mm_shuffle_epi8(hi,ghi));
+      __m128i r   = _mm_loadu_si128((const __m128i *)(reg + v*16 + 1));
+      _mm_storeu_si128((__m128i *)(reg + v*16),_mm_xor_si128(r,p));
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static void rs_encode_avx2(const QR_RSGENERATOR *g,const uint8_t *data,int ncDataCodeWord,uint8_t *reg,int ncRSCodeWord) {
+  int ncVec = (ncRSCodeWord + 31) / 32;
+
+  for(int i=0;i<ncDataCodeWord;i++) {
+    int f = data[i] ^ reg[0];
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)byMulLo[f]));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)byMulHi[f]));
+
+    for(int v=0;v<ncVec;v++) {
+      __m256i glo = _mm256_load_si256((const __m256i *)(g->byGenLo + v*32));
+      __m256i ghi = _mm256_load_si256((const __m256i *)(g->byGenHi + v*32));
+      __m256i p   = _mm256_xor_si256(_mm256_shuffle_epi8(lo,glo),_mm256_shuffle_epi8(hi,ghi));
+      __m256i r   = _mm256_loadu_si256((const __m256i *)(reg + v*32 + 1));
+      _mm256_storeu_si256((__m256i *)(reg + v*32),_mm256_xor_si256(r,p));
+    }
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Lane kernels
+//
+// The same LFSR, transposed: lane n of reg[j] is term j of block n's
+// remainder, so up to RS_LANES blocks of the same shape advance together
+// and the feedback terms of all of them form one vector. Each generator
+// coefficient then multiplies that vector through byMulLo/byMulHi of the
+// coefficient, indexed by the feedback nibbles. Row i of the data is
+// codeword i of every lane, at data + i * nStride; in the interleaved
+// codeword buffer that is a contiguous run, and so is every row of the
+// remainder. Rows with fewer than RS_LANES lanes are read through a copy.
+
+typedef uint8_t RS_LANEREG[MAX_RSDEGREE][RS_LANES];
+
+static inline const uint8_t *lane_row(const uint8_t *data,int nLanes,int nWidth,uint8_t *byRow) {
+  if(nLanes == nWidth) return data;
+  memcpy(byRow,data,nLanes);
+  return byRow;
+}
+
+static void rs_lanes_scalar(const QR_RSGENERATOR *g,const uint8_t *data,int nStride,int ncRows,int nLanes,RS_LANEREG reg,int ncRSCodeWord) {
+  for(int n=0;n<nLanes;n++) {
+    for(int i=0;i<ncRows;i++) {
+      const uint8_t *p = g->byProduct[data[i * nStride + n] ^ reg[0][n]];
+      int j;
+
+      for(j=0;j<ncRSCodeWord-1;j++) reg[j][n] = (uint8_t)(reg[j+1][n] ^ p[j]);
+      reg[j][n] = p[j];
+    }
+  }
+}
+
+__attribute__((target("ssse3")))
+static void rs_lanes_ssse3(const QR_RSGENERATOR *g,const uint8_t *data,int nStride,int ncRows,int nLanes,RS_LANEREG reg,int ncRSCodeWord) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  alignas(16) uint8_t byRow[RS_LANES] = {0};
+
+  for(int h=0;h<nLanes;h+=16) {
+    int nHalf = nLanes - h < 16 ? nLanes - h : 16;
+
+    for(int i=0;i<ncRows;i++) {
+      const uint8_t *row = lane_row(data + i * nStride + h,nHalf,16,byRow);
+      __m128i f  = _mm_xor_si128(_mm_loadu_si128((const __m128i *)row),_mm_load_si128((const __m128i *)(reg[0] + h)));
+      __m128i fl = _mm_and_si128(f,nibble);
+      __m128i fh = _mm_and_si128(_mm_srli_epi16(f,4),nibble);
+      int j;
+
+      for(j=0;j<ncRSCodeWord;j++) {
+        const uint8_t c = g->byCoef[j];
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(_mm_load_si128((const __m128i *)byMulLo[c]),fl),
+                                  _mm_shuffle_epi8(_mm_load_si128((const __m128i *)byMulHi[c]),fh));
+        if(j < ncRSCodeWord - 1) p = _mm_xor_si128(p,_mm_load_si128((const __m128i *)(reg[j+1] + h)));
+        _mm_store_si128((__m128i *)(reg[j] + h),p);
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static void rs_lanes_avx2(const QR_RSGENERATOR *g,const uint8_t *data,int nStride,int ncRows,int nLanes,RS_LANEREG reg,int ncRSCodeWord) {
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  alignas(32) uint8_t byRow[RS_LANES] = {0};
+
+  for(int i=0;i<ncRows;i++) {
+    const uint8_t *row = lane_row(data + i * nStride,nLanes,RS_LANES,byRow);
+    __m256i f  = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)row),_mm256_load_si256((const __m256i *)reg[0]));
+    __m256i fl = _mm256_and_si256(f,nibble);
+    __m256i fh = _mm256_and_si256(_mm256_srli_epi16(f,4),nibble);
+    int j;
+
+    for(j=0;j<ncRSCodeWord;j++) {
+      const uint8_t c = g->byCoef[j];
+      __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)byMulLo[c])),fl),
+                                   _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)byMulHi[c])),fh));
+      if(j < ncRSCodeWord - 1) p = _mm256_xor_si256(p,_mm256_load_si256((const __m256i *)reg[j+1]));
+      _mm256_store_si256((__m256i *)reg[j],p);
+    }
+  }
+}
+
+typedef void (*RSLANEKERNEL)(const QR_RSGENERATOR *,const uint8_t *,int,int,int,RS_LANEREG,int);
+
+typedef void (*RSKERNEL)(const QR_RSGENERATOR *,const uint8_t *,int,uint8_t *,int);
+
+static RSKERNEL default_rs_kernel() {
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))  return rs_encode_avx2;
+  if(__builtin_cpu_supports("ssse3")) return rs_encode_ssse3;
+  return rs_encode_scalar;
+}
+
+static RSKERNEL RSKernel = default_rs_kernel();
+
+static RSLANEKERNEL lane_kernel_for(RSKERNEL k) {
+  if(k == rs_encode_avx2)  return rs_lanes_avx2;
+  if(k == rs_encode_ssse3) return rs_lanes_ssse3;
+  return rs_lanes_scalar;
+}
+
+static RSLANEKERNEL RSLaneKernel = lane_kernel_for(RSKernel);
+
+const char *qr_rs_kernel() {
+  if(RSKernel == rs_encode_avx2)  return "avx2";
+  if(RSKernel == rs_encode_ssse3) return "ssse3";
+  return "scalar";
+}
+
+bool qr_rs_select_kernel(const char *name) {
+  __builtin_cpu_init();
+  if(strcmp(name,"scalar") == 0) RSKernel = rs_encode_scalar;
+  else if(strcmp(name,"ssse3") == 0 && __builtin_cpu_supports("ssse3")) RSKernel = rs_encode_ssse3;
+  else if(strcmp(name,"avx2") == 0 && __builtin_cpu_supports("avx2")) RSKernel = rs_encode_avx2;
+  else return false;
+
+  RSLaneKernel = lane_kernel_for(RSKernel);
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_rs_encode
+// 用  途：ＲＳ誤り訂正コードワード取得
+// 引  数：データコードワード、データコードワード長、ＲＳコードワード格納先、ＲＳコードワード長
+
+void qr_rs_encode(const uint8_t *data,int ncDataCodeWord,uint8_t *ecc,int ncRSCodeWord) {
+  const QR_RSGENERATOR *g = get_generator(ncRSCodeWord);
+
+  alignas(32) uint8_t reg[RS_REGSIZE + 32];
+  memset(reg,0,sizeof(reg));
+
+  RSKernel(g,data,ncDataCodeWord,reg,ncRSCodeWord);
+
+  memcpy(ecc,reg,ncRSCodeWord);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_rs_encode_interleaved
+// 用  途：インターリーブ済みコードワード列の全ブロックＲＳコードワード算出
+// 引  数：総コードワード格納先、ブロック数(1)、ブロック数(2)、ブロック内データコードワード数(1)、ＲＳコードワード長
+
+void qr_rs_encode_interleaved(uint8_t *byAllCodeWord,int ncBlock1,int ncBlock2,int ncDataCodeWord1,int ncRSCodeWord) {
+  const QR_RSGENERATOR *g = get_generator(ncRSCodeWord);
+  const int ncBlockSum = ncBlock1 + ncBlock2;
+  const int ncDataCodeWord = ncBlock1 * ncDataCodeWord1 + ncBlock2 * (ncDataCodeWord1 + 1);
+
+  // 1 種目、2 種目のブロックは別々のレーン群で(2 種目は最後の 1 行が多い)
+  for(int b=0;b<ncBlockSum;) {
+    int bEnd   = b < ncBlock1 ? ncBlock1 : ncBlockSum;
+    int nLanes = bEnd - b < RS_LANES ? bEnd - b : RS_LANES;
+
+    // レーンが少なければ 1 ブロックずつ(ＲＳ項方向のベクトル化が速い)
+    if(nLanes < RS_LANES_MIN) {
+      for(int n=0;n<nLanes;n++,b++) {
+        uint8_t byBlock[MAX_CODEBLOCK], byECC[MAX_RSDEGREE];
+        int ncDataCw = b < ncBlock1 ? ncDataCodeWord1 : ncDataCodeWord1 + 1;
+
+        for(int i=0;i<ncDataCodeWord1;i++) byBlock[i] = byAllCodeWord[ncBlockSum * i + b];
+        if(b >= ncBlock1) byBlock[ncDataCodeWord1] = byAllCodeWord[ncBlockSum * ncDataCodeWord1 + (b - ncBlock1)];
+
+        qr_rs_encode(byBlock,ncDataCw,byECC,ncRSCodeWord);
+        for(int j=0;j<ncRSCodeWord;j++) byAllCodeWord[ncDataCodeWord + ncBlockSum * j + b] = byECC[j];
+      }
+      continue;
+    }
+
+    alignas(32) RS_LANEREG reg;
+    memset(reg,0,sizeof(reg));
+
+    RSLaneKernel(g,byAllCodeWord + b,ncBlockSum,ncDataCodeWord1,nLanes,reg,ncRSCodeWord);
+    if(b >= ncBlock1) RSLaneKernel(g,byAllCodeWord + ncBlockSum * ncDataCodeWord1 + (b - ncBlock1),0,1,nLanes,reg,ncRSCodeWord);
+
+    for(int j=0;j<ncRSCodeWord;j++) memcpy(byAllCodeWord + ncDataCodeWord + ncBlockSum * j + b,reg[j],nLanes);
+
+    b += nLanes;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CQR_Encode::GetRSCodeWord
+// 用  途：ＲＳ誤り訂正コードワード取得
+// 引  数：データコードワードアドレス、データコードワード長、ＲＳコードワード長
+// 備  考：総コードワード分のエリアを確保してから呼び出し
+//         参照実装、エンコードには qr_rs_encode() を使用
+
+void GetRSCodeWord(uint8_t *lpbyRSWork, int ncDataCodeWord, int ncRSCodeWord)
+{
+	int i, j;
+
+	for (i = 0; i < ncDataCodeWord ; ++i)
+	{
+		if (lpbyRSWork[0] != 0)
+		{
+			uint8_t nExpFirst = byIntToExp[lpbyRSWork[0]]; // 初項係数より乗数算出
+
+			for (j = 0; j < ncRSCodeWord; ++j)
+			{
+				// 各項乗数に初項乗数を加算（% 255 → α^255 = 1）
+				uint8_t nExpElement = (uint8_t)(((int)(byRSExp[ncRSCodeWord][j] + nExpFirst)) % 255);
+
+				// 排他論理和による剰余算出
+				lpbyRSWork[j] = (uint8_t)(lpbyRSWork[j + 1] ^ byExpToInt[nExpElement]);
+			}
+
+			// 残り桁をシフト
+			for (j = ncRSCodeWord; j < ncDataCodeWord + ncRSCodeWord - 1; ++j)
+				lpbyRSWork[j] = lpbyRSWork[j + 1];
+		}
+		else
+		{
+			// 残り桁をシフト
+			for (j = 0; j < ncDataCodeWord + ncRSCodeWord - 1; ++j)
+				lpbyRSWork[j] = lpbyRSWork[j + 1];
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef QR_RS_H
+#define QR_RS_H
+#include <stdint.h>
+
+// Reed-Solomon encoder.
+//
+// qr_rs_encode() runs the data through an LFSR remainder register, one
+// GF(256) multiply of the generator per data codeword, so the input is never
+// shifted. The multiply uses per-generator product tables, or split-nibble
+// PSHUFB lookups on SSSE3/AVX2 machines. Output is identical to
+// GetRSCodeWord() for every generator degree in byRSExp.
+
+// ecc receives ncRSCodeWord codewords, data is left untouched.
+void qr_rs_encode(const uint8_t *data,int ncDataCodeWord,uint8_t *ecc,int ncRSCodeWord);
+
+// Every block of a symbol at once. byAllCodeWord holds the interleaved
+// data codewords of ncBlock1 blocks of ncDataCodeWord1 and ncBlock2 blocks
+// of ncDataCodeWord1 + 1; the RS codewords of all blocks are computed side
+// by side, one block per vector lane, and written interleaved after them.
+void qr_rs_encode_interleaved(uint8_t *byAllCodeWord,int ncBlock1,int ncBlock2,int ncDataCodeWord1,int ncRSCodeWord);
+
+// Name of the kernel qr_rs_encode() dispatches to ("avx2", "ssse3" or
+// "scalar"), and a way to force one for testing.
+const char *qr_rs_kernel();
+bool qr_rs_select_kernel(const char *name);
+
+// Original shift-the-buffer implementation, used as the reference.
+void GetRSCodeWord(uint8_t *lpbyRSWork, int ncDataCodeWord, int ncRSCodeWord);
+#endif
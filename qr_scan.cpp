@@ -0,0 +1,244 @@
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include "qr_encodeem.h"
+#include "qr_scan.h"
+
+// 文字種別
+// The low bits say which lead bytes a byte may follow as the second half
+// of a Kanji pair, the high bits which of those a lead byte needs, so
+// IsKanjiData(c1,c2) is ((ScanClass[c1] >> 4) & ScanClass[c2]) != 0.
+#define SCAN_TRAIL      0x01 // 40h 〜 FFh
+#define SCAN_TRAIL_FC   0x02 // 40h 〜 FCh
+#define SCAN_TRAIL_BF   0x04 // 40h 〜 BFh
+#define SCAN_NUMERAL    0x08
+#define SCAN_LEAD       0x10 // 81h 〜 9Eh、E0h 〜 EAh
+#define SCAN_LEAD_9F    0x20
+#define SCAN_LEAD_EB    0x40
+#define SCAN_ALPHABET   0x80 // 数字を含む
+
+struct SCAN_CLASSTABLE
+{
+	uint8_t byClass[256];
+};
+
+static constexpr SCAN_CLASSTABLE build_class_table() {
+  SCAN_CLASSTABLE t = {};
+
+  for(int c=0;c<256;c++) {
+    int n = 0;
+
+    if(c >= 0x40)               n |= SCAN_TRAIL;
+    if(c >= 0x40 && c <= 0xfc)  n |= SCAN_TRAIL_FC;
+    if(c >= 0x40 && c <= 0xbf)  n |= SCAN_TRAIL_BF;
+    if(c >= '0' && c <= '9')    n |= SCAN_NUMERAL;
+    if((c >= 0x81 && c <= 0x9e) || (c >= 0xe0 && c <= 0xea)) n |= SCAN_LEAD;
+    if(c == 0x9f)               n |= SCAN_LEAD_9F;
+    if(c == 0xeb)               n |= SCAN_LEAD_EB;
+    if((c >= '0' && c <= ':') || (c >= 'A' && c <= 'Z') || c == ' ' || c == '$' || c == '%' ||
+       c == '*' || c == '+' || c == '-' || c == '.' || c == '/') n |= SCAN_ALPHABET;
+
+    t.byClass[c] = (uint8_t)n;
+  }
+
+  return t;
+}
+
+static constexpr SCAN_CLASSTABLE ScanClass = build_class_table();
+
+// Masks of one block of up to 64 bytes, bit i for byte i.
+typedef struct tagSCAN_MASKS
+{
+	uint64_t wNumeral;
+	uint64_t wAlphabet;
+	uint64_t wPair;     // IsKanjiData(byte i, byte i + 1)
+} SCAN_MASKS;
+
+// Tail of fewer than 65 bytes, or a whole block without a SIMD kernel.
+static void scan_block_scalar(const uint8_t *p,int ncBytes,bool bNext,SCAN_MASKS *m) {
+  uint64_t wNumeral = 0, wAlphabet = 0, wPair = 0;
+
+  for(int i=0;i<ncBytes;i++) {
+    uint8_t c  = ScanClass.byClass[p[i]];
+    uint8_t c2 = (i + 1 < ncBytes || bNext) ? ScanClass.byClass[p[i + 1]] : 0;
+
+    wNumeral  |= (uint64_t)((c & SCAN_NUMERAL) != 0) << i;
+    wAlphabet |= (uint64_t)((c & SCAN_ALPHABET) != 0) << i;
+    wPair     |= (uint64_t)(((c >> 4) & c2 & 0x07) != 0) << i;
+  }
+
+  m->wNumeral  = wNumeral;
+  m->wAlphabet = wAlphabet;
+  m->wPair     = wPair;
+}
+
+static void scan_kernel_scalar(const uint8_t *p,SCAN_MASKS *m) {
+  scan_block_scalar(p,64,true,m);
+}
+
+// c in lo..hi as an unsigned byte: biased by 80h the range test is one
+// signed compare.
+static inline __m128i in_range_sse2(__m128i c,int lo,int hi) {
+  __m128i t = _mm_add_epi8(c,_mm_set1_epi8((char)(0x80 - lo)));
+  return _mm_cmplt_epi8(t,_mm_set1_epi8((char)(0x80 + hi - lo + 1)));
+}
+
+__attribute__((target("sse2")))
+static void scan_kernel_sse2(const uint8_t *p,SCAN_MASKS *m) {
+  uint64_t wNumeral = 0, wAlphabet = 0, wPair = 0;
+
+  for(int k=0;k<64;k+=16) {
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + k));
+    __m128i d = _mm_loadu_si128((const __m128i *)(p + k + 1)); // 次のバイト
+
+    __m128i num   = in_range_sse2(c,'0','9');
+    __m128i alpha = _mm_or_si128(_mm_or_si128(in_range_sse2(c,'0',':'),in_range_sse2(c,'A','Z')),
+                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c,_mm_set1_epi8(' ')),in_range_sse2(c,'$','%')),
+                                 _mm_or_si128(in_range_sse2(c,'*','+'),in_range_sse2(c,'-','/'))));
+
+    __m128i lead  = _mm_or_si128(in_range_sse2(c,0x81,0x9e),in_range_sse2(c,0xe0,0xea));
+    __m128i pair  = _mm_or_si128(_mm_and_si128(lead,in_range_sse2(d,0x40,0xff)),
+                    _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(c,_mm_set1_epi8((char)0x9f)),in_range_sse2(d,0x40,0xfc)),
+                                 _mm_and_si128(_mm_cmpeq_epi8(c,_mm_set1_epi8((char)0xeb)),in_range_sse2(d,0x40,0xbf))));
+
+    wNumeral  |= (uint64_t)(uint16_t)_mm_movemask_epi8(num) << k;
+    wAlphabet |= (uint64_t)(uint16_t)_mm_movemask_epi8(alpha) << k;
+    wPair     |= (uint64_t)(uint16_t)_mm_movemask_epi8(pair) << k;
+  }
+
+  m->wNumeral  = wNumeral;
+  m->wAlphabet = wAlphabet;
+  m->wPair     = wPair;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i in_range_avx2(__m256i c,int lo,int hi) {
+  __m256i t = _mm256_add_epi8(c,_mm256_set1_epi8((char)(0x80 - lo)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + hi - lo + 1)),t);
+}
+
+__attribute__((target("avx2")))
+static void scan_kernel_avx2(const uint8_t *p,SCAN_MASKS *m) {
+  uint64_t wNumeral = 0, wAlphabet = 0, wPair = 0;
+
+  for(int k=0;k<64;k+=32) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)(p + k));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(p + k + 1)); // 次のバイト
+
+    __m256i num   = in_range_avx2(c,'0','9');
+    __m256i alpha = _mm256_or_si256(_mm256_or_si256(in_range_avx2(c,'0',':'),in_range_avx2(c,'A','Z')),
+                    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c,_mm256_set1_epi8(' ')),in_range_avx2(c,'$','%')),
+                                    _mm256_or_si256(in_range_avx2(c,'*','+'),in_range_avx2(c,'-','/'))));
+
+    __m256i lead  = _mm256_or_si256(in_range_avx2(c,0x81,0x9e),in_range_avx2(c,0xe0,0xea));
+    __m256i pair  = _mm256_or_si256(_mm256_and_si256(lead,in_range_avx2(d,0x40,0xff)),
+                    _mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(c,_mm256_set1_epi8((char)0x9f)),in_range_avx2(d,0x40,0xfc)),
+                                    _mm256_and_si256(_mm256_cmpeq_epi8(c,_mm256_set1_epi8((char)0xeb)),in_range_avx2(d,0x40,0xbf))));
+
+    wNumeral  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(num) << k;
+    wAlphabet |= (uint64_t)(uint32_t)_mm256_movemask_epi8(alpha) << k;
+    wPair     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(pair) << k;
+  }
+
+  m->wNumeral  = wNumeral;
+  m->wAlphabet = wAlphabet;
+  m->wPair     = wPair;
+}
+
+typedef void (*SCANKERNEL)(const uint8_t *,SCAN_MASKS *);
+
+static SCANKERNEL default_scan_kernel() {
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) return scan_kernel_avx2;
+  if(__builtin_cpu_supports("sse2")) return scan_kernel_sse2;
+  return scan_kernel_scalar;
+}
+
+static SCANKERNEL ScanKernel = default_scan_kernel();
+
+const char *qr_scan_kernel() {
+  if(ScanKernel == scan_kernel_avx2) return "avx2";
+  if(ScanKernel == scan_kernel_sse2) return "sse2";
+  return "scalar";
+}
+
+bool qr_scan_select_kernel(const char *name) {
+  __builtin_cpu_init();
+  if(strcmp(name,"scalar") == 0) ScanKernel = scan_kernel_scalar;
+  else if(strcmp(name,"sse2") == 0 && __builtin_cpu_supports("sse2")) ScanKernel = scan_kernel_sse2;
+  else if(strcmp(name,"avx2") == 0 && __builtin_cpu_supports("avx2")) ScanKernel = scan_kernel_avx2;
+  else return false;
+
+  return true;
+}
+
+#define SCAN_EVEN 0x5555555555555555ULL
+#define SCAN_ODD  0xaaaaaaaaaaaaaaaaULL
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_scan_runs
+// 用  途：文字種別の連続区間取得
+// 引  数：入力データ、入力データ長、区間モード格納先、区間長格納先(ncLength 要素)
+// 戻り値：区間数
+
+int qr_scan_runs(const uint8_t *lpsSource,int ncLength,uint8_t *byRunMode,int32_t *nRunLength) {
+  int ncRuns = 0, nRunStart = 0;
+
+  uint64_t wPrevStart = 0; // 前ブロック末尾が漢字の第 1 バイト
+  uint64_t wPrevClass[4] = {0,0,0,0};
+
+  static const uint8_t byClassMode[4] = {QR_MODE_KANJI,QR_MODE_NUMERAL,QR_MODE_ALPHABET,QR_MODE_8BIT};
+
+  for(int nBase=0;nBase<ncLength;nBase+=64) {
+    SCAN_MASKS m;
+    int ncBytes = ncLength - nBase < 64 ? ncLength - nBase : 64;
+
+    // The kernels read one byte past the block for the pair test.
+    if(ncBytes == 64 && nBase + 64 < ncLength)
+      ScanKernel(lpsSource + nBase,&m);
+    else
+      scan_block_scalar(lpsSource + nBase,ncBytes,false,&m);
+
+    uint64_t wValid = ncBytes == 64 ? ~0ULL : (1ULL << ncBytes) - 1;
+
+    // A pair starts wherever one can and the byte before is not a pair's
+    // first byte, so in a row of bytes that could each start one the pairs
+    // start at every other byte from the first. Adding the row's first bit
+    // clears a row that starts on an even bit and leaves the others, which
+    // tells the two parities apart without a loop.
+    uint64_t wPair   = m.wPair & ~wPrevStart;
+    uint64_t wFirst  = wPair & ~(wPair << 1);
+    uint64_t wEvenRow = wPair & ~(wPair + (wFirst & SCAN_EVEN));
+    uint64_t wStart  = (wEvenRow & SCAN_EVEN) | (wPair & ~wEvenRow & SCAN_ODD);
+
+    uint64_t wClass[4];
+    wClass[0] = wStart | (wStart << 1) | wPrevStart;                        // 漢字
+    wClass[1] = m.wNumeral & ~wClass[0];                                    // 数字
+    wClass[2] = m.wAlphabet & ~m.wNumeral & ~wClass[0];                     // 英数字
+    wClass[3] = wValid & ~(wClass[0] | wClass[1] | wClass[2]);              // ８ビットバイト
+
+    wPrevStart = wStart >> 63;
+
+    // 種別の変わり目
+    uint64_t wBound = 0, wOpen[4];
+    for(int n=0;n<4;n++) {
+      wOpen[n] = wClass[n] & ~((wClass[n] << 1) | wPrevClass[n]);
+      wBound |= wOpen[n];
+      wPrevClass[n] = wClass[n] >> 63;
+    }
+
+    while(wBound != 0) {
+      int b = __builtin_ctzll(wBound);
+      int n = (wOpen[0] >> b) & 1 ? 0 : ((wOpen[1] >> b) & 1 ? 1 : ((wOpen[2] >> b) & 1 ? 2 : 3));
+
+      if(ncRuns > 0) nRunLength[ncRuns - 1] = nBase + b - nRunStart;
+
+      byRunMode[ncRuns++] = byClassMode[n];
+      nRunStart = nBase + b;
+      wBound &= wBound - 1;
+    }
+  }
+
+  if(ncRuns > 0) nRunLength[ncRuns - 1] = ncLength - nRunStart;
+  return ncRuns;
+}
@@ -0,0 +1,26 @@
+#ifndef QR_SCAN_H
+#define QR_SCAN_H
+#include <stdint.h>
+
+// Character class scanner.
+//
+// qr_scan_runs() splits the input into the runs the greedy segmentation
+// starts from: Shift-JIS Kanji pairs, digits, other alphanumeric
+// characters and 8-bit bytes, in that order of preference, a Kanji
+// character wherever IsKanjiData() holds for a byte and the next one that
+// is not already the second half of a pair. The bytes are classified 64 at
+// a time into bit masks, by SSE2 or AVX2 range compares or by the 256-entry
+// class table; pairs are taken from the masks with a carry trick rather
+// than byte by byte, and each run is found with one bit scan of where the
+// class changes.
+
+// Writes the runs in the byBlockMode/nBlockLength layout of
+// qr_encode_source_data() (Kanji lengths in bytes, at most ncLength runs)
+// and returns their number.
+int qr_scan_runs(const uint8_t *lpsSource,int ncLength,uint8_t *byRunMode,int32_t *nRunLength);
+
+// Name of the kernel qr_scan_runs() classifies with ("avx2", "sse2" or
+// "scalar"), and a way to force one for testing.
+const char *qr_scan_kernel();
+bool qr_scan_select_kernel(const char *name);
+#endif
@@ -0,0 +1,283 @@
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include "qr_encodeem.h"
+#include "qr_utils.h"
+#include "qr_segment.h"
+
+// 状態(最後のブロックのモードと未確定の文字数)
+#define SEG_NUMERAL0   0 // 数字、3 の倍数
+#define SEG_NUMERAL1   1 // 数字、端数 1
+#define SEG_NUMERAL2   2 // 数字、端数 2
+#define SEG_ALPHABET0  3 // 英数字、2 の倍数
+#define SEG_ALPHABET1  4 // 英数字、端数 1
+#define SEG_8BIT       5
+#define SEG_KANJI      6
+#define SEG_STATES     7
+#define SEG_START      7 // 先頭(ブロックなし)
+
+#define SEG_INFINITY   0x3fffffff
+
+static const uint8_t SegMode[SEG_STATES] = {
+  QR_MODE_NUMERAL,QR_MODE_NUMERAL,QR_MODE_NUMERAL,QR_MODE_ALPHABET,QR_MODE_ALPHABET,QR_MODE_8BIT,QR_MODE_KANJI
+};
+
+// 文字種別(IsNumeralData, IsAlphabetData, IsKanjiData の先頭バイト判定)
+#define SEG_TYPE_NUMERAL   1
+#define SEG_TYPE_ALPHABET  2
+#define SEG_TYPE_KANJI1    4
+#define SEG_TYPE_FIXED     8 // 漢字モード固定(qr_source_fixed)
+
+static uint8_t        SegCharType[256];
+static std::once_flag SegCharTypeOnce;
+
+static void build_char_type() {
+  for(int c=0;c<256;c++) {
+    SegCharType[c] = (uint8_t)((IsNumeralData((unsigned char)c) ? SEG_TYPE_NUMERAL : 0) |
+                               (IsAlphabetData((unsigned char)c) ? SEG_TYPE_ALPHABET : 0) |
+                               (IsKanjiData((unsigned char)c,0x40) ? SEG_TYPE_KANJI1 : 0));
+  }
+}
+
+// byWork holds two bytes per position and version group: the cheapest
+// state there (where a block opened at the next character comes from) and
+// which of the states that can open a block did so.
+#define SEG_OPENED_NUMERAL   1
+#define SEG_OPENED_ALPHABET  2
+#define SEG_OPENED_8BIT      4
+#define SEG_OPENED_KANJI     8
+
+#define SEG_GROUPS           3 // QR_VRESION_S, M, L
+
+size_t qr_segment_work_size(int ncLength) {
+  return (size_t)(ncLength + 1) * 2 * SEG_GROUPS;
+}
+
+static inline int32_t seg_min(int32_t a,int32_t b) {
+  return a < b ? a : b;
+}
+
+// Costs of one version group at p - 1.
+typedef struct tagSEG_STATE
+{
+	int32_t n0, n1, n2; // 数字
+	int32_t a0, a1;     // 英数字
+	int32_t b8;         // ８ビットバイト
+	int32_t kj;         // 漢字
+	int32_t nBest1;     // p-1 の最小
+	int32_t nBest2;     // p-2 の最小
+	int32_t kj2;        // p-2 の漢字
+
+	// モード別の新規ブロック開始コスト(インジケータ + 文字数)と先頭 1 文字
+	int32_t nOpenNumeral, nOpenAlphabet, nOpen8Bit, nOpenKanji;
+} SEG_STATE;
+
+static void seg_init(SEG_STATE &g,int nVerGroup) {
+  g.n0 = g.n1 = g.n2 = SEG_INFINITY;
+  g.a0 = g.a1 = g.b8 = g.kj = SEG_INFINITY;
+  g.nBest1 = 0;
+  g.nBest2 = g.kj2 = SEG_INFINITY;
+
+  g.nOpenNumeral  = 4 + nIndicatorLenNumeral[nVerGroup]  + 4;
+  g.nOpenAlphabet = 4 + nIndicatorLenAlphabet[nVerGroup] + 6;
+  g.nOpen8Bit     = 4 + nIndicatorLen8Bit[nVerGroup]     + 8;
+  g.nOpenKanji    = 4 + nIndicatorLenKanji[nVerGroup]    + 13;
+}
+
+// One position of one group's dynamic program.
+static inline void seg_step(SEG_STATE &g,int nType,bool bKanjiPrev,uint8_t *byArgMin,uint8_t *byOpened) {
+  bool bNumeral  = (nType & SEG_TYPE_NUMERAL) != 0;
+  bool bAlphabet = (nType & SEG_TYPE_ALPHABET) != 0;
+
+  // Continuing a block wins ties so they keep fewer blocks. Values
+  // carried from an unreachable state only grow by a few bits before the
+  // character type changes or a block opens, so they stay near infinity.
+  int32_t nCont, nNew;
+  int nOpened = 0;
+
+  nCont = g.n0 + 4; nNew = g.nBest1 + g.nOpenNumeral;
+  int32_t t1 = bNumeral ? seg_min(nCont,nNew) : SEG_INFINITY;
+  nOpened |= nNew < nCont ? SEG_OPENED_NUMERAL : 0;
+  int32_t t2 = bNumeral ? g.n1 + 3 : SEG_INFINITY;
+  int32_t t0 = bNumeral ? g.n2 + 3 : SEG_INFINITY;
+
+  nCont = g.a0 + 6; nNew = g.nBest1 + g.nOpenAlphabet;
+  int32_t u1 = bAlphabet ? seg_min(nCont,nNew) : SEG_INFINITY;
+  nOpened |= nNew < nCont ? SEG_OPENED_ALPHABET : 0;
+  int32_t u0 = bAlphabet ? g.a1 + 5 : SEG_INFINITY;
+
+  nCont = g.b8 + 8; nNew = g.nBest1 + g.nOpen8Bit;
+  int32_t v8 = (nType & SEG_TYPE_FIXED) ? SEG_INFINITY : seg_min(nCont,nNew);
+  nOpened |= nNew < nCont ? SEG_OPENED_8BIT : 0;
+
+  nCont = g.kj2 + 13; nNew = g.nBest2 + g.nOpenKanji;
+  int32_t vk = bKanjiPrev ? seg_min(nCont,nNew) : SEG_INFINITY;
+  nOpened |= nNew < nCont ? SEG_OPENED_KANJI : 0;
+
+  *byOpened = (uint8_t)nOpened;
+
+  g.kj2    = g.kj;
+  g.nBest2 = g.nBest1;
+
+  g.n0 = t0; g.n1 = t1; g.n2 = t2; g.a0 = u0; g.a1 = u1; g.b8 = v8; g.kj = vk;
+
+  // Cheapest state as a tree, it is on the critical path.
+  int32_t m01 = seg_min(t0,t1), m23 = seg_min(t2,u0), m45 = seg_min(u1,v8);
+  int32_t nBest = seg_min(seg_min(m01,m23),seg_min(m45,vk));
+  g.nBest1 = nBest;
+
+  // Which state that was is only needed when walking back.
+  int s = SEG_KANJI;
+  s = v8 == nBest ? SEG_8BIT      : s;
+  s = u1 == nBest ? SEG_ALPHABET1 : s;
+  s = u0 == nBest ? SEG_ALPHABET0 : s;
+  s = t2 == nBest ? SEG_NUMERAL2  : s;
+  s = t1 == nBest ? SEG_NUMERAL1  : s;
+  s = t0 == nBest ? SEG_NUMERAL0  : s;
+  *byArgMin = (uint8_t)s;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_segment_measure
+// 用  途：全バージョン(型番)グループの最短ビット長算出
+// 引  数：入力データ、入力データ長、作業領域(qr_segment_work_size)、ビット長格納先(3 要素)
+
+template<class SOURCE>
+static void segment_measure(const SOURCE &lpsSource,int ncLength,uint8_t *byWork,int *ncBits) {
+  std::call_once(SegCharTypeOnce,build_char_type);
+
+  // A block may open from the cheapest state of the previous position:
+  // opening a block of the mode already running costs a whole header to
+  // save at most one bit, so it never wins and need not be excluded.
+  // Kanji reaches back two bytes, so its own cost and the cheapest state
+  // at p - 2 are kept as well.
+  SEG_STATE g[SEG_GROUPS];
+  uint8_t  *byArgMin[SEG_GROUPS];
+  uint8_t  *byOpened[SEG_GROUPS];
+
+  for(int n=0;n<SEG_GROUPS;n++) {
+    seg_init(g[n],n);
+
+    byArgMin[n] = byWork + (size_t)(ncLength + 1) * (2 * n);
+    byOpened[n] = byWork + (size_t)(ncLength + 1) * (2 * n + 1);
+    byArgMin[n][0] = SEG_START;
+  }
+
+  bool bKanjiPrev = false; // 位置 p-2 から漢字 1 文字
+
+  for(int p=1;p<=ncLength;p++) {
+    // A fixed pair's bytes can only be reached as one Kanji character: no
+    // state but Kanji survives its second byte (its lead byte is neither a
+    // digit nor alphanumeric and 8-bit is shut off).
+    uint8_t c     = lpsSource[p - 1];
+    int     nType = SegCharType[c] | (qr_source_fixed(lpsSource,p - 1) ? SEG_TYPE_FIXED : 0);
+
+    // The three groups are independent chains, so they overlap.
+    for(int n=0;n<SEG_GROUPS;n++) seg_step(g[n],nType,bKanjiPrev,byArgMin[n] + p,byOpened[n] + p);
+
+    // Whether a Kanji character starts at p - 1, used at p + 1.
+    bKanjiPrev = (nType & SEG_TYPE_KANJI1) && qr_source_kanji(lpsSource,p - 1,ncLength);
+  }
+
+  for(int n=0;n<SEG_GROUPS;n++) ncBits[n] = g[n].nBest1;
+}
+
+void qr_segment_measure(const uint8_t *lpsSource,int ncLength,uint8_t *byWork,int *ncBits) {
+  segment_measure(lpsSource,ncLength,byWork,ncBits);
+}
+
+void qr_segment_measure(const QR_GATHERSOURCE &lpsSource,int ncLength,uint8_t *byWork,int *ncBits) {
+  segment_measure(lpsSource,ncLength,byWork,ncBits);
+}
+
+void qr_segment_measure(const QR_SJISSOURCE &lpsSource,int ncLength,uint8_t *byWork,int *ncBits) {
+  segment_measure(lpsSource,ncLength,byWork,ncBits);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_segment_fit
+// 用  途：指定ビット長に収まる最長の先頭部分の長さ取得
+// 引  数：入力データ、入力データ長、バージョン(型番)グループ、最大ビット長、
+//         分割可能位置(ncLength + 1 要素、NULL=全位置)、先頭部分のビット長格納先(NULL 可)
+// 戻り値：先頭部分の長さ(収まらない場合=0)
+
+int qr_segment_fit(const uint8_t *lpsSource,int ncLength,int nVerGroup,int ncMaxBits,const uint8_t *byCut,int *ncFitBits) {
+  std::call_once(SegCharTypeOnce,build_char_type);
+
+  SEG_STATE g;
+  uint8_t   byArgMin, byOpened; // 後戻りしないので捨てる
+  int       ncFit = 0, ncBits = 0;
+
+  seg_init(g,nVerGroup);
+
+  bool bKanjiPrev = false;
+
+  // The cost of a prefix is not quite monotonic (a lone Kanji lead byte
+  // costs more than the whole character), but every state at p comes from
+  // p - 1 or p - 2, so once both are over the limit everything after is.
+  for(int p=1;p<=ncLength;p++) {
+    uint8_t c     = lpsSource[p - 1];
+    int     nType = SegCharType[c];
+
+    seg_step(g,nType,bKanjiPrev,&byArgMin,&byOpened);
+    bKanjiPrev = (nType & SEG_TYPE_KANJI1) && p < ncLength && IsKanjiData(c,lpsSource[p]);
+
+    if(g.nBest1 <= ncMaxBits && (byCut == NULL || byCut[p])) { ncFit = p; ncBits = g.nBest1; }
+    if(g.nBest1 > ncMaxBits && g.nBest2 > ncMaxBits) break;
+  }
+
+  if(ncFitBits != NULL) *ncFitBits = ncBits;
+  return ncFit;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_segment_blocks
+// 用  途：qr_segment_measure の結果からモードブロック取得
+// 引  数：入力データ長、バージョン(型番)グループ、作業領域、ブロックモード格納先、
+//         ブロック長格納先(ncLength 要素)
+// 戻り値：ブロック数
+
+int qr_segment_blocks(int ncLength,int nVerGroup,const uint8_t *byWork,uint8_t *byBlockMode,int32_t *nBlockLength) {
+  const uint8_t *byArgMin = byWork + (size_t)(ncLength + 1) * (2 * nVerGroup);
+  const uint8_t *byOpened = byWork + (size_t)(ncLength + 1) * (2 * nVerGroup + 1);
+
+  // 最短の終了状態から逆順にたどってブロック化
+  // A block never reopens its own mode, so a change of mode while walking
+  // back is a block boundary.
+  int ncBlock = 0;
+  int pos = ncLength;
+  int s   = byArgMin[ncLength];
+
+  while(pos > 0) {
+    int step = s == SEG_KANJI ? 2 : 1;
+    int nPrev;
+
+    switch(s) {
+    case SEG_NUMERAL1:  nPrev = (byOpened[pos] & SEG_OPENED_NUMERAL)  ? byArgMin[pos - 1] : SEG_NUMERAL0;  break;
+    case SEG_NUMERAL2:  nPrev = SEG_NUMERAL1;  break;
+    case SEG_NUMERAL0:  nPrev = SEG_NUMERAL2;  break;
+    case SEG_ALPHABET1: nPrev = (byOpened[pos] & SEG_OPENED_ALPHABET) ? byArgMin[pos - 1] : SEG_ALPHABET0; break;
+    case SEG_ALPHABET0: nPrev = SEG_ALPHABET1; break;
+    case SEG_8BIT:      nPrev = (byOpened[pos] & SEG_OPENED_8BIT)     ? byArgMin[pos - 1] : SEG_8BIT;      break;
+    default:            nPrev = (byOpened[pos] & SEG_OPENED_KANJI)    ? byArgMin[pos - 2] : SEG_KANJI;     break;
+    }
+
+    if(ncBlock == 0 || byBlockMode[ncBlock - 1] != SegMode[s]) {
+      byBlockMode[ncBlock]  = SegMode[s];
+      nBlockLength[ncBlock] = 0;
+      ++ncBlock;
+    }
+    nBlockLength[ncBlock - 1] += step;
+
+    pos -= step;
+    s = nPrev;
+  }
+
+  // 逆順で格納したので反転
+  for(int i=0,j=ncBlock-1;i<j;++i,--j) {
+    uint8_t byMode = byBlockMode[i];   byBlockMode[i]  = byBlockMode[j];  byBlockMode[j]  = byMode;
+    int32_t nLen   = nBlockLength[i];  nBlockLength[i] = nBlockLength[j]; nBlockLength[j] = nLen;
+  }
+
+  return ncBlock;
+}
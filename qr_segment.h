@@ -0,0 +1,41 @@
+#ifndef QR_SEGMENT_H
+#define QR_SEGMENT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "qr_source.h"
+
+// Optimal mode segmentation.
+//
+// Splits the input into numeric, alphanumeric, 8-bit and Kanji mode blocks
+// so that the bit stream is as short as possible, mode indicators and
+// character count indicators included. It is a single forward pass of a
+// dynamic program over seven states (numeric with 0/1/2 characters pending
+// a group, alphanumeric with 0/1 pending, 8-bit, Kanji), so the partial
+// group costs (4/7 bits numeric, 6 bits alphanumeric) are exact rather than
+// averaged.
+//
+// The bit length depends on the version group only through the character
+// count indicator widths, so qr_segment_measure() runs the program for all
+// three groups in the same pass and qr_segment_blocks() then walks back the
+// one that was chosen.
+
+// Work space needed for ncLength input bytes.
+size_t qr_segment_work_size(int ncLength);
+
+// ncBits[QR_VRESION_S/M/L] receives the shortest bit stream length for
+// each version group.
+void qr_segment_measure(const uint8_t *lpsSource,int ncLength,uint8_t *byWork,int *ncBits);
+void qr_segment_measure(const QR_GATHERSOURCE &lpsSource,int ncLength,uint8_t *byWork,int *ncBits);
+void qr_segment_measure(const QR_SJISSOURCE &lpsSource,int ncLength,uint8_t *byWork,int *ncBits);
+
+// Length of the longest prefix whose shortest bit stream for nVerGroup is
+// at most ncMaxBits, 0 if there is none; ncFitBits (may be NULL) receives
+// that bit stream length. With byCut the prefix only ends at positions p
+// where byCut[p] is set. Reads only as far as it has to.
+int qr_segment_fit(const uint8_t *lpsSource,int ncLength,int nVerGroup,int ncMaxBits,const uint8_t *byCut,int *ncFitBits);
+
+// Writes the blocks of one group in the byBlockMode/nBlockLength layout
+// used by qr_encode_source_data() (Kanji lengths in bytes) and returns
+// their number. byWork must still hold the qr_segment_measure() result.
+int qr_segment_blocks(int ncLength,int nVerGroup,const uint8_t *byWork,uint8_t *byBlockMode,int32_t *nBlockLength);
+#endif
@@ -0,0 +1,830 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "qr_encodeem.h"
+#include "qr_image.h"
+#include "qr_stats.h"
+#include "qr_server.h"
+
+#define MAX_INPUTDATA   3096 // maximum input data size
+#define MAX_QRCODESIZE  4096 // (177*177)/8
+
+#define SERVER_QUEUE    1024  // 既定の待ち行列長
+#define SERVER_PIPELINE 256   // 既定の接続毎未応答要求数上限
+#define SERVER_BUFFER   65536 // 読込、書込バッファ
+
+/////////////////////////////////////////////////////////////////////////////
+// Frame headers
+
+static void put_u16(uint8_t *p,uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p,uint32_t v) {
+  put_u16(p,v);
+  put_u16(p + 2,v >> 16);
+}
+
+static uint32_t get_u16(const uint8_t *p) {
+  return p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+void qr_request_pack(const QR_REQUEST *req,int ncPayload,uint8_t *header) {
+  put_u32(header,QR_SERVER_HEADERSIZE - 4 + ncPayload);
+  put_u32(header + 4,req->nId);
+  header[8]  = (uint8_t)req->nType;
+  header[9]  = (uint8_t)req->nLevel;
+  header[10] = (uint8_t)(int8_t)req->nVersion;
+  header[11] = (uint8_t)(int8_t)req->nMaskingNo;
+  header[12] = (uint8_t)req->nFormat;
+  header[13] = (uint8_t)req->nScale;
+  header[14] = (uint8_t)req->nQuietZone;
+  header[15] = (uint8_t)req->nFlags;
+}
+
+bool qr_request_unpack(const uint8_t *header,QR_REQUEST *req,int *ncPayload) {
+  uint32_t ncLength = get_u32(header);
+  if(ncLength < QR_SERVER_HEADERSIZE - 4 || ncLength > QR_SERVER_HEADERSIZE - 4 + QR_SERVER_MAXPAYLOAD) return false;
+
+  *ncPayload      = (int)ncLength - (QR_SERVER_HEADERSIZE - 4);
+  req->nId        = get_u32(header + 4);
+  req->nType      = header[8];
+  req->nLevel     = header[9];
+  req->nVersion   = (int8_t)header[10];
+  req->nMaskingNo = (int8_t)header[11];
+  req->nFormat    = header[12];
+  req->nScale     = header[13];
+  req->nQuietZone = header[14];
+  req->nFlags     = header[15];
+
+  return true;
+}
+
+void qr_response_pack(const QR_RESPONSE *resp,uint8_t *header) {
+  put_u32(header,QR_SERVER_HEADERSIZE - 4 + resp->ncBody);
+  put_u32(header + 4,resp->nId);
+  header[8]  = (uint8_t)resp->nStatus;
+  header[9]  = (uint8_t)resp->nFormat;
+  header[10] = (uint8_t)resp->nVersion;
+  header[11] = (uint8_t)(int8_t)resp->nMaskingNo;
+  put_u16(header + 12,resp->width);
+  put_u16(header + 14,0);
+}
+
+bool qr_response_unpack(const uint8_t *header,QR_RESPONSE *resp) {
+  uint32_t ncLength = get_u32(header);
+  if(ncLength < QR_SERVER_HEADERSIZE - 4 || ncLength >= 0x40000000) return false;
+
+  resp->ncBody     = ncLength - (QR_SERVER_HEADERSIZE - 4);
+  resp->nId        = get_u32(header + 4);
+  resp->nStatus    = header[8];
+  resp->nFormat    = header[9];
+  resp->nVersion   = header[10];
+  resp->nMaskingNo = (int8_t)header[11];
+  resp->width      = (int)get_u16(header + 12);
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Server
+
+struct SERVER_CONN;
+
+// One request, from the reader through the queue and a worker to the
+// writer, which frees it.
+typedef struct tagSERVER_JOB
+{
+	SERVER_CONN *conn;
+	QR_REQUEST   req;
+	int          ncPayload;
+	uint8_t      byPayload[QR_SERVER_MAXPAYLOAD];
+	uint64_t     nReceived; // 受信時刻
+
+	QR_RESPONSE          resp;
+	std::vector<uint8_t> body;
+	bool                 bDone; // conn->mutex で保護
+} SERVER_JOB;
+
+struct SERVER_CONN
+{
+	QR_SERVER  *server;
+	int         fd;
+	std::thread reader;
+	std::thread writer;
+
+	std::mutex               mutex;
+	std::condition_variable  cv;
+	std::deque<SERVER_JOB *> pending;   // 要求順
+	bool                     bReadDone;
+	std::atomic<bool>        bFinished; // 読込、書込とも終了
+};
+
+struct tagQR_SERVER
+{
+	char *szPath;
+	int   fdListen;
+	int   fdWake[2];  // qr_server_stop() から qr_server_run() へ
+	std::atomic<bool> bStop;
+
+	int ncPipeline;
+	std::vector<std::thread> workers;
+	QR_SYMBOLCACHE *cache;
+
+	// ワーカー前の待ち行列(リングバッファ)
+	std::mutex              queueMutex;
+	std::condition_variable cvNotEmpty;
+	std::condition_variable cvNotFull;
+	SERVER_JOB **queue;
+	int          ncQueue;
+	int          nHead;
+	int          ncQueued;
+	int          ncQueuedMax;
+	bool         bWorkersStop;
+
+	std::list<SERVER_CONN *> conns; // qr_server_run() のスレッドのみ
+
+	std::atomic<uint64_t> ncAccepted, ncConnections, ncRequests, ncFailed, ncBadRequests, ncBadFrames;
+	std::atomic<uint64_t> ncQueueWaits, ncPipelineWaits, ncBytesIn, ncBytesOut;
+	std::atomic<uint64_t> ncBucket[QR_HIST_BUCKETS];
+	std::atomic<uint64_t> nMaxNs;
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// send() rather than write() so a vanished client is EPIPE, not SIGPIPE.
+static bool write_all(int fd,const uint8_t *data,size_t ncData) {
+  while(ncData > 0) {
+    ssize_t n = send(fd,data,ncData,MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+
+    data   += n;
+    ncData -= n;
+  }
+  return true;
+}
+
+static bool append_body(void *arg,const uint8_t *data,size_t ncData) {
+  std::vector<uint8_t> *body = (std::vector<uint8_t> *)arg;
+  body->insert(body->end(),data,data + ncData);
+  return true;
+}
+
+static void encode_job(QR_SERVER *server,SERVER_JOB *job) {
+  const QR_REQUEST &req = job->req;
+  QR_RESPONSE &resp = job->resp;
+  bool bImage = req.nFormat == QR_OUTPUT_PBM || req.nFormat == QR_OUTPUT_PNG;
+
+  if(req.nLevel < QR_LEVEL_L || req.nLevel > QR_LEVEL_H || req.nVersion < 0 || req.nVersion > 40 ||
+     req.nMaskingNo < -1 || req.nMaskingNo > 7 || req.nFormat < QR_OUTPUT_BITMAP || req.nFormat > QR_OUTPUT_PNG ||
+     (bImage && (req.nScale < 1 || req.nScale > QR_SERVER_MAXSCALE || req.nQuietZone > QR_SERVER_MAXQUIET)) || job->ncPayload > MAX_INPUTDATA) {
+    resp.nStatus = QR_STATUS_BADREQUEST;
+    server->ncBadRequests.fetch_add(1,std::memory_order_relaxed);
+    return;
+  }
+
+  uint8_t image[MAX_QRCODESIZE];
+  QR_MASKRESULT mask_result;
+  int outputdata_len, width;
+  bool bAutoExtent = (req.nFlags & QR_REQFLAG_AUTOEXTENT) != 0;
+  bool bOk;
+
+  // エンコーダでは長さ 0 が NUL 終端の意味になるので、ここでデータなしとする
+  if(job->ncPayload == 0)
+    bOk = false;
+  else if(server->cache != NULL && (req.nFlags & QR_REQFLAG_NOCACHE) == 0)
+    bOk = qr_encode_data_cached(server->cache,req.nLevel,req.nVersion,bAutoExtent,req.nMaskingNo,job->byPayload,job->ncPayload,image,&width,&mask_result,1);
+  else
+    bOk = qr_encode_data_ex(req.nLevel,req.nVersion,bAutoExtent,req.nMaskingNo,job->byPayload,job->ncPayload,image,&outputdata_len,&width,&mask_result,1);
+
+  if(!bOk) {
+    resp.nStatus = QR_STATUS_FAILED;
+    server->ncFailed.fetch_add(1,std::memory_order_relaxed);
+    return;
+  }
+
+  resp.width      = width;
+  resp.nVersion   = (width - 17) / 4;
+  resp.nMaskingNo = mask_result.nMaskingNo;
+
+  if(bImage)
+    qr_write_image(image,width,req.nFormat == QR_OUTPUT_PBM ? QR_IMAGE_PBM : QR_IMAGE_PNG,req.nScale,req.nQuietZone,append_body,&job->body);
+  else
+    job->body.assign(image,image + qr_image_size(width));
+}
+
+static void stats_job(QR_SERVER *server,SERVER_JOB *job) {
+  int nFormat = job->req.nFormat;
+
+  if((nFormat != QR_STATS_TEXT && nFormat != QR_STATS_JSON) || job->ncPayload != 0) {
+    job->resp.nStatus = QR_STATUS_BADREQUEST;
+    server->ncBadRequests.fetch_add(1,std::memory_order_relaxed);
+    return;
+  }
+
+  QR_SERVERSTATS stats;
+  QR_STATS encoder;
+  char szServer[4096], szEncoder[8192];
+
+  qr_server_stats(server,&stats);
+  qr_stats_snapshot(&encoder,false);
+
+  int ncServer  = qr_server_stats_format(&stats,nFormat,szServer,sizeof(szServer));
+  int ncEncoder = qr_stats_format(&encoder,nFormat,szEncoder,sizeof(szEncoder));
+  if(ncServer >= (int)sizeof(szServer)) ncServer = sizeof(szServer) - 1;
+  if(ncEncoder >= (int)sizeof(szEncoder)) ncEncoder = sizeof(szEncoder) - 1;
+
+  // JSON はひとつのオブジェクトにまとめる
+  while(ncServer > 0 && szServer[ncServer - 1] == '\n') ncServer--;
+  while(ncEncoder > 0 && szEncoder[ncEncoder - 1] == '\n') ncEncoder--;
+
+  std::vector<uint8_t> &body = job->body;
+  const char *szJoin = nFormat == QR_STATS_JSON ? ",\"encoder\":" : "\n";
+
+  if(nFormat == QR_STATS_JSON) body.insert(body.end(),(const uint8_t *)"{\"server\":",(const uint8_t *)"{\"server\":" + 10);
+  body.insert(body.end(),(uint8_t *)szServer,(uint8_t *)szServer + ncServer);
+  body.insert(body.end(),(const uint8_t *)szJoin,(const uint8_t *)szJoin + strlen(szJoin));
+  body.insert(body.end(),(uint8_t *)szEncoder,(uint8_t *)szEncoder + ncEncoder);
+  if(nFormat == QR_STATS_JSON) body.push_back('}');
+  body.push_back('\n');
+}
+
+static void server_worker(QR_SERVER *server) {
+  for(;;) {
+    SERVER_JOB *job;
+
+    {
+      std::unique_lock<std::mutex> lock(server->queueMutex);
+      server->cvNotEmpty.wait(lock,[&]{ return server->bWorkersStop || server->ncQueued > 0; });
+      if(server->ncQueued == 0) return;
+
+      job = server->queue[server->nHead];
+      server->nHead = (server->nHead + 1) % server->ncQueue;
+      server->ncQueued--;
+    }
+    server->cvNotFull.notify_one();
+
+    if(job->req.nType == QR_REQUEST_STATS) stats_job(server,job);
+    else encode_job(server,job);
+
+    // Notified under the lock: once the writer sees bDone the connection
+    // may go away.
+    SERVER_CONN *conn = job->conn;
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    job->bDone = true;
+    conn->cv.notify_all();
+  }
+}
+
+// Queues a request behind the connection's earlier ones and for the
+// workers, waiting while either limit is reached.
+static void submit_job(SERVER_CONN *conn,SERVER_JOB *job) {
+  QR_SERVER *server = conn->server;
+
+  {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if((int)conn->pending.size() >= server->ncPipeline) {
+      server->ncPipelineWaits.fetch_add(1,std::memory_order_relaxed);
+      conn->cv.wait(lock,[&]{ return (int)conn->pending.size() < server->ncPipeline; });
+    }
+    conn->pending.push_back(job);
+  }
+
+  server->ncRequests.fetch_add(1,std::memory_order_relaxed);
+
+  {
+    std::unique_lock<std::mutex> lock(server->queueMutex);
+    if(server->ncQueued == server->ncQueue) {
+      server->ncQueueWaits.fetch_add(1,std::memory_order_relaxed);
+      server->cvNotFull.wait(lock,[&]{ return server->ncQueued < server->ncQueue; });
+    }
+
+    server->queue[(server->nHead + server->ncQueued) % server->ncQueue] = job;
+    if(++server->ncQueued > server->ncQueuedMax) server->ncQueuedMax = server->ncQueued;
+  }
+  server->cvNotEmpty.notify_one();
+}
+
+static void server_reader(SERVER_CONN *conn) {
+  QR_SERVER *server = conn->server;
+  uint8_t *buf = new uint8_t[SERVER_BUFFER];
+  int ncBuf = 0;
+
+  for(;;) {
+    ssize_t n = read(conn->fd,buf + ncBuf,SERVER_BUFFER - ncBuf);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) break;
+
+    server->ncBytesIn.fetch_add(n,std::memory_order_relaxed);
+    ncBuf += n;
+
+    int nPos = 0;
+    bool bBad = false;
+
+    while(ncBuf - nPos >= QR_SERVER_HEADERSIZE) {
+      QR_REQUEST req;
+      int ncPayload;
+
+      if(!qr_request_unpack(buf + nPos,&req,&ncPayload)) {
+        bBad = true;
+        break;
+      }
+      if(ncBuf - nPos < QR_SERVER_HEADERSIZE + ncPayload) break;
+
+      SERVER_JOB *job = new SERVER_JOB;
+      job->conn      = conn;
+      job->req       = req;
+      job->ncPayload = ncPayload;
+      job->nReceived = now_ns();
+      job->bDone     = false;
+      memcpy(job->byPayload,buf + nPos + QR_SERVER_HEADERSIZE,ncPayload);
+
+      memset(&job->resp,0,sizeof(job->resp));
+      job->resp.nId        = req.nId;
+      job->resp.nFormat    = req.nFormat;
+      job->resp.nMaskingNo = -1;
+
+      submit_job(conn,job);
+      nPos += QR_SERVER_HEADERSIZE + ncPayload;
+    }
+
+    // 不正な長さ以降は区切りが分からないので切断(受付済みの要求には応答する)
+    if(bBad) {
+      server->ncBadFrames.fetch_add(1,std::memory_order_relaxed);
+      break;
+    }
+
+    memmove(buf,buf + nPos,ncBuf - nPos);
+    ncBuf -= nPos;
+  }
+
+  delete [] buf;
+
+  std::lock_guard<std::mutex> lock(conn->mutex);
+  conn->bReadDone = true;
+  conn->cv.notify_all();
+}
+
+// Writes responses in request order as they complete, gathering the ones
+// ready at once into one send. After a failed send the rest are dropped.
+static void server_writer(SERVER_CONN *conn) {
+  QR_SERVER *server = conn->server;
+  std::vector<SERVER_JOB *> ready;
+  std::vector<uint8_t> out;
+  bool bBroken = false;
+
+  out.reserve(SERVER_BUFFER);
+
+  for(;;) {
+    {
+      std::unique_lock<std::mutex> lock(conn->mutex);
+      conn->cv.wait(lock,[&]{ return conn->pending.empty() ? conn->bReadDone : conn->pending.front()->bDone; });
+      if(conn->pending.empty()) break;
+
+      while(!conn->pending.empty() && conn->pending.front()->bDone) {
+        ready.push_back(conn->pending.front());
+        conn->pending.pop_front();
+      }
+    }
+    conn->cv.notify_all(); // 未応答上限で待つ読込側へ
+
+    for(size_t n=0;n<ready.size() && !bBroken;n++) {
+      SERVER_JOB *job = ready[n];
+      uint8_t header[QR_SERVER_HEADERSIZE];
+
+      job->resp.ncBody = (uint32_t)job->body.size();
+      qr_response_pack(&job->resp,header);
+      out.insert(out.end(),header,header + QR_SERVER_HEADERSIZE);
+
+      // 大きな画像はコピーせずに直接
+      if(job->body.size() >= SERVER_BUFFER / 2) {
+        bBroken = !write_all(conn->fd,out.data(),out.size()) || !write_all(conn->fd,job->body.data(),job->body.size());
+        server->ncBytesOut.fetch_add(out.size() + job->body.size(),std::memory_order_relaxed);
+        out.clear();
+        continue;
+      }
+
+      out.insert(out.end(),job->body.begin(),job->body.end());
+      if(out.size() >= SERVER_BUFFER || n + 1 == ready.size()) {
+        bBroken = !write_all(conn->fd,out.data(),out.size());
+        server->ncBytesOut.fetch_add(out.size(),std::memory_order_relaxed);
+        out.clear();
+      }
+    }
+
+    uint64_t nNow = now_ns();
+
+    for(size_t n=0;n<ready.size();n++) {
+      uint64_t nNs = nNow - ready[n]->nReceived;
+
+      server->ncBucket[qr_hist_bucket(nNs)].fetch_add(1,std::memory_order_relaxed);
+      uint64_t nMax = server->nMaxNs.load(std::memory_order_relaxed);
+      while(nNs > nMax && !server->nMaxNs.compare_exchange_weak(nMax,nNs,std::memory_order_relaxed));
+
+      delete ready[n];
+    }
+    ready.clear();
+    out.clear();
+
+    // 読込側も止める(fd は qr_server_run() が回収時に閉じる)
+    if(bBroken) shutdown(conn->fd,SHUT_RDWR);
+  }
+
+  conn->bFinished = true;
+}
+
+static void reap_conn(QR_SERVER *server,SERVER_CONN *conn) {
+  conn->reader.join();
+  conn->writer.join();
+  close(conn->fd);
+  delete conn;
+
+  server->ncConnections.fetch_sub(1,std::memory_order_relaxed);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_server_create
+// 用  途：サーバー作成(待受開始、ワーカー起動)
+// 引  数：ソケットのパス、設定(NULL=既定)
+// 戻り値：サーバー(失敗時=NULL、errno 設定)
+
+QR_SERVER *qr_server_create(const char *szPath,const QR_SERVEROPTIONS *options) {
+  struct sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if(szPath == NULL || strlen(szPath) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  strcpy(addr.sun_path,szPath);
+
+  int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if(fd < 0) return NULL;
+
+  // 残っているソケットファイルは、応答がなければ置き換える
+  struct stat st;
+  if(lstat(szPath,&st) == 0 && S_ISSOCK(st.st_mode)) {
+    if(connect(fd,(struct sockaddr *)&addr,sizeof(addr)) == 0) {
+      close(fd);
+      errno = EADDRINUSE;
+      return NULL;
+    }
+    close(fd);
+    unlink(szPath);
+    fd = socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd < 0) return NULL;
+  }
+
+  int fdWake[2] = {-1,-1};
+
+  if(bind(fd,(struct sockaddr *)&addr,sizeof(addr)) != 0 || listen(fd,SOMAXCONN) != 0 ||
+     fcntl(fd,F_SETFL,O_NONBLOCK) != 0 || pipe(fdWake) != 0) {
+    int nError = errno;
+    close(fd);
+    errno = nError;
+    return NULL;
+  }
+
+  QR_SERVEROPTIONS defaults = {0,0,0,0};
+  if(options == NULL) options = &defaults;
+
+  int nWorkers = options->nWorkers > 0 ? options->nWorkers : (int)std::thread::hardware_concurrency();
+  if(nWorkers < 1) nWorkers = 1;
+
+  QR_SERVER *server = new QR_SERVER;
+
+  server->szPath = new char[strlen(szPath) + 1];
+  strcpy(server->szPath,szPath);
+
+  server->fdListen     = fd;
+  server->fdWake[0]    = fdWake[0];
+  server->fdWake[1]    = fdWake[1];
+  server->bStop        = false;
+  server->ncPipeline   = options->ncPipeline > 0 ? options->ncPipeline : SERVER_PIPELINE;
+  server->cache        = options->ncCacheBudget > 0 ? qr_cache_create(options->ncCacheBudget,0) : NULL;
+  server->ncQueue      = options->ncQueue > 0 ? options->ncQueue : SERVER_QUEUE;
+  server->queue        = new SERVER_JOB *[server->ncQueue];
+  server->nHead        = 0;
+  server->ncQueued     = 0;
+  server->ncQueuedMax  = 0;
+  server->bWorkersStop = false;
+
+  server->ncAccepted = server->ncConnections = server->ncRequests = server->ncFailed = server->ncBadRequests = server->ncBadFrames = 0;
+  server->ncQueueWaits = server->ncPipelineWaits = server->ncBytesIn = server->ncBytesOut = 0;
+  for(int n=0;n<QR_HIST_BUCKETS;n++) server->ncBucket[n] = 0;
+  server->nMaxNs = 0;
+
+  for(int n=0;n<nWorkers;n++) server->workers.push_back(std::thread(server_worker,server));
+
+  return server;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_server_run
+// 用  途：接続の受付(qr_server_stop() まで)
+// 引  数：サーバー
+// 戻り値：qr_server_stop() で終了した時=true、受付エラー時=false
+
+bool qr_server_run(QR_SERVER *server) {
+  struct pollfd fds[2] = {{server->fdListen,POLLIN,0},{server->fdWake[0],POLLIN,0}};
+  bool bOk = true;
+
+  while(!server->bStop) {
+    int n = poll(fds,2,1000);
+
+    // 終了した接続の回収
+    for(std::list<SERVER_CONN *>::iterator it=server->conns.begin();it!=server->conns.end();) {
+      if(!(*it)->bFinished) {
+        ++it;
+        continue;
+      }
+      reap_conn(server,*it);
+      it = server->conns.erase(it);
+    }
+
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0) {
+      bOk = false;
+      break;
+    }
+    if(n == 0 || (fds[0].revents & POLLIN) == 0) continue;
+
+    int fd = accept(server->fdListen,NULL,NULL);
+    if(fd < 0) continue; // EAGAIN、切断済み、fd 不足(次の回収後に再試行)
+
+    struct timeval tv = {QR_SERVER_SENDTIMEOUT,0};
+    setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+
+    SERVER_CONN *conn = new SERVER_CONN;
+    conn->server    = server;
+    conn->fd        = fd;
+    conn->bReadDone = false;
+    conn->bFinished = false;
+    conn->reader    = std::thread(server_reader,conn);
+    conn->writer    = std::thread(server_writer,conn);
+
+    server->conns.push_back(conn);
+    server->ncAccepted.fetch_add(1,std::memory_order_relaxed);
+    server->ncConnections.fetch_add(1,std::memory_order_relaxed);
+  }
+
+  // 読込を止め、受付済みの要求に応答してから閉じる
+  for(std::list<SERVER_CONN *>::iterator it=server->conns.begin();it!=server->conns.end();++it) shutdown((*it)->fd,SHUT_RD);
+  for(std::list<SERVER_CONN *>::iterator it=server->conns.begin();it!=server->conns.end();++it) reap_conn(server,*it);
+  server->conns.clear();
+
+  return bOk;
+}
+
+void qr_server_stop(QR_SERVER *server) {
+  server->bStop = true;
+
+  char c = 0;
+  ssize_t n = write(server->fdWake[1],&c,1);
+  (void)n;
+}
+
+void qr_server_destroy(QR_SERVER *server) {
+  if(server == NULL) return;
+
+  {
+    std::lock_guard<std::mutex> lock(server->queueMutex);
+    server->bWorkersStop = true;
+  }
+  server->cvNotEmpty.notify_all();
+  for(size_t n=0;n<server->workers.size();n++) server->workers[n].join();
+
+  close(server->fdListen);
+  close(server->fdWake[0]);
+  close(server->fdWake[1]);
+  unlink(server->szPath);
+
+  qr_cache_destroy(server->cache);
+  delete [] server->queue;
+  delete [] server->szPath;
+  delete server;
+}
+
+void qr_server_stats(QR_SERVER *server,QR_SERVERSTATS *stats) {
+  memset(stats,0,sizeof(QR_SERVERSTATS));
+
+  stats->ncAccepted      = server->ncAccepted;
+  stats->ncConnections   = server->ncConnections;
+  stats->ncRequests      = server->ncRequests;
+  stats->ncFailed        = server->ncFailed;
+  stats->ncBadRequests   = server->ncBadRequests;
+  stats->ncBadFrames     = server->ncBadFrames;
+  stats->ncQueueWaits    = server->ncQueueWaits;
+  stats->ncPipelineWaits = server->ncPipelineWaits;
+  stats->ncBytesIn       = server->ncBytesIn;
+  stats->ncBytesOut      = server->ncBytesOut;
+  stats->nWorkers        = (int)server->workers.size();
+
+  {
+    std::lock_guard<std::mutex> lock(server->queueMutex);
+    stats->ncQueue     = server->ncQueue;
+    stats->ncQueued    = server->ncQueued;
+    stats->ncQueuedMax = server->ncQueuedMax;
+  }
+
+  uint64_t ncBucket[QR_HIST_BUCKETS], ncTotal = 0;
+  for(int n=0;n<QR_HIST_BUCKETS;n++) ncTotal += (ncBucket[n] = server->ncBucket[n].load(std::memory_order_relaxed));
+
+  stats->nMaxNs  = server->nMaxNs;
+  stats->nP50Ns  = qr_hist_percentile(ncBucket,ncTotal,0.50);
+  stats->nP99Ns  = qr_hist_percentile(ncBucket,ncTotal,0.99);
+  stats->nP999Ns = qr_hist_percentile(ncBucket,ncTotal,0.999);
+
+  // A bucket midpoint can lie above the largest sample.
+  if(stats->nP50Ns > stats->nMaxNs) stats->nP50Ns = stats->nMaxNs;
+  if(stats->nP99Ns > stats->nMaxNs) stats->nP99Ns = stats->nMaxNs;
+  if(stats->nP999Ns > stats->nMaxNs) stats->nP999Ns = stats->nMaxNs;
+
+  if(server->cache != NULL) {
+    stats->bCache = true;
+    qr_cache_stats(server->cache,&stats->cache);
+  }
+}
+
+typedef struct tagSERVER_OUT
+{
+	char   *buf;
+	size_t  ncBuf;
+	size_t  ncLength;
+} SERVER_OUT;
+
+static void out_printf(SERVER_OUT *out,const char *format,...) {
+  va_list args;
+  va_start(args,format);
+
+  size_t ncLeft = out->ncLength < out->ncBuf ? out->ncBuf - out->ncLength : 0;
+  int n = vsnprintf(ncLeft ? out->buf + out->ncLength : NULL,ncLeft,format,args);
+  if(n > 0) out->ncLength += n;
+
+  va_end(args);
+}
+
+// Same contract as qr_stats_format().
+int qr_server_stats_format(const QR_SERVERSTATS *stats,int nFormat,char *buf,size_t ncBuf) {
+  SERVER_OUT out = {buf,ncBuf,0};
+  if(ncBuf > 0) buf[0] = 0;
+
+  unsigned long long v[] = {
+    stats->ncAccepted,stats->ncConnections,stats->ncRequests,stats->ncFailed,stats->ncBadRequests,stats->ncBadFrames,
+    stats->ncQueueWaits,stats->ncPipelineWaits,stats->ncBytesIn,stats->ncBytesOut,
+    stats->nP50Ns,stats->nP99Ns,stats->nP999Ns,stats->nMaxNs
+  };
+  const QR_CACHESTATS &c = stats->cache;
+
+  if(nFormat == QR_STATS_JSON) {
+    out_printf(&out,"{\"accepted\":%llu,\"connections\":%llu,\"requests\":%llu,\"failed\":%llu,\"bad_requests\":%llu,\"bad_frames\":%llu,"
+                    "\"queue_waits\":%llu,\"pipeline_waits\":%llu,\"bytes_in\":%llu,\"bytes_out\":%llu,"
+                    "\"latency\":{\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu},",
+               v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],v[8],v[9],v[10],v[11],v[12],v[13]);
+    out_printf(&out,"\"workers\":%d,\"queue\":{\"capacity\":%d,\"queued\":%d,\"max\":%d}",stats->nWorkers,stats->ncQueue,stats->ncQueued,stats->ncQueuedMax);
+    if(stats->bCache)
+      out_printf(&out,",\"cache\":{\"hits\":%llu,\"misses\":%llu,\"inserts\":%llu,\"evictions\":%llu,\"entries\":%llu,\"bytes\":%llu,\"budget\":%llu}",
+                 (unsigned long long)c.ncHits,(unsigned long long)c.ncMisses,(unsigned long long)c.ncInserts,(unsigned long long)c.ncEvictions,
+                 (unsigned long long)c.ncEntries,(unsigned long long)c.ncBytes,(unsigned long long)c.ncBudget);
+    out_printf(&out,"}\n");
+  } else {
+    out_printf(&out,"accepted %llu  connections %llu  requests %llu  failed %llu  bad_requests %llu  bad_frames %llu\n",v[0],v[1],v[2],v[3],v[4],v[5]);
+    out_printf(&out,"queue_waits %llu  pipeline_waits %llu  bytes_in %llu  bytes_out %llu\n",v[6],v[7],v[8],v[9]);
+    out_printf(&out,"latency p50_ns %llu  p99_ns %llu  p999_ns %llu  max_ns %llu\n",v[10],v[11],v[12],v[13]);
+    out_printf(&out,"workers %d  queue %d/%d  queue_max %d\n",stats->nWorkers,stats->ncQueued,stats->ncQueue,stats->ncQueuedMax);
+    if(stats->bCache)
+      out_printf(&out,"cache hits %llu  misses %llu  inserts %llu  evictions %llu  entries %llu  bytes %llu/%llu\n",
+                 (unsigned long long)c.ncHits,(unsigned long long)c.ncMisses,(unsigned long long)c.ncInserts,(unsigned long long)c.ncEvictions,
+                 (unsigned long long)c.ncEntries,(unsigned long long)c.ncBytes,(unsigned long long)c.ncBudget);
+  }
+
+  return (int)out.ncLength;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Client
+
+struct tagQR_CLIENT
+{
+	int      fd;
+	uint8_t *byOut;   // 未送信の要求
+	int      ncOut;
+
+	std::vector<uint8_t> in; // 受信済み
+	size_t               nInPos;
+	size_t               ncIn;
+};
+
+QR_CLIENT *qr_client_connect(const char *szPath) {
+  struct sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if(szPath == NULL || strlen(szPath) >= sizeof(addr.sun_path)) return NULL;
+  strcpy(addr.sun_path,szPath);
+
+  int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if(fd < 0) return NULL;
+
+  if(connect(fd,(struct sockaddr *)&addr,sizeof(addr)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  QR_CLIENT *client = new QR_CLIENT;
+  client->fd     = fd;
+  client->byOut  = new uint8_t[SERVER_BUFFER];
+  client->ncOut  = 0;
+  client->nInPos = 0;
+  client->ncIn   = 0;
+  client->in.resize(SERVER_BUFFER);
+
+  return client;
+}
+
+void qr_client_close(QR_CLIENT *client) {
+  if(client == NULL) return;
+
+  close(client->fd);
+  delete [] client->byOut;
+  delete client;
+}
+
+bool qr_client_flush(QR_CLIENT *client) {
+  bool bOk = write_all(client->fd,client->byOut,client->ncOut);
+  client->ncOut = 0;
+  return bOk;
+}
+
+bool qr_client_send(QR_CLIENT *client,const QR_REQUEST *req,const uint8_t *lpsPayload,int ncPayload) {
+  if(ncPayload < 0 || ncPayload > QR_SERVER_MAXPAYLOAD) return false;
+  if(client->ncOut + QR_SERVER_HEADERSIZE + ncPayload > SERVER_BUFFER && !qr_client_flush(client)) return false;
+
+  qr_request_pack(req,ncPayload,client->byOut + client->ncOut);
+  if(ncPayload > 0) memcpy(client->byOut + client->ncOut + QR_SERVER_HEADERSIZE,lpsPayload,ncPayload);
+  client->ncOut += QR_SERVER_HEADERSIZE + ncPayload;
+
+  return true;
+}
+
+// Until ncNeed bytes past nInPos have arrived.
+static bool client_fill(QR_CLIENT *client,size_t ncNeed) {
+  if(client->ncIn - client->nInPos >= ncNeed) return true;
+
+  std::vector<uint8_t> &in = client->in;
+
+  if(client->nInPos > 0) {
+    memmove(in.data(),in.data() + client->nInPos,client->ncIn - client->nInPos);
+    client->ncIn  -= client->nInPos;
+    client->nInPos = 0;
+  }
+  if(in.size() < ncNeed) in.resize(ncNeed);
+
+  while(client->ncIn < ncNeed) {
+    ssize_t n = read(client->fd,in.data() + client->ncIn,in.size() - client->ncIn);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    client->ncIn += n;
+  }
+
+  return true;
+}
+
+bool qr_client_recv(QR_CLIENT *client,QR_RESPONSE *resp,const uint8_t **body) {
+  if(client->ncOut > 0 && !qr_client_flush(client)) return false;
+
+  if(!client_fill(client,QR_SERVER_HEADERSIZE)) return false;
+  if(!qr_response_unpack(client->in.data() + client->nInPos,resp)) return false;
+  if(!client_fill(client,QR_SERVER_HEADERSIZE + resp->ncBody)) return false;
+
+  *body = client->in.data() + client->nInPos + QR_SERVER_HEADERSIZE;
+  client->nInPos += QR_SERVER_HEADERSIZE + resp->ncBody;
+
+  return true;
+}
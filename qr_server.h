@@ -0,0 +1,179 @@
+#ifndef QR_SERVER_H
+#define QR_SERVER_H
+#include <stddef.h>
+#include <stdint.h>
+#include "qr_cache.h"
+#include "qr_stats.h"
+
+// Encoding daemon.
+//
+// Serves encodes over a Unix domain socket so that every process on a host
+// shares one set of warm tables, one symbol cache and one thread pool. The
+// protocol is length prefixed binary frames. A connection may pipeline any
+// number of requests; they are encoded in parallel by a fixed pool of
+// workers and answered in the order they were sent.
+//
+// Every frame is a 16 byte header followed by its body, integers little
+// endian. The first field is the length of the rest of the frame.
+//
+//   request                           response
+//    0 uint32 length (12 + payload)    0 uint32 length (12 + body)
+//    4 uint32 id                       4 uint32 id (as in the request)
+//    8 uint8  type QR_REQUEST_*        8 uint8  status QR_STATUS_*
+//    9 uint8  level                    9 uint8  format
+//   10 int8   version, 0 = automatic  10 uint8  version
+//   11 int8   mask, -1 = automatic    11 int8   mask
+//   12 uint8  format QR_OUTPUT_*      12 uint16 width
+//   13 uint8  scale (PBM, PNG)        14 uint16 0
+//   14 uint8  quiet zone (PBM, PNG)
+//   15 uint8  flags QR_REQFLAG_*
+//
+// The body of an encode request is the payload (an empty one fails, it is
+// not taken as NUL terminated), that of its response the symbol in the
+// requested format. A stats request has no payload. Its format is
+// QR_STATS_TEXT or QR_STATS_JSON, and the response body holds the server's
+// counters with the encoder's own statistics (qr_stats.h).
+//
+// Backpressure: the queue in front of the workers and the number of
+// unanswered requests per connection are bounded. When either is full the
+// connection's reader stops reading, and the client's writes block once the
+// socket buffer fills. A client that takes more than QR_SERVER_SENDTIMEOUT
+// seconds to take a response off the socket is disconnected.
+
+#define QR_SERVER_PATH        "/tmp/qrem.sock" // qrd、qrload の既定
+#define QR_SERVER_HEADERSIZE  16
+#define QR_SERVER_MAXPAYLOAD  4096 // 超えるフレームは接続を切断
+#define QR_SERVER_MAXSCALE    32
+#define QR_SERVER_MAXQUIET    16
+#define QR_SERVER_SENDTIMEOUT 10
+
+// 要求種別
+#define QR_REQUEST_ENCODE  0
+#define QR_REQUEST_STATS   1
+
+// 出力形式
+#define QR_OUTPUT_BITMAP   0 // qr_getmodule() のレイアウト
+#define QR_OUTPUT_PBM      1
+#define QR_OUTPUT_PNG      2
+
+// 要求フラグ
+#define QR_REQFLAG_AUTOEXTENT 0x01 // 型番自動拡張
+#define QR_REQFLAG_NOCACHE    0x02 // キャッシュを使わない
+
+// 応答状態
+#define QR_STATUS_OK          0
+#define QR_STATUS_FAILED      1 // データなし、容量オーバー
+#define QR_STATUS_BADREQUEST  2 // 引数不正
+
+typedef struct tagQR_REQUEST
+{
+	uint32_t nId;
+	int      nType;      // QR_REQUEST_*
+	int      nLevel;
+	int      nVersion;
+	int      nMaskingNo;
+	int      nFormat;    // QR_OUTPUT_*、統計要求は QR_STATS_*
+	int      nScale;
+	int      nQuietZone;
+	int      nFlags;     // QR_REQFLAG_*
+
+} QR_REQUEST;
+
+typedef struct tagQR_RESPONSE
+{
+	uint32_t nId;
+	int      nStatus;    // QR_STATUS_*
+	int      nFormat;
+	int      nVersion;
+	int      nMaskingNo;
+	int      width;
+	uint32_t ncBody;
+
+} QR_RESPONSE;
+
+// Frame headers to and from the wire. The unpack functions return false
+// for a length field out of range, after which the stream can't be
+// resynchronised.
+void qr_request_pack(const QR_REQUEST *req,int ncPayload,uint8_t *header);
+bool qr_request_unpack(const uint8_t *header,QR_REQUEST *req,int *ncPayload);
+void qr_response_pack(const QR_RESPONSE *resp,uint8_t *header);
+bool qr_response_unpack(const uint8_t *header,QR_RESPONSE *resp);
+
+// Server
+
+typedef struct tagQR_SERVER QR_SERVER;
+
+typedef struct tagQR_SERVEROPTIONS
+{
+	int    nWorkers;      // 0 = ハードウェアスレッド数
+	int    ncQueue;       // ワーカー前の待ち行列長(0 = 既定)
+	int    ncPipeline;    // 接続毎の未応答要求数上限(0 = 既定)
+	size_t ncCacheBudget; // シンボルキャッシュ(0 = なし)
+
+} QR_SERVEROPTIONS;
+
+typedef struct tagQR_SERVERSTATS
+{
+	uint64_t ncAccepted;      // 受付接続数
+	uint64_t ncConnections;   // 現在の接続数
+	uint64_t ncRequests;
+	uint64_t ncFailed;        // QR_STATUS_FAILED
+	uint64_t ncBadRequests;   // QR_STATUS_BADREQUEST
+	uint64_t ncBadFrames;     // 不正フレームによる切断
+	uint64_t ncQueueWaits;    // 待ち行列満杯で読込停止
+	uint64_t ncPipelineWaits; // 未応答上限で読込停止
+	uint64_t ncBytesIn;
+	uint64_t ncBytesOut;
+
+	int      nWorkers;
+	int      ncQueue;         // 上限
+	int      ncQueued;        // 現在
+	int      ncQueuedMax;     // 最大
+
+	// 受信から応答書込みまで
+	uint64_t nP50Ns;
+	uint64_t nP99Ns;
+	uint64_t nP999Ns;
+	uint64_t nMaxNs;
+
+	bool          bCache;
+	QR_CACHESTATS cache;
+
+} QR_SERVERSTATS;
+
+// Binds and listens on szPath, replacing a stale socket there, and starts
+// the workers. NULL on failure with errno set. options may be NULL.
+QR_SERVER *qr_server_create(const char *szPath,const QR_SERVEROPTIONS *options);
+
+// Accepts and serves connections until qr_server_stop(). Requests already
+// read are still answered before it returns.
+bool qr_server_run(QR_SERVER *server);
+
+// Safe from any thread and from a signal handler.
+void qr_server_stop(QR_SERVER *server);
+
+// After qr_server_run() has returned. Removes the socket file.
+void qr_server_destroy(QR_SERVER *server);
+
+void qr_server_stats(QR_SERVER *server,QR_SERVERSTATS *stats);
+int  qr_server_stats_format(const QR_SERVERSTATS *stats,int nFormat,char *buf,size_t ncBuf);
+
+// Client
+//
+// Requests are buffered until qr_client_flush() or until the buffer is
+// full, so a client pipelines by sending several before reading; reading
+// flushes first. A client that only reads once it has sent everything must
+// keep the number unanswered below the server's pipeline limit, or both
+// sides end up waiting for the other.
+
+typedef struct tagQR_CLIENT QR_CLIENT;
+
+QR_CLIENT *qr_client_connect(const char *szPath);
+void qr_client_close(QR_CLIENT *client);
+
+bool qr_client_send(QR_CLIENT *client,const QR_REQUEST *req,const uint8_t *lpsPayload,int ncPayload);
+bool qr_client_flush(QR_CLIENT *client);
+
+// Next response. *body stays valid until the next call on the client.
+bool qr_client_recv(QR_CLIENT *client,QR_RESPONSE *resp,const uint8_t **body);
+#endif
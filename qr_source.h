@@ -0,0 +1,107 @@
+#ifndef QR_SOURCE_H
+#define QR_SOURCE_H
+#include <stdint.h>
+#include "qr_encodeem.h"
+#include "qr_utils.h"
+
+// Payload access for the segmentation and bit stream stages.
+//
+// Those stages are templates over the source type and only ever index it:
+// a plain const uint8_t * for qr_encode_data_ctx(), or QR_GATHERSOURCE for
+// the fragments of qr_encode_datav_ctx(). Both read the payload front to
+// back with a byte or two of lookahead and then start over for the next
+// pass, so the gather source keeps its current fragment and walks forward
+// from it, going back to the first fragment when an index is behind it.
+// Every byte is read in place; fragment boundaries are invisible to the
+// stages, including inside a Kanji pair or a numeric group.
+//
+// QR_SJISSOURCE is UTF-8 input after qr_utf8_convert() (qr_utf8.h): the
+// Kanji characters are the converted pairs and nothing else, since the
+// bytes around them are raw UTF-8 that may look like Shift-JIS, and those
+// pairs have to stay in Kanji mode. The stages ask qr_source_kanji() and
+// qr_source_fixed() rather than looking at the bytes themselves.
+
+struct QR_GATHERSOURCE
+{
+	const QR_IOVEC *iov;
+	int             ncIov;
+
+	mutable int            nFrag;  // 現在の断片
+	mutable int            nStart; // 現在の断片の先頭位置
+	mutable int            nEnd;   // 現在の断片の終端位置
+	mutable const uint8_t *pFrag;  // 現在の断片のデータ
+
+	QR_GATHERSOURCE(const QR_IOVEC *iov_,int ncIov_) : iov(iov_), ncIov(ncIov_) { rewind(); }
+
+	uint8_t operator[](int i) const {
+		if ((unsigned)(i - nStart) >= (unsigned)(nEnd - nStart))
+			seek(i);
+
+		return pFrag[i - nStart];
+	}
+
+	void rewind() const {
+		nFrag  = nStart = 0;
+		nEnd   = ncIov > 0 ? iov[0].ncData : 0;
+		pFrag  = ncIov > 0 ? iov[0].pData : NULL;
+	}
+
+	void seek(int i) const {
+		if (i < nStart)
+			rewind();
+
+		// 空の断片も読み飛ばす
+		while (i >= nEnd)
+		{
+			nStart = nEnd;
+			nEnd  += iov[++nFrag].ncData;
+		}
+
+		pFrag = iov[nFrag].pData;
+	}
+};
+
+struct QR_SJISSOURCE
+{
+	const uint8_t *pData;   // 変換後データ
+	const uint8_t *byKanji; // QR_UTF8_* (qr_utf8.h)
+
+	uint8_t operator[](int i) const { return pData[i]; }
+};
+
+// Whether a Kanji character starts at i.
+template<class SOURCE>
+inline bool qr_source_kanji(const SOURCE &lpsSource,int i,int ncLength) {
+	return i + 1 < ncLength && IsKanjiData(lpsSource[i],lpsSource[i + 1]);
+}
+
+inline bool qr_source_kanji(const QR_SJISSOURCE &lpsSource,int i,int) {
+	return lpsSource.byKanji[i] == 1; // QR_UTF8_LEAD
+}
+
+// Whether byte i belongs to a Kanji character that must not be encoded in
+// any other mode.
+template<class SOURCE>
+inline bool qr_source_fixed(const SOURCE &,int) {
+	return false;
+}
+
+inline bool qr_source_fixed(const QR_SJISSOURCE &lpsSource,int i) {
+	return lpsSource.byKanji[i] != 0;
+}
+
+// Total payload length of the fragments, -1 if any has a negative length.
+inline int qr_iovec_length(const QR_IOVEC *iov,int ncIov) {
+	int ncLength = 0;
+
+	for (int n = 0; n < ncIov; ++n)
+	{
+		if (iov[n].ncData < 0)
+			return -1;
+
+		ncLength += iov[n].ncData;
+	}
+
+	return ncLength;
+}
+#endif
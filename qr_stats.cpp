@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <atomic>
+#include "qr_stats.h"
+
+static const char *StageName[QR_STAT_COUNT] = {
+  "encode","segment","version","interleave","rs","placement","masking","penalty"
+};
+
+const char *qr_stats_stage_name(int nStage) {
+  if(nStage < 0 || nStage >= QR_STAT_COUNT) return "";
+  return StageName[nStage];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Latency histogram
+//
+// Log-linear buckets: values below 16 ns get a bucket each, above that every
+// power of two is split into 16 buckets, so a bucket is within 1/16 of its
+// value. 64 powers cover any uint64_t.
+
+#define HIST_SUBBITS   4
+#define HIST_SUB       (1 << HIST_SUBBITS)
+
+static_assert(QR_HIST_BUCKETS == 64 * HIST_SUB,"QR_HIST_BUCKETS");
+
+int qr_hist_bucket(uint64_t nNs) {
+  if(nNs < HIST_SUB) return (int)nNs;
+
+  int e = 63 - __builtin_clzll(nNs);
+  return HIST_SUB + (e - HIST_SUBBITS) * HIST_SUB + (int)((nNs >> (e - HIST_SUBBITS)) & (HIST_SUB - 1));
+}
+
+// Midpoint of a bucket.
+uint64_t qr_hist_value(int nBucket) {
+  if(nBucket < HIST_SUB) return nBucket;
+
+  int e     = (nBucket - HIST_SUB) / HIST_SUB + HIST_SUBBITS;
+  int sub   = (nBucket - HIST_SUB) % HIST_SUB;
+  int shift = e - HIST_SUBBITS;
+
+  uint64_t low = (uint64_t)(HIST_SUB + sub) << shift;
+  return low + (((uint64_t)1 << shift) >> 1);
+}
+
+// First bucket whose cumulative count reaches fraction p of ncTotal.
+uint64_t qr_hist_percentile(const uint64_t *ncBucket,uint64_t ncTotal,double p) {
+  if(ncTotal == 0) return 0;
+
+  uint64_t nRank = (uint64_t)(p * ncTotal);
+  if(nRank >= ncTotal) nRank = ncTotal - 1;
+
+  uint64_t nSeen = 0;
+  for(int n=0;n<QR_HIST_BUCKETS;n++) {
+    nSeen += ncBucket[n];
+    if(nSeen > nRank) return qr_hist_value(n);
+  }
+  return qr_hist_value(QR_HIST_BUCKETS - 1);
+}
+
+#ifdef QR_ENABLE_STATS
+
+typedef struct tagQR_STAGECOUNTER
+{
+	std::atomic<uint64_t> ncCalls;
+	std::atomic<uint64_t> nTotalNs;
+	std::atomic<uint64_t> nMinNs;
+	std::atomic<uint64_t> nMaxNs;
+	std::atomic<uint64_t> ncBucket[QR_HIST_BUCKETS];
+} QR_STAGECOUNTER;
+
+static QR_STAGECOUNTER       Stage[QR_STAT_COUNT];
+static std::atomic<uint64_t> ncEncoded, ncNoData, ncOverflow, ncInputBytes;
+static std::atomic<uint64_t> ncVersion[41];
+
+static thread_local QR_CALLSTATS LastCall;
+
+uint64_t qr_stats_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void qr_stats_begin_call() {
+  memset(&LastCall,0,sizeof(LastCall));
+}
+
+void qr_stats_record(int nStage,uint64_t nNs) {
+  QR_STAGECOUNTER &s = Stage[nStage];
+
+  s.ncCalls.fetch_add(1,std::memory_order_relaxed);
+  s.nTotalNs.fetch_add(nNs,std::memory_order_relaxed);
+  s.ncBucket[qr_hist_bucket(nNs)].fetch_add(1,std::memory_order_relaxed);
+
+  // 0 means no sample yet.
+  uint64_t nMin = s.nMinNs.load(std::memory_order_relaxed);
+  while((nMin == 0 || nNs < nMin) && !s.nMinNs.compare_exchange_weak(nMin,nNs ? nNs : 1,std::memory_order_relaxed));
+
+  uint64_t nMax = s.nMaxNs.load(std::memory_order_relaxed);
+  while(nNs > nMax && !s.nMaxNs.compare_exchange_weak(nMax,nNs,std::memory_order_relaxed));
+
+  LastCall.ncCalls[nStage]++;
+  LastCall.nNs[nStage] += nNs;
+}
+
+void qr_stats_count_result(int nResult,int ncInput,int nVersion) {
+  switch(nResult) {
+    case QR_RESULT_OK:
+      ncEncoded.fetch_add(1,std::memory_order_relaxed);
+      if(nVersion >= 1 && nVersion <= 40) ncVersion[nVersion].fetch_add(1,std::memory_order_relaxed);
+      break;
+    case QR_RESULT_NODATA:   ncNoData.fetch_add(1,std::memory_order_relaxed);   break;
+    case QR_RESULT_OVERFLOW: ncOverflow.fetch_add(1,std::memory_order_relaxed); break;
+  }
+  ncInputBytes.fetch_add(ncInput,std::memory_order_relaxed);
+}
+
+static uint64_t take(std::atomic<uint64_t> &v,bool bReset) {
+  return bReset ? v.exchange(0,std::memory_order_relaxed) : v.load(std::memory_order_relaxed);
+}
+
+bool qr_stats_enabled() {
+  return true;
+}
+
+void qr_stats_snapshot(QR_STATS *stats,bool bReset) {
+  uint64_t ncBucket[QR_HIST_BUCKETS];
+  memset(stats,0,sizeof(QR_STATS));
+
+  for(int s=0;s<QR_STAT_COUNT;s++) {
+    QR_STAGESTATS &out = stats->stage[s];
+
+    out.ncCalls  = take(Stage[s].ncCalls,bReset);
+    out.nTotalNs = take(Stage[s].nTotalNs,bReset);
+    out.nMinNs   = take(Stage[s].nMinNs,bReset);
+    out.nMaxNs   = take(Stage[s].nMaxNs,bReset);
+
+    uint64_t ncTotal = 0;
+    for(int n=0;n<QR_HIST_BUCKETS;n++) ncTotal += (ncBucket[n] = take(Stage[s].ncBucket[n],bReset));
+
+    out.nP50Ns  = qr_hist_percentile(ncBucket,ncTotal,0.50);
+    out.nP99Ns  = qr_hist_percentile(ncBucket,ncTotal,0.99);
+    out.nP999Ns = qr_hist_percentile(ncBucket,ncTotal,0.999);
+
+    // A bucket midpoint can fall outside the samples actually seen.
+    uint64_t *p[3] = {&out.nP50Ns,&out.nP99Ns,&out.nP999Ns};
+    for(int n=0;n<3;n++) {
+      if(*p[n] < out.nMinNs) *p[n] = out.nMinNs;
+      if(*p[n] > out.nMaxNs) *p[n] = out.nMaxNs;
+    }
+  }
+
+  stats->ncEncoded    = take(ncEncoded,bReset);
+  stats->ncNoData     = take(ncNoData,bReset);
+  stats->ncOverflow   = take(ncOverflow,bReset);
+  stats->ncInputBytes = take(ncInputBytes,bReset);
+  for(int v=0;v<=40;v++) stats->ncVersion[v] = take(ncVersion[v],bReset);
+}
+
+void qr_stats_last_call(QR_CALLSTATS *call) {
+  *call = LastCall;
+}
+
+#else
+
+bool qr_stats_enabled() {
+  return false;
+}
+
+void qr_stats_snapshot(QR_STATS *stats,bool bReset) {
+  memset(stats,0,sizeof(QR_STATS));
+}
+
+void qr_stats_last_call(QR_CALLSTATS *call) {
+  memset(call,0,sizeof(QR_CALLSTATS));
+}
+
+#endif
+
+void qr_stats_reset() {
+  QR_STATS stats;
+  qr_stats_snapshot(&stats,true);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_stats_format
+
+typedef struct tagQR_STATSOUT
+{
+	char   *buf;
+	size_t  ncBuf;
+	size_t  ncLength;
+} QR_STATSOUT;
+
+static void out_printf(QR_STATSOUT *out,const char *format,...) {
+  va_list args;
+  va_start(args,format);
+
+  size_t ncLeft = out->ncLength < out->ncBuf ? out->ncBuf - out->ncLength : 0;
+  int n = vsnprintf(ncLeft ? out->buf + out->ncLength : NULL,ncLeft,format,args);
+  if(n > 0) out->ncLength += n;
+
+  va_end(args);
+}
+
+int qr_stats_format(const QR_STATS *stats,int nFormat,char *buf,size_t ncBuf) {
+  QR_STATSOUT out = {buf,ncBuf,0};
+  if(ncBuf > 0) buf[0] = 0;
+
+  unsigned long long ncEncoded = stats->ncEncoded, ncNoData = stats->ncNoData, ncOverflow = stats->ncOverflow, ncInputBytes = stats->ncInputBytes;
+
+  if(nFormat == QR_STATS_JSON) {
+    out_printf(&out,"{\"enabled\":%s,\"encoded\":%llu,\"no_data\":%llu,\"overflow\":%llu,\"input_bytes\":%llu,\"stages\":{",
+               qr_stats_enabled() ? "true" : "false",ncEncoded,ncNoData,ncOverflow,ncInputBytes);
+
+    for(int s=0;s<QR_STAT_COUNT;s++) {
+      const QR_STAGESTATS &st = stats->stage[s];
+      out_printf(&out,"%s\"%s\":{\"calls\":%llu,\"total_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}",
+                 s ? "," : "",StageName[s],(unsigned long long)st.ncCalls,(unsigned long long)st.nTotalNs,(unsigned long long)st.nMinNs,
+                 (unsigned long long)st.nMaxNs,(unsigned long long)st.nP50Ns,(unsigned long long)st.nP99Ns,(unsigned long long)st.nP999Ns);
+    }
+
+    out_printf(&out,"},\"versions\":[");
+    for(int v=1;v<=40;v++) out_printf(&out,"%s%llu",v > 1 ? "," : "",(unsigned long long)stats->ncVersion[v]);
+    out_printf(&out,"]}\n");
+  } else {
+    out_printf(&out,"encoded %llu  no_data %llu  overflow %llu  input_bytes %llu%s\n",
+               ncEncoded,ncNoData,ncOverflow,ncInputBytes,qr_stats_enabled() ? "" : "  (stats not compiled in)");
+    out_printf(&out,"%-11s %10s %14s %10s %10s %10s %10s %10s %10s\n","stage","calls","total_ns","mean_ns","min_ns","p50_ns","p99_ns","p999_ns","max_ns");
+
+    for(int s=0;s<QR_STAT_COUNT;s++) {
+      const QR_STAGESTATS &st = stats->stage[s];
+      out_printf(&out,"%-11s %10llu %14llu %10llu %10llu %10llu %10llu %10llu %10llu\n",StageName[s],
+                 (unsigned long long)st.ncCalls,(unsigned long long)st.nTotalNs,(unsigned long long)(st.ncCalls ? st.nTotalNs / st.ncCalls : 0),
+                 (unsigned long long)st.nMinNs,(unsigned long long)st.nP50Ns,(unsigned long long)st.nP99Ns,(unsigned long long)st.nP999Ns,(unsigned long long)st.nMaxNs);
+    }
+
+    out_printf(&out,"versions");
+    for(int v=1;v<=40;v++) if(stats->ncVersion[v]) out_printf(&out," %d:%llu",v,(unsigned long long)stats->ncVersion[v]);
+    out_printf(&out,"\n");
+  }
+
+  return (int)out.ncLength;
+}
@@ -0,0 +1,106 @@
+#ifndef QR_STATS_H
+#define QR_STATS_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Encode pipeline statistics.
+//
+// Built with QR_ENABLE_STATS (make STATS=1) the encoder times each stage and
+// keeps call counts, totals and a latency histogram per stage, shared by all
+// threads. Without it the QR_STAT_* macros expand to nothing and the calls
+// below report empty statistics, so callers need no #ifdefs of their own.
+
+// 計測区間
+#define QR_STAT_ENCODE      0 // qr_encode_data 全体
+#define QR_STAT_SEGMENT     1 // モード分割とビット列化
+#define QR_STAT_VERSION     2 // qr_encode_with_version (SEGMENT を含む)
+#define QR_STAT_INTERLEAVE  3 // データコードワードインターリーブ
+#define QR_STAT_RS          4 // ＲＳコードワード算出
+#define QR_STAT_PLACEMENT   5 // モジュール配置
+#define QR_STAT_MASKING     6 // マスキング(自動選択時は PENALTY を含む)
+#define QR_STAT_PENALTY     7 // CountPenalty
+#define QR_STAT_COUNT       8
+
+// エンコード結果(QR_STAT_RESULT)
+#define QR_RESULT_OK        0
+#define QR_RESULT_NODATA    1 // データなし
+#define QR_RESULT_OVERFLOW  2 // 容量オーバー
+
+// 出力形式
+#define QR_STATS_TEXT  0
+#define QR_STATS_JSON  1
+
+typedef struct tagQR_STAGESTATS
+{
+	uint64_t ncCalls;  // 呼出回数
+	uint64_t nTotalNs; // 累計
+	uint64_t nMinNs;
+	uint64_t nMaxNs;
+	uint64_t nP50Ns;   // 百分位数(ヒストグラムより、誤差 6% 以内)
+	uint64_t nP99Ns;
+	uint64_t nP999Ns;
+} QR_STAGESTATS;
+
+typedef struct tagQR_STATS
+{
+	QR_STAGESTATS stage[QR_STAT_COUNT];
+
+	uint64_t ncEncoded;    // エンコード成功数
+	uint64_t ncNoData;     // データなし
+	uint64_t ncOverflow;   // 容量オーバー
+	uint64_t ncInputBytes; // 入力データ累計
+	uint64_t ncVersion[41]; // 型番別シンボル数
+} QR_STATS;
+
+// Timings of the last qr_encode_data() call made on this thread. A stage
+// run several times in one call (segmentation, penalty) is summed.
+typedef struct tagQR_CALLSTATS
+{
+	uint64_t ncCalls[QR_STAT_COUNT];
+	uint64_t nNs[QR_STAT_COUNT];
+} QR_CALLSTATS;
+
+// False when compiled without QR_ENABLE_STATS.
+bool qr_stats_enabled();
+
+// Copies the current statistics, and clears them if bReset is set. Calls
+// running at the same time may land on either side of a reset.
+void qr_stats_snapshot(QR_STATS *stats,bool bReset);
+void qr_stats_reset();
+void qr_stats_last_call(QR_CALLSTATS *call);
+
+const char *qr_stats_stage_name(int nStage);
+
+// Writes stats as QR_STATS_TEXT or QR_STATS_JSON. Same contract as
+// snprintf: returns the full length, output is cut at ncBuf - 1.
+int qr_stats_format(const QR_STATS *stats,int nFormat,char *buf,size_t ncBuf);
+
+// Latency histogram behind the percentiles, for callers keeping their own
+// (always compiled in). Counts go in ncBucket[qr_hist_bucket(nNs)].
+#define QR_HIST_BUCKETS 1024
+
+int qr_hist_bucket(uint64_t nNs);
+uint64_t qr_hist_value(int nBucket);
+uint64_t qr_hist_percentile(const uint64_t *ncBucket,uint64_t ncTotal,double p);
+
+#ifdef QR_ENABLE_STATS
+
+uint64_t qr_stats_now();
+void qr_stats_begin_call();
+void qr_stats_record(int nStage,uint64_t nNs);
+void qr_stats_count_result(int nResult,int ncInput,int nVersion);
+
+#define QR_STAT_CALL()                 qr_stats_begin_call()
+#define QR_STAT_BEGIN(name)            uint64_t qr_stat_##name = qr_stats_now()
+#define QR_STAT_END(name,nStage)       qr_stats_record(nStage,qr_stats_now() - qr_stat_##name)
+#define QR_STAT_RESULT(r,ncInput,ver)  qr_stats_count_result(r,ncInput,ver)
+
+#else
+
+#define QR_STAT_CALL()
+#define QR_STAT_BEGIN(name)
+#define QR_STAT_END(name,nStage)
+#define QR_STAT_RESULT(r,ncInput,ver)
+
+#endif
+#endif
@@ -0,0 +1,602 @@
+#include <stdint.h>
+#include <string.h>
+#include "qr_encodeem.h"
+#include "qr_bits.h"
+#include "qr_rs.h"
+#include "qr_utils.h"
+#include "qr_version.h"
+#include "qr_template.h"
+
+#define MAX_INPUTDATA   3096 // maximum input data size
+#define MAX_QRCODESIZE  4096 // (177*177)/8
+#define MAX_ALLCODEWORD 3706 // 総コードワード数最大値(Ver.40)
+
+void ApplyMaskingPattern(uint8_t *image,int width,int m_nMaskingNo,int version,int level);
+int  SelectMaskingPattern(const uint8_t *placed,int width,int version,int level,int *penalties,int nThreads,uint8_t *work);
+
+// 文字種別(分割を決める区別)
+#define CLASS_NUMERAL  0 // 数字
+#define CLASS_ALPHABET 1 // 数字以外の英数字
+#define CLASS_8BIT     2 // その他の ASCII
+#define CLASS_INVALID  3 // 非 ASCII
+
+struct TEMPLATE_CLASSTABLE
+{
+	uint8_t byClass[256];
+};
+
+constexpr TEMPLATE_CLASSTABLE build_class_table() {
+  TEMPLATE_CLASSTABLE t = {};
+  const char szAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+  for(int c=0;c<256;c++) t.byClass[c] = c < 0x80 ? CLASS_8BIT : CLASS_INVALID;
+  for(int c='0';c<='9';c++) t.byClass[c] = CLASS_NUMERAL;
+  for(int n=0;szAlphabet[n] != 0;n++) t.byClass[(uint8_t)szAlphabet[n]] = CLASS_ALPHABET;
+
+  return t;
+}
+
+static constexpr TEMPLATE_CLASSTABLE ClassTable = build_class_table();
+
+// byExp[a + b] = exp(a + b) for exponents a, b up to 254, and 0 from
+// LOG_ZERO on, so a product of logs needs neither a wrap nor a zero test.
+#define LOG_ZERO 510
+
+struct TEMPLATE_EXPTABLE
+{
+	uint8_t byExp[LOG_ZERO + 256];
+};
+
+constexpr TEMPLATE_EXPTABLE build_exp_table() {
+  TEMPLATE_EXPTABLE t = {};
+  for(int n=0;n<LOG_ZERO;n++) t.byExp[n] = byExpToInt[n % 255];
+  return t;
+}
+
+static constexpr TEMPLATE_EXPTABLE ExpTable = build_exp_table();
+
+// Bits of one numeric triple, alphanumeric pair, byte or Kanji character.
+typedef struct tagTEMPLATE_GROUP
+{
+	uint8_t nMode;   // QR_MODE_*
+	int     nStart;  // 入力データ内位置
+	int     ncChars; // 文字数(バイト数)
+	int     nBit;    // nFirstCodeWord 先頭からのビット位置
+	int     ncBits;
+} TEMPLATE_GROUP;
+
+// Modules of one codeword, MSB first.
+typedef struct tagTEMPLATE_MODULES
+{
+	uint16_t wModule[8];
+} TEMPLATE_MODULES;
+
+struct tagQR_TEMPLATE
+{
+	int nLevel;
+	int nVersion;
+	int nMaskingNo; // -1 = シンボル毎に選択
+	int width;
+	int ncBytes;
+
+	int      ncPrefix;
+	int      ncField;
+	uint8_t *bySource; // 見本の入力データ
+	uint8_t *byClass;  // 欄の文字種別
+
+	int             ncGroups; // 欄の文字を含むビット群
+	TEMPLATE_GROUP *groups;
+
+	// 欄のビットを含むデータコードワード(ブロック順)
+	int       nFirstCodeWord;
+	int       ncCodeWords;
+	uint8_t  *byBaseData;   // 見本の値(末尾 2 バイト余裕)
+	uint8_t  *nBlock;       // 所属ブロック - nFirstBlock
+	TEMPLATE_MODULES *dataModules; // ncCodeWords
+	uint16_t *wParityLog;   // ncCodeWords * ncRSCodeWord、ＲＳ寄与の指数(LOG_ZERO = 0)
+
+	// それらのブロックのＲＳコードワード
+	int       nFirstBlock;
+	int       ncBlocks;
+	int       ncRSCodeWord;
+	TEMPLATE_MODULES *parityModules; // ncBlocks * ncRSCodeWord
+
+	uint8_t  *byBase; // 見本のシンボル(自動マスク時はマスク前)
+};
+
+static bool is_kanji_lead(uint8_t c) {
+  return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xeb);
+}
+
+void qr_template_destroy(QR_TEMPLATE *t) {
+  if(t == NULL) return;
+
+  delete [] t->bySource;
+  delete [] t->byClass;
+  delete [] t->groups;
+  delete [] t->byBaseData;
+  delete [] t->nBlock;
+  delete [] t->dataModules;
+  delete [] t->wParityLog;
+  delete [] t->parityModules;
+  delete [] t->byBase;
+  delete t;
+}
+
+// Splits the mode blocks into bit groups and keeps those holding a field
+// character, their bit positions still counted from the stream start.
+static bool find_groups(QR_TEMPLATE *t,const uint8_t *byBlockMode,const int32_t *nBlockLength,int ncBlocks) {
+  int nVerGroup = t->nVersion >= 27 ? QR_VRESION_L : (t->nVersion >= 10 ? QR_VRESION_M : QR_VRESION_S);
+  int nFieldEnd = t->ncPrefix + t->ncField;
+  int nBit = 0, nChar = 0;
+
+  t->groups   = new TEMPLATE_GROUP[t->ncField];
+  t->ncGroups = 0;
+
+  for(int i=0;i<ncBlocks;i++) {
+    int nMode = byBlockMode[i], ncData = nBlockLength[i];
+
+    // モードインジケータ、文字数指示子
+    nBit += GetBitLength((uint8_t)nMode,0,nVerGroup);
+
+    for(int j=0;j<ncData;) {
+      int ncChars, ncBits;
+
+      if(nMode == QR_MODE_NUMERAL) {
+        ncChars = ncData - j >= 3 ? 3 : ncData - j;
+        ncBits  = ncChars == 3 ? 10 : (ncChars == 2 ? 7 : 4);
+      } else if(nMode == QR_MODE_ALPHABET) {
+        ncChars = ncData - j >= 2 ? 2 : 1;
+        ncBits  = ncChars == 2 ? 11 : 6;
+      } else if(nMode == QR_MODE_8BIT) {
+        ncChars = 1;
+        ncBits  = 8;
+      } else {
+        ncChars = 2;
+        ncBits  = 13;
+      }
+
+      if(nChar + ncChars > t->ncPrefix && nChar < nFieldEnd) {
+        if(nMode == QR_MODE_KANJI) return false; // 欄は ASCII のみ
+
+        TEMPLATE_GROUP &g = t->groups[t->ncGroups++];
+        g.nMode   = (uint8_t)nMode;
+        g.nStart  = nChar;
+        g.ncChars = ncChars;
+        g.nBit    = nBit;
+        g.ncBits  = ncBits;
+      }
+
+      nChar += ncChars;
+      nBit  += ncBits;
+      j     += ncChars;
+    }
+  }
+
+  return t->ncGroups > 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_template_create
+// 用  途：テンプレート作成
+// 引  数：誤り訂正レベル、型番(0=自動)、型番自動拡張フラグ、マスキング番号(-1=自動)、
+//         前置データ、前置データ長、欄の見本、欄の長さ、後置データ、後置データ長
+// 戻り値：テンプレート(作成できない場合=NULL)
+
+QR_TEMPLATE *qr_template_create(int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo,const uint8_t *lpsPrefix,int ncPrefix,const uint8_t *lpsSample,int ncField,const uint8_t *lpsSuffix,int ncSuffix) {
+  if(lpsPrefix == NULL) ncPrefix = 0;
+  if(lpsSuffix == NULL) ncSuffix = 0;
+
+  int ncLength = ncPrefix + ncField + ncSuffix;
+
+  if(ncField <= 0 || ncLength > MAX_INPUTDATA) return NULL;
+  if(ncPrefix > 0 && is_kanji_lead(lpsPrefix[ncPrefix - 1])) return NULL;
+
+  for(int i=0;i<ncField;i++) {
+    if(ClassTable.byClass[lpsSample[i]] == CLASS_INVALID) return NULL;
+  }
+
+  QR_TEMPLATE *t = new QR_TEMPLATE;
+  memset(t,0,sizeof(QR_TEMPLATE));
+
+  t->nLevel     = nLevel;
+  t->nMaskingNo = nMaskingNo;
+  t->ncPrefix   = ncPrefix;
+  t->ncField    = ncField;
+  t->bySource   = new uint8_t[ncLength];
+  t->byClass    = new uint8_t[ncField];
+
+  if(ncPrefix > 0) memcpy(t->bySource,lpsPrefix,ncPrefix);
+  memcpy(t->bySource + ncPrefix,lpsSample,ncField);
+  if(ncSuffix > 0) memcpy(t->bySource + ncPrefix + ncField,lpsSuffix,ncSuffix);
+
+  for(int i=0;i<ncField;i++) t->byClass[i] = ClassTable.byClass[lpsSample[i]];
+
+  // 見本をデータコードワードまでエンコード
+  QR_ENCODER_CTX *ctx = qr_encoder_ctx_create();
+  uint8_t *byData      = new uint8_t[MAX_INPUTDATA];
+  uint8_t *byBlockMode = new uint8_t[ncLength + 1];
+  int32_t *nBlockLength = new int32_t[ncLength + 1];
+  int ncBlocks;
+
+  t->nVersion = qr_encode_codewords(ctx,nLevel,nVersion,bAutoExtent,t->bySource,ncLength,byData,byBlockMode,nBlockLength,&ncBlocks);
+  qr_encoder_ctx_destroy(ctx);
+
+  bool bGroups = t->nVersion != 0 && find_groups(t,byBlockMode,nBlockLength,ncBlocks);
+
+  delete [] byBlockMode;
+  delete [] nBlockLength;
+
+  if(!bGroups) {
+    delete [] byData;
+    qr_template_destroy(t);
+    return NULL;
+  }
+
+  const QR_VERSIONMETA &M = QR_VersionMeta;
+  int V = t->nVersion, L = nLevel;
+
+  int ncBlock1   = M.ncBlock1[V][L];
+  int ncDataCw1  = M.ncBlockData1[V][L];
+  int ncRSCw     = M.ncRSCodeWord[V][L];
+  int ncBlockSum = ncBlock1 + M.ncBlock2[V][L];
+  int ncData     = M.ncDataCodeWord[V][L];
+
+  t->width        = M.nWidth[V];
+  t->ncBytes      = qr_image_size(t->width);
+  t->ncRSCodeWord = ncRSCw;
+
+  // 影響範囲(コードワード単位)
+  const TEMPLATE_GROUP &gLast = t->groups[t->ncGroups - 1];
+  t->nFirstCodeWord = t->groups[0].nBit / 8;
+  t->ncCodeWords    = (gLast.nBit + gLast.ncBits - 1) / 8 - t->nFirstCodeWord + 1;
+
+  for(int g=0;g<t->ncGroups;g++) t->groups[g].nBit -= t->nFirstCodeWord * 8;
+
+  t->byBaseData  = new uint8_t[t->ncCodeWords + 2];
+  t->nBlock      = new uint8_t[t->ncCodeWords];
+  t->dataModules = new TEMPLATE_MODULES[t->ncCodeWords];
+  t->wParityLog  = new uint16_t[t->ncCodeWords * ncRSCw];
+
+  memcpy(t->byBaseData,byData + t->nFirstCodeWord,t->ncCodeWords);
+  memset(t->byBaseData + t->ncCodeWords,0,2);
+
+  const uint16_t *wPlacement = qr_placement_map(V,NULL);
+  uint8_t byUnit[MAX_ALLCODEWORD];
+  uint8_t byRS[MAX_ALLCODEWORD];
+
+  // Block of each codeword in the range, and where it sits in the block.
+  int b = 0, j = t->nFirstCodeWord;
+
+  for(;;b++) {
+    int ncDataCw = b < ncBlock1 ? ncDataCw1 : ncDataCw1 + 1;
+    if(j < ncDataCw) break;
+    j -= ncDataCw;
+  }
+
+  t->nFirstBlock = b;
+
+  for(int c=0;c<t->ncCodeWords;c++) {
+    int ncDataCw = b < ncBlock1 ? ncDataCw1 : ncDataCw1 + 1;
+
+    // インターリーブ後の位置
+    int nPos = j < ncDataCw1 ? ncBlockSum * j + b : ncBlockSum * ncDataCw1 + (b - ncBlock1);
+    memcpy(t->dataModules[c].wModule,wPlacement + nPos * 8,sizeof(TEMPLATE_MODULES));
+
+    // そのコードワードだけ 1 のブロックのＲＳコードワード
+    memset(byUnit,0,ncDataCw);
+    byUnit[j] = 1;
+    qr_rs_encode(byUnit,ncDataCw,byRS,ncRSCw);
+    for(int r=0;r<ncRSCw;r++) t->wParityLog[c * ncRSCw + r] = byRS[r] != 0 ? byIntToExp[byRS[r]] : LOG_ZERO;
+
+    t->nBlock[c] = (uint8_t)(b - t->nFirstBlock);
+
+    if(++j == ncDataCw) {
+      j = 0;
+      b++;
+    }
+  }
+
+  t->ncBlocks      = t->nBlock[t->ncCodeWords - 1] + 1;
+  t->parityModules = new TEMPLATE_MODULES[t->ncBlocks * ncRSCw];
+
+  for(int n=0;n<t->ncBlocks;n++) {
+    for(int r=0;r<ncRSCw;r++) {
+      int nPos = ncData + ncBlockSum * r + t->nFirstBlock + n;
+      memcpy(t->parityModules[n * ncRSCw + r].wModule,wPlacement + nPos * 8,sizeof(TEMPLATE_MODULES));
+    }
+  }
+
+  // 見本のシンボル
+  uint8_t *byAllCodeWord = new uint8_t[MAX_ALLCODEWORD];
+  uint8_t *byRSWork      = new uint8_t[MAX_ALLCODEWORD];
+
+  t->byBase = new uint8_t[t->ncBytes];
+  qr_codeword_stage(V,L)(L,byData,byAllCodeWord,byRSWork,t->byBase);
+  if(nMaskingNo >= 0) ApplyMaskingPattern(t->byBase,t->width,nMaskingNo,V,L);
+
+  delete [] byAllCodeWord;
+  delete [] byRSWork;
+  delete [] byData;
+
+  return t;
+}
+
+int qr_template_width(const QR_TEMPLATE *t) {
+  return t->width;
+}
+
+// Flips the modules of the set bits of d.
+static inline void flip_modules(uint8_t *image,const TEMPLATE_MODULES &m,uint8_t d) {
+  for(int k=0;k<8;k++) image[m.wModule[k] >> 3] ^= (uint8_t)(((d >> (7 - k)) & 1) << (m.wModule[k] & 7));
+}
+
+// Writes the low ncBits (at most 13) of wData at bit nBit, MSB first.
+static inline void put_bits(uint8_t *byData,int nBit,uint32_t wData,int ncBits) {
+  uint8_t *p = byData + (nBit >> 3);
+  int nShift = 24 - (nBit & 7) - ncBits;
+  uint32_t wWord = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+  uint32_t wMask = ((1u << ncBits) - 1) << nShift;
+
+  wWord = (wWord & ~wMask) | (wData << nShift);
+
+  p[0] = (uint8_t)(wWord >> 16);
+  p[1] = (uint8_t)(wWord >> 8);
+  p[2] = (uint8_t)wWord;
+}
+
+// Packs the field groups from nGroup on into byData (the template's
+// codeword range) and applies the change from its previous contents to
+// image: data modules directly, RS modules through the per-codeword
+// contributions. Groups before nGroup must already hold the field.
+static void apply_field(const QR_TEMPLATE *t,uint8_t *byData,const uint8_t *lpsField,uint8_t *image,int nGroup) {
+  const uint16_t (*tn)[256] = QR_PackTable.wNumeral;
+  const uint16_t (*ta)[256] = QR_PackTable.wAlphabet;
+
+  int nFirst = t->groups[nGroup].nBit >> 3;
+  uint8_t byOld[MAX_INPUTDATA];
+  memcpy(byOld + nFirst,byData + nFirst,t->ncCodeWords - nFirst);
+
+  for(int g=nGroup;g<t->ncGroups;g++) {
+    const TEMPLATE_GROUP &group = t->groups[g];
+    uint8_t c[3];
+
+    for(int i=0;i<group.ncChars;i++) {
+      int n = group.nStart + i - t->ncPrefix;
+      c[i] = n >= 0 && n < t->ncField ? lpsField[n] : t->bySource[group.nStart + i];
+    }
+
+    uint32_t wData;
+
+    if(group.nMode == QR_MODE_NUMERAL)
+      wData = group.ncChars == 3 ? tn[0][c[0]] + tn[1][c[1]] + tn[2][c[2]] : (group.ncChars == 2 ? tn[1][c[0]] + tn[2][c[1]] : tn[2][c[0]]);
+    else if(group.nMode == QR_MODE_ALPHABET)
+      wData = group.ncChars == 2 ? ta[0][c[0]] + ta[1][c[1]] : ta[1][c[0]];
+    else
+      wData = c[0];
+
+    put_bits(byData,group.nBit,wData,group.ncBits);
+  }
+
+  // ＲＳコードワードの変化分(ブロック毎)
+  int ncRSCw = t->ncRSCodeWord;
+  int nFirstParity = t->nBlock[nFirst] * ncRSCw;
+  uint8_t byParity[MAX_ALLCODEWORD];
+  memset(byParity + nFirstParity,0,t->ncBlocks * ncRSCw - nFirstParity);
+
+  for(int c=nFirst;c<t->ncCodeWords;c++) {
+    uint8_t d = byData[c] ^ byOld[c];
+    if(d == 0) continue;
+
+    flip_modules(image,t->dataModules[c],d);
+
+    const uint16_t *pLog = t->wParityLog + c * ncRSCw;
+    uint8_t *pParity = byParity + t->nBlock[c] * ncRSCw;
+    const uint8_t *pExp = ExpTable.byExp + byIntToExp[d];
+
+    for(int r=0;r<ncRSCw;r++) pParity[r] ^= pExp[pLog[r]];
+  }
+
+  for(int n=nFirstParity;n<t->ncBlocks * ncRSCw;n++) {
+    if(byParity[n] != 0) flip_modules(image,t->parityModules[n],byParity[n]);
+  }
+}
+
+// Masks a symbol built from the template's base: with a fixed mask it is
+// already masked, otherwise the mask is selected and applied here.
+static int finish_mask(const QR_TEMPLATE *t,uint8_t *image,QR_MASKRESULT *mask_result) {
+  int nMaskingNo = t->nMaskingNo;
+  int *nPenalty = NULL;
+
+  if(mask_result != NULL) {
+    for(int n=0;n<8;n++) mask_result->nPenalty[n] = -1;
+    nPenalty = mask_result->nPenalty;
+  }
+
+  if(nMaskingNo == -1) {
+    uint8_t work[MAX_QRCODESIZE];
+
+    nMaskingNo = SelectMaskingPattern(image,t->width,t->nVersion,t->nLevel,nPenalty,1,work);
+    ApplyMaskingPattern(image,t->width,nMaskingNo,t->nVersion,t->nLevel);
+  }
+
+  return nMaskingNo;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_template_encode
+// 用  途：テンプレートからのエンコード
+// 引  数：テンプレート、欄のデータ、出力先、一辺モジュール数格納先、マスキング選択結果格納先(NULL可)
+// 戻り値：エンコード成功時=true、欄の文字種別が見本と異なる時=false
+
+bool qr_template_encode(const QR_TEMPLATE *t,const uint8_t *lpsField,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result) {
+  for(int i=0;i<t->ncField;i++) {
+    if(ClassTable.byClass[lpsField[i]] != t->byClass[i]) return false;
+  }
+
+  uint8_t byData[MAX_INPUTDATA + 2];
+  memcpy(byData,t->byBaseData,t->ncCodeWords + 2);
+  memcpy(outputdata,t->byBase,t->ncBytes);
+
+  apply_field(t,byData,lpsField,outputdata,0);
+
+  int nMaskingNo = finish_mask(t,outputdata,mask_result);
+
+  if(mask_result != NULL) mask_result->nMaskingNo = nMaskingNo;
+  *width = t->width;
+
+  return true;
+}
+
+// Serial number sequences
+
+struct tagQR_SEQUENCE
+{
+	QR_TEMPLATE *t;
+	int      ncDigits;
+	uint64_t nLimit;    // 10 ^ ncDigits
+	int     *nGroupOf;  // 欄の各桁を含む最初のビット群
+
+	uint64_t nCurrent;  // byData、image の番号
+	uint8_t *byField;   // その数字列
+	uint8_t *byData;    // テンプレートのコードワード範囲(末尾 2 バイト余裕)
+	uint8_t *image;     // そのシンボル(自動マスク時はマスク前)
+	uint8_t *byMasked;  // 自動マスク時のコールバック用
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_sequence_create
+// 用  途：連番エンコーダ作成
+// 引  数：誤り訂正レベル、型番(0=自動)、型番自動拡張フラグ、マスキング番号(-1=自動)、
+//         前置データ、前置データ長、番号の桁数、後置データ、後置データ長
+// 戻り値：連番エンコーダ(作成できない場合=NULL)
+
+QR_SEQUENCE *qr_sequence_create(int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo,const uint8_t *lpsPrefix,int ncPrefix,int ncDigits,const uint8_t *lpsSuffix,int ncSuffix) {
+  if(ncDigits < 1 || ncDigits > QR_SEQUENCE_MAXDIGITS) return NULL;
+
+  uint8_t bySample[QR_SEQUENCE_MAXDIGITS];
+  memset(bySample,'0',ncDigits);
+
+  QR_TEMPLATE *t = qr_template_create(nLevel,nVersion,bAutoExtent,nMaskingNo,lpsPrefix,ncPrefix,bySample,ncDigits,lpsSuffix,ncSuffix);
+  if(t == NULL) return NULL;
+
+  QR_SEQUENCE *s = new QR_SEQUENCE;
+
+  s->t        = t;
+  s->ncDigits = ncDigits;
+  s->nLimit   = 1;
+  for(int i=0;i<ncDigits;i++) s->nLimit *= 10;
+
+  s->nGroupOf = new int[ncDigits];
+  for(int i=0,g=0;i<ncDigits;i++) {
+    while(t->groups[g].nStart + t->groups[g].ncChars <= t->ncPrefix + i) g++;
+    s->nGroupOf[i] = g;
+  }
+
+  // 最初は見本(番号 0)の状態
+  s->nCurrent = 0;
+  s->byField  = new uint8_t[ncDigits];
+  s->byData   = new uint8_t[t->ncCodeWords + 2];
+  s->image    = new uint8_t[t->ncBytes];
+  s->byMasked = new uint8_t[t->ncBytes];
+
+  memcpy(s->byField,bySample,ncDigits);
+  memcpy(s->byData,t->byBaseData,t->ncCodeWords + 2);
+  memcpy(s->image,t->byBase,t->ncBytes);
+
+  return s;
+}
+
+void qr_sequence_destroy(QR_SEQUENCE *s) {
+  if(s == NULL) return;
+
+  qr_template_destroy(s->t);
+  delete [] s->nGroupOf;
+  delete [] s->byField;
+  delete [] s->byData;
+  delete [] s->image;
+  delete [] s->byMasked;
+  delete s;
+}
+
+int qr_sequence_width(const QR_SEQUENCE *s) {
+  return s->t->width;
+}
+
+// Moves the state to serial nSerial (< nLimit). Only the groups from the
+// first digit that differs from the current serial are packed again, for
+// the next serial usually just the last group.
+static void sequence_seek(QR_SEQUENCE *s,uint64_t nSerial) {
+  if(nSerial == s->nCurrent) return;
+
+  uint8_t byField[QR_SEQUENCE_MAXDIGITS];
+  uint64_t n = nSerial;
+
+  for(int i=s->ncDigits-1;i>=0;i--) {
+    byField[i] = (uint8_t)('0' + n % 10);
+    n /= 10;
+  }
+
+  int nFirst = 0;
+  while(byField[nFirst] == s->byField[nFirst]) nFirst++;
+
+  apply_field(s->t,s->byData,byField,s->image,s->nGroupOf[nFirst]);
+
+  memcpy(s->byField + nFirst,byField + nFirst,s->ncDigits - nFirst);
+  s->nCurrent = nSerial;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_sequence_encode
+// 用  途：連番のエンコード(出力先へ)
+// 引  数：連番エンコーダ、最初の番号、シンボル数、出力先、マスキング番号格納先(NULL可)
+// 戻り値：成功時=true、番号が桁数を超える時=false
+
+bool qr_sequence_encode(QR_SEQUENCE *s,uint64_t nFirst,int ncCount,uint8_t *outputdata,int *nMaskingNo) {
+  if(ncCount < 0 || nFirst >= s->nLimit || s->nLimit - nFirst < (uint64_t)ncCount) return false;
+
+  const QR_TEMPLATE *t = s->t;
+
+  for(int i=0;i<ncCount;i++) {
+    uint8_t *image = outputdata + (size_t)i * t->ncBytes;
+
+    sequence_seek(s,nFirst + i);
+    memcpy(image,s->image,t->ncBytes);
+
+    int nMask = finish_mask(t,image,NULL);
+    if(nMaskingNo != NULL) nMaskingNo[i] = nMask;
+  }
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_sequence_run
+// 用  途：連番のエンコード(コールバックへ)
+// 引  数：連番エンコーダ、最初の番号、最後の番号、コールバック、コールバック引数
+// 戻り値：全て渡せた時=true、番号が桁数を超える時、コールバックが false を返した時=false
+
+bool qr_sequence_run(QR_SEQUENCE *s,uint64_t nFirst,uint64_t nLast,QR_SEQUENCEFUNC func,void *arg) {
+  if(nFirst > nLast || nLast >= s->nLimit) return false;
+
+  const QR_TEMPLATE *t = s->t;
+
+  for(uint64_t n=nFirst;;n++) {
+    const uint8_t *image = s->image;
+    int nMask = t->nMaskingNo;
+
+    sequence_seek(s,n);
+
+    // 固定マスクなら状態のシンボルをそのまま渡す
+    if(nMask == -1) {
+      memcpy(s->byMasked,s->image,t->ncBytes);
+      nMask = finish_mask(t,s->byMasked,NULL);
+      image = s->byMasked;
+    }
+
+    if(!func(arg,n,image,t->width,nMask)) return false;
+    if(n == nLast) break;
+  }
+
+  return true;
+}
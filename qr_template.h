@@ -0,0 +1,88 @@
+#ifndef QR_TEMPLATE_H
+#define QR_TEMPLATE_H
+#include <stdint.h>
+#include "qr_encodeem.h"
+
+// Templated payloads.
+//
+// Many payloads are a fixed prefix and suffix around a short field
+// (https://x.example/t/<id>). Segmentation only looks at which class each
+// character is in (digit, other alphanumeric, other byte), not at its
+// value, so every field whose characters have the classes of a sample
+// field is cut into the same mode blocks, fills the same bits and picks the
+// same version. qr_template_create() encodes the sample once and records:
+//
+//  - the bit groups (numeric triples, alphanumeric pairs, bytes) holding
+//    field characters, and the data codewords they fall in;
+//  - for each of those codewords the RS codewords of its block as if it
+//    were 1 and every other codeword 0. RS is linear over GF(256), so a
+//    codeword change d changes the block's RS codewords by d times them;
+//  - the modules of those data codewords and of their blocks' RS
+//    codewords, and the finished (or, for an automatic mask, the placed
+//    unmasked) symbol.
+//
+// qr_template_encode() then only packs the field groups, XORs the changed
+// data codewords and their RS contributions into a copy of the sample
+// symbol module by module, and with an automatic mask re-runs the mask
+// selection. The symbol is byte for byte what qr_encode_data() makes for
+// prefix + field + suffix in the same version.
+//
+// Field characters must be ASCII, and the prefix may not end in a
+// Shift-JIS lead byte (it could pair with the field). A template is read
+// only once created, any number of threads may encode from it.
+
+typedef struct tagQR_TEMPLATE QR_TEMPLATE;
+
+// Empty prefix or suffix: NULL or length 0. The sample is ncField bytes and
+// sets the character class of each field position. nMaskingNo -1 chooses
+// the mask per symbol. Returns NULL if the sample is not ASCII, the prefix
+// ends in a lead byte or the payload does not fit.
+QR_TEMPLATE *qr_template_create(int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo,const uint8_t *lpsPrefix,int ncPrefix,const uint8_t *lpsSample,int ncField,const uint8_t *lpsSuffix,int ncSuffix);
+void qr_template_destroy(QR_TEMPLATE *t);
+
+// Width of every symbol of the template.
+int qr_template_width(const QR_TEMPLATE *t);
+
+// lpsField is ncField bytes. Returns false if a character's class differs
+// from the sample's. mask_result may be NULL.
+bool qr_template_encode(const QR_TEMPLATE *t,const uint8_t *lpsField,uint8_t *outputdata,int *width,QR_MASKRESULT *mask_result);
+
+// Serial number sequences.
+//
+// A sequence is a template whose field is a zero padded decimal counter
+// (SN-00000042). It keeps the codewords and symbol of the last serial it
+// made; moving to the next serial repacks only the numeric groups from the
+// first digit that changed, which is the last group nine times in ten, and
+// flips the modules of the codewords and RS codewords that change with
+// them. With a fixed mask the symbol is final as it stands; with nMaskingNo
+// -1 the mask is evaluated again for every serial, which then costs far
+// more than the update.
+//
+// The state makes a sequence single threaded. To use several cores, create
+// one sequence per thread and give each a part of the range.
+
+#define QR_SEQUENCE_MAXDIGITS 19 // uint64_t に収まる桁数
+
+typedef struct tagQR_SEQUENCE QR_SEQUENCE;
+
+// Called once per serial. image is only valid during the call. Returning
+// false stops qr_sequence_run(), which then returns false.
+typedef bool (*QR_SEQUENCEFUNC)(void *arg,uint64_t nSerial,const uint8_t *image,int width,int nMaskingNo);
+
+// Serials are ncDigits (1 to QR_SEQUENCE_MAXDIGITS) digits, zero padded,
+// between the prefix and the suffix. The version is chosen for that length,
+// so every serial gets the same one. NULL as for qr_template_create().
+QR_SEQUENCE *qr_sequence_create(int nLevel,int nVersion,bool bAutoExtent,int nMaskingNo,const uint8_t *lpsPrefix,int ncPrefix,int ncDigits,const uint8_t *lpsSuffix,int ncSuffix);
+void qr_sequence_destroy(QR_SEQUENCE *s);
+int qr_sequence_width(const QR_SEQUENCE *s);
+
+// Symbols of serials nFirst to nFirst + ncCount - 1, each qr_image_size(width)
+// bytes, one after another in outputdata. nMaskingNo (may be NULL) gets the
+// mask of each. Returns false, encoding nothing, if a serial needs more than
+// ncDigits digits.
+bool qr_sequence_encode(QR_SEQUENCE *s,uint64_t nFirst,int ncCount,uint8_t *outputdata,int *nMaskingNo);
+
+// Serials nFirst to nLast inclusive, handed to func in order. With a fixed
+// mask image points into the sequence's state, no copy is made.
+bool qr_sequence_run(QR_SEQUENCE *s,uint64_t nFirst,uint64_t nLast,QR_SEQUENCEFUNC func,void *arg);
+#endif
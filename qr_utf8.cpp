@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <string.h>
+#include "qr_utf8.h"
+#include "qr_utf8_table.h"
+
+uint16_t qr_utf8_sjis(uint32_t c) {
+  if(c >= 0x10000) return 0;
+  return QR_Utf8Sjis[QR_Utf8Block[c >> 7]][c & 0x7f];
+}
+
+static inline bool is_continuation(uint32_t c) {
+  return (c & 0xc0) == 0x80;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// qr_utf8_convert
+// 用  途：UTF-8 から漢字モード用データへの変換
+// 引  数：入力データ、入力データ長、出力先(入力データ長)、バイト種別格納先、
+//         未変換バイト数格納先(NULL 可)
+// 戻り値：出力データ長
+
+int qr_utf8_convert(const uint8_t *lpsSource,int ncSource,uint8_t *byOutput,uint8_t *byKanji,int *ncFallback) {
+  int i = 0, o = 0, ncRaw = 0;
+
+  while(i < ncSource) {
+    // ASCII は 8 バイト単位で複写
+    // The output never runs ahead of the input (o <= i), so a whole word
+    // can be stored even when only its first bytes are ASCII: the rest is
+    // written over by what follows.
+    while(i + 8 <= ncSource) {
+      uint64_t w;
+      memcpy(&w,lpsSource + i,8);
+      memcpy(byOutput + o,&w,8);
+      memset(byKanji + o,QR_UTF8_BYTE,8);
+
+      uint64_t wHigh = w & 0x8080808080808080ULL;
+      int      ncASCII = wHigh != 0 ? __builtin_ctzll(wHigh) / 8 : 8;
+
+      i += ncASCII;
+      o += ncASCII;
+      if(ncASCII < 8) break;
+    }
+
+    if(i == ncSource) break;
+
+    uint8_t c = lpsSource[i];
+
+    if(c < 0x80) {
+      // 末尾 8 バイト未満
+      byOutput[o] = c;
+      byKanji[o++] = QR_UTF8_BYTE;
+      i++;
+      continue;
+    }
+
+    // 非 ASCII が続く間はここで処理
+    do {
+      c = lpsSource[i];
+
+      // Kanji mode characters are all in the BMP, so only two and three
+      // byte sequences are decoded; overlong forms and surrogates are not
+      // characters and are copied like any other malformed byte. Each length
+      // has its own straight path, with the lookup last.
+      uint32_t nCode = 0x10000; // 変換対象外
+      int      ncSeq = 1;
+
+      if(c >= 0xe0 && c < 0xf0 && i + 2 < ncSource) {
+        uint32_t c1 = lpsSource[i + 1], c2 = lpsSource[i + 2];
+
+        if(is_continuation(c1) && is_continuation(c2)) {
+          uint32_t n = ((uint32_t)(c & 0x0f) << 12) | ((c1 & 0x3f) << 6) | (c2 & 0x3f);
+          if(n >= 0x800 && (n < 0xd800 || n > 0xdfff)) { nCode = n; ncSeq = 3; }
+        }
+      } else if(c >= 0xc2 && c < 0xe0 && i + 1 < ncSource) {
+        uint32_t c1 = lpsSource[i + 1];
+
+        if(is_continuation(c1)) { nCode = ((uint32_t)(c & 0x1f) << 6) | (c1 & 0x3f); ncSeq = 2; }
+      }
+
+      uint16_t wSjis = qr_utf8_sjis(nCode);
+
+      if(wSjis != 0) {
+        byOutput[o]     = (uint8_t)(wSjis >> 8);
+        byOutput[o + 1] = (uint8_t)wSjis;
+        byKanji[o]      = QR_UTF8_LEAD;
+        byKanji[o + 1]  = QR_UTF8_TRAIL;
+        o += 2;
+        i += ncSeq;
+      } else {
+        // 変換できない文字は UTF-8 のまま
+        memcpy(byOutput + o,lpsSource + i,ncSeq);
+        memset(byKanji + o,QR_UTF8_BYTE,ncSeq);
+        o += ncSeq;
+        i += ncSeq;
+        ncRaw += ncSeq;
+      }
+    } while(i < ncSource && lpsSource[i] >= 0x80);
+  }
+
+  if(ncFallback != NULL) *ncFallback = ncRaw;
+  return o;
+}
@@ -0,0 +1,34 @@
+#ifndef QR_UTF8_H
+#define QR_UTF8_H
+#include <stdint.h>
+
+// UTF-8 input.
+//
+// Kanji mode only carries Shift-JIS pairs, so UTF-8 text is first converted:
+// every character that has a Kanji mode code (JIS X 0208, see
+// qr_utf8_table.h) becomes its Shift-JIS pair, everything else (ASCII,
+// other scripts, malformed bytes) is left as it is. qr_encode_utf8_ctx()
+// then segments the result with the converted pairs held in Kanji mode and
+// the rest free to take any mode; if any UTF-8 bytes are left over it
+// starts the symbol with ECI 26, so the 8-bit mode bytes decode as UTF-8.
+//
+// A code point costs two table loads, and ASCII is copied 8 bytes at a
+// time, so the conversion runs near memcpy speed on mostly ASCII text.
+
+// Output byte classes
+#define QR_UTF8_BYTE   0 // 変換なし(ASCII、UTF-8)
+#define QR_UTF8_LEAD   1 // 変換した漢字の第 1 バイト
+#define QR_UTF8_TRAIL  2 // 変換した漢字の第 2 バイト
+
+// ECI assignment for UTF-8
+#define QR_ECI_UTF8   26
+
+// Shift-JIS code of code point c in Kanji mode, 0 if it has none.
+uint16_t qr_utf8_sjis(uint32_t c);
+
+// Converts ncSource bytes of UTF-8 into byOutput, which needs ncSource
+// bytes (the output is never longer), and the class of every output byte
+// into byKanji. Returns the output length; ncFallback (may be NULL)
+// receives the number of bytes of 0x80 and over left unconverted.
+int qr_utf8_convert(const uint8_t *lpsSource,int ncSource,uint8_t *byOutput,uint8_t *byKanji,int *ncFallback);
+#endif
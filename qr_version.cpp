@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <utility>
+#include "qr_encodeem.h"
+#include "qr_rs.h"
+#include "qr_stats.h"
+#include "qr_version.h"
+
+void PlaceModule(uint8_t *image,int width,uint8_t *input_data,int input_data_len,int version);
+
+/////////////////////////////////////////////////////////////////////////////
+// Versions 5-40
+//
+// The block shapes of the version are constants, the level picks one of
+// four of them.
+
+template<int V>
+static void codeword_stage(int nLevel,const uint8_t *byDataCodeWord,uint8_t *byAllCodeWord,uint8_t *byRSWork,uint8_t *image) {
+  constexpr const QR_VERSIONMETA &M = QR_VersionMeta;
+  constexpr int width = M.nWidth[V];
+
+  const int ncBlock1  = M.ncBlock1[V][nLevel],     ncBlock2  = M.ncBlock2[V][nLevel];
+  const int ncDataCw1 = M.ncBlockData1[V][nLevel], ncDataCw2 = M.ncBlockData2[V][nLevel];
+  const int ncRSCw    = M.ncRSCodeWord[V][nLevel];
+  const int ncBlockSum = ncBlock1 + ncBlock2;
+
+  // データコードワードインターリーブ配置
+  QR_STAT_BEGIN(interleave);
+
+  const uint8_t *p = byDataCodeWord;
+  for(int b=0;b<ncBlockSum;b++) {
+    int ncDataCw = b < ncBlock1 ? ncDataCw1 : ncDataCw2;
+
+    for(int j=0;j<ncDataCw1;j++) byAllCodeWord[ncBlockSum * j + b] = p[j];
+
+    // ２種目ブロック端数分配置
+    if(ncDataCw > ncDataCw1) byAllCodeWord[ncBlockSum * ncDataCw1 + (b - ncBlock1)] = p[ncDataCw1];
+
+    p += ncDataCw;
+  }
+
+  QR_STAT_END(interleave,QR_STAT_INTERLEAVE);
+
+  // ＲＳコードワード算出、配置(全ブロック並列)
+  QR_STAT_BEGIN(rs);
+  qr_rs_encode_interleaved(byAllCodeWord,ncBlock1,ncBlock2,ncDataCw1,ncRSCw);
+  QR_STAT_END(rs,QR_STAT_RS);
+
+  QR_STAT_BEGIN(placement);
+  PlaceModule(image,width,byAllCodeWord,M.ncAllCodeWord[V],V);
+  QR_STAT_END(placement,QR_STAT_PLACEMENT);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Versions 1-4
+//
+// No version information and at most one alignment pattern, so the
+// function area is simple enough to redo at compile time. The placement
+// walk and the interleaving are folded into one map per (version, level)
+// from codeword bit (in block order, data then RS) to module, and the
+// placement is unrolled over it. qrbench checks the result against the
+// generic stages.
+
+#define QR_SMALL_VERSIONS 4
+
+constexpr bool small_function_module(int nVersion,int x,int y) {
+  int width = nVersion * 4 + 17;
+
+  if(x <= 8 && y <= 8) return true;          // 左上位置検出パターン、分離パターン、フォーマット情報
+  if(x >= width - 8 && y <= 8) return true;  // 右上
+  if(x <= 8 && y >= width - 8) return true;  // 左下
+  if(x == 6 || y == 6) return true;          // タイミングパターン
+
+  int c = width - 7;                         // 位置合わせパターン
+  if(nVersion >= 2 && x >= c - 2 && x <= c + 2 && y >= c - 2 && y <= c + 2) return true;
+
+  return false;
+}
+
+template<int V,int L>
+struct QR_SMALLMAP
+{
+	static constexpr const QR_VERSIONMETA &M = QR_VersionMeta;
+
+	static constexpr int ncBlock1   = M.ncBlock1[V][L];
+	static constexpr int ncBlock2   = M.ncBlock2[V][L];
+	static constexpr int ncBlockSum = ncBlock1 + ncBlock2;
+	static constexpr int ncDataCw1  = M.ncBlockData1[V][L];
+	static constexpr int ncDataCw2  = M.ncBlockData2[V][L];
+	static constexpr int ncRSCw     = M.ncRSCodeWord[V][L];
+	static constexpr int ncData     = M.ncDataCodeWord[V][L];
+	static constexpr int ncAll      = M.ncAllCodeWord[V];
+
+	std::array<uint16_t,ncData * 8>                wData; // データコードワード(ブロック順)
+	std::array<uint16_t,ncBlockSum * ncRSCw * 8>   wRS;   // ＲＳコードワード(ブロック順)
+};
+
+template<int V,int L>
+constexpr QR_SMALLMAP<V,L> build_small_map() {
+  typedef QR_SMALLMAP<V,L> MAP;
+  constexpr int width = V * 4 + 17;
+
+  // 配置順のモジュール(build_function_template と同じ走査)
+  std::array<uint16_t,MAP::ncAll * 8> wPlacement = {};
+  int x = width, y = width - 1, nCoef_x = 1, nCoef_y = 1;
+
+  for(int i=0;i<MAP::ncAll * 8;i++) {
+    do {
+      x += nCoef_x;
+      nCoef_x = -nCoef_x;
+
+      if(nCoef_x < 0) {
+        y += nCoef_y;
+
+        if(y < 0 || y == width) {
+          y = y < 0 ? 0 : width - 1;
+          nCoef_y = -nCoef_y;
+          x -= 2;
+          if(x == 6) --x; // タイミングパターン
+        }
+      }
+    } while(small_function_module(V,x,y));
+
+    wPlacement[i] = (uint16_t)(y * width + x);
+  }
+
+  // ブロック順からインターリーブ後の位置へ
+  MAP m = {};
+  int nIndex = 0;
+
+  for(int b=0;b<MAP::ncBlockSum;b++) {
+    int ncDataCw = b < MAP::ncBlock1 ? MAP::ncDataCw1 : MAP::ncDataCw2;
+
+    for(int j=0;j<ncDataCw;j++,nIndex++) {
+      int nPos = j < MAP::ncDataCw1 ? MAP::ncBlockSum * j + b : MAP::ncBlockSum * MAP::ncDataCw1 + (b - MAP::ncBlock1);
+      for(int k=0;k<8;k++) m.wData[nIndex * 8 + k] = wPlacement[nPos * 8 + k];
+    }
+
+    for(int j=0;j<MAP::ncRSCw;j++) {
+      int nPos = MAP::ncData + MAP::ncBlockSum * j + b;
+      for(int k=0;k<8;k++) m.wRS[(b * MAP::ncRSCw + j) * 8 + k] = wPlacement[nPos * 8 + k];
+    }
+  }
+
+  return m;
+}
+
+template<int V,int L>
+inline constexpr QR_SMALLMAP<V,L> QR_SmallMap = build_small_map<V,L>();
+
+// Codeword bit I (MSB first) of byCodeWord to module wMap[I]. The data
+// modules of the template are clear, so the bits are only ever ORed in.
+template<int V,int L,bool bRS,size_t... I>
+static inline void place_bits(const uint8_t *byCodeWord,uint8_t *image,std::index_sequence<I...>) {
+  constexpr const uint16_t *wMap = bRS ? QR_SmallMap<V,L>.wRS.data() : QR_SmallMap<V,L>.wData.data();
+  ((image[wMap[I] >> 3] |= (uint8_t)(((byCodeWord[I >> 3] >> (7 - (I & 7))) & 1) << (wMap[I] & 7))), ...);
+}
+
+template<int V,int L>
+static void small_codeword_stage(int nLevel,const uint8_t *byDataCodeWord,uint8_t *byAllCodeWord,uint8_t *byRSWork,uint8_t *image) {
+  typedef QR_SMALLMAP<V,L> MAP;
+
+  // ＲＳコードワード算出(ブロック順)
+  QR_STAT_BEGIN(rs);
+
+  const uint8_t *p = byDataCodeWord;
+  for(int b=0;b<MAP::ncBlockSum;b++) {
+    int ncDataCw = b < MAP::ncBlock1 ? MAP::ncDataCw1 : MAP::ncDataCw2;
+    qr_rs_encode(p,ncDataCw,byRSWork + b * MAP::ncRSCw,MAP::ncRSCw);
+    p += ncDataCw;
+  }
+
+  QR_STAT_END(rs,QR_STAT_RS);
+
+  QR_STAT_BEGIN(placement);
+
+  memcpy(image,qr_function_image(V),(MAP::M.nWidth[V] * MAP::M.nWidth[V] + 7) / 8);
+  place_bits<V,L,false>(byDataCodeWord,image,std::make_index_sequence<MAP::ncData * 8>());
+  place_bits<V,L,true>(byRSWork,image,std::make_index_sequence<MAP::ncBlockSum * MAP::ncRSCw * 8>());
+
+  QR_STAT_END(placement,QR_STAT_PLACEMENT);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Dispatch
+
+template<int V,int L>
+constexpr QR_CODEWORDSTAGE select_stage() {
+  if constexpr (V <= QR_SMALL_VERSIONS) return small_codeword_stage<V,L>;
+  else return codeword_stage<V>;
+}
+
+template<size_t... I>
+constexpr std::array<std::array<QR_CODEWORDSTAGE,4>,41> build_stage_table(std::index_sequence<I...>) {
+  return {{ {{NULL,NULL,NULL,NULL}},
+            {{select_stage<I + 1,0>(),select_stage<I + 1,1>(),select_stage<I + 1,2>(),select_stage<I + 1,3>()}}... }};
+}
+
+static constexpr std::array<std::array<QR_CODEWORDSTAGE,4>,41> QR_CodeWordStage = build_stage_table(std::make_index_sequence<40>());
+
+QR_CODEWORDSTAGE qr_codeword_stage(int nVersion,int nLevel) {
+  return QR_CodeWordStage[nVersion][nLevel];
+}
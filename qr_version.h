@@ -0,0 +1,82 @@
+#ifndef QR_VERSION_H
+#define QR_VERSION_H
+#include <stdint.h>
+#include "qr_encodeem.h"
+
+// Per-version metadata and encode stages.
+//
+// QR_VersionMeta is QR_VersionInfo rearranged at compile time into one
+// small array per field, indexed [version] or [version][level], so the
+// encode stages read the few values they need from adjacent bytes and,
+// inside the per-version templates of qr_version.cpp, as constants.
+//
+// qr_codeword_stage() returns the stage that takes the padded data
+// codewords to the placed (unmasked) symbol: interleaving, Reed-Solomon and
+// module placement. Each version has its own instantiation with the block
+// shapes as constants. Versions 1-4 go further: every (version, level) has
+// a fully unrolled instantiation that places data and RS codewords
+// straight from the block buffers through a placement map computed at
+// compile time, so they are never interleaved into byAllCodeWord.
+
+typedef struct tagQR_VERSIONMETA
+{
+	uint8_t  nWidth[41];             // 一辺モジュール数
+	uint16_t ncAllCodeWord[41];      // 総コードワード数
+	uint16_t ncDataCodeWord[41][4];  // データコードワード数
+	uint8_t  ncBlock1[41][4];        // ＲＳブロック数(1)
+	uint8_t  ncBlock2[41][4];        // ＲＳブロック数(2)
+	uint8_t  ncBlockData1[41][4];    // ブロック内データコードワード数(1)
+	uint8_t  ncBlockData2[41][4];    // ブロック内データコードワード数(2)
+	uint8_t  ncRSCodeWord[41][4];    // ブロック内ＲＳコードワード数(両種同数)
+	uint8_t  ncAlignPoint[41];
+	uint8_t  nAlignPoint[41][6];
+} QR_VERSIONMETA;
+
+constexpr QR_VERSIONMETA qr_build_version_meta() {
+  QR_VERSIONMETA m = {};
+
+  for(int v=1;v<=40;v++) {
+    const QR_VERSIONINFO &vi = QR_VersionInfo[v];
+
+    m.nWidth[v]        = (uint8_t)(v * 4 + 17);
+    m.ncAllCodeWord[v] = (uint16_t)vi.ncAllCodeWord;
+    m.ncAlignPoint[v]  = (uint8_t)vi.ncAlignPoint;
+    for(int i=0;i<6;i++) m.nAlignPoint[v][i] = (uint8_t)vi.nAlignPoint[i];
+
+    for(int l=0;l<4;l++) {
+      m.ncDataCodeWord[v][l] = (uint16_t)vi.ncDataCodeWord[l];
+      m.ncBlock1[v][l]       = (uint8_t)vi.RS_BlockInfo1[l].ncRSBlock;
+      m.ncBlock2[v][l]       = (uint8_t)vi.RS_BlockInfo2[l].ncRSBlock;
+      m.ncBlockData1[v][l]   = (uint8_t)vi.RS_BlockInfo1[l].ncDataCodeWord;
+      m.ncBlockData2[v][l]   = (uint8_t)vi.RS_BlockInfo2[l].ncDataCodeWord;
+      m.ncRSCodeWord[v][l]   = (uint8_t)(vi.RS_BlockInfo1[l].ncAllCodeWord - vi.RS_BlockInfo1[l].ncDataCodeWord);
+    }
+  }
+  return m;
+}
+
+inline constexpr QR_VERSIONMETA QR_VersionMeta = qr_build_version_meta();
+
+// Both kinds of block have the same number of RS codewords, and the
+// second kind holds exactly one more data codeword.
+constexpr bool qr_check_version_meta() {
+  for(int v=1;v<=40;v++) {
+    for(int l=0;l<4;l++) {
+      const QR_VERSIONINFO &vi = QR_VersionInfo[v];
+      if(vi.RS_BlockInfo2[l].ncRSBlock == 0) continue;
+      if(vi.RS_BlockInfo2[l].ncAllCodeWord - vi.RS_BlockInfo2[l].ncDataCodeWord != QR_VersionMeta.ncRSCodeWord[v][l]) return false;
+      if(vi.RS_BlockInfo2[l].ncDataCodeWord != vi.RS_BlockInfo1[l].ncDataCodeWord + 1) return false;
+    }
+  }
+  return true;
+}
+static_assert(qr_check_version_meta(),"RS block shapes");
+
+// byDataCodeWord: padded data codewords, block after block
+// byAllCodeWord:  interleaved data and RS codewords (not written for versions 1-4)
+// byRSWork:       scratch, ncBlocks * ncRSCodeWord bytes
+// image:          receives the placed symbol, qr_image_size(width) bytes
+typedef void (*QR_CODEWORDSTAGE)(int nLevel,const uint8_t *byDataCodeWord,uint8_t *byAllCodeWord,uint8_t *byRSWork,uint8_t *image);
+
+QR_CODEWORDSTAGE qr_codeword_stage(int nVersion,int nLevel);
+#endif
@@ -0,0 +1,69 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "qr_server.h"
+
+// qrd: the encoding daemon (qr_server.h). Runs until SIGINT or SIGTERM,
+// then answers what it has read and prints its counters.
+
+static QR_SERVER *Server;
+
+static void on_signal(int) {
+  qr_server_stop(Server);
+}
+
+static void usage() {
+  fprintf(stderr,"usage: qrd [-s socket] [-w workers] [-q queue] [-p pipeline] [-c cache_mb]\n"
+                 "  -s  socket path (default %s)\n"
+                 "  -w  encoder threads (default: one per hardware thread)\n"
+                 "  -q  requests queued for the workers before readers wait\n"
+                 "  -p  unanswered requests per connection before its reader waits\n"
+                 "  -c  symbol cache budget in MiB (default 0, no cache)\n",QR_SERVER_PATH);
+}
+
+int main(int argc,char **argv) {
+  const char *szPath = QR_SERVER_PATH;
+  QR_SERVEROPTIONS options = {0,0,0,0};
+  int c;
+
+  while((c = getopt(argc,argv,"s:w:q:p:c:h")) != -1) {
+    switch(c) {
+      case 's': szPath = optarg;                                     break;
+      case 'w': options.nWorkers      = atoi(optarg);                 break;
+      case 'q': options.ncQueue       = atoi(optarg);                 break;
+      case 'p': options.ncPipeline    = atoi(optarg);                 break;
+      case 'c': options.ncCacheBudget = (size_t)atol(optarg) << 20;   break;
+      default:  usage(); return 2;
+    }
+  }
+
+  Server = qr_server_create(szPath,&options);
+  if(Server == NULL) {
+    fprintf(stderr,"qrd: %s: %s\n",szPath,strerror(errno));
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+  signal(SIGPIPE,SIG_IGN);
+
+  QR_SERVERSTATS stats;
+  qr_server_stats(Server,&stats);
+  fprintf(stderr,"qrd: listening on %s, %d workers\n",szPath,stats.nWorkers);
+
+  bool bOk = qr_server_run(Server);
+
+  char report[4096];
+  qr_server_stats(Server,&stats);
+  qr_server_stats_format(&stats,QR_STATS_TEXT,report,sizeof(report));
+  fputs(report,stderr);
+
+  qr_server_destroy(Server);
+  return bOk ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "qr_encodeem.h"
+#include "qr_server.h"
+#include "qr_stats.h"
+
+// qrload: load generator for qrd. Each connection keeps a fixed number of
+// requests in flight and times every one from send to response; at the end
+// it prints throughput and latency percentiles over all connections.
+
+#define MAX_QRCODESIZE 4096 // (177*177)/8
+
+typedef struct tagLOAD_OPTIONS
+{
+	const char *szPath;
+	int         ncConnections;
+	int         ncDepth;     // 接続毎の送信済み未応答要求数
+	uint64_t    ncRequests;  // 全接続合計
+	int         ncPayload;   // 入力データ長
+	uint64_t    ncUnique;    // 異なる入力データ数
+	QR_REQUEST  req;
+	bool        bVerify;     // 応答をローカルのエンコードと比較
+} LOAD_OPTIONS;
+
+typedef struct tagLOAD_THREAD
+{
+	const LOAD_OPTIONS *options;
+	int      nIndex;
+	uint64_t ncRequests;
+
+	uint64_t ncDone;
+	uint64_t ncErrors;    // 状態が QR_STATUS_OK 以外
+	uint64_t ncMismatch;  // id の順序、-v の比較
+	uint64_t ncBytes;
+	bool     bFailed;     // 接続、送受信の失敗
+	uint64_t nMaxNs;
+	uint64_t ncBucket[QR_HIST_BUCKETS];
+} LOAD_THREAD;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Payload number nKey: a URL padded with digits to ncPayload bytes.
+static int make_payload(const LOAD_OPTIONS *options,uint64_t nKey,uint8_t *payload) {
+  char szKey[32];
+  int ncKey = snprintf(szKey,sizeof(szKey),"%llu",(unsigned long long)nKey);
+  const char *szPrefix = "https://x.example/item/";
+  int ncPrefix = strlen(szPrefix);
+  int n = 0;
+
+  for(;n<options->ncPayload - ncKey && n<ncPrefix;n++) payload[n] = szPrefix[n];
+  for(;n<options->ncPayload - ncKey;n++) payload[n] = '0';
+  memcpy(payload + n,szKey,ncKey);
+
+  return n + ncKey;
+}
+
+static void load_thread(LOAD_THREAD *t) {
+  const LOAD_OPTIONS *options = t->options;
+  QR_CLIENT *client = qr_client_connect(options->szPath);
+
+  if(client == NULL) {
+    t->bFailed = true;
+    return;
+  }
+
+  std::vector<uint64_t> nSent(options->ncDepth);
+  uint8_t payload[QR_SERVER_MAXPAYLOAD];
+  uint64_t nNext = 0;
+
+  while(t->ncDone < t->ncRequests) {
+    // 窓が埋まるまで送る(受信時にまとめて送出)
+    for(;nNext < t->ncRequests && nNext - t->ncDone < (uint64_t)options->ncDepth;nNext++) {
+      QR_REQUEST req = options->req;
+      uint64_t nKey = (nNext * options->ncConnections + t->nIndex) % options->ncUnique;
+      int ncPayload = make_payload(options,nKey,payload);
+
+      req.nId = (uint32_t)nNext;
+      if(!qr_client_send(client,&req,payload,ncPayload)) {
+        t->bFailed = true;
+        break;
+      }
+      nSent[nNext % options->ncDepth] = now_ns();
+    }
+    if(t->bFailed) break;
+
+    QR_RESPONSE resp;
+    const uint8_t *body;
+
+    if(!qr_client_recv(client,&resp,&body)) {
+      t->bFailed = true;
+      break;
+    }
+
+    uint64_t nNs = now_ns() - nSent[t->ncDone % options->ncDepth];
+    t->ncBucket[qr_hist_bucket(nNs)]++;
+    if(nNs > t->nMaxNs) t->nMaxNs = nNs;
+
+    if(resp.nId != (uint32_t)t->ncDone) t->ncMismatch++;
+    if(resp.nStatus != QR_STATUS_OK) t->ncErrors++;
+    t->ncBytes += QR_SERVER_HEADERSIZE + resp.ncBody;
+
+    if(options->bVerify && resp.nStatus == QR_STATUS_OK) {
+      uint64_t nKey = (t->ncDone * options->ncConnections + t->nIndex) % options->ncUnique;
+      int ncPayload = make_payload(options,nKey,payload);
+      uint8_t image[MAX_QRCODESIZE];
+      int outputdata_len, width;
+
+      qr_encode_data(options->req.nLevel,options->req.nVersion,(options->req.nFlags & QR_REQFLAG_AUTOEXTENT) != 0,options->req.nMaskingNo,
+                     payload,ncPayload,image,&outputdata_len,&width);
+      if(width != resp.width || resp.ncBody != (uint32_t)qr_image_size(width) || memcmp(body,image,resp.ncBody) != 0) t->ncMismatch++;
+    }
+
+    t->ncDone++;
+  }
+
+  qr_client_close(client);
+}
+
+static bool print_server_stats(const char *szPath,int nFormat) {
+  QR_CLIENT *client = qr_client_connect(szPath);
+  if(client == NULL) return false;
+
+  QR_REQUEST req;
+  memset(&req,0,sizeof(req));
+  req.nType   = QR_REQUEST_STATS;
+  req.nFormat = nFormat;
+
+  QR_RESPONSE resp;
+  const uint8_t *body;
+  bool bOk = qr_client_send(client,&req,NULL,0) && qr_client_recv(client,&resp,&body) && resp.nStatus == QR_STATUS_OK;
+
+  if(bOk) fwrite(body,1,resp.ncBody,stdout);
+  qr_client_close(client);
+
+  return bOk;
+}
+
+static void usage() {
+  fprintf(stderr,"usage: qrload [-s socket] [-c connections] [-d depth] [-n requests] [-l length] [-u unique]\n"
+                 "              [-f bitmap|pbm|png] [-x scale] [-e level] [-m mask] [-N] [-v] [-S|-J]\n"
+                 "  -c  connections, one thread each (default 4)\n"
+                 "  -d  requests in flight per connection (default 16)\n"
+                 "  -n  requests over all connections (default 100000)\n"
+                 "  -l  payload length (default 40), -u distinct payloads (default: all)\n"
+                 "  -N  bypass the server's cache, -v compare bitmaps with a local encode\n"
+                 "  -S, -J  only print the server's statistics, as text or JSON\n");
+}
+
+int main(int argc,char **argv) {
+  LOAD_OPTIONS options;
+  memset(&options,0,sizeof(options));
+
+  options.szPath        = QR_SERVER_PATH;
+  options.ncConnections = 4;
+  options.ncDepth       = 16;
+  options.ncRequests    = 100000;
+  options.ncPayload     = 40;
+  options.req.nType       = QR_REQUEST_ENCODE;
+  options.req.nLevel      = QR_LEVEL_M;
+  options.req.nMaskingNo  = -1;
+  options.req.nFormat     = QR_OUTPUT_BITMAP;
+  options.req.nScale      = 4;
+  options.req.nQuietZone  = 4;
+  options.req.nFlags      = QR_REQFLAG_AUTOEXTENT;
+
+  int nStats = -1, c;
+
+  while((c = getopt(argc,argv,"s:c:d:n:l:u:f:x:e:m:NvSJh")) != -1) {
+    switch(c) {
+      case 's': options.szPath        = optarg;                       break;
+      case 'c': options.ncConnections = atoi(optarg);                 break;
+      case 'd': options.ncDepth       = atoi(optarg);                 break;
+      case 'n': options.ncRequests    = strtoull(optarg,NULL,10);     break;
+      case 'l': options.ncPayload     = atoi(optarg);                 break;
+      case 'u': options.ncUnique      = strtoull(optarg,NULL,10);     break;
+      case 'x': options.req.nScale    = atoi(optarg);                 break;
+      case 'e': options.req.nLevel    = atoi(optarg);                 break;
+      case 'm': options.req.nMaskingNo = atoi(optarg);                break;
+      case 'N': options.req.nFlags   |= QR_REQFLAG_NOCACHE;           break;
+      case 'v': options.bVerify       = true;                         break;
+      case 'S': nStats = QR_STATS_TEXT;                               break;
+      case 'J': nStats = QR_STATS_JSON;                               break;
+      case 'f':
+        if(strcmp(optarg,"bitmap") == 0)   options.req.nFormat = QR_OUTPUT_BITMAP;
+        else if(strcmp(optarg,"pbm") == 0) options.req.nFormat = QR_OUTPUT_PBM;
+        else if(strcmp(optarg,"png") == 0) options.req.nFormat = QR_OUTPUT_PNG;
+        else { usage(); return 2; }
+        break;
+      default: usage(); return 2;
+    }
+  }
+
+  if(nStats >= 0) {
+    if(print_server_stats(options.szPath,nStats)) return 0;
+    fprintf(stderr,"qrload: no server at %s\n",options.szPath);
+    return 1;
+  }
+
+  if(options.ncConnections < 1 || options.ncDepth < 1 || options.ncPayload < 1 || options.ncPayload > QR_SERVER_MAXPAYLOAD) {
+    usage();
+    return 2;
+  }
+  if(options.ncUnique == 0) options.ncUnique = options.ncRequests;
+  if(options.req.nFormat != QR_OUTPUT_BITMAP) options.bVerify = false;
+
+  std::vector<LOAD_THREAD> threads(options.ncConnections);
+  std::vector<std::thread> running;
+
+  for(int n=0;n<options.ncConnections;n++) {
+    memset(&threads[n],0,sizeof(LOAD_THREAD));
+    threads[n].options    = &options;
+    threads[n].nIndex     = n;
+    threads[n].ncRequests = options.ncRequests / options.ncConnections + (n < (int)(options.ncRequests % options.ncConnections) ? 1 : 0);
+  }
+
+  uint64_t nStart = now_ns();
+  for(int n=0;n<options.ncConnections;n++) running.push_back(std::thread(load_thread,&threads[n]));
+  for(int n=0;n<options.ncConnections;n++) running[n].join();
+  double seconds = (now_ns() - nStart) / 1e9;
+
+  LOAD_THREAD total;
+  memset(&total,0,sizeof(total));
+  int ncFailed = 0;
+
+  for(int n=0;n<options.ncConnections;n++) {
+    const LOAD_THREAD &t = threads[n];
+
+    total.ncDone     += t.ncDone;
+    total.ncErrors   += t.ncErrors;
+    total.ncMismatch += t.ncMismatch;
+    total.ncBytes    += t.ncBytes;
+    if(t.nMaxNs > total.nMaxNs) total.nMaxNs = t.nMaxNs;
+    if(t.bFailed) ncFailed++;
+    for(int b=0;b<QR_HIST_BUCKETS;b++) total.ncBucket[b] += t.ncBucket[b];
+  }
+
+  double p[5] = {0.50,0.90,0.99,0.999,0.9999};
+  uint64_t nNs[5];
+
+  for(int n=0;n<5;n++) {
+    nNs[n] = qr_hist_percentile(total.ncBucket,total.ncDone,p[n]);
+    if(nNs[n] > total.nMaxNs) nNs[n] = total.nMaxNs;
+  }
+
+  printf("requests %llu  errors %llu  mismatches %llu  failed_connections %d\n",(unsigned long long)total.ncDone,(unsigned long long)total.ncErrors,
+         (unsigned long long)total.ncMismatch,ncFailed);
+  printf("connections %d  depth %d  seconds %.3f  requests_per_s %.0f  MiB_per_s %.1f\n",options.ncConnections,options.ncDepth,seconds,
+         total.ncDone / seconds,total.ncBytes / seconds / 1048576.0);
+  printf("latency_us p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  p9999 %.1f  max %.1f\n",nNs[0] / 1e3,nNs[1] / 1e3,nNs[2] / 1e3,nNs[3] / 1e3,nNs[4] / 1e3,total.nMaxNs / 1e3);
+
+  return ncFailed == 0 && total.ncErrors == 0 && total.ncMismatch == 0 ? 0 : 1;
+}